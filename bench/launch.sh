@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# launch.sh
+#
+# Container launch latency and throughput benchmark.
+#
+# OVERVIEW:
+# Runs RUNS containers with a trivial command through euclid's batch mode, for
+# every variant and every concurrency level in JOBS, and reports:
+# - Time to exec: p50/p99/max of the "total" of each launch (-t)
+# - Time to exit: p50/p99/max of each job's elapsed time (elapsed=.. in the job
+#   lines), from the start of the launch until the container was reaped
+# - Launches per second: jobs divided by the batch's elapsed time
+# followed by the median time of each launch stage for every variant, at the
+# first concurrency level.
+#
+# For the pool variant, the warm containers were set up ahead of time, so time
+# to exec is measured from when the container received its command.
+#
+# USAGE:
+#   sudo make bench
+#   sudo RUNS=1000 JOBS="1 8 32" sh bench/launch.sh bin/euclid
+#
+# ENVIRONMENT:
+# - RUNS: Containers per measurement (default 200)
+# - JOBS: Concurrency levels (default "1 4 16")
+# - CMD: Command every container runs (default /bin/true)
+# - VARIANTS: Variants to run (default all of them, see variant_args)
+
+EUCLID=${1:-bin/euclid}
+RUNS=${RUNS:-200}
+JOBS=${JOBS:-"1 4 16"}
+CMD=${CMD:-/bin/true}
+VARIANTS=${VARIANTS:-"default pool no-overlay no-seccomp no-net network minimal-dev legacy-mount vfork supervise compute no-mounts minimal"}
+
+#
+# variant_args - Print the euclid options of a variant
+# $1: Variant name
+# $2: Concurrency level, for the pool size
+#
+variant_args() {
+  case "$1" in
+  default) ;;
+  pool) echo "-n $2" ;;
+  no-overlay) echo "-s overlay=no" ;;
+  no-seccomp) echo "-s seccomp=no" ;;
+  no-net) echo "-s namespaces=uts,pid,ipc" ;;
+  network) echo "-s network=yes" ;;
+  minimal-dev) echo "-s minimal_dev=yes" ;;
+  vfork) echo "-s vfork=yes" ;;
+  supervise) echo "-s supervise=yes" ;;
+  compute) echo "-s policy=compute" ;;
+  no-mounts) echo "-s mount_dev=no -s mount_proc=no" ;;
+  legacy-mount) echo "-s new_mount_api=no" ;;
+  minimal) echo "-s namespaces= -s overlay=no -s seccomp=no" ;;
+  *)
+    echo "Unknown variant: $1" >&2
+    exit 1
+    ;;
+  esac
+}
+
+#
+# percentiles - Print p50, p99 and max of the numbers on stdin, in ms
+#
+percentiles() {
+  sort -n | awk '
+    { v[NR] = $1 }
+    END {
+      if (NR == 0) { printf "%9s %9s %9s", "-", "-", "-"; exit }
+      p50 = v[int((NR - 1) * 0.50) + 1]
+      p99 = v[int((NR - 1) * 0.99) + 1]
+      printf "%9.3f %9.3f %9.3f", p50 * 1000, p99 * 1000, v[NR] * 1000
+    }'
+}
+
+#
+# json_field - Print the value of a numeric field of every JSON line on stdin
+# $1: Field name
+#
+json_field() {
+  sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p"
+}
+
+#
+# stage_medians - Print the median of every stage of the launch lines on stdin
+#
+stage_medians() {
+  stages="cgroup overlay_slot net_slot clone close_fds join_cgroup netns uts propagation"
+  stages="$stages overlay rootfs dev proc drop_caps lock_caps seccomp command exec"
+  input=$(cat)
+
+  for stage in $stages; do
+    printf '%s' "$input" | json_field "$stage" | sort -n |
+      awk -v stage="$stage" '
+        { v[NR] = $1 }
+        END { if (NR) printf "  %-12s %9.3f ms\n", stage, v[int((NR + 1) / 2)] * 1000 }'
+  done
+}
+
+if [ ! -x "$EUCLID" ]; then
+  echo "No euclid binary at $EUCLID, run make first" >&2
+  exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+i=0
+while [ "$i" -lt "$RUNS" ]; do
+  echo "$CMD"
+  i=$((i + 1))
+done >"$TMP/commands"
+
+FIRST_JOBS=${JOBS%% *}
+
+printf '%-11s %4s | %-29s | %-29s | %9s\n' "" "" "time to exec (ms)" \
+  "time to exit (ms)" ""
+printf '%-11s %4s | %9s %9s %9s | %9s %9s %9s | %9s\n' variant jobs p50 p99 \
+  max p50 p99 max launch/s
+
+for variant in $VARIANTS; do
+  for jobs in $JOBS; do
+    # shellcheck disable=SC2046
+    if ! "$EUCLID" $(variant_args "$variant" "$jobs") -t -j "$jobs" \
+      -o "$TMP/launch" -b "$TMP/commands" >"$TMP/jobs" 2>"$TMP/errors"; then
+      echo "$variant with $jobs jobs failed:" >&2
+      tail -n 5 "$TMP/errors" >&2
+      continue
+    fi
+
+    exec_key=total
+    if [ "$variant" = pool ]; then
+      exec_key=exec
+    fi
+
+    exec_times=$(json_field "$exec_key" <"$TMP/launch" | percentiles)
+    exit_times=$(sed -n 's/.* elapsed=\([0-9.]*\) cmd=.*/\1/p' "$TMP/jobs" |
+      percentiles)
+    rate=$(awk '/^jobs=/ { split($1, j, "="); split($3, e, "=");
+                            printf "%9.1f", j[2] / e[2] }' "$TMP/jobs")
+
+    printf '%-11s %4s | %s | %s | %s\n' "$variant" "$jobs" "$exec_times" \
+      "$exit_times" "$rate"
+
+    if [ "$jobs" = "$FIRST_JOBS" ]; then
+      cp "$TMP/launch" "$TMP/stages-$variant"
+    fi
+  done
+done
+
+for variant in $VARIANTS; do
+  if [ -f "$TMP/stages-$variant" ]; then
+    echo
+    echo "Median stage times, $variant, $FIRST_JOBS jobs:"
+    stage_medians <"$TMP/stages-$variant"
+  fi
+done
@@ -0,0 +1,581 @@
+/**
+ * syscalls.c
+ *
+ * Syscall overhead benchmark for the seccomp filter.
+ *
+ * OVERVIEW:
+ * Times tight loops of common syscalls without a filter and under each filter
+ * variant, and reports the cost per call next to the number of comparisons the
+ * filter makes before it reaches that syscall's verdict. The difference
+ * between the columns is what the filter costs at that position.
+ *
+ * VARIANTS:
+ * - none: No filter, the baseline
+ * - linear: One JEQ per allowed syscall in ascending order, like a classic
+ *   allowlist chain, behind the same arch check as the tree. Built here from
+ *   the tree, which it falls through to for everything it doesn't allow, so
+ *   it decides exactly like the tree.
+ * - tree: The filter from get_fprog(), exactly as apply_seccomp() installs it
+ * - profile: The tree weighted with a recorded profile (-p)
+ *
+ * A filter can't be removed once installed, so every variant runs in a fresh
+ * child process and sends its timings back over a pipe.
+ *
+ * SYSCALLS:
+ * The raw syscall numbers are made through syscall(), so glibc can't serve
+ * any of them from a cache or the vDSO. clock_gettime and gettimeofday are
+ * what programs fall back to when the vDSO can't be used. openat and close
+ * are timed as a pair, which is reported as one row.
+ *
+ * ACTION CACHE:
+ * Since Linux 5.11 the kernel checks every filter once per syscall number
+ * when it's installed, and if the verdict can't depend on the arguments (true
+ * for every syscall the policy doesn't check the arguments of), later calls
+ * skip the filter entirely. On
+ * such kernels the overhead of an allowed syscall is the same at every
+ * position, and the comparisons only matter for filters that inspect
+ * arguments or on kernels without the cache.
+ *
+ * INSIDE A CONTAINER:
+ * The binary is linked statically so it can be copied into the rootfs and
+ * run as the container's command. The container must be started with
+ * seccomp=no, otherwise the baseline already runs under the filter (a
+ * warning is printed when that's the case).
+ *
+ * USAGE:
+ *   make bench-syscalls
+ *   bin/euclid-syscall-bench [-i iterations] [-p profile]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/futex.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "child_security.h"
+#include "filter.h"
+#include "profile.h"
+
+/**
+ * DEFAULT_ITERATIONS - Loop iterations per round
+ */
+#define DEFAULT_ITERATIONS 200000
+
+/**
+ * WARMUP_DIVISOR - Share of the iterations run untimed before each loop
+ */
+#define WARMUP_DIVISOR 10
+
+/**
+ * ROUNDS - Times each loop is repeated, the fastest round is reported
+ *
+ * Interrupts, migrations and noisy neighbours only ever make a round slower,
+ * so the minimum is the closest to the real cost.
+ */
+#define ROUNDS 5
+
+/**
+ * MAX_LINEAR_INSNS - Room for the linear chain: the arch check and the load
+ * of the syscall number, two instructions per syscall and the tree behind
+ * them
+ */
+#define MAX_LINEAR_INSNS (2 * SYSCALL_TABLE_SIZE + 4 + BPF_MAXINSNS)
+
+/**
+ * VERDICT_ARGS - Verdict filter_comparisons() reports for syscalls whose
+ * verdict depends on their arguments
+ *
+ * Not a seccomp return value any filter uses.
+ */
+#define VERDICT_ARGS 0xffffffffU
+
+/**
+ * enum variant - Filters the syscalls are timed under
+ */
+enum variant { VARIANT_NONE, VARIANT_LINEAR, VARIANT_TREE, VARIANT_PROFILE,
+               VARIANT_COUNT };
+
+static const char *variant_names[VARIANT_COUNT] = {"none", "linear", "tree",
+                                                   "profile"};
+
+/**
+ * struct workload_state - Resources the loops operate on
+ * @pipe_fds: Empty non-blocking pipe, reads fail with EAGAIN
+ * @futex_word: Futex nobody waits on, wakes return 0
+ */
+struct workload_state {
+  int pipe_fds[2];
+  unsigned int futex_word;
+};
+
+/**
+ * struct workload - One timed loop
+ * @name: Row label
+ * @nrs: Syscalls made per iteration, terminated by -1
+ * @run: Makes one iteration's syscalls
+ */
+struct workload {
+  const char *name;
+  int nrs[3];
+  void (*run)(struct workload_state *state);
+};
+
+static void run_getpid(struct workload_state *state) {
+  (void)state;
+  syscall(SYS_getpid);
+}
+
+static void run_read(struct workload_state *state) {
+  char byte;
+  syscall(SYS_read, state->pipe_fds[0], &byte, 1);
+}
+
+static void run_futex(struct workload_state *state) {
+  syscall(SYS_futex, &state->futex_word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void run_clock_gettime(struct workload_state *state) {
+  struct timespec ts;
+  (void)state;
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+}
+
+static void run_gettimeofday(struct workload_state *state) {
+  struct timeval tv;
+  (void)state;
+  syscall(SYS_gettimeofday, &tv, NULL);
+}
+
+static void run_openat_close(struct workload_state *state) {
+  (void)state;
+  long fd = syscall(SYS_openat, AT_FDCWD, "/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    syscall(SYS_close, fd);
+  }
+}
+
+static const struct workload workloads[] = {
+    {"getpid", {SYS_getpid, -1}, run_getpid},
+    {"read", {SYS_read, -1}, run_read},
+    {"futex", {SYS_futex, -1}, run_futex},
+    {"clock_gettime", {SYS_clock_gettime, -1}, run_clock_gettime},
+    {"gettimeofday", {SYS_gettimeofday, -1}, run_gettimeofday},
+    {"openat+close", {SYS_openat, SYS_close, -1}, run_openat_close},
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/**
+ * filter_comparisons - Run a filter program on a syscall number
+ * @prog: Filter to run
+ * @nr: Syscall number
+ * @action: Set to the filter's verdict
+ *
+ * A small interpreter for the instructions our filters use: loads of the
+ * arch and syscall number, jumps and returns. The syscall is taken to be an
+ * x86_64 one, like the benchmark's own. Counts the conditional jumps taken on
+ * the way, the arch check included, which is the syscall's position in the
+ * filter. The interpreter stops at the first load of an argument, with
+ * VERDICT_ARGS as the verdict.
+ *
+ * Return: Number of comparisons, -1 for an instruction it doesn't know
+ */
+static int filter_comparisons(const struct sock_fprog *prog, unsigned int nr,
+                              unsigned int *action) {
+  unsigned int acc = 0;
+  int comparisons = 0;
+
+  for (unsigned int pc = 0; pc < prog->len; pc++) {
+    const struct sock_filter *insn = &prog->filter[pc];
+
+    switch (insn->code) {
+    case BPF_LD | BPF_W | BPF_ABS:
+      if (insn->k >= offsetof(struct seccomp_data, args)) {
+        *action = VERDICT_ARGS;
+        return comparisons;
+      }
+      if (insn->k == offsetof(struct seccomp_data, arch)) {
+        acc = AUDIT_ARCH_X86_64;
+      } else if (insn->k == offsetof(struct seccomp_data, nr)) {
+        acc = nr;
+      } else {
+        return -1;
+      }
+      break;
+    case BPF_JMP | BPF_JA:
+      pc += insn->k;
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K:
+      comparisons++;
+      pc += acc == insn->k ? insn->jt : insn->jf;
+      break;
+    case BPF_JMP | BPF_JGE | BPF_K:
+      comparisons++;
+      pc += acc >= insn->k ? insn->jt : insn->jf;
+      break;
+    case BPF_JMP | BPF_JGT | BPF_K:
+      comparisons++;
+      pc += acc > insn->k ? insn->jt : insn->jf;
+      break;
+    case BPF_RET | BPF_K:
+      *action = insn->k;
+      return comparisons;
+    default:
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * build_linear_filter - Build a JEQ chain allowing what the tree allows
+ * @tree: Filter from get_fprog()
+ * @insns: Output array with room for MAX_LINEAR_INSNS instructions
+ * @prog: Filled in with the chain
+ *
+ * Syscalls the tree doesn't allow outright fall through to a copy of it at
+ * the end of the chain, which kills them, fails them or checks their
+ * arguments like the tree itself. Its jumps are relative, so the copy works
+ * as it is.
+ *
+ * Return: 0 on success, -1 if the tree can't be interpreted
+ */
+static int build_linear_filter(const struct sock_fprog *tree,
+                               struct sock_filter *insns,
+                               struct sock_fprog *prog) {
+  unsigned short len = 0;
+
+  insns[len++] = (struct sock_filter)BPF_STMT(
+      BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+  insns[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                              AUDIT_ARCH_X86_64, 1, 0);
+  insns[len++] =
+      (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS);
+  insns[len++] = (struct sock_filter)BPF_STMT(
+      BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+
+  for (unsigned int nr = 0; nr < SYSCALL_TABLE_SIZE; nr++) {
+    unsigned int action;
+    if (filter_comparisons(tree, nr, &action) == -1) {
+      fprintf(stderr, "Failed to interpret the seccomp filter\n");
+      return -1;
+    }
+
+    if (action == SECCOMP_RET_ALLOW) {
+      insns[len++] =
+          (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, 1);
+      insns[len++] =
+          (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    }
+  }
+
+  if (len + tree->len > BPF_MAXINSNS) {
+    fprintf(stderr, "Linear chain exceeds %d instructions\n", BPF_MAXINSNS);
+    return -1;
+  }
+
+  memcpy(&insns[len], tree->filter, tree->len * sizeof(insns[0]));
+  len += tree->len;
+
+  prog->len = len;
+  prog->filter = insns;
+
+  return 0;
+}
+
+/**
+ * install_filter - Install a variant's filter in the calling process
+ * @variant: Variant to install
+ * @linear: The linear chain
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int install_filter(enum variant variant,
+                          const struct sock_fprog *linear) {
+  if (variant == VARIANT_NONE) {
+    return 0;
+  }
+
+  if (lock_capabilities() == -1) {
+    return -1;
+  }
+
+  if (variant != VARIANT_LINEAR) {
+    return apply_seccomp();
+  }
+
+  if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, linear, 0, 0) == -1) {
+    fprintf(stderr, "Failed to install seccomp filter: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * time_workload - Time one workload's loop
+ * @workload: Workload to run
+ * @state: Resources the loop operates on
+ * @iterations: Timed iterations per round
+ *
+ * Return: Nanoseconds per iteration in the fastest round
+ */
+static double time_workload(const struct workload *workload,
+                            struct workload_state *state, long iterations) {
+  double best = 0;
+
+  for (long i = 0; i < iterations / WARMUP_DIVISOR; i++) {
+    workload->run(state);
+  }
+
+  for (int round = 0; round < ROUNDS; round++) {
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; i++) {
+      workload->run(state);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = ((end.tv_sec - start.tv_sec) * 1e9 +
+                 (end.tv_nsec - start.tv_nsec)) /
+                iterations;
+    if (round == 0 || ns < best) {
+      best = ns;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * run_variant - Time every workload under a variant's filter
+ * @variant: Variant to run
+ * @linear: The linear chain
+ * @iterations: Timed iterations per round
+ * @results: Filled in with nanoseconds per iteration of each workload
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int run_variant(enum variant variant, const struct sock_fprog *linear,
+                       long iterations, double results[NUM_WORKLOADS]) {
+  int result_fds[2];
+  if (pipe(result_fds) == -1) {
+    fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+    close(result_fds[0]);
+    close(result_fds[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    struct workload_state state = {.futex_word = 0};
+    double times[NUM_WORKLOADS];
+
+    close(result_fds[0]);
+
+    if (pipe2(state.pipe_fds, O_NONBLOCK) == -1) {
+      fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+      _exit(EXIT_FAILURE);
+    }
+
+    if (install_filter(variant, linear) == -1) {
+      _exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+      times[i] = time_workload(&workloads[i], &state, iterations);
+    }
+
+    if (write(result_fds[1], times, sizeof(times)) != (ssize_t)sizeof(times)) {
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(result_fds[1]);
+
+  ssize_t bytes = read(result_fds[0], results, sizeof(double) * NUM_WORKLOADS);
+  close(result_fds[0]);
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    fprintf(stderr, "Failed to wait for child: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (WIFSIGNALED(status)) {
+    fprintf(stderr, "The %s run was killed by signal %d\n",
+            variant_names[variant], WTERMSIG(status));
+    return -1;
+  }
+
+  if (bytes != (ssize_t)(sizeof(double) * NUM_WORKLOADS)) {
+    fprintf(stderr, "The %s run failed\n", variant_names[variant]);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * format_position - Format a workload's comparisons under a filter
+ * @workload: Workload to describe
+ * @prog: Filter it runs under
+ * @buf: Output buffer
+ * @size: Size of buf
+ */
+static void format_position(const struct workload *workload,
+                            const struct sock_fprog *prog, char *buf,
+                            size_t size) {
+  size_t len = 0;
+  buf[0] = '\0';
+
+  for (int i = 0; workload->nrs[i] != -1 && len < size; i++) {
+    unsigned int action;
+    int comparisons = filter_comparisons(prog, workload->nrs[i], &action);
+    len += snprintf(buf + len, size - len, "%s%d", i ? "+" : "", comparisons);
+  }
+}
+
+/**
+ * warn_if_filtered - Warn when the baseline would run under a filter
+ *
+ * Inside a container started with seccomp enabled, every variant including
+ * none already runs under euclid's filter.
+ */
+static void warn_if_filtered(void) {
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (!fp) {
+    return;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    int mode;
+    if (sscanf(line, "Seccomp: %d", &mode) == 1 && mode != 0) {
+      fprintf(stderr, "Warning: a seccomp filter is already installed, the "
+                      "baseline includes its cost\n");
+    }
+  }
+
+  fclose(fp);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-i iterations] [-p profile]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = DEFAULT_ITERATIONS;
+  const char *profile_path = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:p:")) != -1) {
+    switch (opt) {
+    case 'i':
+      iterations = strtol(optarg, NULL, 10);
+      if (iterations <= 0) {
+        fprintf(stderr, "Invalid iteration count: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'p':
+      profile_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  warn_if_filtered();
+
+  /*
+   * The unweighted tree is copied before the profile rebuilds the filter, so
+   * both can be reported side by side.
+   */
+  const struct sock_fprog *fprog = get_fprog();
+  if (!fprog) {
+    return EXIT_FAILURE;
+  }
+
+  static struct sock_filter tree_insns[BPF_MAXINSNS];
+  static struct sock_filter linear_insns[MAX_LINEAR_INSNS];
+  struct sock_fprog tree = {.len = fprog->len, .filter = tree_insns};
+  struct sock_fprog linear;
+
+  memcpy(tree_insns, fprog->filter, sizeof(tree_insns[0]) * fprog->len);
+
+  if (build_linear_filter(&tree, linear_insns, &linear) == -1) {
+    return EXIT_FAILURE;
+  }
+
+  const struct sock_fprog *progs[VARIANT_COUNT] = {NULL, &linear, &tree, NULL};
+  int num_variants = VARIANT_PROFILE;
+
+  double results[VARIANT_COUNT][NUM_WORKLOADS];
+
+  for (int variant = VARIANT_NONE; variant < VARIANT_PROFILE; variant++) {
+    if (run_variant(variant, &linear, iterations, results[variant]) == -1) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (profile_path) {
+    if (load_profile(profile_path) == -1) {
+      return EXIT_FAILURE;
+    }
+
+    progs[VARIANT_PROFILE] = get_fprog();
+    if (!progs[VARIANT_PROFILE] ||
+        run_variant(VARIANT_PROFILE, &linear, iterations,
+                    results[VARIANT_PROFILE]) == -1) {
+      return EXIT_FAILURE;
+    }
+    num_variants++;
+  }
+
+  printf("%-14s %9s", "ns/call", "none");
+  for (int variant = VARIANT_LINEAR; variant < num_variants; variant++) {
+    printf(" | %9s %5s %8s", variant_names[variant], "cmp", "overhead");
+  }
+  printf("\n");
+
+  for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+    printf("%-14s %9.1f", workloads[i].name, results[VARIANT_NONE][i]);
+
+    for (int variant = VARIANT_LINEAR; variant < num_variants; variant++) {
+      char position[16];
+      format_position(&workloads[i], progs[variant], position,
+                      sizeof(position));
+      printf(" | %9.1f %5s %8.1f", results[variant][i], position,
+             results[variant][i] - results[VARIANT_NONE][i]);
+    }
+    printf("\n");
+  }
+
+  printf("\n%d rounds of %ld iterations, %u instructions in the linear chain, %u in the "
+         "tree\n",
+         ROUNDS, iterations, linear.len, tree.len);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/**
+ * batch.h
+ *
+ * Running many containers concurrently from one euclid process.
+ *
+ * OVERVIEW:
+ * Reads commands from a stream (one per line) and runs each of them in its
+ * own container, with up to a fixed number of containers running at once.
+ * Every container gets its own leaf cgroup, so limits and accounting are per
+ * job.
+ *
+ * EVENT LOOP:
+ * Instead of blocking in waitpid() on one container at a time, a pidfd is
+ * opened for every running container and registered with epoll. A pidfd
+ * becomes readable when its process exits, so a single epoll_wait() tells us
+ * which containers are done, in the order they finish.
+ *
+ * REPORTING:
+ * One line per job on stdout once it exits:
+ *   job=<n> pid=<pid> exit=<code> elapsed=<seconds> cmd=<argv[0]>
+ * with signal=<number> instead of exit=<code> for jobs killed by a signal,
+ * followed by a summary line once all jobs are done. Telemetry, launch timing
+ * and exit records, if enabled, are written separately (see telemetry.h and
+ * timing.h), and so is the jobs' own output when it's logged (see relay.h).
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "context.h"
+#include "pool.h"
+#include "telemetry.h"
+
+/**
+ * run_batch - Run every command in a stream in its own container
+ * @ctx: Container configuration, its cmd is replaced for every job
+ * @stream: Stream to read commands from, one per line
+ * @concurrency: Maximum number of containers running at the same time
+ * @pool: Warm container pool to take containers from, or NULL to spawn a
+ *        fresh container for every job
+ * @telemetry: Telemetry configuration, NULL to disable telemetry
+ * @launch_out: Stream to write launch timing to, NULL unless ctx->time_launch
+ * @exit_out: Stream to write an exit record per job to, NULL for none
+ * @log_dir: Directory to relay every job's output to, as <job>.out and
+ *           <job>.err, NULL unless ctx->capture_output
+ *
+ * Blank lines are skipped. Malformed lines are reported and skipped.
+ *
+ * Return: Number of jobs that didn't exit with status 0, -1 on failure
+ */
+int run_batch(struct container_ctx *ctx, FILE *stream, int concurrency,
+              struct pool *pool, const struct telemetry_config *telemetry,
+              FILE *launch_out, FILE *exit_out, const char *log_dir);
+
+#endif
@@ -9,26 +9,138 @@
  * memory, PIDs) for processes.
  *
  * WORKFLOW:
- * - Parent process calls configure_cgroups() to set limits
+ * - Parent process calls configure_cgroups() to create the container's leaf
+ *   cgroup and set limits
  * - Child process calls add_self_to_cgroup() to join the cgroup
  * - Kernel enforces the configured limits on the child
+ * - Parent process calls remove_cgroup() after reaping the child
+ *
+ * LEAF POOL:
+ * When many containers are launched, the parent calls cgroup_pool_init() once
+ * to create and configure their leaves up front, and then uses
+ * acquire_cgroup() and release_cgroup() in place of configure_cgroups() and
+ * remove_cgroup(). Leaves are recycled once the kernel reports them empty.
  */
 
 #ifndef CGROUPS_H
 #define CGROUPS_H
 
+#include <linux/limits.h>
+
 #include "context.h"
 
+/**
+ * CGROUP_VALUE_MAX - Maximum length for values written to cgroup files
+ *
+ * Limits are written as strings, so we need a buffer large enough for the
+ * largest possible value while leaving room for newline and null terminator.
+ */
+#define CGROUP_VALUE_MAX 128
+
+/**
+ * enum cgroup_limit - Limit control files set through a cgroup handle
+ * @CGROUP_CPU_MAX: cpu.max
+ * @CGROUP_MEMORY_MAX: memory.max
+ * @CGROUP_MEMORY_HIGH: memory.high
+ * @CGROUP_MEMORY_SWAP_MAX: memory.swap.max
+ * @CGROUP_PIDS_MAX: pids.max
+ * @CGROUP_CPUSET_CPUS: cpuset.cpus, only written when the cpuset controller
+ *                      is used
+ * @CGROUP_CPUSET_MEMS: cpuset.mems, likewise
+ * @CGROUP_CPUSET_PARTITION: cpuset.cpus.partition, likewise
+ * @CGROUP_FREEZE: cgroup.freeze, "1" stops every process in the cgroup and
+ *                 "0" lets them run again (see freezer.h)
+ * @CGROUP_LIMIT_COUNT: Number of limits
+ */
+enum cgroup_limit {
+  CGROUP_CPU_MAX,
+  CGROUP_MEMORY_MAX,
+  CGROUP_MEMORY_HIGH,
+  CGROUP_MEMORY_SWAP_MAX,
+  CGROUP_PIDS_MAX,
+  CGROUP_CPUSET_CPUS,
+  CGROUP_CPUSET_MEMS,
+  CGROUP_CPUSET_PARTITION,
+  CGROUP_FREEZE,
+  CGROUP_LIMIT_COUNT
+};
+
+/**
+ * struct cgroup - Handle to an open cgroup
+ * @path: Path of the cgroup
+ * @dir_fd: O_PATH descriptor of the cgroup directory, control files are
+ *          opened relative to it
+ * @limit_fds: Open descriptor of each limit file, -1 until it's first written
+ * @limit_values: Last value written to each limit file, empty if unknown
+ */
+struct cgroup {
+  char path[PATH_MAX];
+  int dir_fd;
+  int limit_fds[CGROUP_LIMIT_COUNT];
+  char limit_values[CGROUP_LIMIT_COUNT][CGROUP_VALUE_MAX];
+};
+
+/**
+ * cgroup_open - Open a handle to a cgroup, creating the cgroup if needed
+ * @cgroup: Handle to initialize
+ * @path: Path of the cgroup
+ *
+ * Even on failure, the handle can be passed to cgroup_close().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_open(struct cgroup *cgroup, const char *path);
+
+/**
+ * cgroup_set - Write a limit through a cgroup handle
+ * @cgroup: Handle of the cgroup
+ * @limit: Limit to set
+ * @value: Value to write, including the trailing newline
+ *
+ * Skips the write if value is what was last written to the limit through
+ * this handle.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_set(struct cgroup *cgroup, enum cgroup_limit limit,
+               const char *value);
+
+/**
+ * cgroup_reclaim - Push a cgroup's memory out of RAM
+ * @cgroup: Handle of the cgroup
+ *
+ * Asks the kernel to reclaim as much as the cgroup has charged, through
+ * memory.reclaim (Linux 5.19 and later). Page cache is dropped or written
+ * back. Anonymous memory can only go to swap, or zswap if it's enabled, so it
+ * stays put unless memory.swap.max allows some.
+ *
+ * Reclaiming less than asked for is not a failure, the kernel simply found
+ * nothing more to take.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_reclaim(struct cgroup *cgroup);
+
+/**
+ * cgroup_close - Close a cgroup handle
+ * @cgroup: Handle to close
+ *
+ * The cgroup itself stays in place, see remove_cgroup().
+ */
+void cgroup_close(struct cgroup *cgroup);
+
 /**
  * configure_cgroups - Set up cgroup with resource limits
  * @ctx: Container configuration contianing resource limit values
+ * @name: Name of the container's leaf cgroup, unique among running containers
  *
- * Creates a new cgroup directory at /sys/fs/cgroup/euclid and configures
- * resource limits by writing to the cgroup's control files.
+ * Creates a new cgroup directory at {ctx->cgroup_parent}/{name} and
+ * configures resource limits by writing to the cgroup's control files. The
+ * path of the new cgroup is stored in ctx->cgroup_path for the child.
  *
  * This must be called by the parent process before the child joins the cgroup,
  * as it requires privileges to enable controllers and create the cgroup
- * directory.
+ * directory, or a cgroup_parent inside a subtree delegated to our user.
  *
  * Configured limits:
  * - cpu.max: CPU quota
@@ -36,16 +148,19 @@
  * - memory.high: Soft memory limit (triggers reclaim)
  * - memory.swap.max: Maximum swap usage
  * - pids.max: Maximum number of processes/threads
+ * - cpuset.cpus, cpuset.mems and cpuset.cpus.partition: CPU and NUMA
+ *   placement, if configured
  *
  * Return: 0 on success, -1 on failure
  */
-int configure_cgroups(struct container_ctx *ctx);
+int configure_cgroups(struct container_ctx *ctx, const char *name);
 
 /**
  * add_self_to_cgroup - Move calling process into the configured cgroup
+ * @group_dir: Path of the leaf cgroup to join (ctx->cgroup_path)
  *
- * Adds the calling process to the euclid cgroup by writing "0" to the
- * cgroups.procs file, which tells the kernel to add the current process.
+ * Adds the calling process to the cgroup by writing "0" to the cgroups.procs
+ * file, which tells the kernel to add the current process.
  *
  * This must be called by the child process after configure_cgroups() has been
  * called by the parent. Once in the cgroup, the kernel will enforce all
@@ -53,6 +168,68 @@ int configure_cgroups(struct container_ctx *ctx);
  *
  * Return: 0 on success, -1 on failure
  */
-int add_self_to_cgroup(void);
+int add_self_to_cgroup(const char *group_dir);
+
+/**
+ * remove_cgroup - Remove a container's leaf cgroup
+ * @group_dir: Path of the leaf cgroup (ctx->cgroup_path)
+ *
+ * Must be called after the container has been reaped.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int remove_cgroup(const char *group_dir);
+
+/**
+ * cgroup_pool_init - Create and configure a pool of leaf cgroups
+ * @ctx: Container configuration containing resource limit values
+ * @size: Number of leaves to create, at least the number of containers that
+ *        are alive at the same time for the pool to always have one ready
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_pool_init(struct container_ctx *ctx, int size);
+
+/**
+ * acquire_cgroup - Get a configured leaf cgroup for a new container
+ * @ctx: Container configuration, the leaf's path is stored in cgroup_path
+ * @name: Name to create a fresh leaf under if no pooled leaf is ready
+ *
+ * Hands out a pooled leaf that is not in use and has no processes left. If
+ * there is none, falls back to configure_cgroups() with @name.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int acquire_cgroup(struct container_ctx *ctx, const char *name);
+
+/**
+ * release_cgroup - Give up a container's leaf cgroup
+ * @group_dir: Path of the leaf cgroup (ctx->cgroup_path)
+ *
+ * Returns a pooled leaf to the pool and removes any other leaf. Must be called
+ * after the container has been reaped.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int release_cgroup(const char *group_dir);
+
+/**
+ * forget_cgroup_limit - Stop trusting a pooled leaf's last write to a limit
+ * @group_dir: Path of the leaf cgroup
+ * @limit: Limit whose file was changed through another handle
+ *
+ * For whoever changes a pooled leaf's limit through a handle of their own,
+ * like the governor (see governor.h), and fails to put it back. The next
+ * acquire_cgroup() then rewrites the limit instead of trusting the pool's
+ * handle. Does nothing for a leaf that isn't pooled.
+ */
+void forget_cgroup_limit(const char *group_dir, enum cgroup_limit limit);
+
+/**
+ * cgroup_pool_destroy - Remove every leaf in the pool
+ *
+ * Must be called after every container using a pooled leaf has been reaped.
+ */
+void cgroup_pool_destroy(void);
 
 #endif
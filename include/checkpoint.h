@@ -0,0 +1,105 @@
+/**
+ * checkpoint.h
+ *
+ * Checkpointing a running container and restoring copies of it with CRIU.
+ *
+ * OVERVIEW:
+ * Services that spend seconds warming up after their exec (JIT compilation,
+ * cache loading) can be started once, checkpointed when they're ready, and
+ * restored from that image instead of being started from scratch. CRIU
+ * (Checkpoint/Restore In Userspace) does the dumping and restoring, euclid
+ * runs it on the container and provides the cgroup the copy runs in.
+ *
+ * WORKFLOW:
+ * - euclid -k DIR starts the container as usual and waits for SIGUSR1
+ * - Once the service is ready, SIGUSR1 to euclid makes it call
+ *   checkpoint_container(), which dumps the container's process tree into
+ *   DIR with criu dump, ending the container
+ * - euclid -r DIR calls restore_container() (see launch.h) for a fresh leaf
+ *   cgroup, which calls restore_checkpoint() to recreate the process tree,
+ *   namespaces included, inside that leaf
+ *
+ * LAZY RESTORE:
+ * With lazy_restore on, restore_checkpoint() starts criu lazy-pages before
+ * criu restore. The restored processes then start running with most of their
+ * memory missing, and userfaultfd hands every first touch of a page to the
+ * lazy-pages daemon, which copies it in from the image. A large heap costs
+ * nothing until it's used, and pages that are never touched are never read.
+ *
+ * LIMITATIONS:
+ * The image refers to the container's root by path, so checkpointed
+ * containers run on rootfs directly, without an overlay slot's tmpfs that
+ * would be gone by the restore. Network slots are left out for the same
+ * reason. The container's stdin, stdout and stderr must be a terminal, which
+ * criu reattaches to the terminal of the restore (--shell-job).
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "context.h"
+#include "launch.h"
+
+/**
+ * catch_checkpoint_signal - Keep SIGUSR1 from killing us before it's awaited
+ *
+ * Must be called before the container is started. The signal is caught
+ * rather than blocked or ignored, since exec resets caught signals to their
+ * default but passes on the signal mask and ignored signals, and the
+ * container's own SIGUSR1 should behave as usual.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int catch_checkpoint_signal(void);
+
+/**
+ * wait_for_checkpoint_signal - Wait until euclid is told to checkpoint
+ * @container: Container to checkpoint
+ *
+ * SIGUSR1 is blocked and read from a signalfd from here on. A SIGUSR1 caught
+ * since catch_checkpoint_signal() counts as well.
+ *
+ * Return: 0 once SIGUSR1 arrived, -1 if the container exited first or on
+ * failure
+ */
+int wait_for_checkpoint_signal(const struct container *container);
+
+/**
+ * checkpoint_container - Dump a container's process tree into a directory
+ * @ctx: Container configuration, criu is the criu binary to run
+ * @container: Container to dump, killed by criu once the dump is complete
+ * @dir: Directory the image is written to, created if it doesn't exist
+ *
+ * The container still has to be reaped afterwards. criu's log is left in
+ * dir/dump.log.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int checkpoint_container(const struct container_ctx *ctx,
+                         const struct container *container, const char *dir);
+
+/**
+ * restore_checkpoint - Recreate a checkpointed container inside a cgroup
+ * @ctx: Container configuration, rootfs must be the root the image was taken
+ *       on
+ * @dir: Directory holding the image written by checkpoint_container()
+ * @cgroup_path: Leaf cgroup the restored processes are created in
+ *
+ * criu restores the container's init as a sibling of itself, which makes it
+ * our child, so it can be watched and reaped like a container we cloned. Call
+ * finish_restore() once it has been reaped.
+ *
+ * Return: PID of the restored init on success, -1 on failure
+ */
+int restore_checkpoint(const struct container_ctx *ctx, const char *dir,
+                       const char *cgroup_path);
+
+/**
+ * finish_restore - Clean up after a restored container has exited
+ *
+ * Stops the lazy-pages daemon if it's still running and removes the restore's
+ * work directory. Does nothing if there was no restore.
+ */
+void finish_restore(void);
+
+#endif
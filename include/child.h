@@ -15,6 +15,7 @@
  * - Configure mount namespace (pivot_root, proc, dev)
  * - Drop all capabilities
  * - Apply seccomp filter
+ * - Wait for a command (warm containers only)
  * - Execute target program
  *
  * NAMESPACES:
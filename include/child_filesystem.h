@@ -6,8 +6,14 @@
  * Handles the filesystem isolation layer of the container, including:
  * - OverlayFS: Provides writable layer on top of read-only rootfs
  * - /proc: Process information isolated to the container's PID namespace
- * - /dev: Device access via devtmpfs
- * - tmpfs: The overlay is created within a temporary filesystem located in RAM
+ * - /dev: Device access via devtmpfs, unless the overlay brings its own
+ *   (see devices.h)
+ * - tmpfs: The overlay's writable layer lives in a temporary filesystem
+ *   located in RAM, prepared by the parent in an overlay slot (see overlay.h)
+ *
+ * Everything is mounted through the fd-based mount API (fsopen(), fsmount(),
+ * move_mount()) if new_mount_api is set and the kernel has it, and through
+ * mount(2) otherwise.
  */
 
 #ifndef CHILD_FILESYSTEM_H
@@ -15,35 +21,28 @@
 
 #include "context.h"
 
-/**
- * struct overlay_dirs - paths to directories required by overlayFS
- * @overlay_work: Used for atomic file operations ({overlay_base}/work)
- * @overlay_upper: Used for writable layer ({overlay_base}/upper)
- * @overlay_merged: Used for combined view of layers ({overlay_base}/merged)
- */
-struct overlay_dirs {
-  char *overlay_work;
-  char *overlay_upper;
-  char *overlay_merged;
-};
-
 /**
  * setup_overlay - Configure overlayfs for writable rootfs
- * @ctx: Container configuration containing paths for overlayFS
+ * @ctx: Container configuration containing rootfs and the overlay slot
+ * @merged: Set to the overlay's mount point, PATH_MAX bytes
  *
- * Creates an overlay filesystem:
- * - Lower layer: Read-only rootfs
+ * Mounts an overlay filesystem at {overlay_dir}/merged:
+ * - Lower layer: Read-only rootfs, or the stack of layers in ctx->lowerdir
  * - Upper layer: Writable layer
  * - Work layer: Temporary workspace used by overlayfs for atomic operations
  * - Merged: Combined view of lower and upper that becomes the new root
- * 
+ *
+ * The slot's tmpfs and directories must already exist, see
+ * acquire_overlay_slot().
+ *
  * Return: 0 on success, -1 on failure
  */
-int setup_overlay(struct container_ctx *ctx);
+int setup_overlay(const struct container_ctx *ctx, char *merged);
 
 /**
  * setup_rootfs - Change root filesystem using pivot_root
- * @ctx: Container configuration containing rootfs path
+ * @ctx: Container configuration containing overlay and new_mount_api
+ * @root: Directory to make the new root
  *
  * Replaces the current root filesystem with a new one, completely isolating the
  * container's filesystem view from the host. Uses pivot_root instead of chroot
@@ -51,10 +50,11 @@ int setup_overlay(struct container_ctx *ctx);
  *
  * Return: 0 on success, -1 on failure
  */
-int setup_rootfs(struct container_ctx *ctx);
+int setup_rootfs(const struct container_ctx *ctx, const char *root);
 
 /**
  * mount_dev - Mount /dev filesystem
+ * @ctx: Container configuration containing new_mount_api
  *
  * Mounts a devtmpfs filesystem at /dev to provide access to device files. The
  * container's /dev is isolated from the host's /dev because we're in a mount
@@ -62,16 +62,29 @@ int setup_rootfs(struct container_ctx *ctx);
  * 
  * Return: 0 on success, -1 on failure
  */
-int mount_dev(void);
+int mount_dev(const struct container_ctx *ctx);
+
+/**
+ * mount_devpts - Mount a devpts instance of the container's own at /dev/pts
+ * @ctx: Container configuration containing new_mount_api
+ *
+ * Gives the minimal /dev, which has a ptmx link into pts but no pty devices
+ * of its own, working pseudo-terminals.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_devpts(const struct container_ctx *ctx);
 
 /**
  * mount_proc - Mount /proc filesystem
+ * @ctx: Container configuration containing new_mount_api
+ * @target: Where to mount it, "/proc" once the new root is in place
  *
- * Mounts a proc filesystem at /proc. Because we're in a PID namespace, this
+ * Mounts a proc filesystem at target. Because we're in a PID namespace, this
  * /proc shows only processes in our namespace rather than host processes.
  * 
  * Return: 0 on success, -1 on failure
  */
-int mount_proc(void);
+int mount_proc(const struct container_ctx *ctx, const char *target);
 
 #endif
@@ -34,4 +34,12 @@ int setup_uts_namespace(struct container_ctx *ctx);
  */
 int setup_mount_propagation(void);
 
+/**
+ * join_network_namespace - Move into the network slot's namespace
+ * @ctx: Container configuration with netns_fd, which gets closed
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int join_network_namespace(struct container_ctx *ctx);
+
 #endif
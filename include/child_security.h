@@ -44,4 +44,32 @@ int lock_capabilities(void);
  */
 int apply_seccomp(void);
 
+/**
+ * apply_seccomp_profiler - Install the syscall profiling filter
+ * @report_fd: Write end of the pipe used to report the listener fd
+ *
+ * Installs a filter that reports every syscall to the parent as a seccomp user
+ * notification, so the parent can count how often each syscall is made. The
+ * number of the listener file descriptor is written to report_fd.
+ *
+ * Must be called after lock_capabilities() and before apply_seccomp().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int apply_seccomp_profiler(int report_fd);
+
+/**
+ * apply_seccomp_supervised - Install the syscall filter with a supervisor
+ * @report_fd: Write end of the pipe used to report the listener fd
+ *
+ * Installs the same filter as apply_seccomp(), built with
+ * set_filter_supervise() on, and writes the number of its listener file
+ * descriptor to report_fd for the parent's supervisor (see supervisor.h).
+ *
+ * Takes the place of apply_seccomp(), after lock_capabilities().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int apply_seccomp_supervised(int report_fd);
+
 #endif
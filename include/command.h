@@ -0,0 +1,80 @@
+/**
+ * command.h
+ *
+ * Command vectors that can be handed to a container after it was spawned.
+ *
+ * OVERVIEW:
+ * Normally the command to run is part of the container configuration and is
+ * inherited by the child through clone(). Pre-spawned (warm) containers exist
+ * before their command is known, so the parent sends the command over the
+ * synchronization pipe instead.
+ *
+ * WIRE FORMAT:
+ * A 32-bit length followed by that many bytes of NUL-terminated arguments,
+ * packed back to back. The whole message is at most PIPE_BUF bytes, so it is
+ * written to the pipe atomically.
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <limits.h>
+#include <stdint.h>
+
+/**
+ * COMMAND_MAX - Maximum size of the packed arguments in bytes
+ */
+#define COMMAND_MAX (PIPE_BUF - sizeof(uint32_t))
+
+/**
+ * COMMAND_ARGS_MAX - Maximum number of arguments in a command
+ */
+#define COMMAND_ARGS_MAX 64
+
+/**
+ * struct command - A command and its arguments
+ * @len: Number of bytes used in buf
+ * @buf: Arguments packed as consecutive NUL-terminated strings
+ * @argv: NULL-terminated array of pointers into buf, suitable for execvp()
+ *
+ * Everything lives inside the struct, so a command can be built without any
+ * heap allocation and copied freely.
+ */
+struct command {
+  uint32_t len;
+  char buf[COMMAND_MAX];
+  char *argv[COMMAND_ARGS_MAX + 1];
+};
+
+/**
+ * command_from_line - Split a line of text into a command
+ * @cmd: Command to fill in
+ * @line: Arguments separated by spaces or tabs, may end in a newline
+ *
+ * There is no quoting, every run of whitespace separates two arguments.
+ *
+ * Return: Number of arguments on success (0 for a blank line), -1 if the line
+ * has too many arguments or is too long
+ */
+int command_from_line(struct command *cmd, const char *line);
+
+/**
+ * send_command - Write a command to a pipe
+ * @fd: Write end of the pipe
+ * @cmd: Command to send
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int send_command(int fd, const struct command *cmd);
+
+/**
+ * receive_command - Read a command from a pipe
+ * @fd: Read end of the pipe
+ * @cmd: Command to fill in
+ *
+ * Return: 1 if a command was received, 0 if the pipe was closed first, -1 on
+ * failure
+ */
+int receive_command(int fd, struct command *cmd);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * config.h
+ *
+ * Runtime configuration of the container.
+ *
+ * OVERVIEW:
+ * Overrides the compile-time defaults from context.c in a container_ctx, so
+ * one binary can be tuned per job. Settings come from configuration files
+ * (-c) and single assignments on the command line (-s), applied in the order
+ * they were given, so later settings win.
+ *
+ * FORMAT:
+ * One "key = value" assignment per line. Blank lines and lines starting with
+ * '#' are ignored, and whitespace around the key and the value is trimmed:
+ *   # Build jobs get more memory
+ *   cmd = /usr/bin/make -C /src -j4
+ *   mem_max = 2G
+ *   pids_max = 1024
+ *
+ * KEYS:
+ * - hostname, rootfs, overlay_base, layer_store, cgroup_parent: Strings
+ * - layers: Layers to stack instead of rootfs, top first, separated by ':'
+ *   (see layers.h)
+ * - cmd: Command and arguments separated by whitespace, without quoting
+ * - cpu_max: cpu.max value, "quota period" or "max period"
+ * - mem_max, mem_high, mem_swap_max: Sizes in bytes, with an optional K, M,
+ *   G or T suffix (powers of 1024), or "max"
+ * - mem_high_min, mem_high_max: Sizes, bounds for adapting memory.high (-a)
+ * - pids_max: Number of tasks, or "max"
+ * - tmpfs_size: Size of each overlay slot's tmpfs in megabytes
+ * - tmpfs_huge, tmpfs_mpol: huge= and mpol= options of the slots' tmpfs,
+ *   such as "within_size" and "bind:0" (see tmpfs(5))
+ * - tmpfs_nr_inodes: Most inodes in each slot's tmpfs, or "max"
+ * - namespaces: Comma-separated optional namespaces to create, out of uts,
+ *   pid, net, ipc and user (the mount namespace is always created)
+ * - overlay, seccomp: "yes" or "no", whether to set up the tmpfs overlay and
+ *   the seccomp filter
+ * - minimal_dev: "yes" or "no", whether /dev only has the basic devices
+ *   (see devices.h) instead of all of the host's
+ * - mount_dev, mount_proc: "yes" or "no", whether to set up /dev and /proc
+ * - new_mount_api: "yes" or "no", whether to mount through fsopen() and
+ *   move_mount() where the kernel has them, or always through mount(2)
+ *
+ * Leaving out namespaces, the overlay or seccomp weakens the sandbox. These
+ * exist to measure what each layer costs.
+ *
+ * mem_max also moves mem_high, mem_high_min and mem_high_max to their default
+ * shares of it (see set_ctx_mem_max()), so set those after mem_max.
+ *
+ * LOCKED-DOWN BUILDS:
+ * Building with EUCLID_LOCKED (make LOCKED=1) leaves this out entirely, and
+ * the compile-time defaults are the only configuration.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifndef EUCLID_LOCKED
+
+#include "context.h"
+
+/**
+ * config_set - Apply one "key=value" assignment
+ * @ctx: Container context to configure
+ * @assignment: Key and value separated by '='
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int config_set(struct container_ctx *ctx, const char *assignment);
+
+/**
+ * config_load - Apply every assignment in a configuration file
+ * @ctx: Container context to configure
+ * @path: Path of the configuration file
+ *
+ * Stops at the first invalid line, so a typo doesn't go unnoticed.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int config_load(struct container_ctx *ctx, const char *path);
+
+#endif
+
+#endif
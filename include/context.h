@@ -9,9 +9,10 @@
  * synchronization primatives.
  *
  * DESIGN RATIONALE:
- * Configuration is compile-time rather than runtime to reduce the attack
- * surface. External configuration files could be exploited or tampered with,
- * while compile-time constants are baked into the binary.
+ * The defaults are compile-time constants, baked into the binary. They can be
+ * overridden at runtime from a configuration file or the command line (see
+ * config.h), unless euclid was built with EUCLID_LOCKED, which keeps the
+ * external configuration out of the attack surface.
  *
  * MEMORY MANAGEMENT:
  * The context is allocated on the heap and must be properly freed. This is
@@ -22,19 +23,105 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <linux/limits.h>
+
+#include "timing.h"
+
 /**
  * struct container_ctx - Container configuration and state
  * @hostname: Hostname visible inside the container
  * @rootfs: Path to the root filesystem directory to use
- * @cmd: NULL-terminated array of command and arguments to execute
+ * @layers: Layers to stack as the overlay's lower layer instead of rootfs,
+ *          top first and separated by ':', empty for none (see layers.h)
+ * @layer_store: Directory of the content-addressed layer store
+ * @lowerdir: The overlay's lowerdir option built from layers by
+ *            resolve_layers(), NULL to use rootfs
+ * @cmd: NULL-terminated array of command and arguments to execute, owned by
+ *       the context
+ * @cgroup_parent: Cgroup the containers' leaf cgroups are created in, its
+ *                 parent must allow enabling controllers for it
  * @cpu_max: CPU quota string in cgroups format "quota period"
- * @mem_high: Soft memory limit in bytes (triggers reclaim)
- * @mem_max: Hard memory limit in bytes (OOM kill if exceeded)
- * @mem_swap_max: Maximum swap usage in bytes (0 to disable swap)
- * @pids_max: Maximum number of PIDS (prevents fork bombs)
+ * @mem_high: Soft memory limit in bytes (triggers reclaim), -1 for none
+ * @mem_high_min: Lowest memory.high when adapting it to memory pressure
+ * @mem_high_max: Highest memory.high when adapting it to memory pressure
+ * @adapt_mem_high: Non-zero if the parent adapts memory.high to the
+ *                  container's memory pressure while it runs
+ * @mem_max: Hard memory limit in bytes (OOM kill if exceeded), -1 for none
+ * @mem_swap_max: Maximum swap usage in bytes (0 to disable swap), -1 for none
+ * @pids_max: Maximum number of PIDS (prevents fork bombs), -1 for none
+ * @cpuset_cpus: CPUs the container may run on, empty for all of them
+ * @cpuset_mems: NUMA nodes the container may allocate memory on, empty for
+ *               all of them
+ * @cpuset_partition: cpuset.cpus.partition of the leaf, empty to leave it a
+ *                    member
+ * @numa_spread: Non-zero to place every container on one NUMA node, chosen
+ *               by numa_acquire_node(), instead of cpuset_cpus and cpuset_mems
+ * @numa_node: NUMA node of the container being started, -1 for none
  * @pipe_fds: File descriptors for parent-child synchronization
- * @overlay_base: Directory to store tmpfs overlay
- * @tmpfs_size: Size of the tempfs fileystem in Megabytes
+ * @overlay_base: Directory holding the overlay slots (see overlay.h)
+ * @tmpfs_size: Size of each overlay slot's tmpfs in Megabytes
+ * @tmpfs_huge: huge= option of the slots' tmpfs, empty for the default
+ * @tmpfs_mpol: mpol= option of the slots' tmpfs, empty for the default
+ * @tmpfs_nr_inodes: Inode limit of the slots' tmpfs, -1 for none and 0 for
+ *                   the default
+ * @namespaces: CLONE_NEW* flags of the optional namespaces to create (UTS,
+ *              PID, network, IPC, user), the mount namespace is always
+ *              created
+ * @overlay: Non-zero to put a tmpfs overlay on top of rootfs, otherwise
+ *           rootfs is used directly and writes reach it
+ * @seccomp: Non-zero to install the seccomp filter
+ * @policy: Name of the seccomp policy the filter is built from (see policy.h)
+ * @supervise: Non-zero to hand the filter's rare, argument-dependent syscalls
+ *             to the supervisor thread instead of killing or allowing them
+ *             outright (see supervisor.h), needs seccomp
+ * @minimal_dev: Non-zero to give the container the /dev template of the
+ *               overlay's top lower layer instead of devtmpfs
+ * @mount_dev: Non-zero to give the container a /dev, otherwise it sees the
+ *             rootfs's own /dev directory
+ * @mount_proc: Non-zero to mount /proc in the container
+ * @new_mount_api: Non-zero to mount filesystems through the fd-based mount
+ *                 API when the kernel has it (see child_filesystem.c)
+ * @vfork: Non-zero to spawn containers that don't wait for the parent before
+ *         their exec with CLONE_VM | CLONE_VFORK (see spawn_container())
+ * @network: Non-zero to connect the container to bridge through a network
+ *           slot (see network.h), needs the network namespace
+ * @bridge: Host bridge the containers' veth pairs are attached to
+ * @subnet: IPv4 subnet of the bridge in CIDR notation, the bridge gets its
+ *          first address and the containers the ones after it
+ * @netns_fd: Network namespace the child joins instead of creating one, set by
+ *            acquire_net_slot(), -1 for none
+ * @criu: criu binary run to checkpoint and restore containers (see
+ *        checkpoint.h), looked up in PATH unless it contains a slash
+ * @lazy_restore: Non-zero to restore checkpoints with their memory faulted in
+ *                on first touch by criu lazy-pages, instead of all at once
+ * @freeze_idle: Milliseconds a container has to sit idle before it's frozen
+ *               through cgroup.freeze (see freezer.h), -1 to never freeze
+ * @idle_reclaim: Non-zero to push a frozen container's memory out of RAM
+ *                through memory.reclaim
+ * @profile_fds: Pipe the child reports its seccomp listener on when profiling
+ *               syscalls, both ends are -1 otherwise
+ * @supervisor_fds: Pipe the child reports its seccomp listener on for the
+ *                  supervisor, both ends are -1 unless a container is being
+ *                  started with supervise
+ * @cgroup_path: Leaf cgroup the child joins, set by configure_cgroups()
+ * @overlay_dir: Overlay slot the child mounts its overlay from, set by
+ *               acquire_overlay_slot()
+ * @pooled: Non-zero if the child is a warm container that receives its command
+ *          over pipe_fds after setup, instead of running cmd
+ * @in_cgroup: Non-zero if the child was created inside cgroup_path with
+ *             CLONE_INTO_CGROUP, so it doesn't need to wait for the parent
+ *             and join the cgroup itself
+ * @time_launch: Non-zero if start_container() sets up timing_fds, so the
+ *               child reports when each stage of its launch ended
+ * @timing_fds: Pipe the child sends its launch timing on, both ends are -1
+ *              unless a container is being started with time_launch
+ * @timing: Stage timestamps of the launch in progress, see timing.h
+ * @output_buffer: Size in bytes of each output pipe when output is captured
+ * @capture_output: Non-zero if start_container() gives the child pipes of
+ *                  its own for stdout and stderr, see relay.h
+ * @stdout_fds: Pipe the child's stdout goes into, both ends are -1 unless a
+ *              container is being started with capture_output
+ * @stderr_fds: Likewise for the child's stderr
  *
  * SYNCHRONIZATION:
  * The pipe_fds are used to coordinate between parent and child:
@@ -42,19 +129,67 @@
  * - Parent writes to pipe_fds[1]
  * - Child blocks on read from pipe_fds[0]
  * - Child receives signal and joins cgroup
+ * Children created with CLONE_INTO_CGROUP skip all of this and only use the
+ * pipe to receive commands.
  */
 struct container_ctx {
   char **cmd;
   char *hostname;
   char *rootfs;
+  char *layers;
+  char *layer_store;
+  char *lowerdir;
+  char *cgroup_parent;
   char *cpu_max;
-  int mem_high;
-  int mem_max;
-  int mem_swap_max;
+  long long mem_high;
+  long long mem_high_min;
+  long long mem_high_max;
+  int adapt_mem_high;
+  long long mem_max;
+  long long mem_swap_max;
   int pids_max;
+  char *cpuset_cpus;
+  char *cpuset_mems;
+  char *cpuset_partition;
+  int numa_spread;
+  int numa_node;
   int pipe_fds[2];
   char *overlay_base;
   int tmpfs_size;
+  char *tmpfs_huge;
+  char *tmpfs_mpol;
+  int tmpfs_nr_inodes;
+  int namespaces;
+  int overlay;
+  int seccomp;
+  char *policy;
+  int supervise;
+  int minimal_dev;
+  int mount_dev;
+  int mount_proc;
+  int new_mount_api;
+  int vfork;
+  int network;
+  char *bridge;
+  char *subnet;
+  int netns_fd;
+  char *criu;
+  int lazy_restore;
+  int freeze_idle;
+  int idle_reclaim;
+  int profile_fds[2];
+  int supervisor_fds[2];
+  char cgroup_path[PATH_MAX];
+  char overlay_dir[PATH_MAX];
+  int pooled;
+  int in_cgroup;
+  int time_launch;
+  int timing_fds[2];
+  struct launch_timing timing;
+  long long output_buffer;
+  int capture_output;
+  int stdout_fds[2];
+  int stderr_fds[2];
 };
 
 /**
@@ -71,7 +206,6 @@ void cleanup_ctx(struct container_ctx *ctx);
 
 /**
  * init_ctx - Initialize container context with configuration
- * @pipe_fds: Pipe file descriptors for parent-child synchronization
  *
  * Allocates and initializes a container_ctx structure with values from the
  * compile-time constants defined in context.c.
@@ -81,10 +215,30 @@ void cleanup_ctx(struct container_ctx *ctx);
  * - Command array is allocated and each argument is duplicated
  * - If any allocation fails, previously allocated memory is freed
  *
- * The pipe file descriptors are stored but not created by this function. The caller (main) must create the pipe before calling init_ctx().
+ * The pipe file descriptors start out as -1. start_container() creates a new
+ * pipe for every container it spawns.
  *
  * Return: Pointer to initialized context on success, NULL on failure
  */
-struct container_ctx *init_ctx(int pipe_fds[2]);
+struct container_ctx *init_ctx(void);
+
+/**
+ * set_ctx_cmd - Replace the command the container runs
+ * @ctx: Container context
+ * @argv: NULL-terminated array of command and arguments, copied
+ *
+ * Return: 0 on success, -1 on failure (ctx->cmd is left unchanged)
+ */
+int set_ctx_cmd(struct container_ctx *ctx, char *const argv[]);
+
+/**
+ * set_ctx_mem_max - Set the hard memory limit and the limits derived from it
+ * @ctx: Container context
+ * @mem_max: Hard memory limit in bytes, -1 for none
+ *
+ * mem_high, mem_high_min and mem_high_max move to their default shares of the
+ * new limit, so anything that sets them explicitly has to come after this.
+ */
+void set_ctx_mem_max(struct container_ctx *ctx, long long mem_max);
 
 #endif
\ No newline at end of file
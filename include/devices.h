@@ -0,0 +1,53 @@
+/**
+ * devices.h
+ *
+ * Minimal /dev for containers, as an extra lower layer of the overlay.
+ *
+ * OVERVIEW:
+ * Mounting devtmpfs gives a container every device node of the host. With
+ * minimal_dev, the container's /dev instead comes from a template the parent
+ * builds once below overlay_base and stacks on top of the root filesystem's
+ * lower layers, so /dev is already in place when the overlay is mounted and
+ * the child doesn't mount anything for it:
+ *
+ *   /tmp/euclid_overlay/dev_layer/dev
+ *   +-- null, zero, full, random, urandom, tty
+ *   +-- fd -> /proc/self/fd, stdin, stdout, stderr
+ *   +-- ptmx -> pts/ptmx
+ *   +-- pts/
+ *   +-- shm/
+ *
+ * Device nodes in an overlay lead to the same drivers as anywhere else, and
+ * writes to them never copy anything up. Everything else the container
+ * creates in /dev ends up in its overlay slot like any other write.
+ */
+
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "context.h"
+
+/**
+ * setup_dev_layer - Build the /dev template and put it on top of lowerdir
+ * @ctx: Container configuration with minimal_dev, lowerdir is replaced
+ *
+ * Must be called after resolve_layers(). The template is only built if an
+ * earlier run hasn't already done so.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int setup_dev_layer(struct container_ctx *ctx);
+
+/**
+ * bind_dev - Give a container in a user namespace its /dev
+ * @root: Directory that is about to become the container's root
+ *
+ * Mounts a tmpfs at {root}/dev with the host's null, zero, full, random,
+ * urandom and tty bind-mounted into it, and the links and directories of the
+ * template. Must be called in the child, before setup_rootfs().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int bind_dev(const char *root);
+
+#endif
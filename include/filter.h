@@ -13,10 +13,18 @@
  * program on every syscall to determine if it should be allowed.
  *
  * DESIGN:
+ * - The allowed syscalls come from a policy compiled in from policy/ (see
+ *   policy.h)
+ * - BPF program kills syscalls made with any other calling convention than
+ *   x86_64's, such as i386 syscalls through int 0x80
  * - BPF program loads current syscall number from seccomp_data structure
- * - Compares against each allowed syscall number
- * - Returns SECCOMP_RET_ALLOW if matched
- * - Returns SECCOMP_RET_KILL_PROCESS if no match found
+ * - Binary searches the sorted ranges of allowed and blocked syscall numbers
+ * - Returns SECCOMP_RET_ALLOW if the number falls in an allowed range
+ * - Returns SECCOMP_RET_KILL_PROCESS if it falls in a blocked range
+ * - Compares the arguments of the syscalls the policy has conditions on, and
+ *   returns the action the policy gives for the outcome
+ * - Returns SECCOMP_RET_USER_NOTIF for the few supervised syscalls, if
+ *   supervision is on
  *
  * LIMITATIONS:
  * - Cannot be removed once installed
@@ -29,11 +37,21 @@
 
 #include <linux/filter.h>
 
+/**
+ * SYSCALL_TABLE_SIZE - Number of syscall numbers tracked by profiles
+ *
+ * Comfortably above the highest syscall number on x86_64. Calls with larger
+ * numbers (such as x32 ABI calls) are never allowed, so there's nothing to
+ * gain from weighting them.
+ */
+#define SYSCALL_TABLE_SIZE 1024
+
 /**
  * get_fprog - Get pointer to seccomp filter program
  *
  * Returns a pointer to the sock_fprog structure containing the syscall filter.
- * The structure contains:
+ * The program is generated from the policy on the first call, later calls
+ * return the same program. The structure contains:
  * - len: Number of BPF instructions
  * - filter: Pointer to array of sock_filter instructions
  *
@@ -48,8 +66,64 @@
  * Once installed, the filter cannot be removed or modified. Any attempt to
  * execute a non-whitelisted syscall will kill the process with SIGSYS.
  *
- * Return: Pointer to sock_fprog structure
+ * Return: Pointer to sock_fprog structure, NULL if the filter can't be built
  */
 const struct sock_fprog *get_fprog(void);
 
-#endif
\ No newline at end of file
+/**
+ * set_filter_weights - Weight the decision tree with a syscall profile
+ * @counts: Number of recorded calls indexed by syscall number
+ *
+ * Rebuilds the filter on the next get_fprog() call so that frequently made
+ * syscalls are reached in fewer comparisons. Must be called before the filter
+ * is installed to have any effect.
+ */
+void set_filter_weights(const unsigned long counts[SYSCALL_TABLE_SIZE]);
+
+/**
+ * set_filter_network - Choose whether the filter permits socket syscalls
+ * @allow: Non-zero for containers with a network (see network.h)
+ *
+ * Like set_filter_weights(), this must be called before the filter is
+ * installed to have any effect.
+ */
+void set_filter_network(int allow);
+
+/**
+ * set_filter_supervise - Choose whether the supervisor decides rare syscalls
+ * @enable: Non-zero to hand socket(), execve() and execveat() to the
+ *          supervisor (see supervisor.h) instead of deciding them in the
+ *          kernel
+ *
+ * Like set_filter_weights(), this must be called before the filter is
+ * installed to have any effect. The filter then has to be installed with
+ * apply_seccomp_supervised().
+ */
+void set_filter_supervise(int enable);
+
+/**
+ * set_filter_policy - Choose the policy the filter is built from
+ * @name: Name of a policy file in policy/, without .policy
+ *
+ * The filter is built from the "default" policy unless this is called. Like
+ * set_filter_weights(), this must be called before the filter is installed to
+ * have any effect.
+ *
+ * Return: 0 on success, -1 if no such policy was compiled in
+ */
+int set_filter_policy(const char *name);
+
+/**
+ * get_profiler_fprog - Get pointer to the profiling filter program
+ * @report_fd: File descriptor the child uses to report its listener fd
+ *
+ * Returns a filter that turns every syscall into a SECCOMP_RET_USER_NOTIF,
+ * except write() on report_fd. It is meant to be stacked underneath the
+ * regular filter from get_fprog() which still kills disallowed syscalls,
+ * because SECCOMP_RET_KILL_PROCESS takes precedence over user notifications.
+ *
+ * Return: Pointer to sock_fprog structure
+ */
+const struct sock_fprog *get_profiler_fprog(int report_fd);
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * freezer.h
+ *
+ * Freezing idle containers and thawing them on demand.
+ *
+ * OVERVIEW:
+ * A container that sits idle still holds its memory. Writing "1" to its
+ * cgroup.freeze stops every process in it where they are, after which
+ * memory.reclaim can push its memory out of RAM without the container
+ * faulting it straight back in. Writing "0" lets the processes run again
+ * from where they stopped, paying for whatever they touch that was swapped
+ * out.
+ *
+ * IDLENESS:
+ * - A warm container in a pool (see pool.h) is idle from the moment it's
+ *   spawned until it's handed a command, which is its demand
+ * - A single container is idle once it used less than 1% of a CPU over
+ *   ctx->freeze_idle milliseconds, going by usage_usec in its cpu.stat.
+ *   SIGUSR2 to euclid is its demand, sent by whatever routes work to it
+ *
+ * A frozen service doesn't answer, but the kernel still queues connections to
+ * its listening sockets, so thawing it before handing it the request is
+ * enough.
+ *
+ * EVENT LOOP:
+ * The freezer of a single container has two file descriptors for the
+ * caller's poll() set: a timer that fires every freeze_idle milliseconds,
+ * which calls for freezer_tick(), and a signalfd for SIGUSR2, which calls for
+ * freezer_demand().
+ */
+
+#ifndef FREEZER_H
+#define FREEZER_H
+
+#include "cgroups.h"
+#include "context.h"
+
+/**
+ * struct freezer - Idle freezing of a single container
+ * @cgroup: Handle of the container's leaf cgroup
+ * @stat_fd: The cgroup's cpu.stat, read with pread()
+ * @timer_fd: timerfd that fires every freeze_idle milliseconds
+ * @signal_fd: signalfd for SIGUSR2, which is blocked while the freezer runs
+ * @interval_ms: ctx->freeze_idle
+ * @reclaim: ctx->idle_reclaim
+ * @usage_usec: CPU time the container had used at the last tick
+ * @frozen: Whether the container is frozen
+ */
+struct freezer {
+  struct cgroup cgroup;
+  int stat_fd;
+  int timer_fd;
+  int signal_fd;
+  int interval_ms;
+  int reclaim;
+  long long usage_usec;
+  int frozen;
+};
+
+/**
+ * freeze_cgroup - Freeze a container and reclaim its memory
+ * @cgroup: Handle of the container's leaf cgroup
+ * @reclaim: Non-zero to reclaim the container's memory once it's frozen
+ *
+ * A failed reclaim is reported, but the container stays frozen.
+ *
+ * Return: 0 on success, -1 if the container couldn't be frozen
+ */
+int freeze_cgroup(struct cgroup *cgroup, int reclaim);
+
+/**
+ * thaw_cgroup - Let a frozen container run again
+ * @cgroup: Handle of the container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int thaw_cgroup(struct cgroup *cgroup);
+
+/**
+ * freezer_start - Start freezing a single container while it's idle
+ * @freezer: Freezer to initialize
+ * @ctx: Container configuration with freeze_idle and idle_reclaim
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int freezer_start(struct freezer *freezer, struct container_ctx *ctx,
+                  const char *cgroup_path);
+
+/**
+ * freezer_tick - React to the idle timer firing
+ * @freezer: Freezer whose timer_fd became readable
+ */
+void freezer_tick(struct freezer *freezer);
+
+/**
+ * freezer_demand - React to SIGUSR2
+ * @freezer: Freezer whose signal_fd became readable
+ *
+ * Thaws the container if it's frozen. Either way it gets a whole interval
+ * before it can be frozen again.
+ */
+void freezer_demand(struct freezer *freezer);
+
+/**
+ * freezer_stop - Stop freezing, thawing the container if it's frozen
+ * @freezer: Freezer to stop
+ *
+ * Thawing matters for pooled leaf cgroups, whose next container would
+ * otherwise start out frozen.
+ */
+void freezer_stop(struct freezer *freezer);
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * governor.h
+ *
+ * Adapting memory.high to a container's memory pressure.
+ *
+ * OVERVIEW:
+ * A fixed memory.high is a guess. Set too low, the job is throttled by
+ * reclaim long before it runs out of memory. Set too high, a burst runs
+ * straight into memory.max and the OOM killer. The governor moves memory.high
+ * between ctx->mem_high_min and ctx->mem_high_max while the container runs:
+ * - Raise it by a step whenever the container stalls on memory for too long
+ * - Lower it by a smaller step after an interval without such stalls, so
+ *   memory the job doesn't need goes back to the host
+ *
+ * PSI TRIGGERS:
+ * Writing "some <stall us> <window us>" to a cgroup's memory.pressure turns
+ * the open file into a trigger. poll() reports POLLPRI (EPOLLPRI for epoll)
+ * on it once per window in which some task in the cgroup stalled on memory
+ * for at least the stall time. Nothing is read from the file, the event
+ * itself is the notification.
+ *
+ * EVENT LOOP:
+ * The governor has two file descriptors for the caller's poll() or epoll
+ * set: the trigger, which calls for governor_pressure(), and a timer that
+ * fires every relax interval, which calls for governor_relax().
+ */
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include "cgroups.h"
+#include "context.h"
+
+/**
+ * struct governor - memory.high governor of one container
+ * @cgroup: Handle of the container's leaf cgroup
+ * @trigger_fd: PSI trigger on memory.pressure, readable with POLLPRI
+ * @timer_fd: timerfd that fires every relax interval
+ * @high: Current memory.high in bytes
+ * @initial: memory.high the container started with, restored on stop
+ * @min: Lowest memory.high to set
+ * @max: Highest memory.high to set
+ * @stalled: Whether the trigger fired since the last relax interval
+ */
+struct governor {
+  struct cgroup cgroup;
+  int trigger_fd;
+  int timer_fd;
+  long long high;
+  long long initial;
+  long long min;
+  long long max;
+  int stalled;
+};
+
+/**
+ * governor_start - Start adapting a container's memory.high
+ * @governor: Governor to initialize
+ * @ctx: Container configuration with the memory.high bounds
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Fails if the kernel has no PSI support or memory.pressure can't be opened.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int governor_start(struct governor *governor, struct container_ctx *ctx,
+                   const char *cgroup_path);
+
+/**
+ * governor_pressure - React to the PSI trigger firing
+ * @governor: Governor whose trigger_fd reported POLLPRI
+ */
+void governor_pressure(struct governor *governor);
+
+/**
+ * governor_relax - React to the relax timer firing
+ * @governor: Governor whose timer_fd became readable
+ */
+void governor_relax(struct governor *governor);
+
+/**
+ * governor_stop - Stop adapting and restore the initial memory.high
+ * @governor: Governor to stop
+ *
+ * Restoring the initial value matters for pooled leaf cgroups, which the
+ * next container expects to find configured as usual. If the restore fails,
+ * the leaf gets its memory.high rewritten when it's next acquired.
+ */
+void governor_stop(struct governor *governor);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * image.h
+ *
+ * Layers imported from filesystem images and tarballs.
+ *
+ * OVERVIEW:
+ * Besides directories, the layer store takes two kinds of files (see
+ * layers.h):
+ * - squashfs and erofs images, which stay compressed in the store and are
+ *   mounted read-only through a loop device. The kernel caches the image's
+ *   pages once for every container, and a single file is far quicker to copy
+ *   around and read from disk than the thousands of small files of a rootfs.
+ * - Tarballs, which are unpacked once into a directory layer, like the Alpine
+ *   minirootfs.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/**
+ * image_fstype - Recognize a filesystem image by its superblock
+ * @fd: Open file to check
+ *
+ * Return: "squashfs" or "erofs", or NULL if fd is neither
+ */
+const char *image_fstype(int fd);
+
+/**
+ * mount_image - Mount a filesystem image read-only through a loop device
+ * @image: Image file
+ * @fstype: Filesystem of the image, as returned by image_fstype()
+ * @target: Directory to mount it on
+ *
+ * The loop device is set to clear itself, so unmounting target is all it
+ * takes to let go of it again.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_image(const char *image, const char *fstype, const char *target);
+
+/**
+ * extract_tarball - Unpack a tarball into a directory
+ * @tarball: Archive to unpack, compressed or not
+ * @dir: Existing directory to unpack it into
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int extract_tarball(const char *tarball, const char *dir);
+
+#endif
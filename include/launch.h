@@ -0,0 +1,160 @@
+/**
+ * launch.h
+ *
+ * Container process creation and reaping.
+ *
+ * OVERVIEW:
+ * Creates the container's init process in new namespaces and reports how it
+ * terminated. Shared by the single-container path in main.c and the warm
+ * container pool.
+ *
+ * NAMESPACES USED:
+ * - CLONE_NEWUTS: Isolated hostname
+ * - CLONE_NEWPID: Isolated process tree (child is PID 1)
+ * - CLONE_NEWNS: Isolated mount table
+ * - CLONE_NEWNET: Isolated network stack
+ * - CLONE_NEWIPC: Isolated IPC resources
+ */
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <linux/limits.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "context.h"
+#include "timing.h"
+
+/**
+ * struct container - A container as seen from the parent
+ * @id: Sequence number of the container within this euclid process
+ * @pid: PID of the container's init process
+ * @pidfd: pidfd of the container's init process, -1 if the kernel has no
+ *         pidfds (before Linux 5.3)
+ * @sync_fd: Parent's end of the synchronization pipe, -1 once closed
+ * @cgroup_path: The container's leaf cgroup
+ * @overlay_slot: The container's overlay slot, -1 if it has no overlay
+ * @net_slot: The container's network slot, -1 if it has no network
+ * @numa_node: The container's NUMA node, -1 unless numa_spread is on
+ * @timing_fd: Non-blocking read end of the launch timing pipe, -1 if the
+ *             launch isn't timed or its record was already read
+ * @timing: Launch timing record, filled in by read_launch_timing()
+ * @stdout_fd: Non-blocking read end of the container's stdout pipe, -1 if
+ *             output isn't captured or a relay took it over
+ * @stderr_fd: Likewise for the container's stderr
+ */
+struct container {
+  int id;
+  int pid;
+  int pidfd;
+  int sync_fd;
+  char cgroup_path[PATH_MAX];
+  int overlay_slot;
+  int net_slot;
+  int numa_node;
+  int timing_fd;
+  struct launch_timing timing;
+  int stdout_fd;
+  int stderr_fd;
+};
+
+/**
+ * spawn_container - Create child process in new namespaces
+ * @ctx: Container configuration
+ *
+ * Creates a new process using clone() with namespace isolation flags. The
+ * child process will execute child_main() in the new namespaces, with its own
+ * copy of ctx. With ctx->vfork, the child shares our memory until its exec
+ * and we're suspended meanwhile, unless it's a warm, profiled or supervised
+ * container.
+ *
+ * Return: Child PID on success, -1 on failure
+ */
+int spawn_container(struct container_ctx *ctx);
+
+/**
+ * start_container - Create a container in its own leaf cgroup
+ * @ctx: Container configuration, pipe_fds, numa_node, cgroup_path and
+ *       netns_fd are overwritten
+ * @container: Filled in with the new container
+ *
+ * Picks a NUMA node if ctx->numa_spread is on (see numa.h), acquires a
+ * configured leaf cgroup placed on it, from the cgroup pool if there is one or
+ * else a new one named after this process and the container's sequence
+ * number, claims an overlay slot unless ctx->overlay is off (see overlay.h)
+ * and a network slot if ctx->network is on (see network.h),
+ * creates a fresh synchronization pipe and spawns the container
+ * inside the leaf with clone3() and CLONE_INTO_CGROUP. On kernels without
+ * CLONE_INTO_CGROUP, it queues the "cgroups ready" byte on the pipe and
+ * spawns the container with clone() instead, and the child joins the leaf
+ * itself. Either way the child starts its setup without waiting for the
+ * parent. The parent keeps only the write end of the pipe, which it can later
+ * use to send a command with send_command().
+ *
+ * If ctx->profile_fds is set up, the parent's copy of its write end is closed
+ * once the child has been spawned. With ctx->time_launch, the child reports
+ * the timing of its launch on container->timing_fd (see timing.h). With
+ * ctx->capture_output, the child's stdout and stderr go into pipes read from
+ * container->stdout_fd and container->stderr_fd (see relay.h). With
+ * ctx->supervise, the child reports its seccomp listener on a pipe handed to
+ * supervise_container() (see supervisor.h), and a container that can't be
+ * supervised is killed.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int start_container(struct container_ctx *ctx, struct container *container);
+
+/**
+ * restore_container - Restore a checkpointed container in its own leaf cgroup
+ * @ctx: Container configuration, numa_node and cgroup_path are overwritten
+ * @container: Filled in with the restored container
+ * @dir: Directory holding the image written by checkpoint_container()
+ *
+ * Claims a NUMA node and leaf cgroup like start_container(), then has criu
+ * recreate the checkpointed process tree inside the leaf (see checkpoint.h).
+ * The restored container has no overlay or network slot and no pipes, and
+ * is watched, reaped and released like any other.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int restore_container(struct container_ctx *ctx, struct container *container,
+                      const char *dir);
+
+/**
+ * collect_launch_timing - Read a container's launch timing if it's ready
+ * @container: Container with an open timing_fd
+ * @job: Job number to report
+ * @out: Stream to write the launch timing line to
+ *
+ * Writes the report once the container has exec'd, and closes timing_fd once
+ * there is nothing more to read. A container that dies before its exec goes
+ * unreported.
+ *
+ * Return: 1 if timing_fd was closed, 0 if the exec hasn't happened yet
+ */
+int collect_launch_timing(struct container *container, int job, FILE *out);
+
+/**
+ * release_container - Free the parent's resources for a container
+ * @container: Container that has already been reaped
+ *
+ * Closes the pidfd, the synchronization pipe and the timing pipe if they're
+ * still open and releases the container's leaf cgroup (see release_cgroup())
+ * and overlay slot (see release_overlay_slot()).
+ */
+void release_container(struct container *container);
+
+/**
+ * wait_for_container - Wait for container to exit and report status
+ * @pid: PID of container process
+ * @status: Set to the wait status
+ * @usage: Set to the container's rusage, see wait4(2)
+ *
+ * Blocks until the container process exits, then reports how it terminated.
+ *
+ * Return: 0 on success, -1 if the container couldn't be reaped
+ */
+int wait_for_container(int pid, int *status, struct rusage *usage);
+
+#endif
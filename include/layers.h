@@ -0,0 +1,77 @@
+/**
+ * layers.h
+ *
+ * Content-addressed store of root filesystem layers.
+ *
+ * OVERVIEW:
+ * Instead of a single rootfs, the overlay's lower layer can be a stack of
+ * read-only layers. Layers live in the layer store under the SHA-256 digest of
+ * their content, so a base OS layer is stored once and shared by every
+ * container that uses it, on disk and in the page cache, and only the small
+ * layers on top of it differ between workloads:
+ *
+ *   /var/lib/euclid/layers
+ *   +-- 5f1c...e07a      Alpine base
+ *   +-- 9b03...41d2      Python on top of it
+ *   +-- c7aa...0f19      the application
+ *
+ * WORKFLOW:
+ * - Prepare each layer as a directory holding just what it adds or changes,
+ *   with overlayfs whiteouts (0:0 character devices) for what it removes, or
+ *   as a squashfs or erofs image or a tarball of such a directory (image.h)
+ * - import_layer() moves it into the store under its digest (euclid -i)
+ * - The layers key lists the digests to stack, top first, like lowerdir
+ * - resolve_layers() turns the list into ctx->lowerdir before launch
+ *
+ * DIGESTS:
+ * The digest covers the tree, not how it was built: every entry's path
+ * relative to the layer, type, permissions and owner, plus the contents of
+ * regular files, the targets of symlinks and the numbers of device nodes.
+ * Timestamps are left out, so importing the same tree twice gives the same
+ * digest. Images are hashed as they are, byte for byte. Layers are shared,
+ * so they must never be modified once imported.
+ */
+
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include "context.h"
+
+/**
+ * LOWERDIR_MAX - Room for the lower layers in the overlay's mount options
+ *
+ * The kernel copies mount options into a single page.
+ */
+#define LOWERDIR_MAX 4096
+
+/**
+ * import_layer - Move a directory, image or tarball into the layer store
+ * @ctx: Container configuration containing layer_store
+ * @path: Directory, squashfs or erofs image, or tarball holding the layer.
+ *        Directories and images must be on the store's filesystem
+ *
+ * Prints the layer's digest on stdout. A layer already in the store is left
+ * where it was and not imported a second time. Tarballs are unpacked and
+ * left where they are.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int import_layer(const struct container_ctx *ctx, const char *path);
+
+/**
+ * resolve_layers - Build the overlay's lowerdir from ctx->layers
+ * @ctx: Container configuration, lowerdir is replaced
+ *
+ * Every ':'-separated entry of ctx->layers is either an absolute path or the
+ * digest of a layer in layer_store, or any prefix of a digest that matches
+ * only one layer. Layers from the store end up relative to layer_store in
+ * lowerdir, so the child has to mount the overlay from inside that directory.
+ * Image layers that aren't mounted yet are mounted on the way.
+ *
+ * Does nothing if ctx->layers is empty, the overlay then uses rootfs.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int resolve_layers(struct container_ctx *ctx);
+
+#endif
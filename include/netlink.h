@@ -0,0 +1,98 @@
+/**
+ * netlink.h
+ *
+ * Minimal rtnetlink client for setting up container networking.
+ *
+ * OVERVIEW:
+ * ip(8) configures interfaces by sending rtnetlink messages to the kernel.
+ * These functions send the few messages euclid needs itself, so that
+ * networking a container costs a handful of syscalls instead of a fork and
+ * exec of ip for every step.
+ *
+ * NAMESPACES:
+ * A netlink socket talks to the network namespace it was created in, for as
+ * long as it exists. To configure a container's namespace, open a socket
+ * while inside it.
+ *
+ * ERRORS:
+ * Every request waits for the kernel's acknowledgement. On failure, the
+ * functions return -1 with errno set to the kernel's error, without printing
+ * anything, so callers can decide which errors are fatal (EEXIST, ENODEV).
+ */
+
+#ifndef NETLINK_H
+#define NETLINK_H
+
+#include <netinet/in.h>
+
+/**
+ * nl_open - Open an rtnetlink socket in the current network namespace
+ *
+ * Return: Socket on success, -1 on failure
+ */
+int nl_open(void);
+
+/**
+ * nl_create_bridge - Create a bridge
+ * @nl: rtnetlink socket
+ * @name: Name of the bridge
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_create_bridge(int nl, const char *name);
+
+/**
+ * nl_create_veth - Create a veth pair
+ * @nl: rtnetlink socket, the first end is created in its namespace
+ * @name: Name of the first end
+ * @peer: Name of the other end
+ * @peer_ns_fd: Network namespace to create the other end in
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_create_veth(int nl, const char *name, const char *peer, int peer_ns_fd);
+
+/**
+ * nl_delete_link - Delete an interface by name
+ * @nl: rtnetlink socket
+ * @name: Name of the interface, deleting one end of a veth pair deletes both
+ *
+ * Return: 0 on success, -1 on failure with errno set (ENODEV if there is no
+ * such interface)
+ */
+int nl_delete_link(int nl, const char *name);
+
+/**
+ * nl_set_link - Bring an interface up, optionally attaching it to a bridge
+ * @nl: rtnetlink socket
+ * @index: Interface index
+ * @master: Interface index of the bridge, 0 for none
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_set_link(int nl, int index, int master);
+
+/**
+ * nl_add_address - Give an interface an IPv4 address
+ * @nl: rtnetlink socket
+ * @index: Interface index
+ * @addr: Address
+ * @prefix: Prefix length of the address's subnet
+ *
+ * Adding an address the interface already has succeeds.
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_add_address(int nl, int index, struct in_addr addr, int prefix);
+
+/**
+ * nl_add_default_route - Add an IPv4 default route
+ * @nl: rtnetlink socket
+ * @index: Interface index the gateway is reached through
+ * @gateway: Address of the gateway
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_add_default_route(int nl, int index, struct in_addr gateway);
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * network.h
+ *
+ * Pre-created network namespaces for containers with a network.
+ *
+ * OVERVIEW:
+ * A container's own network namespace normally has just a loopback device
+ * that is down. With network turned on, every container instead joins a
+ * network slot: a namespace the parent set up earlier, with a veth pair
+ * connecting it to a bridge on the host.
+ *
+ *   host                               slot 0's namespace
+ *   euclid0 (bridge) 10.88.0.1/16
+ *   +-- veth-eu0  <----- veth ----->   eth0 10.88.0.2/16, default route via
+ *   +-- veth-eu1  <--- ...              10.88.0.1, lo up
+ *
+ * Slots are numbered like overlay slots, and slot N always gets the Nth
+ * address after the gateway. Everything is configured over rtnetlink (see
+ * netlink.h) from euclid itself.
+ *
+ * WORKFLOW:
+ * - start_container() calls acquire_net_slot(), which stores the slot's
+ *   namespace in ctx->netns_fd
+ * - The child is cloned without CLONE_NEWNET and setns()es into netns_fd
+ * - release_container() calls release_net_slot() after the container has
+ *   been reaped, and the slot goes to the next container as it is
+ *
+ * Batch mode calls net_pool_init() up front, so no container waits for its
+ * network to be created. Routing or NAT between the bridge and the outside
+ * world is left to the host's configuration.
+ */
+
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include "context.h"
+
+/**
+ * net_pool_init - Create network slots ahead of the containers using them
+ * @ctx: Container configuration, nothing happens unless network is on
+ * @size: Number of slots to create, at least the number of containers that
+ *        are alive at the same time for every launch to find one ready
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int net_pool_init(struct container_ctx *ctx, int size);
+
+/**
+ * acquire_net_slot - Claim a network slot for a new container
+ * @ctx: Container configuration, the slot's namespace is stored in netns_fd
+ *
+ * Slots are claimed with an exclusive flock() on their lock file, so a slot
+ * is never shared with the containers of other euclid processes. If this
+ * process has no free slot, a new one is created.
+ *
+ * Return: Slot number on success, -1 on failure
+ */
+int acquire_net_slot(struct container_ctx *ctx);
+
+/**
+ * release_net_slot - Give up a container's network slot
+ * @slot: Slot number returned by acquire_net_slot(), -1 for none
+ *
+ * The slot stays claimed by this process for its next container, until
+ * net_pool_destroy().
+ */
+void release_net_slot(int slot);
+
+/**
+ * net_pool_destroy - Delete every network slot of this process
+ *
+ * Must only be called once no container is using a slot anymore.
+ */
+void net_pool_destroy(void);
+
+#endif
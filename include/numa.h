@@ -0,0 +1,56 @@
+/**
+ * numa.h
+ *
+ * Spreading containers across NUMA nodes.
+ *
+ * OVERVIEW:
+ * With numa_spread, every container is confined to the CPUs and memory of a
+ * single NUMA node through its leaf cgroup's cpuset.cpus and cpuset.mems.
+ * Each new container goes to the node running the fewest of our containers,
+ * so a batch fills all sockets evenly, and a job's threads never migrate to
+ * another socket away from their caches and memory. cpuset.mems also applies
+ * to the pages the job writes to its overlay slot's tmpfs.
+ *
+ * WORKFLOW:
+ * - start_container() calls numa_acquire_node() and stores the node in
+ *   ctx->numa_node, which the cgroup setup turns into cpuset values
+ * - release_container() calls numa_release_node() once the container has
+ *   been reaped
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+/**
+ * numa_acquire_node - Pick the NUMA node for a new container
+ *
+ * The topology is read from /sys/devices/system/node on the first call.
+ * Nodes without CPUs (memory-only nodes) are never picked.
+ *
+ * Return: Node index on success, -1 on failure
+ */
+int numa_acquire_node(void);
+
+/**
+ * numa_release_node - Give back a container's NUMA node
+ * @node: Node index returned by numa_acquire_node(), -1 for none
+ */
+void numa_release_node(int node);
+
+/**
+ * numa_node_cpus - CPUs of a NUMA node
+ * @node: Node index returned by numa_acquire_node()
+ *
+ * Return: CPU list in cpuset.cpus syntax, such as "0-15,32-47"
+ */
+const char *numa_node_cpus(int node);
+
+/**
+ * numa_node_mems - Memory of a NUMA node
+ * @node: Node index returned by numa_acquire_node()
+ *
+ * Return: The node's number in cpuset.mems syntax
+ */
+const char *numa_node_mems(int node);
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * overlay.h
+ *
+ * Pre-staged overlay slots for the container's writable layer.
+ *
+ * OVERVIEW:
+ * Every container with an overlay gets a slot: a directory below
+ * overlay_base with its own tmpfs and the upper, work and merged directories
+ * overlayfs needs already created inside it. The parent sets slots up once
+ * and keeps them across containers and across runs, so all the child has to
+ * do is a single overlay mount (see setup_overlay()).
+ *
+ *   /tmp/euclid_overlay
+ *   +-- slot0            tmpfs of tmpfs_size megabytes, with the other
+ *   |                    tmpfs_* options
+ *   |   +-- upper        writable layer
+ *   |   +-- work         overlayfs workspace
+ *   |   +-- merged       mount point of the overlay, inside the container
+ *   +-- slot0.lock       locked while slot0 is in use, holds the options
+ *                        slot0's tmpfs was mounted with
+ *   +-- slot1
+ *   +-- slot1.lock
+ *
+ * WORKFLOW:
+ * - start_container() calls acquire_overlay_slot(), which stores the slot's
+ *   directory in ctx->overlay_dir
+ * - The child mounts the overlay at {overlay_dir}/merged
+ * - release_container() calls release_overlay_slot() after the container has
+ *   been reaped, which resets the slot if the container wrote to it
+ *
+ * USER NAMESPACES:
+ * Without root, the parent can't mount the slots' tmpfs. A container in a
+ * user namespace calls mount_private_slot() instead, which mounts a fresh
+ * tmpfs for it inside its own mount namespace. That's the one mount the
+ * slots exist to save, paid again on every launch.
+ */
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include "context.h"
+
+/**
+ * acquire_overlay_slot - Claim a free overlay slot for a new container
+ * @ctx: Container configuration, the slot's directory is stored in
+ *       overlay_dir
+ *
+ * Slots are claimed with an exclusive flock() on their lock file, so a slot
+ * is never shared between containers, even those of other euclid processes.
+ * If every known slot is taken, a new one is created.
+ *
+ * Return: Slot number on success, -1 on failure
+ */
+int acquire_overlay_slot(struct container_ctx *ctx);
+
+/**
+ * release_overlay_slot - Give up a container's overlay slot
+ * @slot: Slot number returned by acquire_overlay_slot(), -1 for none
+ *
+ * Must be called after the container has been reaped, since the slot could
+ * otherwise be reset while the container still has its overlay mounted.
+ */
+void release_overlay_slot(int slot);
+
+/**
+ * mount_private_slot - Set up a slot only the calling child can see
+ * @ctx: Container configuration, the slot's directory is stored in
+ *       overlay_dir
+ *
+ * Must be called in the child, after setup_mount_propagation().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_private_slot(struct container_ctx *ctx);
+
+#endif
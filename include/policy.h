@@ -0,0 +1,128 @@
+/**
+ * policy.h
+ *
+ * Seccomp policies compiled into euclid at build time.
+ *
+ * OVERVIEW:
+ * The syscalls a container may make are written down in policy/NAME.policy,
+ * one file per policy. At build time, policygen (policy/policygen.c) turns
+ * every file into the tables declared here, and filter.c lays the selected
+ * policy out as a BPF program (see filter.h). Syscall names and constants are
+ * resolved by the C compiler, so a typo in a policy fails the build with the
+ * policy's file and line.
+ *
+ * POLICY FORMAT:
+ * One rule per line, # starts a comment:
+ *   read
+ *   ioctl: arg1 == TCGETS || arg1 == TIOCGWINSZ; return ENOTTY
+ *   clone: arg0 & CLONE_THREAD
+ *   getxattr: return ENODATA
+ * A bare name allows the syscall. An expression allows it when it holds and
+ * kills the process otherwise, or fails the call with the errno given after
+ * "; return". "return ERRNO" alone always fails the call.
+ *
+ * Expressions are comparisons of the syscall's 64-bit arguments, ORed with ||
+ * and ANDed with && (which binds tighter), with no parentheses:
+ * - argN == VALUE, argN != VALUE: The argument is, or isn't, VALUE
+ * - argN & VALUE: At least one bit of VALUE is set in the argument
+ * - argN in VALUE: No bit outside VALUE is set in the argument
+ * Tokens are separated by whitespace, so a VALUE is a C constant expression
+ * without spaces, such as CLONE_NEWNS|CLONE_NEWPID.
+ *
+ * SHARING:
+ * policygen gives identical expressions a single policy_check, across
+ * syscalls and policies, and filter.c emits one BPF block for every check
+ * and pair of actions it's used with, which all of its syscalls jump to.
+ */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdint.h>
+
+/**
+ * POLICY_CLAUSE_CONDS_MAX - Most comparisons ANDed in one clause
+ *
+ * Keeps every jump out of a clause within the 8 bits of a BPF jump offset.
+ */
+#define POLICY_CLAUSE_CONDS_MAX 16
+
+/**
+ * enum policy_op - How a policy_cond compares an argument
+ * @POLICY_EQ: argN == VALUE
+ * @POLICY_NE: argN != VALUE
+ * @POLICY_SET: argN & VALUE
+ * @POLICY_IN: argN in VALUE
+ */
+enum policy_op { POLICY_EQ, POLICY_NE, POLICY_SET, POLICY_IN };
+
+/**
+ * struct policy_cond - One comparison of a syscall argument
+ * @arg: Index of the argument, 0 to 5
+ * @op: Comparison, see enum policy_op
+ * @value: Value compared against
+ */
+struct policy_cond {
+  unsigned int arg;
+  unsigned int op;
+  uint64_t value;
+};
+
+/**
+ * struct policy_clause - Comparisons that must all hold
+ * @first: Index of the first comparison in policy_conds
+ * @num: Number of comparisons, at most POLICY_CLAUSE_CONDS_MAX
+ */
+struct policy_clause {
+  unsigned int first;
+  unsigned int num;
+};
+
+/**
+ * struct policy_check - Clauses of which at least one must hold
+ * @first: Index of the first clause in policy_clauses
+ * @num: Number of clauses
+ */
+struct policy_check {
+  unsigned int first;
+  unsigned int num;
+};
+
+/**
+ * struct policy_rule - What a policy does with one syscall
+ * @nr: Syscall number
+ * @check: Index of the check in policy_checks, -1 if the syscall gets action
+ *         whatever its arguments
+ * @action: Seccomp return value when the check holds
+ * @fail_action: Seccomp return value when it doesn't
+ */
+struct policy_rule {
+  unsigned int nr;
+  int check;
+  unsigned int action;
+  unsigned int fail_action;
+};
+
+/**
+ * struct policy - A policy file
+ * @name: The file's name without .policy
+ * @rules: One rule per syscall the policy names, the rest are killed
+ * @num_rules: Number of elements in rules
+ */
+struct policy {
+  const char *name;
+  const struct policy_rule *rules;
+  unsigned int num_rules;
+};
+
+/*
+ * Tables generated by policygen. The checks of every policy share
+ * policy_conds, policy_clauses and policy_checks.
+ */
+extern const struct policy_cond policy_conds[];
+extern const struct policy_clause policy_clauses[];
+extern const struct policy_check policy_checks[];
+extern const struct policy policies[];
+extern const unsigned int num_policies;
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * pool.h
+ *
+ * Pool of pre-spawned (warm) containers.
+ *
+ * OVERVIEW:
+ * Most of the time it takes to launch a container goes into setting it up:
+ * joining the cgroup, mounting the overlay, pivot_root, /dev and /proc,
+ * dropping capabilities and installing the seccomp filter. None of this
+ * depends on the command, so a pool keeps a number of containers that have
+ * already done all of it and are parked just before execvp(), waiting for a
+ * command on their synchronization pipe.
+ *
+ * WORKFLOW:
+ * - pool_init() spawns the warm containers, each in its own leaf cgroup
+ * - pool_dispatch() hands a command to the oldest warm container and spawns
+ *   its replacement, whose setup then overlaps with the command's execution
+ * - pool_destroy() closes the pipes of containers that were never used, which
+ *   makes them exit, and reaps them
+ *
+ * IDLE FREEZING:
+ * With ctx->freeze_idle set, a warm container that has waited that long for
+ * a command is frozen and its memory reclaimed (see freezer.h), so a pool
+ * sized for bursts doesn't hold on to RAM between them. The pool's timer_fd
+ * goes into the caller's poll() or epoll set and calls for pool_idle().
+ * pool_dispatch() prefers containers that aren't frozen, and thaws the one it
+ * takes if they all are.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <time.h>
+
+#include "cgroups.h"
+#include "command.h"
+#include "context.h"
+#include "launch.h"
+
+/**
+ * struct warm_container - A container waiting in a pool
+ * @container: The container
+ * @spawned: CLOCK_MONOTONIC time it was spawned at
+ * @frozen: Whether it's frozen, cgroup is only open if it is
+ * @cgroup: Handle of its leaf cgroup
+ */
+struct warm_container {
+  struct container container;
+  struct timespec spawned;
+  int frozen;
+  struct cgroup cgroup;
+};
+
+/**
+ * struct pool - Warm container pool
+ * @ctx: Configuration every container in the pool is spawned with
+ * @size: Number of warm containers to keep around
+ * @count: Number of warm containers currently available
+ * @containers: Warm containers, oldest first, so the frozen ones come before
+ *              all others
+ * @timer_fd: timerfd that fires when the next warm container has been idle
+ *            for ctx->freeze_idle, -1 if containers are never frozen
+ */
+struct pool {
+  struct container_ctx *ctx;
+  int size;
+  int count;
+  struct warm_container *containers;
+  int timer_fd;
+};
+
+/**
+ * pool_init - Fill a pool with warm containers
+ * @pool: Pool to initialize
+ * @ctx: Configuration to spawn containers with, its cmd is ignored
+ * @size: Number of warm containers to keep around
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int pool_init(struct pool *pool, struct container_ctx *ctx, int size);
+
+/**
+ * pool_dispatch - Run a command in a warm container
+ * @pool: Pool to take the container from
+ * @cmd: Command to run
+ * @container: Set to the container running the command
+ *
+ * Takes the oldest warm container, sends it the command and spawns a
+ * replacement. If no warm container is available (or all of them died), a
+ * cold one is spawned for the command.
+ *
+ * The container leaves the pool, so the caller is responsible for reaping it
+ * and calling release_container().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int pool_dispatch(struct pool *pool, const struct command *cmd,
+                  struct container *container);
+
+/**
+ * pool_idle - Freeze the warm containers that have been idle for too long
+ * @pool: Pool whose timer_fd became readable
+ */
+void pool_idle(struct pool *pool);
+
+/**
+ * pool_destroy - Shut down all warm containers in a pool
+ * @pool: Pool to destroy
+ */
+void pool_destroy(struct pool *pool);
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * profile.h
+ *
+ * Syscall frequency profiling for tuning the seccomp filter.
+ *
+ * OVERVIEW:
+ * The seccomp filter is a decision tree over syscall numbers. How many
+ * comparisons a syscall costs depends on where it sits in that tree, so the
+ * tree can be tuned for a workload by placing its most frequent syscalls near
+ * the root. This module records those frequencies from a trial run and loads
+ * them back for later runs.
+ *
+ * WORKFLOW:
+ * - Child installs the profiling filter via apply_seccomp_profiler()
+ * - Parent calls record_profile(), which counts every syscall the container
+ *   makes until it exits and writes the counts to a profile file
+ * - Later runs call load_profile() before spawning the container, which
+ *   weights the filter built by get_fprog()
+ *
+ * PROFILE FORMAT:
+ * One "syscall_nr count" pair per line, hottest first. Lines starting with
+ * '#' are comments.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/**
+ * record_profile - Count syscalls made by a container until it exits
+ * @pid: PID of the container process
+ * @report_fd: Read end of the pipe the child reports its listener fd on
+ * @path: File to write the profile to
+ *
+ * Acts as the seccomp user notification supervisor for the child. Each
+ * notification is counted and then answered with
+ * SECCOMP_USER_NOTIF_FLAG_CONTINUE, so the syscall runs as it normally would.
+ * Returns once every process in the container has exited.
+ *
+ * The caller still has to reap the container afterwards.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int record_profile(int pid, int report_fd, const char *path);
+
+/**
+ * load_profile - Weight the seccomp filter with a recorded profile
+ * @path: Profile file written by record_profile()
+ *
+ * Must be called before the child installs its filter.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int load_profile(const char *path);
+
+#endif
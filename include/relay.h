@@ -0,0 +1,78 @@
+/**
+ * relay.h
+ *
+ * Relaying container output to log files without copying it through us.
+ *
+ * OVERVIEW:
+ * With -l, every batch container writes its stdout and stderr into pipes of
+ * its own instead of sharing ours, and the parent moves what arrives into
+ * {log_dir}/<job>.out and {log_dir}/<job>.err:
+ *
+ *   job stdout --> pipe --splice()--> <job>.out
+ *   job stderr --> pipe --splice()--> <job>.err
+ *
+ * splice() hands the pipe's pages straight to the file, so output never
+ * passes through a buffer in our address space, and a relay costs one
+ * syscall per chunk however much the job logs.
+ *
+ * BACKPRESSURE:
+ * The pipe is the only buffer, sized by ctx->output_buffer. Each time the
+ * pipe becomes readable, at most one buffer's worth is relayed before the
+ * event loop moves on, so a job that logs faster than the disk takes it
+ * can't starve the others. It fills its pipe instead and blocks in write()
+ * until the relay catches up, the same as a program writing to a slow
+ * terminal.
+ *
+ * DESTINATIONS:
+ * Only regular files are relayed to. splice() could feed a socket just the
+ * same, but -l names a directory and nothing else names a destination, so
+ * there is no socket to relay to. relay_open() creates or truncates what it
+ * is given, and a path naming a socket fails to open with ENXIO.
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+/**
+ * struct relay - One output stream of a container
+ * @pipe_fd: Non-blocking read end of the stream's pipe, -1 once closed
+ * @out_fd: File the stream is relayed to, -1 once closed
+ * @chunk: Most bytes moved per relay_pump()
+ */
+struct relay {
+  int pipe_fd;
+  int out_fd;
+  int chunk;
+};
+
+/**
+ * relay_open - Start relaying a pipe to a new file
+ * @relay: Relay to set up
+ * @pipe_fd: Read end of the pipe, owned by the relay from now on, even if
+ *           this fails
+ * @path: File to relay to, created or truncated
+ * @chunk: Most bytes moved per relay_pump(), normally the pipe's size
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int relay_open(struct relay *relay, int pipe_fd, const char *path, int chunk);
+
+/**
+ * relay_pump - Move what's waiting in a relay's pipe to its file
+ * @relay: Relay whose pipe became readable
+ *
+ * Return: 1 while the stream is open, 0 once the relay has been closed
+ * because the writer went away or the file couldn't be written
+ */
+int relay_pump(struct relay *relay);
+
+/**
+ * relay_close - Relay whatever is left in the pipe, then close the relay
+ * @relay: Relay to close, may already be closed
+ *
+ * Stops at the first empty read, so writers that outlive the container
+ * don't keep us waiting.
+ */
+void relay_close(struct relay *relay);
+
+#endif
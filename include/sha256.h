@@ -0,0 +1,62 @@
+/**
+ * sha256.h
+ *
+ * SHA-256 message digest.
+ *
+ * OVERVIEW:
+ * A small, self-contained implementation of SHA-256 (FIPS 180-4) for naming
+ * layers in the layer store by their content. Data can be fed in pieces of
+ * any size:
+ *   struct sha256 sha;
+ *   sha256_init(&sha);
+ *   sha256_update(&sha, data, len);
+ *   sha256_hex(&sha, digest);
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * SHA256_HEX_LEN - Length of a digest in hex, without the null terminator
+ */
+#define SHA256_HEX_LEN 64
+
+/**
+ * struct sha256 - State of a digest in progress
+ * @state: Intermediate hash value
+ * @length: Number of bytes fed so far
+ * @block: Bytes waiting for a full 64-byte block
+ * @block_len: Number of bytes in block
+ */
+struct sha256 {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+  size_t block_len;
+};
+
+/**
+ * sha256_init - Start a new digest
+ * @sha: Digest state to initialize
+ */
+void sha256_init(struct sha256 *sha);
+
+/**
+ * sha256_update - Feed data into a digest
+ * @sha: Digest state
+ * @data: Data to add
+ * @len: Number of bytes in data
+ */
+void sha256_update(struct sha256 *sha, const void *data, size_t len);
+
+/**
+ * sha256_hex - Finish a digest and format it in lowercase hex
+ * @sha: Digest state, can't be fed any more data afterwards
+ * @hex: Output buffer of SHA256_HEX_LEN + 1 bytes
+ */
+void sha256_hex(struct sha256 *sha, char *hex);
+
+#endif
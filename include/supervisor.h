@@ -0,0 +1,89 @@
+/**
+ * supervisor.h
+ *
+ * Seccomp user notification supervisor for the syscalls the filter leaves to
+ * euclid.
+ *
+ * OVERVIEW:
+ * The filter decides every syscall in the kernel, which is only possible for
+ * syscalls that are safe or unsafe whatever their arguments. A few rare ones,
+ * such as socket(), are fine with some arguments and not with others. With
+ * supervise on, the filter returns SECCOMP_RET_USER_NOTIF for those instead,
+ * which suspends the calling thread until a supervisor answers it. Hot
+ * syscalls are still allowed in the kernel and never reach the supervisor.
+ *
+ * A single thread supervises every container of the euclid process. It waits
+ * on all of their listeners in one epoll set, so the batch loop never has to
+ * stop for a notification and a notification never waits for a launch.
+ *
+ * POLICY:
+ * - socket() in a container without a network fails with EAFNOSUPPORT, like
+ *   on a kernel without the family, instead of killing the container
+ * - socket() with a network is continued for AF_UNIX, TCP and UDP sockets
+ *   and NETLINK_ROUTE. ping works through ICMP and ICMPv6 datagram sockets,
+ *   which need no capability. Anything else, raw sockets included, fails
+ *   with EPERM.
+ * - execve() and execveat() are always continued
+ *
+ * Decisions are made only on the arguments in registers, which the container
+ * can't change after the fact, so continuing a checked call is safe.
+ *
+ * DECISIONS ONLY:
+ * Every notification is answered with SECCOMP_USER_NOTIF_FLAG_CONTINUE or an
+ * errno. The supervisor never creates a descriptor for a container and adds
+ * it with SECCOMP_IOCTL_NOTIF_ADDFD: anything we create carries our
+ * privileges, and the container could reconfigure it through syscalls that
+ * aren't supervised, like setsockopt(IP_HDRINCL) on a raw socket. The only
+ * socket that used to be brokered this way is covered by ping sockets.
+ *
+ * The filter kills syscalls made through the i386 entry before they can
+ * reach us (see filter.c), so a 32-bit execve() or socketcall() can't get
+ * around the supervisor either.
+ *
+ * WORKFLOW:
+ * - main() calls supervisor_start() before the first container
+ * - The child installs its filter with apply_seccomp_supervised() and
+ *   reports the listener's fd number on its supervisor pipe
+ * - start_container() hands the pipe and a pidfd to supervise_container()
+ * - The thread takes the listener over with pidfd_getfd(), answers its
+ *   notifications, and forgets it once every process using the filter is gone
+ * - main() calls supervisor_stop() after the last container has been reaped
+ *
+ * REQUIREMENTS:
+ * Linux 5.6 for pidfd_getfd(). Containers can't be spawned with
+ * vfork, since the suspended parent couldn't answer the exec.
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+/**
+ * supervisor_start - Start the supervisor thread
+ * @network: Non-zero if the containers have a network (see network.h)
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int supervisor_start(int network);
+
+/**
+ * supervise_container - Supervise a container's supervised syscalls
+ * @pidfd: pidfd of the container's init, owned by the supervisor from now on
+ * @report_fd: Read end of the container's supervisor pipe, likewise
+ *
+ * Returns right away. The listener is taken over once the child reports it,
+ * and the child's exec waits for that. If it can't be taken over, the
+ * container is killed, as it would wait forever.
+ *
+ * Return: 0 on success, -1 on failure with both fds closed
+ */
+int supervise_container(int pidfd, int report_fd);
+
+/**
+ * supervisor_stop - Stop the supervisor thread
+ *
+ * Must only be called once no supervised container is alive anymore. Does
+ * nothing if supervisor_start() wasn't called.
+ */
+void supervisor_stop(void);
+
+#endif
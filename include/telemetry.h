@@ -0,0 +1,227 @@
+/**
+ * telemetry.h
+ *
+ * Resource usage telemetry of running containers.
+ *
+ * OVERVIEW:
+ * Samples a container's leaf cgroup while the container runs, and writes
+ * what it used as JSON lines, one object per line:
+ *   {"type":"sample","job":1,"pid":4120,"elapsed":0.100,...}
+ *   {"type":"summary","job":1,"pid":4120,"elapsed":1.254,"samples":12,...}
+ * Samples are written every interval, the summary once the container has
+ * exited. Values the kernel doesn't provide (a controller that isn't enabled,
+ * or no PSI support) are left out instead of being reported as zero.
+ *
+ * FILES SAMPLED:
+ * - cpu.stat: CPU time used and time spent throttled by cpu.max
+ * - memory.current, memory.peak: Memory in use and its high-water mark
+ * - memory.events: How often memory.high, memory.max and the OOM killer hit
+ * - pids.current: Number of tasks
+ * - memory.pressure, cpu.pressure: Pressure stall information (PSI)
+ *
+ * PER-JOB NUMBERS:
+ * Counters are reported relative to a baseline taken when monitoring starts,
+ * so they only count the job even in a reused leaf cgroup. memory.peak is
+ * reset for our file descriptor where the kernel supports it (Linux 6.12),
+ * otherwise it's the leaf's peak since it was created.
+ *
+ * EXIT RECORDS:
+ * Independently of sampling, exit accounting writes one line per container
+ * once it has been reaped:
+ *   {"type":"exit","job":1,"pid":4120,"exit":1,"cause":"exit",...}
+ * combining the rusage wait4() returned with the cgroup's throttling and
+ * memory events over the container's lifetime, so a scheduler can tell a job
+ * that was slow from one that cpu.max held back. It opens only cpu.stat and
+ * memory.events, and reads them twice.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/**
+ * struct telemetry_config - How to collect telemetry
+ * @out: Stream to write JSON lines to
+ * @interval_ms: Milliseconds between samples, 0 for the summary only
+ */
+struct telemetry_config {
+  FILE *out;
+  int interval_ms;
+};
+
+/**
+ * enum telemetry_file - Control files read for every sample
+ * @TELEMETRY_CPU_STAT: cpu.stat
+ * @TELEMETRY_MEMORY_CURRENT: memory.current
+ * @TELEMETRY_MEMORY_PEAK: memory.peak
+ * @TELEMETRY_MEMORY_EVENTS: memory.events
+ * @TELEMETRY_PIDS_CURRENT: pids.current
+ * @TELEMETRY_MEMORY_PRESSURE: memory.pressure
+ * @TELEMETRY_CPU_PRESSURE: cpu.pressure
+ * @TELEMETRY_FILE_COUNT: Number of files
+ */
+enum telemetry_file {
+  TELEMETRY_CPU_STAT,
+  TELEMETRY_MEMORY_CURRENT,
+  TELEMETRY_MEMORY_PEAK,
+  TELEMETRY_MEMORY_EVENTS,
+  TELEMETRY_PIDS_CURRENT,
+  TELEMETRY_MEMORY_PRESSURE,
+  TELEMETRY_CPU_PRESSURE,
+  TELEMETRY_FILE_COUNT
+};
+
+/**
+ * struct telemetry_sample - One reading of a cgroup, -1 where unavailable
+ * @cpu_usage_usec: Total CPU time
+ * @cpu_user_usec: CPU time in user mode
+ * @cpu_system_usec: CPU time in kernel mode
+ * @cpu_nr_throttled: Number of periods cpu.max throttled the cgroup in
+ * @cpu_throttled_usec: Time spent throttled
+ * @memory_current: Memory in use in bytes
+ * @memory_peak: Highest memory use in bytes
+ * @memory_high: Times memory.high was exceeded and reclaim forced
+ * @memory_max: Times memory.max was about to be exceeded
+ * @memory_oom: Times the cgroup ran out of memory
+ * @memory_oom_kill: Processes killed by the OOM killer
+ * @pids_current: Number of tasks
+ * @memory_some_avg10: Share of the last 10s some task stalled on memory (%)
+ * @memory_full_avg10: Share of the last 10s all tasks stalled on memory (%)
+ * @cpu_some_avg10: Share of the last 10s some task waited for a CPU (%)
+ * @memory_some_total: Total time some task stalled on memory in usec
+ * @memory_full_total: Total time all tasks stalled on memory in usec
+ * @cpu_some_total: Total time some task waited for a CPU in usec
+ */
+struct telemetry_sample {
+  long long cpu_usage_usec;
+  long long cpu_user_usec;
+  long long cpu_system_usec;
+  long long cpu_nr_throttled;
+  long long cpu_throttled_usec;
+  long long memory_current;
+  long long memory_peak;
+  long long memory_high;
+  long long memory_max;
+  long long memory_oom;
+  long long memory_oom_kill;
+  long long pids_current;
+  double memory_some_avg10;
+  double memory_full_avg10;
+  double cpu_some_avg10;
+  long long memory_some_total;
+  long long memory_full_total;
+  long long cpu_some_total;
+};
+
+/**
+ * struct telemetry - Telemetry state of one monitored container
+ * @job: Job number reported with every line
+ * @pid: PID of the container's init process
+ * @fds: Open descriptor of each sampled file, -1 if it couldn't be opened
+ * @start: When monitoring started (CLOCK_MONOTONIC)
+ * @base: Reading taken when monitoring started
+ * @samples: Number of samples written
+ * @memory_peak: Highest memory use seen so far
+ * @pids_peak: Highest number of tasks seen so far
+ */
+struct telemetry {
+  int job;
+  int pid;
+  int fds[TELEMETRY_FILE_COUNT];
+  struct timespec start;
+  struct telemetry_sample base;
+  int samples;
+  long long memory_peak;
+  long long pids_peak;
+};
+
+/**
+ * struct exit_accounting - Exit accounting state of one container
+ * @fds: Open descriptor of each sampled file, -1 if it couldn't be opened or
+ *       isn't needed for the record, which only uses cpu.stat and
+ *       memory.events
+ * @start: When accounting started (CLOCK_MONOTONIC)
+ * @base: Reading taken when accounting started
+ */
+struct exit_accounting {
+  int fds[TELEMETRY_FILE_COUNT];
+  struct timespec start;
+  struct telemetry_sample base;
+};
+
+/**
+ * telemetry_start - Start monitoring a container
+ * @telemetry: State to initialize
+ * @job: Job number to report
+ * @pid: PID of the container's init process
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int telemetry_start(struct telemetry *telemetry, int job, int pid,
+                    const char *cgroup_path);
+
+/**
+ * telemetry_sample - Read the container's cgroup and write a sample line
+ * @telemetry: State of the container
+ * @out: Stream to write to
+ */
+void telemetry_sample(struct telemetry *telemetry, FILE *out);
+
+/**
+ * telemetry_finish - Write the summary line and stop monitoring
+ * @telemetry: State of a container that has exited
+ * @out: Stream to write to
+ *
+ * Must be called before the container's cgroup is released, since the
+ * summary is read from it.
+ */
+void telemetry_finish(struct telemetry *telemetry, FILE *out);
+
+/**
+ * telemetry_timer - Create a timer that fires every sampling interval
+ * @interval_ms: Milliseconds between samples
+ *
+ * Return: timerfd on success, -1 on failure
+ */
+int telemetry_timer(int interval_ms);
+
+/**
+ * exit_accounting_start - Take the baseline of a container's exit record
+ * @acct: State to initialize
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Missing counters are left out of the record rather than failing, like
+ * telemetry's.
+ *
+ * Return: 0 on success, -1 if the cgroup couldn't be opened
+ */
+int exit_accounting_start(struct exit_accounting *acct,
+                          const char *cgroup_path);
+
+/**
+ * exit_accounting_finish - Write a container's exit record
+ * @acct: State of a container that has been reaped
+ * @job: Job number to report
+ * @pid: PID the container's init process had
+ * @status: Wait status of the container's init process
+ * @usage: rusage of the container's init process and the processes it reaped
+ * @out: Stream to write to
+ *
+ * Must be called before the container's cgroup is released.
+ */
+void exit_accounting_finish(struct exit_accounting *acct, int job, int pid,
+                            int status, const struct rusage *usage,
+                            FILE *out);
+
+/**
+ * exit_accounting_abort - Stop accounting without writing an exit record
+ * @acct: State of a container whose exit can't be reported, such as one that
+ *        couldn't be reaped
+ */
+void exit_accounting_abort(struct exit_accounting *acct);
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * timing.h
+ *
+ * Per-stage timing of container launches.
+ *
+ * OVERVIEW:
+ * Every stage of a launch, on both sides of clone(), ends with a
+ * CLOCK_MONOTONIC timestamp in a struct launch_timing. The parent stamps its
+ * stages into ctx->timing before cloning, the child inherits that copy, adds
+ * its own stamps and writes the whole record to the timing pipe right before
+ * execvp(). The write end is close-on-exec, so the parent sees EOF the moment
+ * the exec succeeds, which is the final stamp.
+ *
+ * CLOCK_MONOTONIC isn't namespaced unless the container gets a time
+ * namespace, which it doesn't, so stamps from both sides compare directly.
+ *
+ * REPORTING:
+ * The time spent in each stage goes out as a JSON line, in seconds:
+ *   {"type":"launch","job":1,"pid":4120,"cgroup":0.000041,...,"total":0.0032}
+ * For warm containers, "command" is the time spent waiting in the pool.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * enum launch_stage - Stages of a launch, in order, each stamped as it ends
+ * @LAUNCH_START: start_container() was called
+ * @LAUNCH_CGROUP: Leaf cgroup acquired and configured (parent)
+ * @LAUNCH_OVERLAY_SLOT: Overlay slot claimed (parent)
+ * @LAUNCH_NET_SLOT: Network slot claimed (parent), instant without network
+ * @LAUNCH_CLONE: Child process running (child)
+ * @LAUNCH_CLOSE_FDS: Inherited file descriptors closed
+ * @LAUNCH_JOIN_CGROUP: Waited for the parent and joined the cgroup, instant
+ *                      for children created with CLONE_INTO_CGROUP
+ * @LAUNCH_NETNS: Joined the network slot's namespace, instant without network
+ * @LAUNCH_UTS: Hostname set
+ * @LAUNCH_PROPAGATION: Mounts made private
+ * @LAUNCH_OVERLAY: Overlay mounted
+ * @LAUNCH_ROOTFS: Root filesystem pivoted
+ * @LAUNCH_DEV: /dev mounted
+ * @LAUNCH_PROC: /proc mounted
+ * @LAUNCH_DROP_CAPS: Capabilities dropped
+ * @LAUNCH_LOCK_CAPS: no_new_privs set
+ * @LAUNCH_SECCOMP: Seccomp filter installed
+ * @LAUNCH_COMMAND: Command received, instant for cold containers
+ * @LAUNCH_EXEC: execvp() succeeded (parent, when the timing pipe closes)
+ * @LAUNCH_STAGE_COUNT: Number of stamps
+ */
+enum launch_stage {
+  LAUNCH_START,
+  LAUNCH_CGROUP,
+  LAUNCH_OVERLAY_SLOT,
+  LAUNCH_NET_SLOT,
+  LAUNCH_CLONE,
+  LAUNCH_CLOSE_FDS,
+  LAUNCH_JOIN_CGROUP,
+  LAUNCH_NETNS,
+  LAUNCH_UTS,
+  LAUNCH_PROPAGATION,
+  LAUNCH_OVERLAY,
+  LAUNCH_ROOTFS,
+  LAUNCH_DEV,
+  LAUNCH_PROC,
+  LAUNCH_DROP_CAPS,
+  LAUNCH_LOCK_CAPS,
+  LAUNCH_SECCOMP,
+  LAUNCH_COMMAND,
+  LAUNCH_EXEC,
+  LAUNCH_STAGE_COUNT
+};
+
+/**
+ * struct launch_timing - Timestamps of one launch
+ * @stamps: When each stage ended (CLOCK_MONOTONIC)
+ * @received: Whether the parent has received the child's record
+ */
+struct launch_timing {
+  struct timespec stamps[LAUNCH_STAGE_COUNT];
+  int received;
+};
+
+/**
+ * launch_stamp - Record that a stage just ended
+ * @timing: Timestamps of the launch
+ * @stage: Stage that ended
+ */
+void launch_stamp(struct launch_timing *timing, enum launch_stage stage);
+
+/**
+ * send_launch_timing - Write the child's record to the timing pipe
+ * @fd: Write end of the timing pipe, -1 if launches aren't timed
+ * @timing: Timestamps of the launch
+ *
+ * Called right before execvp(). The record is smaller than PIPE_BUF and the
+ * pipe is empty, so a single write() never blocks or splits it.
+ */
+void send_launch_timing(int fd, const struct launch_timing *timing);
+
+/**
+ * read_launch_timing - Read the child's record from a non-blocking pipe
+ * @fd: Read end of the timing pipe
+ * @timing: Filled in with the child's record
+ *
+ * Stamps LAUNCH_EXEC when it reaches EOF after the record.
+ *
+ * Return: 1 once the record is complete, 0 if the exec hasn't happened yet,
+ * -1 if the pipe closed without a record (the child died first) or on failure
+ */
+int read_launch_timing(int fd, struct launch_timing *timing);
+
+/**
+ * report_launch_timing - Write the stages of a launch as a JSON line
+ * @timing: A complete record
+ * @job: Job number to report
+ * @pid: PID of the container's init process
+ * @out: Stream to write to
+ */
+void report_launch_timing(const struct launch_timing *timing, int job, int pid,
+                          FILE *out);
+
+#endif
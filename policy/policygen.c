@@ -0,0 +1,614 @@
+/**
+ * policygen.c
+ *
+ * Compiles seccomp policy files into the tables declared in policy.h.
+ *
+ * OVERVIEW:
+ * Run by make on every policy/NAME.policy file, writes a C source file to
+ * stdout that is compiled into euclid like any other. The format of a policy
+ * is described in policy.h.
+ *
+ * Nothing is resolved here. Syscall names become __NR_ constants and values
+ * and errno names are copied into the output as C expressions, each preceded
+ * by a #line directive pointing back into the policy. If a name doesn't
+ * exist, the compiler reports it at the policy line that used it.
+ *
+ * Expressions that are identical token for token become a single
+ * policy_check, so syscalls and policies that check the same thing share the
+ * same BPF block (see filter.c).
+ *
+ * USAGE:
+ *   policygen policy/default.policy [more.policy...] > policies.c
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+
+/**
+ * MAX_TOKENS - Most tokens in the body of one rule
+ */
+#define MAX_TOKENS 512
+
+/**
+ * struct cond - One comparison as written in the policy
+ * @arg: Index of the argument
+ * @op: Name of the policy_op enumerator
+ * @value: C expression of the value
+ */
+struct cond {
+  unsigned int arg;
+  const char *op;
+  char *value;
+};
+
+/**
+ * struct check - A deduplicated expression
+ * @text: The expression's tokens separated by single spaces
+ * @first_clause: Index of its first clause in clauses
+ * @num_clauses: Number of clauses
+ * @file: Policy file the expression first appeared in
+ * @line: Line it first appeared on
+ */
+struct check {
+  char *text;
+  unsigned int first_clause;
+  unsigned int num_clauses;
+  const char *file;
+  int line;
+};
+
+/**
+ * struct rule - One line of a policy
+ * @name: Syscall name
+ * @check: Index of the rule's check in checks, -1 for none
+ * @action: C expression of the seccomp return value when the check holds
+ * @fail_action: Likewise for when it doesn't
+ * @line: Line of the rule in its policy
+ */
+struct rule {
+  char *name;
+  int check;
+  char *action;
+  char *fail_action;
+  int line;
+};
+
+/**
+ * struct policy_file - A parsed policy
+ * @path: Path of the policy file
+ * @name: Name of the policy
+ * @rules: Rules in the order they were written
+ * @num_rules: Number of elements in rules
+ */
+struct policy_file {
+  const char *path;
+  char *name;
+  struct rule *rules;
+  unsigned int num_rules;
+};
+
+static struct cond *conds;
+static unsigned int num_conds;
+
+/*
+ * Clauses are stored as the index of their first cond and their length.
+ */
+static unsigned int (*clauses)[2];
+static unsigned int num_clauses;
+
+static struct check *checks;
+static unsigned int num_checks;
+
+/**
+ * grow - Make room for one more element at the end of an array
+ * @array: Array to grow, reallocated as needed
+ * @len: Number of elements in use
+ * @size: Size of one element
+ *
+ * Exits on allocation failure, which is all a build tool can do about it.
+ *
+ * Return: The grown array
+ */
+static void *grow(void *array, unsigned int len, size_t size) {
+  array = realloc(array, (len + 1) * size);
+  if (!array) {
+    fprintf(stderr, "policygen: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  return array;
+}
+
+/**
+ * copy - Duplicate a string, exiting on allocation failure
+ * @str: String to copy
+ *
+ * Return: The copy
+ */
+static char *copy(const char *str) {
+  char *dup = strdup(str);
+  if (!dup) {
+    fprintf(stderr, "policygen: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  return dup;
+}
+
+/**
+ * fail - Report an error in a policy and exit
+ * @file: Policy file
+ * @line: Line of the error
+ * @message: What's wrong
+ * @token: The offending token, or NULL
+ */
+static void fail(const char *file, int line, const char *message,
+                 const char *token) {
+  if (token) {
+    fprintf(stderr, "%s:%d: %s: %s\n", file, line, message, token);
+  } else {
+    fprintf(stderr, "%s:%d: %s\n", file, line, message);
+  }
+  exit(EXIT_FAILURE);
+}
+
+/**
+ * is_name - Check that a token is a C identifier
+ * @token: Token to check
+ *
+ * Return: 1 if it is, 0 otherwise
+ */
+static int is_name(const char *token) {
+  if (!isalpha((unsigned char)token[0]) && token[0] != '_') {
+    return 0;
+  }
+
+  for (const char *c = token; *c; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_') {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * is_value - Check that a token can be copied into a C expression
+ * @token: Token to check
+ *
+ * Anything that could end the expression or the surrounding initializer, or
+ * start a comment or string, is refused.
+ *
+ * Return: 1 if it can, 0 otherwise
+ */
+static int is_value(const char *token) {
+  if (!*token) {
+    return 0;
+  }
+
+  for (const char *c = token; *c; c++) {
+    if (!isalnum((unsigned char)*c) && !strchr("_|&^~()<>+-*", *c)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * parse_cond - Parse one comparison
+ * @tokens: The comparison's three tokens
+ * @file: Policy file, for errors
+ * @line: Line of the rule, for errors
+ */
+static void parse_cond(char **tokens, const char *file, int line) {
+  struct cond cond;
+
+  if (strncmp(tokens[0], "arg", 3) != 0 || tokens[0][3] < '0' ||
+      tokens[0][3] > '5' || tokens[0][4] != '\0') {
+    fail(file, line, "Expected arg0 to arg5", tokens[0]);
+  }
+  cond.arg = tokens[0][3] - '0';
+
+  if (strcmp(tokens[1], "==") == 0) {
+    cond.op = "POLICY_EQ";
+  } else if (strcmp(tokens[1], "!=") == 0) {
+    cond.op = "POLICY_NE";
+  } else if (strcmp(tokens[1], "&") == 0) {
+    cond.op = "POLICY_SET";
+  } else if (strcmp(tokens[1], "in") == 0) {
+    cond.op = "POLICY_IN";
+  } else {
+    fail(file, line, "Expected ==, !=, & or in", tokens[1]);
+  }
+
+  if (!is_value(tokens[2])) {
+    fail(file, line, "Invalid value", tokens[2]);
+  }
+  cond.value = copy(tokens[2]);
+
+  conds = grow(conds, num_conds, sizeof(*conds));
+  conds[num_conds++] = cond;
+}
+
+/**
+ * parse_check - Parse an expression, or find an identical one
+ * @tokens: The expression's tokens
+ * @num_tokens: Number of elements in tokens
+ * @file: Policy file, for errors
+ * @line: Line of the rule, for errors
+ *
+ * Return: Index of the expression's check
+ */
+static int parse_check(char **tokens, int num_tokens, const char *file,
+                       int line) {
+  size_t text_len = 1;
+  for (int i = 0; i < num_tokens; i++) {
+    text_len += strlen(tokens[i]) + 1;
+  }
+
+  char *text = grow(NULL, text_len - 1, 1);
+  text[0] = '\0';
+  for (int i = 0; i < num_tokens; i++) {
+    if (i > 0) {
+      strcat(text, " ");
+    }
+    strcat(text, tokens[i]);
+  }
+
+  for (unsigned int i = 0; i < num_checks; i++) {
+    if (strcmp(checks[i].text, text) == 0) {
+      free(text);
+      return i;
+    }
+  }
+
+  struct check check = {text, num_clauses, 0, file, line};
+  int pos = 0;
+
+  for (;;) {
+    unsigned int first_cond = num_conds;
+
+    for (;;) {
+      if (num_tokens - pos < 3) {
+        fail(file, line, "Incomplete comparison", NULL);
+      }
+      if (num_conds - first_cond == POLICY_CLAUSE_CONDS_MAX) {
+        fail(file, line, "Too many comparisons joined with &&", NULL);
+      }
+
+      parse_cond(&tokens[pos], file, line);
+      pos += 3;
+
+      if (pos == num_tokens || strcmp(tokens[pos], "&&") != 0) {
+        break;
+      }
+      pos++;
+    }
+
+    clauses = grow(clauses, num_clauses, sizeof(*clauses));
+    clauses[num_clauses][0] = first_cond;
+    clauses[num_clauses][1] = num_conds - first_cond;
+    num_clauses++;
+    check.num_clauses++;
+
+    if (pos == num_tokens) {
+      break;
+    }
+    if (strcmp(tokens[pos], "||") != 0) {
+      fail(file, line, "Expected && or ||", tokens[pos]);
+    }
+    pos++;
+  }
+
+  checks = grow(checks, num_checks, sizeof(*checks));
+  checks[num_checks] = check;
+
+  return num_checks++;
+}
+
+/**
+ * errno_action - Build the seccomp return value that fails with an errno
+ * @token: errno name or number
+ * @file: Policy file, for errors
+ * @line: Line of the rule, for errors
+ *
+ * Return: C expression of the return value
+ */
+static char *errno_action(const char *token, const char *file, int line) {
+  if (!is_value(token)) {
+    fail(file, line, "Invalid errno", token);
+  }
+
+  const char *prefix = "SECCOMP_RET_ERRNO | ";
+  char *action = grow(NULL, strlen(prefix) + strlen(token), 1);
+  strcpy(action, prefix);
+  strcat(action, token);
+
+  return action;
+}
+
+/**
+ * tokenize - Split text at whitespace
+ * @text: Text to split, modified in place
+ * @tokens: Output array with room for MAX_TOKENS tokens
+ * @file: Policy file, for errors
+ * @line: Line of the rule, for errors
+ *
+ * Return: Number of tokens
+ */
+static int tokenize(char *text, char **tokens, const char *file, int line) {
+  int num_tokens = 0;
+
+  for (char *token = strtok(text, " \t"); token; token = strtok(NULL, " \t")) {
+    if (num_tokens == MAX_TOKENS) {
+      fail(file, line, "Rule is too long", NULL);
+    }
+    tokens[num_tokens++] = token;
+  }
+
+  return num_tokens;
+}
+
+/**
+ * parse_rule - Parse one line of a policy
+ * @policy: Policy to add the rule to
+ * @text: The line without its comment, modified by tokenizing it
+ * @line: Line number, for errors
+ */
+static void parse_rule(struct policy_file *policy, char *text, int line) {
+  const char *file = policy->path;
+  struct rule rule = {NULL, -1, copy("SECCOMP_RET_ALLOW"),
+                      copy("SECCOMP_RET_KILL_PROCESS"), line};
+
+  char *body = strchr(text, ':');
+  if (body) {
+    *body++ = '\0';
+  }
+
+  char *name = strtok(text, " \t");
+  if (!name || strtok(NULL, " \t") || !is_name(name)) {
+    fail(file, line, "Expected a syscall name", NULL);
+  }
+  rule.name = copy(name);
+
+  for (unsigned int i = 0; i < policy->num_rules; i++) {
+    if (strcmp(policy->rules[i].name, name) == 0) {
+      fail(file, line, "Syscall listed twice", name);
+    }
+  }
+
+  /*
+   * The body is an expression, an expression and "; return ERRNO", or
+   * "return ERRNO" alone.
+   */
+  char *tokens[MAX_TOKENS];
+  char *ret[MAX_TOKENS];
+  int num_tokens = 0;
+  int num_ret = -1;
+
+  if (body) {
+    char *ret_text = strchr(body, ';');
+    if (ret_text) {
+      *ret_text++ = '\0';
+    }
+
+    num_tokens = tokenize(body, tokens, file, line);
+
+    if (ret_text) {
+      if (num_tokens == 0) {
+        fail(file, line, "Expected an expression before ;", NULL);
+      }
+      num_ret = tokenize(ret_text, ret, file, line);
+    } else if (num_tokens > 0 && strcmp(tokens[0], "return") == 0) {
+      memcpy(ret, tokens, num_tokens * sizeof(tokens[0]));
+      num_ret = num_tokens;
+      num_tokens = 0;
+    } else if (num_tokens == 0) {
+      fail(file, line, "Expected an expression or return after :", NULL);
+    }
+  }
+
+  if (num_ret != -1 && (num_ret != 2 || strcmp(ret[0], "return") != 0)) {
+    fail(file, line, "Expected return and an errno", NULL);
+  }
+
+  if (num_tokens > 0) {
+    rule.check = parse_check(tokens, num_tokens, file, line);
+    if (num_ret != -1) {
+      free(rule.fail_action);
+      rule.fail_action = errno_action(ret[1], file, line);
+    }
+  } else if (num_ret != -1) {
+    free(rule.action);
+    rule.action = errno_action(ret[1], file, line);
+  }
+
+  policy->rules = grow(policy->rules, policy->num_rules, sizeof(rule));
+  policy->rules[policy->num_rules++] = rule;
+}
+
+/**
+ * parse_policy - Read a policy file
+ * @policy: Filled in with the policy
+ * @path: Path of the file, which must end in .policy
+ */
+static void parse_policy(struct policy_file *policy, const char *path) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+
+  size_t base_len = strlen(base);
+  if (base_len <= strlen(".policy") ||
+      strcmp(base + base_len - strlen(".policy"), ".policy") != 0) {
+    fprintf(stderr, "%s: Policy files must end in .policy\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  policy->path = path;
+  policy->name = copy(base);
+  policy->name[base_len - strlen(".policy")] = '\0';
+  policy->rules = NULL;
+  policy->num_rules = 0;
+
+  for (const char *c = policy->name; *c; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-') {
+      fprintf(stderr, "%s: Invalid policy name\n", path);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  char text[4096];
+  int line = 0;
+
+  while (fgets(text, sizeof(text), file)) {
+    line++;
+
+    if (!strchr(text, '\n') && !feof(file)) {
+      fail(path, line, "Line is too long", NULL);
+    }
+
+    text[strcspn(text, "#\n")] = '\0';
+    if (text[strspn(text, " \t")] == '\0') {
+      continue;
+    }
+
+    parse_rule(policy, text, line);
+  }
+
+  if (ferror(file)) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  fclose(file);
+
+  if (policy->num_rules == 0) {
+    fprintf(stderr, "%s: Policy has no rules\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * write_tables - Write the generated C source
+ * @files: Parsed policies
+ * @num_files: Number of elements in files
+ *
+ * C has no empty arrays, so shared tables without entries get a single
+ * unused one.
+ */
+static void write_tables(const struct policy_file *files, int num_files) {
+  printf("/*\n"
+         " * Generated by policygen, edit the policies instead:\n");
+  for (int i = 0; i < num_files; i++) {
+    printf(" * - %s\n", files[i].path);
+  }
+  printf(" */\n\n"
+         "#define _GNU_SOURCE\n"
+         "#include <errno.h>\n"
+         "#include <linux/seccomp.h>\n"
+         "#include <sched.h>\n"
+         "#include <sys/ioctl.h>\n"
+         "#include <sys/prctl.h>\n"
+         "#include <sys/syscall.h>\n\n"
+         "#include \"policy.h\"\n\n");
+
+  printf("const struct policy_cond policy_conds[] = {\n");
+  for (unsigned int i = 0; i < num_checks; i++) {
+    const struct check *check = &checks[i];
+    unsigned int last_clause = check->first_clause + check->num_clauses - 1;
+    unsigned int first = clauses[check->first_clause][0];
+    unsigned int last = clauses[last_clause][0] + clauses[last_clause][1];
+
+    printf("#line %d \"%s\"\n", check->line, check->file);
+    for (unsigned int j = first; j < last; j++) {
+      printf("    {%u, %s, (uint64_t)(%s)},\n", conds[j].arg, conds[j].op,
+             conds[j].value);
+    }
+  }
+  if (num_conds == 0) {
+    printf("    {0, POLICY_EQ, 0},\n");
+  }
+  printf("};\n\n");
+
+  printf("const struct policy_clause policy_clauses[] = {\n");
+  for (unsigned int i = 0; i < num_clauses; i++) {
+    printf("    {%u, %u},\n", clauses[i][0], clauses[i][1]);
+  }
+  if (num_clauses == 0) {
+    printf("    {0, 0},\n");
+  }
+  printf("};\n\n");
+
+  printf("const struct policy_check policy_checks[] = {\n");
+  for (unsigned int i = 0; i < num_checks; i++) {
+    printf("    {%u, %u}, /* %s */\n", checks[i].first_clause,
+           checks[i].num_clauses, checks[i].text);
+  }
+  if (num_checks == 0) {
+    printf("    {0, 0},\n");
+  }
+  printf("};\n\n");
+
+  for (int i = 0; i < num_files; i++) {
+    printf("static const struct policy_rule policy_%d_rules[] = {\n", i);
+    for (unsigned int j = 0; j < files[i].num_rules; j++) {
+      const struct rule *rule = &files[i].rules[j];
+      printf("#line %d \"%s\"\n", rule->line, files[i].path);
+      printf("    {__NR_%s, %d, %s, %s},\n", rule->name, rule->check,
+             rule->action, rule->fail_action);
+    }
+    printf("};\n\n");
+  }
+
+  printf("const struct policy policies[] = {\n");
+  for (int i = 0; i < num_files; i++) {
+    printf("    {\"%s\", policy_%d_rules,\n"
+           "     sizeof(policy_%d_rules) / sizeof(policy_%d_rules[0])},\n",
+           files[i].name, i, i, i);
+  }
+  printf("};\n\n"
+         "const unsigned int num_policies = %d;\n",
+         num_files);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s file.policy...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int num_files = argc - 1;
+  struct policy_file *files = grow(NULL, num_files - 1, sizeof(*files));
+
+  for (int i = 0; i < num_files; i++) {
+    parse_policy(&files[i], argv[i + 1]);
+
+    for (int j = 0; j < i; j++) {
+      if (strcmp(files[j].name, files[i].name) == 0) {
+        fprintf(stderr, "%s: Policy %s is also defined by %s\n",
+                files[i].path, files[i].name, files[j].path);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  write_tables(files, num_files);
+
+  if (fflush(stdout) == EOF || ferror(stdout)) {
+    fprintf(stderr, "policygen: Failed to write output: %s\n",
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,717 @@
+/**
+ * batch.c
+ *
+ * Running many containers concurrently from one euclid process.
+ *
+ * OVERVIEW:
+ * Keeps up to a fixed number of containers running, starting a new one for
+ * the next command whenever one exits. All waiting happens in a single
+ * epoll_wait() over the pidfds of the running containers.
+ *
+ * JOB SLOTS:
+ * There is one slot per allowed concurrent container. A slot holds everything
+ * we need to know about the job running in it, including its command, since
+ * the child's argv points into the slot's copy (clone() gives the child its
+ * own copy of our memory, so the slot can be reused once the child has been
+ * spawned).
+ *
+ * PIDFDS:
+ * A pidfd (Linux 5.3) is a file descriptor that refers to a process
+ * and becomes readable once that process exits. Unlike SIGCHLD, it can't be
+ * lost or coalesced, and it carries the identity of the process with it, so
+ * the epoll event tells us exactly which slot finished.
+ *
+ * TELEMETRY:
+ * With telemetry enabled, a timerfd joins the pidfds in the epoll set, and
+ * every running job is sampled each time it fires. See telemetry.h.
+ *
+ * EXIT RECORDS:
+ * Jobs are reaped with wait4() for their rusage either way. With exit
+ * records enabled, each job's throttling and memory events are counted from
+ * the moment it's started, so a reused leaf or a warm container's wait in the
+ * pool doesn't show up in them.
+ *
+ * MEMORY GOVERNOR:
+ * With ctx->adapt_mem_high, every job's PSI trigger and relax timer join the
+ * epoll set too. See governor.h.
+ *
+ * OUTPUT:
+ * With a log directory, the read ends of every job's stdout and stderr pipes
+ * join the epoll set as well, and are relayed to the job's log files as
+ * output arrives. See relay.h.
+ *
+ * IDLE FREEZING:
+ * With a pool that freezes idle warm containers, its timer joins the epoll
+ * set. The pool is most idle while we wait for the next command, so that
+ * wait polls the input together with the timer, which needs the input stream
+ * unbuffered: stdio reading ahead would leave commands in its buffer while
+ * poll() sees nothing left to read. See freezer.h.
+ *
+ * EVENTS:
+ * The epoll user data of every file descriptor holds what kind of event it
+ * is in the upper 32 bits and the index of its job's slot in the lower 32.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "command.h"
+#include "context.h"
+#include "governor.h"
+#include "launch.h"
+#include "pool.h"
+#include "relay.h"
+#include "telemetry.h"
+
+/**
+ * enum batch_event - Kinds of file descriptors in the epoll set
+ * @EVENT_EXIT: A job's pidfd, the job has exited
+ * @EVENT_SAMPLE: The telemetry timer, not tied to a job
+ * @EVENT_PRESSURE: A job's PSI trigger fired
+ * @EVENT_RELAX: A job's governor relax timer fired
+ * @EVENT_LAUNCH: A job's launch timing pipe became readable
+ * @EVENT_STDOUT: A job's stdout pipe became readable
+ * @EVENT_STDERR: A job's stderr pipe became readable
+ * @EVENT_POOL: The pool's freeze timer fired, not tied to a job
+ */
+enum batch_event {
+  EVENT_EXIT,
+  EVENT_SAMPLE,
+  EVENT_PRESSURE,
+  EVENT_RELAX,
+  EVENT_LAUNCH,
+  EVENT_STDOUT,
+  EVENT_STDERR,
+  EVENT_POOL,
+};
+
+/**
+ * OUTPUT_STREAMS - Output streams relayed per job, indexed like the events
+ * from EVENT_STDOUT on, and the suffix of each one's log file
+ */
+static const char *OUTPUT_STREAMS[] = {"out", "err"};
+
+#define NUM_OUTPUT_STREAMS (sizeof(OUTPUT_STREAMS) / sizeof(OUTPUT_STREAMS[0]))
+
+/**
+ * event_data - Build the epoll user data of a file descriptor
+ * @kind: Kind of event
+ * @slot: Index of the job's slot, 0 if not tied to a job
+ *
+ * Return: epoll user data
+ */
+static uint64_t event_data(enum batch_event kind, int slot) {
+  return ((uint64_t)kind << 32) | (uint32_t)slot;
+}
+
+/**
+ * struct batch_job - A job slot
+ * @number: Line number of the job's command in the input
+ * @pidfd: pidfd of the running container (owned by container), -1 if the slot
+ *         is free
+ * @container: The container running the job
+ * @cmd: The job's command
+ * @start: When the job was started (CLOCK_MONOTONIC)
+ * @monitored: Whether telemetry is being collected for the job
+ * @telemetry: Telemetry state of the job
+ * @governed: Whether the job's memory.high is being adapted
+ * @governor: memory.high governor of the job
+ * @accounted: Whether an exit record is written for the job
+ * @accounting: Exit accounting state of the job
+ * @output: Relays of the job's stdout and stderr, closed unless output is
+ *          being logged
+ */
+struct batch_job {
+  int number;
+  int pidfd;
+  struct container container;
+  struct command cmd;
+  struct timespec start;
+  int monitored;
+  struct telemetry telemetry;
+  int governed;
+  struct governor governor;
+  int accounted;
+  struct exit_accounting accounting;
+  struct relay output[NUM_OUTPUT_STREAMS];
+};
+
+/**
+ * elapsed_seconds - Seconds between two CLOCK_MONOTONIC timestamps
+ * @start: Earlier timestamp
+ * @end: Later timestamp
+ *
+ * Return: end - start in seconds
+ */
+static double elapsed_seconds(const struct timespec *start,
+                              const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) +
+         (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * start_output - Relay a job's stdout and stderr to its log files
+ * @job: Slot of a job whose container was just started
+ * @epoll_fd: epoll instance to register the output pipes with
+ * @slot: Index of the job's slot
+ * @log_dir: Directory holding the log files
+ * @ctx: Container configuration, output_buffer sets the relay's chunk
+ *
+ * The pipes' read ends move from the container to the relays, so they are
+ * closed with the relays rather than by release_container().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int start_output(struct batch_job *job, int epoll_fd, int slot,
+                        const char *log_dir,
+                        const struct container_ctx *ctx) {
+  int pipe_fds[NUM_OUTPUT_STREAMS] = {job->container.stdout_fd,
+                                      job->container.stderr_fd};
+  job->container.stdout_fd = -1;
+  job->container.stderr_fd = -1;
+
+  int chunk = ctx->output_buffer > INT_MAX ? INT_MAX : ctx->output_buffer;
+  int ret = 0;
+
+  for (size_t i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    job->output[i].pipe_fd = -1;
+    job->output[i].out_fd = -1;
+
+    if (ret == -1) {
+      close(pipe_fds[i]);
+      continue;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%d.%s", log_dir, job->number,
+             OUTPUT_STREAMS[i]);
+    if (relay_open(&job->output[i], pipe_fds[i], path, chunk) == -1) {
+      ret = -1;
+      continue;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN, .data.u64 = event_data(EVENT_STDOUT + i, slot)};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipe_fds[i], &event) == -1) {
+      fprintf(stderr, "Failed to watch output of job %d: %s\n", job->number,
+              strerror(errno));
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * start_job - Start a job's container and register it with epoll
+ * @ctx: Container configuration
+ * @pool: Warm container pool, or NULL
+ * @job: Slot whose number and cmd are filled in
+ * @epoll_fd: epoll instance to register the job's pidfd with
+ * @slot: Index of the job's slot, stored as epoll user data
+ * @telemetry: Telemetry configuration, NULL if telemetry is disabled
+ * @exit_out: Stream exit records go to, NULL if there are none
+ * @log_dir: Directory to relay the job's output to, NULL if not logged
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int start_job(struct container_ctx *ctx, struct pool *pool,
+                     struct batch_job *job, int epoll_fd, int slot,
+                     const struct telemetry_config *telemetry,
+                     FILE *exit_out, const char *log_dir) {
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  job->monitored = 0;
+  job->governed = 0;
+  job->accounted = 0;
+
+  if (pool) {
+    if (pool_dispatch(pool, &job->cmd, &job->container) == -1) {
+      return -1;
+    }
+  } else {
+    /*
+     * The child gets its own copy of ctx at clone() time, so the job's argv
+     * only needs to be in place while the container is spawned. ctx->cmd
+     * still owns the default command, which cleanup_ctx() frees.
+     */
+    char **default_cmd = ctx->cmd;
+    ctx->cmd = job->cmd.argv;
+    int ret = start_container(ctx, &job->container);
+    ctx->cmd = default_cmd;
+    if (ret == -1) {
+      return -1;
+    }
+
+    /*
+     * The child doesn't read anything past the "cgroups ready" byte, which
+     * is already queued, so we don't need our end of the pipe anymore.
+     */
+    if (close(job->container.sync_fd) == -1) {
+      fprintf(stderr, "Failed to close pipe: %s\n", strerror(errno));
+    }
+    job->container.sync_fd = -1;
+  }
+
+  /*
+   * start_container() gets the pidfd from clone3() or pidfd_open(), either of
+   * which may be missing on old kernels.
+   */
+  job->pidfd = job->container.pidfd;
+  if (job->pidfd == -1) {
+    fprintf(stderr, "Failed to get pidfd for job %d\n", job->number);
+    goto kill_job;
+  }
+
+  struct epoll_event event = {.events = EPOLLIN,
+                              .data.u64 = event_data(EVENT_EXIT, slot)};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->pidfd, &event) == -1) {
+    fprintf(stderr, "Failed to watch job %d: %s\n", job->number,
+            strerror(errno));
+    job->pidfd = -1;
+    goto kill_job;
+  }
+
+  /*
+   * Unlike telemetry, output can't be dropped: a job whose pipes nobody
+   * reads blocks as soon as they are full.
+   */
+  if (log_dir && start_output(job, epoll_fd, slot, log_dir, ctx) == -1) {
+    goto kill_job;
+  }
+
+  /* A job we can't monitor or account for still runs, just unreported */
+  job->accounted =
+      exit_out && exit_accounting_start(&job->accounting,
+                                        job->container.cgroup_path) == 0;
+
+  if (telemetry) {
+    job->monitored =
+        telemetry_start(&job->telemetry, job->number, job->container.pid,
+                        job->container.cgroup_path) == 0;
+  }
+
+  /* The report is optional, so a pipe we can't watch is simply dropped */
+  if (job->container.timing_fd != -1) {
+    struct epoll_event launch = {.events = EPOLLIN,
+                                 .data.u64 = event_data(EVENT_LAUNCH, slot)};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->container.timing_fd,
+                  &launch) == -1) {
+      fprintf(stderr, "Failed to watch launch of job %d: %s\n", job->number,
+              strerror(errno));
+      close(job->container.timing_fd);
+      job->container.timing_fd = -1;
+    }
+  }
+
+  /* Likewise, a job we can't govern keeps its fixed memory.high */
+  if (ctx->adapt_mem_high &&
+      governor_start(&job->governor, ctx, job->container.cgroup_path) == 0) {
+    struct epoll_event pressure = {
+        .events = EPOLLPRI, .data.u64 = event_data(EVENT_PRESSURE, slot)};
+    struct epoll_event relax = {.events = EPOLLIN,
+                                .data.u64 = event_data(EVENT_RELAX, slot)};
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->governor.trigger_fd,
+                  &pressure) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->governor.timer_fd, &relax) ==
+            -1) {
+      fprintf(stderr, "Failed to watch memory pressure of job %d: %s\n",
+              job->number, strerror(errno));
+      governor_stop(&job->governor);
+    } else {
+      job->governed = 1;
+    }
+  }
+
+  return 0;
+
+kill_job:
+  /* We couldn't watch the container, so we can't let it run either */
+  kill(job->container.pid, SIGKILL);
+  waitpid(job->container.pid, NULL, 0);
+  for (size_t i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    relay_close(&job->output[i]);
+  }
+  release_container(&job->container);
+
+  /* free_slot() goes by the pidfd, and the final kill loop too */
+  job->pidfd = -1;
+  job->container.pidfd = -1;
+  return -1;
+}
+
+/**
+ * finish_job - Reap a job's container and report how it went
+ * @job: Slot of a job whose pidfd became readable
+ * @telemetry: Telemetry configuration, NULL if telemetry is disabled
+ * @launch_out: Stream to write launch timing to, NULL if not timed
+ * @exit_out: Stream to write the exit record to, NULL if there is none
+ *
+ * A job that couldn't be reaped is reported with exit=unknown and counted as
+ * failed, since there's no status to go by.
+ *
+ * Return: 0 if the job exited with status 0, 1 otherwise
+ */
+static int finish_job(struct batch_job *job,
+                      const struct telemetry_config *telemetry,
+                      FILE *launch_out, FILE *exit_out) {
+  int status = 0;
+  struct rusage usage;
+  struct timespec end;
+
+  int reaped = wait4(job->container.pid, &status, 0, &usage) != -1;
+  if (!reaped) {
+    fprintf(stderr, "Failed to reap job %d: %s\n", job->number,
+            strerror(errno));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("job=%d pid=%d ", job->number, job->container.pid);
+  if (!reaped) {
+    printf("exit=unknown");
+  } else if (WIFSIGNALED(status)) {
+    printf("signal=%d", WTERMSIG(status));
+  } else {
+    printf("exit=%d", WEXITSTATUS(status));
+  }
+  printf(" elapsed=%.6f cmd=%s\n", elapsed_seconds(&job->start, &end),
+         job->cmd.argv[0]);
+  fflush(stdout);
+
+  /* A job that exited right after its exec left the EOF unread */
+  if (job->container.timing_fd != -1) {
+    collect_launch_timing(&job->container, job->number, launch_out);
+  }
+
+  /* The summary is read from the cgroup, so this has to come first */
+  if (job->monitored) {
+    telemetry_finish(&job->telemetry, telemetry->out);
+  }
+
+  /* Likewise for the exit record's counters */
+  if (job->accounted && reaped) {
+    exit_accounting_finish(&job->accounting, job->number, job->container.pid,
+                           status, &usage, exit_out);
+  } else if (job->accounted) {
+    exit_accounting_abort(&job->accounting);
+  }
+
+  /* Output still buffered in the pipes is all the job wrote after us */
+  for (size_t i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    relay_close(&job->output[i]);
+  }
+
+  /* Closing the governor's descriptors removes them from the epoll set */
+  if (job->governed) {
+    governor_stop(&job->governor);
+    job->governed = 0;
+  }
+
+  /* Closing the pidfd also removes it from the epoll set */
+  release_container(&job->container);
+  job->pidfd = -1;
+
+  return !reaped || !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/**
+ * free_slot - Find a slot without a running job
+ * @jobs: Array of job slots
+ * @concurrency: Number of slots
+ *
+ * Return: Index of a free slot, -1 if all slots are busy
+ */
+static int free_slot(struct batch_job *jobs, int concurrency) {
+  for (int i = 0; i < concurrency; i++) {
+    if (jobs[i].pidfd == -1) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * wait_for_input - Freeze idle warm containers until there is input
+ * @stream: Unbuffered stream the next command is read from
+ * @pool: Pool whose timer_fd is set
+ *
+ * Returns once reading from the stream won't block, at EOF too, or once the
+ * pool stopped freezing containers.
+ */
+static void wait_for_input(FILE *stream, struct pool *pool) {
+  while (pool->timer_fd != -1) {
+    struct pollfd fds[2] = {{.fd = fileno(stream), .events = POLLIN},
+                            {.fd = pool->timer_fd, .events = POLLIN}};
+
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to wait for input: %s\n", strerror(errno));
+      return;
+    }
+
+    if (fds[0].revents) {
+      return;
+    }
+
+    if (fds[1].revents) {
+      pool_idle(pool);
+    }
+  }
+}
+
+/**
+ * run_batch - Run every command in a stream in its own container
+ * @ctx: Container configuration, its cmd is replaced for every job
+ * @stream: Stream to read commands from, one per line
+ * @concurrency: Maximum number of containers running at the same time
+ * @pool: Warm container pool to take containers from, or NULL
+ * @telemetry: Telemetry configuration, NULL to disable telemetry
+ * @launch_out: Stream to write launch timing to, NULL if not timed
+ * @exit_out: Stream to write exit records to, NULL for none
+ * @log_dir: Directory to relay every job's output to, NULL to let jobs
+ *           write to our stdout and stderr
+ *
+ * Input is read lazily, only when a slot is free, so the stream can be an
+ * endless pipe or FIFO that other programs feed commands into.
+ *
+ * Return: Number of jobs that didn't exit with status 0, -1 on failure
+ */
+int run_batch(struct container_ctx *ctx, FILE *stream, int concurrency,
+              struct pool *pool, const struct telemetry_config *telemetry,
+              FILE *launch_out, FILE *exit_out, const char *log_dir) {
+  struct batch_job *jobs = calloc(concurrency, sizeof(struct batch_job));
+  struct epoll_event *events =
+      calloc(concurrency + 1, sizeof(struct epoll_event));
+  if (!jobs || !events) {
+    fprintf(stderr, "Memory allocation failed for batch jobs: %s\n",
+            strerror(errno));
+    free(jobs);
+    free(events);
+    return -1;
+  }
+
+  for (int i = 0; i < concurrency; i++) {
+    jobs[i].pidfd = -1;
+    for (size_t j = 0; j < NUM_OUTPUT_STREAMS; j++) {
+      jobs[i].output[j].pipe_fd = -1;
+      jobs[i].output[j].out_fd = -1;
+    }
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+    free(jobs);
+    free(events);
+    return -1;
+  }
+
+  int timer_fd = -1;
+  if (telemetry && telemetry->interval_ms > 0) {
+    timer_fd = telemetry_timer(telemetry->interval_ms);
+
+    struct epoll_event event = {.events = EPOLLIN,
+                                .data.u64 = event_data(EVENT_SAMPLE, 0)};
+    if (timer_fd == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1) {
+      fprintf(stderr, "Failed to set up telemetry sampling\n");
+      if (timer_fd != -1) {
+        close(timer_fd);
+      }
+      close(epoll_fd);
+      free(jobs);
+      free(events);
+      return -1;
+    }
+  }
+
+  int freezing = pool && pool->timer_fd != -1;
+  if (freezing) {
+    struct epoll_event event = {.events = EPOLLIN,
+                                .data.u64 = event_data(EVENT_POOL, 0)};
+    if (setvbuf(stream, NULL, _IONBF, 0) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pool->timer_fd, &event) == -1) {
+      fprintf(stderr, "Failed to set up idle freezing\n");
+      if (timer_fd != -1) {
+        close(timer_fd);
+      }
+      close(epoll_fd);
+      free(jobs);
+      free(events);
+      return -1;
+    }
+  }
+
+  struct timespec batch_start, batch_end;
+  clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+  char *line = NULL;
+  size_t line_size = 0;
+  int line_num = 0;
+  int running = 0;
+  int total = 0;
+  int failed = 0;
+  int eof = 0;
+
+  while (!eof || running > 0) {
+    /*
+     * Start jobs until every slot is busy or we run out of input.
+     */
+    while (!eof && running < concurrency) {
+      if (freezing) {
+        wait_for_input(stream, pool);
+      }
+
+      if (getline(&line, &line_size, stream) == -1) {
+        eof = 1;
+        break;
+      }
+      line_num++;
+
+      /*
+       * running < concurrency guarantees a free slot, so not finding one
+       * means our bookkeeping is off. Stop taking jobs rather than trusting
+       * it any further.
+       */
+      int slot = free_slot(jobs, concurrency);
+      if (slot == -1) {
+        fprintf(stderr, "No free slot for job %d with %d of %d running\n",
+                line_num, running, concurrency);
+        failed++;
+        eof = 1;
+        break;
+      }
+      struct batch_job *job = &jobs[slot];
+      job->number = line_num;
+
+      /* Skip blank lines, malformed ones were already reported */
+      if (command_from_line(&job->cmd, line) <= 0) {
+        continue;
+      }
+
+      total++;
+      if (start_job(ctx, pool, job, epoll_fd, slot, telemetry, exit_out,
+                    log_dir) == -1) {
+        printf("job=%d failed to start cmd=%s\n", job->number,
+               job->cmd.argv[0]);
+        fflush(stdout);
+        failed++;
+        continue;
+      }
+      running++;
+    }
+
+    if (running == 0) {
+      continue;
+    }
+
+    int ready = epoll_wait(epoll_fd, events, concurrency + 1, -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to wait for jobs: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      enum batch_event kind = events[i].data.u64 >> 32;
+      struct batch_job *job = &jobs[(uint32_t)events[i].data.u64];
+      uint64_t expirations;
+
+      /*
+       * A job that exited earlier in this batch of events has already closed
+       * its governor's and timing descriptors, but their events were already
+       * queued.
+       */
+      if ((kind == EVENT_PRESSURE || kind == EVENT_RELAX) && !job->governed) {
+        continue;
+      }
+      if (kind == EVENT_LAUNCH && job->container.timing_fd == -1) {
+        continue;
+      }
+      if ((kind == EVENT_STDOUT || kind == EVENT_STDERR) &&
+          job->output[kind - EVENT_STDOUT].pipe_fd == -1) {
+        continue;
+      }
+      if (kind == EVENT_POOL && pool->timer_fd == -1) {
+        continue;
+      }
+
+      switch (kind) {
+      case EVENT_EXIT:
+        failed += finish_job(job, telemetry, launch_out, exit_out);
+        running--;
+        break;
+      case EVENT_SAMPLE:
+        if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+          for (int j = 0; j < concurrency; j++) {
+            if (jobs[j].pidfd != -1 && jobs[j].monitored) {
+              telemetry_sample(&jobs[j].telemetry, telemetry->out);
+            }
+          }
+        }
+        break;
+      case EVENT_PRESSURE:
+        governor_pressure(&job->governor);
+        break;
+      case EVENT_RELAX:
+        governor_relax(&job->governor);
+        break;
+      case EVENT_LAUNCH:
+        collect_launch_timing(&job->container, job->number, launch_out);
+        break;
+      case EVENT_STDOUT:
+      case EVENT_STDERR:
+        relay_pump(&job->output[kind - EVENT_STDOUT]);
+        break;
+      case EVENT_POOL:
+        pool_idle(pool);
+        break;
+      }
+    }
+  }
+
+  /*
+   * We only get here with jobs still running if epoll_wait() failed. Kill
+   * them rather than leaving them unsupervised.
+   */
+  for (int i = 0; i < concurrency; i++) {
+    if (jobs[i].pidfd != -1) {
+      kill(jobs[i].container.pid, SIGKILL);
+      failed += finish_job(&jobs[i], telemetry, launch_out, exit_out);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &batch_end);
+  printf("jobs=%d failed=%d elapsed=%.6f\n", total, failed,
+         elapsed_seconds(&batch_start, &batch_end));
+  fflush(stdout);
+
+  free(line);
+  free(jobs);
+  free(events);
+  if (timer_fd != -1) {
+    close(timer_fd);
+  }
+  close(epoll_fd);
+
+  return failed;
+}
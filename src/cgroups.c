@@ -8,6 +8,42 @@
  * Creates a dedicated cgroup directory and configures CPU, memory, and process
  * limits by writing to special kernel files.
  *
+ * HIERARCHY:
+ * Every container gets its own leaf cgroup below ctx->cgroup_parent
+ * (/sys/fs/cgroup/euclid by default), so containers running at the same time
+ * don't share limits or accounting:
+ *
+ *   /sys/fs/cgroup
+ *   +-- euclid           controllers enabled, never holds processes itself
+ *       +-- <leaf>       one container, limits configured here
+ *       +-- <leaf>
+ *
+ * Cgroups v2 only lets a cgroup hand controllers down to its children while
+ * it has no processes of its own ("no internal processes" rule), which is why
+ * containers never join the euclid cgroup directly.
+ *
+ * LEAF POOL:
+ * Creating a leaf and writing its five limits costs a mkdir() and a handful of
+ * open()/write()/close() round trips into the kernel on every launch. When
+ * many containers are launched, cgroup_pool_init() creates and configures a
+ * set of leaves up front instead. A leaf goes back to the pool when its
+ * container is released, and is handed out again once the kernel reports it
+ * empty ("populated 0" in cgroup.events). When no pooled leaf is ready, a
+ * fresh one is created as before and removed after use.
+ *
+ * Counters such as cpu.stat and memory.events keep counting across the
+ * containers that reuse a leaf, so per-job numbers from a pooled leaf are
+ * differences between readings before and after the job.
+ *
+ * HANDLES:
+ * A struct cgroup keeps an O_PATH descriptor of the cgroup directory, so
+ * control files are opened relative to it with openat() instead of walking
+ * the full path through cgroupfs every time. Limit files stay open once they
+ * have been written, and the handle remembers the last value written to each
+ * of them, so reapplying an unchanged configuration costs no syscalls at all.
+ * A freshly created cgroup starts out with the kernel's defaults recorded, so
+ * writing "max" to it is skipped too.
+ *
  * CGROUPS V2:
  * Cgroups v2 uses a unified hierarchy:
  * - Single mount point: /sys/fs/cgroup
@@ -16,57 +52,172 @@
  * - Processes added by writing PIDs to cgroup.procs
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cgroups.h"
 #include "context.h"
+#include "numa.h"
+
+/**
+ * REMOVE_RETRIES - How many times to retry removing a busy cgroup
+ *
+ * After the container's init process has been reaped, the kernel may take a
+ * moment to notice that the cgroup is empty. rmdir() fails with EBUSY until
+ * then, so we retry a few times, one millisecond apart.
+ */
+static const int REMOVE_RETRIES = 100;
 
 /**
- * VALUE_MAX - Maximum length for values written to cgroup files
+ * CONTROLLERS - Controllers the leaves need, in cgroup.subtree_control syntax
  *
- * Limits are written as strings, so we need a buffer large enough for the
- * largest possible value while leaving room for newline and null terminator.
+ * cpuset comes last, and is only enabled when CPU or NUMA placement is
+ * configured. Enabling it makes the kernel check every later change to the
+ * CPUs of the hierarchy against it, which other runs shouldn't pay for.
+ */
+static const char *CONTROLLERS[] = {"cpu", "memory", "pids", "cpuset"};
+
+#define NUM_CONTROLLERS (sizeof(CONTROLLERS) / sizeof(CONTROLLERS[0]))
+
+/**
+ * struct limit_file - A limit control file
+ * @name: Name of the file inside the cgroup directory
+ * @initial: Value the kernel gives the file in a new cgroup, as it would be
+ *           written by set_limit_int() or set_limit_str()
  */
-static const int VALUE_MAX = 128;
+struct limit_file {
+  const char *name;
+  const char *initial;
+};
+
+/**
+ * limit_files - Control file of every enum cgroup_limit
+ */
+static const struct limit_file limit_files[CGROUP_LIMIT_COUNT] = {
+    [CGROUP_CPU_MAX] = {"cpu.max", "max 100000\n"},
+    [CGROUP_MEMORY_MAX] = {"memory.max", "max\n"},
+    [CGROUP_MEMORY_HIGH] = {"memory.high", "max\n"},
+    [CGROUP_MEMORY_SWAP_MAX] = {"memory.swap.max", "max\n"},
+    [CGROUP_PIDS_MAX] = {"pids.max", "max\n"},
+    [CGROUP_CPUSET_CPUS] = {"cpuset.cpus", "\n"},
+    [CGROUP_CPUSET_MEMS] = {"cpuset.mems", "\n"},
+    [CGROUP_CPUSET_PARTITION] = {"cpuset.cpus.partition", "member\n"},
+    [CGROUP_FREEZE] = {"cgroup.freeze", "0\n"},
+};
+
+/**
+ * struct cgroup_leaf - A pre-created leaf cgroup
+ * @cgroup: Handle of the leaf, kept open for as long as the pool exists
+ * @in_use: Whether the leaf is currently handed out to a container
+ */
+struct cgroup_leaf {
+  struct cgroup cgroup;
+  int in_use;
+};
+
+/**
+ * leaf_pool - Pre-created leaves, NULL if there is no pool
+ */
+static struct cgroup_leaf *leaf_pool = NULL;
+
+/**
+ * leaf_pool_size - Number of leaves in leaf_pool
+ */
+static int leaf_pool_size = 0;
+
+/**
+ * controller_listed - Check whether a controller is in a controller list
+ * @list: Space-separated controller names, as read from cgroup.subtree_control
+ * @name: Controller to look for
+ *
+ * Return: 1 if name is in list, 0 otherwise
+ */
+static int controller_listed(const char *list, const char *name) {
+  size_t name_len = strlen(name);
+
+  while (*list) {
+    list += strspn(list, " \n");
+
+    size_t word_len = strcspn(list, " \n");
+    if (word_len == name_len && strncmp(list, name, name_len) == 0) {
+      return 1;
+    }
+
+    list += word_len;
+  }
+
+  return 0;
+}
 
 /**
  * enable_controllers - Enable required cgroup controllers
+ * @group_dir: Cgroup whose children should get the controllers
+ * @cpuset: Non-zero to enable the cpuset controller as well
  *
- * Writes "+cpu +memory +pids" to /sys/fs/cgroup/cgroup.subtree_control to
- * enable these controllers for child cgroups. This has to be done before
- * creating the euclid cgroup.
+ * Writes "+cpu +memory +pids" to {group_dir}/cgroup.subtree_control to enable
+ * these controllers for child cgroups, followed by "+cpuset" if asked to.
+ * This has to be done before creating the child cgroups.
  *
  * CONTROLLER PURPOSES:
  * - cpu: Limits CPU time available to the cgroup
  * - memory: Limits RAM and swap usage
  * - pids: Limits number of processes/threads (prevents fork bombs)
+ * - cpuset: Pins the cgroup to CPUs and NUMA nodes
  *
  * The '+' prefix enables the controller, '-' would disable it.
  *
+ * The controllers stay enabled after euclid exits, so every run but the first
+ * finds them already listed and skips the write.
+ *
  * Return: 0 on success, -1 on failure
  */
-static int enable_controllers(void) {
-  const char *subtree_path = "/sys/fs/cgroup/cgroup.subtree_control";
+static int enable_controllers(const char *group_dir, int cpuset) {
+  char subtree_path[PATH_MAX];
+  snprintf(subtree_path, PATH_MAX, "%s/cgroup.subtree_control", group_dir);
 
   /*
-   * O_WRONLY: Open for writing only
+   * O_RDWR: We check which controllers are enabled before writing
    * O_CLOEXEC: Close file descriptor on exec() (prevents leaking to child)
    */
-  int subtree_control_fd = open(subtree_path, O_WRONLY | O_CLOEXEC);
+  int subtree_control_fd = open(subtree_path, O_RDWR | O_CLOEXEC);
   if (subtree_control_fd == -1) {
     fprintf(stderr, "Failed to open %s: %s\n", subtree_path, strerror(errno));
     return -1;
   }
 
+  char enabled[CGROUP_VALUE_MAX * 2];
+  ssize_t enabled_len = read(subtree_control_fd, enabled, sizeof(enabled) - 1);
+  if (enabled_len == -1) {
+    fprintf(stderr, "Failed to read %s: %s\n", subtree_path, strerror(errno));
+    close(subtree_control_fd);
+    return -1;
+  }
+  enabled[enabled_len] = '\0';
+
+  size_t count = cpuset ? NUM_CONTROLLERS : NUM_CONTROLLERS - 1;
+  char request[CGROUP_VALUE_MAX];
+  size_t request_len = 0;
+  int missing = 0;
+  for (size_t i = 0; i < count; i++) {
+    missing |= !controller_listed(enabled, CONTROLLERS[i]);
+    request_len += snprintf(request + request_len,
+                            sizeof(request) - request_len, "%s+%s",
+                            i == 0 ? "" : " ", CONTROLLERS[i]);
+  }
+  request[request_len++] = '\n';
+
   /*
    * Write the controller list to enable them.
    */
-  if (write(subtree_control_fd, "+cpu +memory +pids\n", 20) == -1) {
+  if (missing && pwrite(subtree_control_fd, request, request_len, 0) == -1) {
     fprintf(stderr, "Failed to write to %s: %s\n", subtree_path,
             strerror(errno));
     /*
@@ -89,20 +240,20 @@ static int enable_controllers(void) {
 }
 
 /**
- * make_cgroup_dir - Create the euclid cgroup directory
+ * make_cgroup_dir - Create a cgroup directory
+ * @group_dir: Path of the cgroup to create
  *
- * Creates /sys/fs/cgroup/euclid with permissions 0755. The kernel creates the
- * necessary control files inside this directory once it is created.
+ * Creates group_dir with permissions 0755. The kernel creates the necessary
+ * control files inside this directory once it is created.
  *
  * EEXIST:
  * If the directory already exists, we treat it as success. The existing limits
  * will be overwritten.
  *
- * Return: 0 on success, -1 on failure
+ * Return: 1 if the directory was created, 0 if it already existed, -1 on
+ * failure
  */
-static int make_cgroup_dir(void) {
-  const char *group_dir = "/sys/fs/cgroup/euclid";
-
+static int make_cgroup_dir(const char *group_dir) {
   int dir_status = mkdir(group_dir, 0755);
 
   /*
@@ -115,14 +266,79 @@ static int make_cgroup_dir(void) {
     return -1;
   }
 
+  return dir_status == 0;
+}
+
+/**
+ * uses_cpuset - Check whether a container needs the cpuset controller
+ * @ctx: Container configuration
+ *
+ * Return: 1 if any CPU or NUMA placement is configured, 0 otherwise
+ */
+static int uses_cpuset(const struct container_ctx *ctx) {
+  return ctx->numa_spread || ctx->cpuset_cpus[0] != '\0' ||
+         ctx->cpuset_mems[0] != '\0' || ctx->cpuset_partition[0] != '\0';
+}
+
+/**
+ * prepare_parent_cgroup - Set up the euclid cgroup that holds all leaves
+ * @ctx: Container configuration, decides whether cpuset is enabled
+ *
+ * Enables the controllers in the directory above ctx->cgroup_parent (the
+ * root by default), creates cgroup_parent and enables the controllers again
+ * inside it, so that every leaf gets them. This only needs to happen once per
+ * process, later calls return immediately.
+ *
+ * DELEGATION:
+ * Without root, the directory above cgroup_parent has to be delegated to us:
+ * owned by our user, along with its cgroup.procs, cgroup.subtree_control and
+ * cgroup.threads. Moving the containers into their leaves also needs us to
+ * run somewhere inside that delegated subtree already.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int prepare_parent_cgroup(const struct container_ctx *ctx) {
+  static int parent_ready = 0;
+
+  if (parent_ready) {
+    return 0;
+  }
+
+  int cpuset = uses_cpuset(ctx);
+
+  char above[PATH_MAX];
+  snprintf(above, PATH_MAX, "%s", ctx->cgroup_parent);
+  char *slash = strrchr(above, '/');
+  if (!slash || slash == above) {
+    fprintf(stderr, "cgroup_parent must be below the cgroup hierarchy: %s\n",
+            ctx->cgroup_parent);
+    return -1;
+  }
+  *slash = '\0';
+
+  if (enable_controllers(above, cpuset) == -1) {
+    return -1;
+  }
+
+  if (make_cgroup_dir(ctx->cgroup_parent) == -1) {
+    return -1;
+  }
+
+  if (enable_controllers(ctx->cgroup_parent, cpuset) == -1) {
+    return -1;
+  }
+
+  parent_ready = 1;
+
   return 0;
 }
 
 /**
- * add_self_to_cgroup - Move calling process into the euclid group
+ * add_self_to_cgroup - Move calling process into a container's cgroup
+ * @group_dir: Path of the leaf cgroup to join
  *
- * Writes "0" to /sys/fs/cgroup/euclid/cgroup.procs to add the current process
- * to the cgroup.
+ * Writes "0" to {group_dir}/cgroup.procs to add the current process to the
+ * cgroup.
  *
  * PROCESS MIGRATION:
  * When a process joins a cgroup:
@@ -132,16 +348,16 @@ static int make_cgroup_dir(void) {
  *
  * TIMING:
  * This must be called by the child process after the parent has:
- * - Called enable_controllers()
- * - Called make_cgroup_dir()
- * - Called set_limit_* functions to configure limits
+ * - Called configure_cgroups() for this leaf
  *
  * The pipe synchronization in main.c ensures this ordering
  *
  * Return: 0 on success, -1 on failure
  */
-int add_self_to_cgroup(void) {
-  const char *procs_path = "/sys/fs/cgroup/euclid/cgroup.procs";
+int add_self_to_cgroup(const char *group_dir) {
+  char procs_path[PATH_MAX];
+  snprintf(procs_path, PATH_MAX, "%s/cgroup.procs", group_dir);
+
   int procs_fd = open(procs_path, O_WRONLY | O_CLOEXEC);
 
   if (procs_fd == -1) {
@@ -170,98 +386,285 @@ int add_self_to_cgroup(void) {
 }
 
 /**
- * set_limit_int - Write an integer limit to a cgroup control file
- * @filename: Name of the control file
- * @value: Limit value to write (-1 for "max")
+ * cgroup_open - Open a handle to a cgroup, creating the cgroup if needed
+ * @cgroup: Handle to initialize
+ * @path: Path of the cgroup
  *
- * Generic function for setting integer-based cgroup limits. Constructs the full
- * path, converts the integer to a string, and writes it to the control file.
- *
- * SPECIAL VALUE:
- * Passing -1 writes the string "max" instead of a number, which removes the
- * limit for that resource
+ * O_PATH doesn't open the directory for reading, it only pins it so that
+ * openat() can resolve control files relative to it.
  *
  * Return: 0 on success, -1 on failure
  */
-static int set_limit_int(char *filename, int value) {
-  char limit_path[PATH_MAX];
-  snprintf(limit_path, PATH_MAX, "/sys/fs/cgroup/euclid/%s", filename);
+int cgroup_open(struct cgroup *cgroup, const char *path) {
+  snprintf(cgroup->path, PATH_MAX, "%s", path);
+  cgroup->dir_fd = -1;
 
-  int limit_fd = open(limit_path, O_WRONLY | O_CLOEXEC);
+  for (int i = 0; i < CGROUP_LIMIT_COUNT; i++) {
+    cgroup->limit_fds[i] = -1;
+    cgroup->limit_values[i][0] = '\0';
+  }
 
-  if (limit_fd == -1) {
-    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+  int created = make_cgroup_dir(path);
+  if (created == -1) {
     return -1;
   }
 
-  char value_str[VALUE_MAX];
+  cgroup->dir_fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (cgroup->dir_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
 
   /*
-   * Convert the value to a string. If value is -1, we use "max instead of -1"
+   * We only know what's in the limit files of a cgroup we just created. An
+   * existing one may have been changed by anyone.
    */
-  if (value == -1) {
-    snprintf(value_str, VALUE_MAX, "max\n");
-  } else {
-    snprintf(value_str, VALUE_MAX, "%d\n", value);
+  if (created) {
+    for (int i = 0; i < CGROUP_LIMIT_COUNT; i++) {
+      snprintf(cgroup->limit_values[i], CGROUP_VALUE_MAX, "%s",
+               limit_files[i].initial);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * cgroup_set - Write a limit through a cgroup handle
+ * @cgroup: Handle of the cgroup
+ * @limit: Limit to set
+ * @value: Value to write, including the trailing newline
+ *
+ * Does nothing if value is what was last written to the limit through this
+ * handle. The control file is opened on first use and kept open.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_set(struct cgroup *cgroup, enum cgroup_limit limit,
+               const char *value) {
+  const char *filename = limit_files[limit].name;
+
+  if (strcmp(cgroup->limit_values[limit], value) == 0) {
+    return 0;
+  }
+
+  if (cgroup->limit_fds[limit] == -1) {
+    cgroup->limit_fds[limit] =
+        openat(cgroup->dir_fd, filename, O_WRONLY | O_CLOEXEC);
+    if (cgroup->limit_fds[limit] == -1) {
+      fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+      return -1;
+    }
   }
 
   /*
-   * Write the value string to the control file.
+   * Each write() to a cgroup control file is parsed on its own, the file
+   * offset doesn't matter, so there's no need to rewind the fd.
    */
-  if (write(limit_fd, value_str, strlen(value_str)) == -1) {
+  ssize_t value_len = strlen(value);
+  if (write(cgroup->limit_fds[limit], value, value_len) != value_len) {
     fprintf(stderr, "Failed to write to %s: %s\n", filename, strerror(errno));
-    if (close(limit_fd) == -1) {
-      fprintf(stderr, "Failed to close %s: %s\n", filename, strerror(errno));
-    }
+    /* The kernel may or may not have taken part of it */
+    cgroup->limit_values[limit][0] = '\0';
     return -1;
   }
 
-  if (close(limit_fd) == -1) {
-    fprintf(stderr, "Failed to close %s: %s\n", filename, strerror(errno));
-    return -1;
-  }
+  snprintf(cgroup->limit_values[limit], CGROUP_VALUE_MAX, "%s", value);
 
   return 0;
 }
 
 /**
- * set_limit_str - Write a string limit to a cgroup control file
- * @filename: Name of the control file
- * @value: Limit value to write
+ * cgroup_reclaim - Push a cgroup's memory out of RAM
+ * @cgroup: Handle of the cgroup
  *
- * Generic function for setting string-based cgroup limits.
+ * memory.reclaim takes the number of bytes to reclaim. We ask for everything
+ * in memory.current, and the kernel answers EAGAIN when it got less than
+ * that, which is what happens with anything pinned or without swap.
  *
  * Return: 0 on success, -1 on failure
  */
-static int set_limit_str(char *filename, char *value) {
-  char limit_path[PATH_MAX];
+int cgroup_reclaim(struct cgroup *cgroup) {
+  char value[CGROUP_VALUE_MAX];
 
-  snprintf(limit_path, PATH_MAX, "/sys/fs/cgroup/euclid/%s", filename);
+  int current_fd =
+      openat(cgroup->dir_fd, "memory.current", O_RDONLY | O_CLOEXEC);
+  if (current_fd == -1) {
+    fprintf(stderr, "Failed to open %s/memory.current: %s\n", cgroup->path,
+            strerror(errno));
+    return -1;
+  }
 
-  int limit_fd = open(limit_path, O_WRONLY | O_CLOEXEC);
+  ssize_t value_len = read(current_fd, value, sizeof(value) - 1);
+  close(current_fd);
+  if (value_len <= 0) {
+    fprintf(stderr, "Failed to read %s/memory.current: %s\n", cgroup->path,
+            value_len == 0 ? "empty file" : strerror(errno));
+    return -1;
+  }
+  value[value_len] = '\0';
+
+  /* Nothing charged, nothing to reclaim */
+  if (strtoll(value, NULL, 10) == 0) {
+    return 0;
+  }
 
-  if (limit_fd == -1) {
-    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+  int reclaim_fd =
+      openat(cgroup->dir_fd, "memory.reclaim", O_WRONLY | O_CLOEXEC);
+  if (reclaim_fd == -1) {
+    fprintf(stderr, "Failed to open %s/memory.reclaim: %s\n", cgroup->path,
+            strerror(errno));
     return -1;
   }
 
+  /* memory.current's contents already end in the newline */
+  int ret = 0;
+  if (write(reclaim_fd, value, value_len) == -1 && errno != EAGAIN) {
+    fprintf(stderr, "Failed to write to %s/memory.reclaim: %s\n",
+            cgroup->path, strerror(errno));
+    ret = -1;
+  }
+
+  close(reclaim_fd);
+
+  return ret;
+}
+
+/**
+ * cgroup_close - Close a cgroup handle
+ * @cgroup: Handle to close
+ *
+ * The cgroup itself stays in place.
+ */
+void cgroup_close(struct cgroup *cgroup) {
+  for (int i = 0; i < CGROUP_LIMIT_COUNT; i++) {
+    if (cgroup->limit_fds[i] != -1) {
+      close(cgroup->limit_fds[i]);
+      cgroup->limit_fds[i] = -1;
+    }
+  }
+
+  if (cgroup->dir_fd != -1) {
+    close(cgroup->dir_fd);
+    cgroup->dir_fd = -1;
+  }
+}
+
+/**
+ * set_limit_int - Write an integer limit through a cgroup handle
+ * @cgroup: Handle of the cgroup
+ * @limit: Limit to set
+ * @value: Limit value to write (-1 for "max")
+ *
+ * SPECIAL VALUE:
+ * Passing -1 writes the string "max" instead of a number, which removes the
+ * limit for that resource
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int set_limit_int(struct cgroup *cgroup, enum cgroup_limit limit,
+                         long long value) {
+  char value_str[CGROUP_VALUE_MAX];
+
+  /*
+   * Convert the value to a string. If value is -1, we use "max instead of -1"
+   */
+  if (value == -1) {
+    snprintf(value_str, CGROUP_VALUE_MAX, "max\n");
+  } else {
+    snprintf(value_str, CGROUP_VALUE_MAX, "%lld\n", value);
+  }
+
+  return cgroup_set(cgroup, limit, value_str);
+}
+
+/**
+ * set_limit_str - Write a string limit through a cgroup handle
+ * @cgroup: Handle of the cgroup
+ * @limit: Limit to set
+ * @value: Limit value to write
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int set_limit_str(struct cgroup *cgroup, enum cgroup_limit limit,
+                         const char *value) {
   /*
    * Append a newline to the value string.
    * Most cgroup files expect this.
    */
-  char value_str[VALUE_MAX - 1];
-  snprintf(value_str, VALUE_MAX, "%s\n", value);
+  char value_str[CGROUP_VALUE_MAX];
+  snprintf(value_str, CGROUP_VALUE_MAX, "%s\n", value);
 
-  if (write(limit_fd, value_str, strlen(value_str)) == -1) {
-    fprintf(stderr, "Failed to write to %s: %s\n", filename, strerror(errno));
-    if (close(limit_fd) == -1) {
-      fprintf(stderr, "Failed to close %s: %s\n", filename, strerror(errno));
-    }
+  return cgroup_set(cgroup, limit, value_str);
+}
+
+/**
+ * apply_cpuset - Write the container's CPU and NUMA placement to a cgroup
+ * @cgroup: Handle of the cgroup
+ * @ctx: Container configuration, with numa_node set if numa_spread is on
+ *
+ * An empty cpuset.cpus or cpuset.mems makes the leaf use everything its
+ * parent has. The CPUs are written before the partition, since the kernel
+ * checks a partition root's CPUs when it becomes one.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int apply_cpuset(struct cgroup *cgroup,
+                        const struct container_ctx *ctx) {
+  const char *cpus = ctx->cpuset_cpus;
+  const char *mems = ctx->cpuset_mems;
+
+  if (ctx->numa_node != -1) {
+    cpus = numa_node_cpus(ctx->numa_node);
+    mems = numa_node_mems(ctx->numa_node);
+  }
+
+  if (set_limit_str(cgroup, CGROUP_CPUSET_CPUS, cpus) == -1) {
+    return -1;
+  }
+
+  if (set_limit_str(cgroup, CGROUP_CPUSET_MEMS, mems) == -1) {
     return -1;
   }
 
-  if (close(limit_fd) == -1) {
-    fprintf(stderr, "Failed to close %s: %s\n", filename, strerror(errno));
+  if (ctx->cpuset_partition[0] != '\0' &&
+      set_limit_str(cgroup, CGROUP_CPUSET_PARTITION, ctx->cpuset_partition) ==
+          -1) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * apply_limits - Write the container's resource limits to a cgroup
+ * @cgroup: Handle of the cgroup
+ * @ctx: Container configuration containing resource limit values
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int apply_limits(struct cgroup *cgroup, struct container_ctx *ctx) {
+  if (set_limit_str(cgroup, CGROUP_CPU_MAX, ctx->cpu_max) == -1) {
+    return -1;
+  }
+
+  if (set_limit_int(cgroup, CGROUP_MEMORY_MAX, ctx->mem_max) == -1) {
+    return -1;
+  }
+
+  if (set_limit_int(cgroup, CGROUP_MEMORY_HIGH, ctx->mem_high) == -1) {
+    return -1;
+  }
+
+  if (set_limit_int(cgroup, CGROUP_MEMORY_SWAP_MAX, ctx->mem_swap_max) == -1) {
+    return -1;
+  }
+
+  if (set_limit_int(cgroup, CGROUP_PIDS_MAX, ctx->pids_max) == -1) {
+    return -1;
+  }
+
+  if (uses_cpuset(ctx) && apply_cpuset(cgroup, ctx) == -1) {
     return -1;
   }
 
@@ -271,52 +674,240 @@ static int set_limit_str(char *filename, char *value) {
 /**
  * configure_cgroups - Set up and configure the container's cgroup
  * @ctx: Container configuration containing resource limit values
+ * @name: Name of the container's leaf cgroup
  *
  * Entry point for cgroup setup. This function orchestrates the creation of the
  * cgroup and configuration of all resource limits.
  *
  * EXECUTION ORDER:
- * - Enable controllers in parent cgroup
- * - Create euclid cgroup directory
+ * - Enable controllers and create the euclid cgroup (first call only)
+ * - Create the leaf cgroup directory, path stored in ctx->cgroup_path
  * - Configure CPU limit (cpu.max)
  * - Configure hard memory limit (memory.max)
  * - Configure soft memory limit (memory.high)
  * - Configure swap limit (memory.swap.max)
  * - Configure PID limit (pids.max)
+ * - Configure CPU and NUMA placement (cpuset.*), if any
  *
  * This must be called by the parent process before the child calls
  * add_process_to_cgroup(), this is ensured by the pipe mechanism in main.c.
  *
  * Return: 0 on success, -1 on failure
  */
-int configure_cgroups(struct container_ctx *ctx) {
-  if (enable_controllers()) {
+int configure_cgroups(struct container_ctx *ctx, const char *name) {
+  if (prepare_parent_cgroup(ctx) == -1) {
     return -1;
   }
 
-  if (make_cgroup_dir() == -1) {
-    return -1;
+  snprintf(ctx->cgroup_path, PATH_MAX, "%s/%s", ctx->cgroup_parent, name);
+
+  struct cgroup cgroup;
+  int ret = cgroup_open(&cgroup, ctx->cgroup_path);
+  if (ret == 0) {
+    ret = apply_limits(&cgroup, ctx);
   }
 
-  if (set_limit_str("cpu.max", ctx->cpu_max) == -1) {
-    return -1;
+  cgroup_close(&cgroup);
+
+  return ret;
+}
+
+/**
+ * remove_cgroup - Remove a container's leaf cgroup
+ * @group_dir: Path of the leaf cgroup
+ *
+ * A cgroup can only be removed once it has no processes left. We retry for a
+ * short while on EBUSY, since the kernel can lag slightly behind the reaping
+ * of the container. An empty path means there is nothing to remove.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int remove_cgroup(const char *group_dir) {
+  const struct timespec delay = {.tv_sec = 0, .tv_nsec = 1000000};
+
+  /* The cgroup was never configured, so there's nothing to remove */
+  if (group_dir[0] == '\0') {
+    return 0;
+  }
+
+  for (int attempt = 0; attempt < REMOVE_RETRIES; attempt++) {
+    if (rmdir(group_dir) == 0 || errno == ENOENT) {
+      return 0;
+    }
+
+    if (errno != EBUSY) {
+      break;
+    }
+
+    nanosleep(&delay, NULL);
   }
 
-  if (set_limit_int("memory.max", ctx->mem_max) == -1) {
+  fprintf(stderr, "Failed to remove cgroup %s: %s\n", group_dir,
+          strerror(errno));
+  return -1;
+}
+
+/**
+ * cgroup_populated - Check whether a cgroup still has processes
+ * @cgroup: Handle of the cgroup
+ *
+ * cgroup.events is a flat keyed file maintained by the kernel. Its populated
+ * key is 1 while the cgroup or any of its descendants has live processes.
+ *
+ * Return: 1 if populated, 0 if empty, -1 on failure
+ */
+static int cgroup_populated(const struct cgroup *cgroup) {
+  int events_fd = openat(cgroup->dir_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+  if (events_fd == -1) {
+    fprintf(stderr, "Failed to open %s/cgroup.events: %s\n", cgroup->path,
+            strerror(errno));
     return -1;
   }
 
-  if (set_limit_int("memory.high", ctx->mem_high) == -1) {
+  FILE *events = fdopen(events_fd, "r");
+  if (!events) {
+    fprintf(stderr, "Failed to open %s/cgroup.events: %s\n", cgroup->path,
+            strerror(errno));
+    close(events_fd);
     return -1;
   }
 
-  if (set_limit_int("memory.swap.max", ctx->mem_swap_max) == -1) {
+  char key[32];
+  int value;
+  int populated = -1;
+
+  while (fscanf(events, "%31s %d", key, &value) == 2) {
+    if (strcmp(key, "populated") == 0) {
+      populated = value;
+      break;
+    }
+  }
+
+  fclose(events);
+
+  return populated;
+}
+
+/**
+ * cgroup_pool_init - Create and configure a pool of leaf cgroups
+ * @ctx: Container configuration containing resource limit values
+ * @size: Number of leaves to create
+ *
+ * Leaves are named "<pid>-pool<n>" after the calling process, so they can't
+ * collide with the leaves of another euclid process or with fresh leaves.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int cgroup_pool_init(struct container_ctx *ctx, int size) {
+  if (prepare_parent_cgroup(ctx) == -1) {
     return -1;
   }
 
-  if (set_limit_int("pids.max", ctx->pids_max) == -1) {
+  leaf_pool = calloc(size, sizeof(struct cgroup_leaf));
+  if (!leaf_pool) {
+    fprintf(stderr, "Memory allocation failed for cgroup pool: %s\n",
+            strerror(errno));
     return -1;
   }
 
+  for (int i = 0; i < size; i++) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%d-pool%d", ctx->cgroup_parent, getpid(),
+             i);
+
+    /*
+     * Count the leaf before configuring it, so that cgroup_pool_destroy()
+     * also removes a leaf that was only partially set up.
+     */
+    leaf_pool_size++;
+    struct cgroup *cgroup = &leaf_pool[i].cgroup;
+    if (cgroup_open(cgroup, path) == -1 || apply_limits(cgroup, ctx) == -1) {
+      cgroup_pool_destroy();
+      return -1;
+    }
+  }
+
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * acquire_cgroup - Get a configured leaf cgroup for a new container
+ * @ctx: Container configuration, the leaf's path is stored in cgroup_path
+ * @name: Name to create a fresh leaf under if no pooled leaf is ready
+ *
+ * A pooled leaf gets ctx's limits reapplied through its handle. That's free
+ * unless something changed them while the leaf was in use.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int acquire_cgroup(struct container_ctx *ctx, const char *name) {
+  for (int i = 0; i < leaf_pool_size; i++) {
+    struct cgroup_leaf *leaf = &leaf_pool[i];
+
+    /*
+     * A leaf that was just released can still be populated for a moment,
+     * until the kernel is done tearing down its last processes.
+     */
+    if (leaf->in_use || cgroup_populated(&leaf->cgroup) != 0) {
+      continue;
+    }
+
+    leaf->in_use = 1;
+    snprintf(ctx->cgroup_path, PATH_MAX, "%s", leaf->cgroup.path);
+    return apply_limits(&leaf->cgroup, ctx);
+  }
+
+  return configure_cgroups(ctx, name);
+}
+
+/**
+ * release_cgroup - Give up a container's leaf cgroup
+ * @group_dir: Path of the leaf cgroup
+ *
+ * Pooled leaves are returned to the pool, fresh leaves are removed.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int release_cgroup(const char *group_dir) {
+  for (int i = 0; i < leaf_pool_size; i++) {
+    if (strcmp(leaf_pool[i].cgroup.path, group_dir) == 0) {
+      leaf_pool[i].in_use = 0;
+      return 0;
+    }
+  }
+
+  return remove_cgroup(group_dir);
+}
+
+/**
+ * forget_cgroup_limit - Stop trusting a pooled leaf's last write to a limit
+ * @group_dir: Path of the leaf cgroup
+ * @limit: Limit whose file was changed through another handle
+ *
+ * An empty cached value never matches, so cgroup_set() writes the limit the
+ * next time apply_limits() gets to it.
+ */
+void forget_cgroup_limit(const char *group_dir, enum cgroup_limit limit) {
+  for (int i = 0; i < leaf_pool_size; i++) {
+    if (strcmp(leaf_pool[i].cgroup.path, group_dir) == 0) {
+      leaf_pool[i].cgroup.limit_values[limit][0] = '\0';
+      return;
+    }
+  }
+}
+
+/**
+ * cgroup_pool_destroy - Remove every leaf in the pool
+ *
+ * Must be called after every container using a pooled leaf has been reaped.
+ */
+void cgroup_pool_destroy(void) {
+  for (int i = 0; i < leaf_pool_size; i++) {
+    cgroup_close(&leaf_pool[i].cgroup);
+    remove_cgroup(leaf_pool[i].cgroup.path);
+  }
+
+  free(leaf_pool);
+  leaf_pool = NULL;
+  leaf_pool_size = 0;
+}
@@ -0,0 +1,461 @@
+/**
+ * checkpoint.c
+ *
+ * Checkpointing a running container and restoring copies of it with CRIU.
+ *
+ * OVERVIEW:
+ * Everything here runs the criu binary in a child process and waits for it,
+ * the way ip(8) or a shell would. CRIU's own library would save the fork and
+ * exec, but every dump and restore takes far longer than those anyway, and
+ * the binary keeps euclid free of a dependency only these modes need.
+ *
+ * CGROUPS:
+ * criu restore creates the restored processes itself, so they start out in
+ * criu's cgroup. The child joins the container's leaf cgroup before its exec,
+ * and the restored processes are born into it with the leaf's limits already
+ * in place. --manage-cgroups=ignore keeps criu from recording or recreating
+ * cgroups of its own.
+ *
+ * WORK DIRECTORY:
+ * The image directory is only read by a restore, so that several containers
+ * can be restored from one image at the same time. Each restore gets a work
+ * directory of its own, {WORK_BASE}/restore-PID, for criu's logs, its pidfile
+ * and the lazy-pages socket. It stays behind when the restore fails, so the
+ * logs can be read.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cgroups.h"
+#include "checkpoint.h"
+
+/**
+ * WORK_BASE - Directory the restores' work directories are created in
+ */
+static const char *WORK_BASE = "/run/euclid";
+
+/**
+ * WORK_DIR_MAX - Size of a work directory's path, WORK_BASE and a PID fit
+ */
+#define WORK_DIR_MAX 64
+
+/**
+ * checkpoint_requested - Set by the SIGUSR1 handler
+ */
+static volatile sig_atomic_t checkpoint_requested = 0;
+
+/**
+ * lazy_pages_pid - PID of the lazy-pages daemon of our restore, -1 for none
+ */
+static int lazy_pages_pid = -1;
+
+/**
+ * work_dir - Work directory of our restore, empty if there is none
+ */
+static char work_dir[WORK_DIR_MAX];
+
+/**
+ * handle_checkpoint_signal - Remember a SIGUSR1 that arrived early
+ * @sig: Signal number, always SIGUSR1
+ */
+static void handle_checkpoint_signal(int sig) {
+  (void)sig;
+  checkpoint_requested = 1;
+}
+
+/**
+ * catch_checkpoint_signal - Keep SIGUSR1 from killing us before it's awaited
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int catch_checkpoint_signal(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_checkpoint_signal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+
+  if (sigaction(SIGUSR1, &action, NULL) == -1) {
+    fprintf(stderr, "Failed to catch SIGUSR1: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * wait_for_checkpoint_signal - Wait until euclid is told to checkpoint
+ * @container: Container to checkpoint
+ *
+ * The signal is blocked before the flag is checked, so one arriving in
+ * between stays pending for the signalfd. Without a pidfd, an exited
+ * container is only noticed by the dump failing.
+ *
+ * Return: 0 once SIGUSR1 arrived, -1 if the container exited first or on
+ * failure
+ */
+int wait_for_checkpoint_signal(const struct container *container) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+    fprintf(stderr, "Failed to block SIGUSR1: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (checkpoint_requested) {
+    return 0;
+  }
+
+  int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (sig_fd == -1) {
+    fprintf(stderr, "Failed to create signalfd: %s\n", strerror(errno));
+    return -1;
+  }
+
+  struct pollfd fds[2] = {
+      {.fd = sig_fd, .events = POLLIN},
+      {.fd = container->pidfd, .events = POLLIN},
+  };
+  nfds_t nfds = container->pidfd == -1 ? 1 : 2;
+
+  int ret = -1;
+  for (;;) {
+    if (poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to poll for SIGUSR1: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      struct signalfd_siginfo info;
+      if (read(sig_fd, &info, sizeof(info)) != sizeof(info)) {
+        fprintf(stderr, "Failed to read signalfd: %s\n", strerror(errno));
+        break;
+      }
+      ret = 0;
+      break;
+    }
+
+    if (nfds == 2 && fds[1].revents) {
+      fprintf(stderr, "Container exited before it was checkpointed\n");
+      break;
+    }
+  }
+
+  close(sig_fd);
+  return ret;
+}
+
+/**
+ * spawn_criu - Run criu in a child process
+ * @criu: criu binary, looked up in PATH unless it contains a slash
+ * @argv: criu's arguments, argv[0] included, NULL-terminated
+ * @cgroup_path: Leaf cgroup criu joins before its exec, NULL to stay in ours
+ * @status_fd: Descriptor criu inherits for --status-fd, -1 for none
+ *
+ * Return: PID of criu on success, -1 on failure
+ */
+static int spawn_criu(const char *criu, char *const argv[],
+                      const char *cgroup_path, int status_fd) {
+  int pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Failed to fork criu: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    if (cgroup_path && add_self_to_cgroup(cgroup_path) == -1) {
+      _exit(127);
+    }
+
+    if (status_fd != -1 && fcntl(status_fd, F_SETFD, 0) == -1) {
+      fprintf(stderr, "Failed to pass on status fd: %s\n", strerror(errno));
+      _exit(127);
+    }
+
+    execvp(criu, argv);
+    fprintf(stderr, "Failed to execute %s: %s\n", criu, strerror(errno));
+    _exit(127);
+  }
+
+  return pid;
+}
+
+/**
+ * wait_for_criu - Reap criu and check that it succeeded
+ * @pid: PID of criu
+ * @log: criu's log file, for the error message
+ *
+ * Return: 0 if criu exited with status 0, -1 otherwise
+ */
+static int wait_for_criu(int pid, const char *log) {
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Failed to wait for criu: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "criu failed, see %s\n", log);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * checkpoint_container - Dump a container's process tree into a directory
+ * @ctx: Container configuration, criu is the criu binary to run
+ * @container: Container to dump, killed by criu once the dump is complete
+ * @dir: Directory the image is written to, created if it doesn't exist
+ *
+ * Dumping the container's init dumps its whole PID namespace, and with it
+ * the namespaces, mounts, seccomp filters and capabilities of its processes.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int checkpoint_container(const struct container_ctx *ctx,
+                         const struct container *container, const char *dir) {
+  if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+    return -1;
+  }
+
+  char tree[16];
+  char log[PATH_MAX];
+  snprintf(tree, sizeof(tree), "%d", container->pid);
+  if (snprintf(log, PATH_MAX, "%s/dump.log", dir) >= PATH_MAX) {
+    fprintf(stderr, "Checkpoint directory path is too long\n");
+    return -1;
+  }
+
+  char *const argv[] = {"criu",
+                        "dump",
+                        "--tree",
+                        tree,
+                        "--images-dir",
+                        (char *)dir,
+                        "--log-file",
+                        log,
+                        "--manage-cgroups=ignore",
+                        "--shell-job",
+                        "--file-locks",
+                        NULL};
+
+  int pid = spawn_criu(ctx->criu, argv, NULL, -1);
+  if (pid == -1) {
+    return -1;
+  }
+
+  return wait_for_criu(pid, log);
+}
+
+/**
+ * start_lazy_pages - Start the daemon serving a lazy restore's pages
+ * @ctx: Container configuration, criu is the criu binary to run
+ * @dir: Directory holding the image
+ *
+ * criu restore connects to the daemon's socket in the work directory right
+ * away, so we wait for the daemon to report on --status-fd that it's
+ * listening. EOF instead means it failed.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int start_lazy_pages(const struct container_ctx *ctx, const char *dir) {
+  char log[PATH_MAX];
+  if (snprintf(log, PATH_MAX, "%s/lazy-pages.log", work_dir) >= PATH_MAX) {
+    fprintf(stderr, "Restore work directory path is too long\n");
+    return -1;
+  }
+
+  int status_fds[2];
+  if (pipe2(status_fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create status pipe: %s\n", strerror(errno));
+    return -1;
+  }
+
+  char status_fd[16];
+  snprintf(status_fd, sizeof(status_fd), "%d", status_fds[1]);
+
+  char *const argv[] = {"criu",     "lazy-pages",  "--images-dir",
+                        (char *)dir, "--work-dir",  work_dir,
+                        "--log-file", log,         "--status-fd",
+                        status_fd,   NULL};
+
+  int pid = spawn_criu(ctx->criu, argv, NULL, status_fds[1]);
+  close(status_fds[1]);
+  if (pid == -1) {
+    close(status_fds[0]);
+    return -1;
+  }
+
+  char ready;
+  ssize_t bytes;
+  do {
+    bytes = read(status_fds[0], &ready, 1);
+  } while (bytes == -1 && errno == EINTR);
+  close(status_fds[0]);
+
+  if (bytes != 1) {
+    fprintf(stderr, "criu lazy-pages didn't start, see %s\n", log);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+
+  lazy_pages_pid = pid;
+  return 0;
+}
+
+/**
+ * stop_lazy_pages - Stop and reap the lazy-pages daemon if we started one
+ *
+ * The daemon exits on its own once it has handed out every page, so it may
+ * only be waiting to be reaped.
+ */
+static void stop_lazy_pages(void) {
+  if (lazy_pages_pid == -1) {
+    return;
+  }
+
+  kill(lazy_pages_pid, SIGTERM);
+  waitpid(lazy_pages_pid, NULL, 0);
+  lazy_pages_pid = -1;
+}
+
+/**
+ * read_pidfile - Read the PID criu restore wrote
+ * @path: The pidfile
+ *
+ * Return: The PID on success, -1 on failure
+ */
+static int read_pidfile(const char *path) {
+  FILE *file = fopen(path, "re");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  int pid;
+  if (fscanf(file, "%d", &pid) != 1 || pid <= 0) {
+    fprintf(stderr, "Failed to read a PID from %s\n", path);
+    pid = -1;
+  }
+
+  fclose(file);
+  return pid;
+}
+
+/**
+ * restore_checkpoint - Recreate a checkpointed container inside a cgroup
+ * @ctx: Container configuration, rootfs must be the root the image was taken
+ *       on
+ * @dir: Directory holding the image written by checkpoint_container()
+ * @cgroup_path: Leaf cgroup the restored processes are created in
+ *
+ * --restore-detached makes criu exit once the processes run, and
+ * --restore-sibling creates the container's init with CLONE_PARENT, so its
+ * parent is us rather than criu.
+ *
+ * Return: PID of the restored init on success, -1 on failure
+ */
+int restore_checkpoint(const struct container_ctx *ctx, const char *dir,
+                       const char *cgroup_path) {
+  if (mkdir(WORK_BASE, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", WORK_BASE, strerror(errno));
+    return -1;
+  }
+
+  snprintf(work_dir, WORK_DIR_MAX, "%s/restore-%d", WORK_BASE, getpid());
+  if (mkdir(work_dir, 0700) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", work_dir, strerror(errno));
+    work_dir[0] = '\0';
+    return -1;
+  }
+
+  char log[PATH_MAX];
+  char pidfile[PATH_MAX];
+  snprintf(log, PATH_MAX, "%s/restore.log", work_dir);
+  snprintf(pidfile, PATH_MAX, "%s/restore.pid", work_dir);
+
+  if (ctx->lazy_restore && start_lazy_pages(ctx, dir) == -1) {
+    return -1;
+  }
+
+  char *const argv[] = {"criu",
+                        "restore",
+                        "--images-dir",
+                        (char *)dir,
+                        "--work-dir",
+                        work_dir,
+                        "--root",
+                        ctx->rootfs,
+                        "--log-file",
+                        log,
+                        "--pidfile",
+                        pidfile,
+                        "--restore-detached",
+                        "--restore-sibling",
+                        "--manage-cgroups=ignore",
+                        "--shell-job",
+                        "--file-locks",
+                        ctx->lazy_restore ? "--lazy-pages" : NULL,
+                        NULL};
+
+  int criu_pid = spawn_criu(ctx->criu, argv, cgroup_path, -1);
+  if (criu_pid == -1 || wait_for_criu(criu_pid, log) == -1) {
+    stop_lazy_pages();
+    return -1;
+  }
+
+  int pid = read_pidfile(pidfile);
+  if (pid == -1) {
+    stop_lazy_pages();
+  }
+
+  return pid;
+}
+
+/**
+ * finish_restore - Clean up after a restored container has exited
+ */
+void finish_restore(void) {
+  stop_lazy_pages();
+
+  if (work_dir[0] == '\0') {
+    return;
+  }
+
+  DIR *dir = opendir(work_dir);
+  if (dir) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        unlinkat(dirfd(dir), entry->d_name, 0);
+      }
+    }
+    closedir(dir);
+  }
+
+  if (rmdir(work_dir) == -1) {
+    fprintf(stderr, "Failed to remove %s: %s\n", work_dir, strerror(errno));
+  }
+  work_dir[0] = '\0';
+}
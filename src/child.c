@@ -10,34 +10,137 @@
  * configure its isolated environment.
  *
  * SECURITY LAYERS:
- * - Namespace isolation (UTS, PID, mount, network, IPC)
+ * - Namespace isolation (UTS, PID, mount, network, IPC, optionally user)
  * - Filesystem isolation (pivot_root to separate root)
  * - Capability dropping (remove all Linux capabilities)
  * - Syscall filtering (seccomp-bpf whitelist)
  * - Resource limits (cgroups for CPU, memory, PIDs)
  *
  * EXECUTION FLOW:
- * - Wait for parent to configure cgroups
- * - Join cgroup
+ * - Close inherited fds and redirect output (captured output only)
+ * - Wait for parent to configure cgroups (unless created inside the cgroup)
+ * - Join cgroup (unless created inside the cgroup)
+ * - Join the network slot's namespace (containers with a network only)
  * - Set hostname
- * - Set up mount namespace
+ * - Set up mount namespace, mounting /dev and /proc unless turned off
  * - Drop all capabilities
  * - Lock capabilities
+ * - Install the syscall profiler (profiling runs only)
  * - Apply seccomp filter
+ * - Wait for a command (warm containers only)
  * - Execute target program
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "cgroups.h"
 #include "child.h"
+#include "command.h"
 #include "child_filesystem.h"
 #include "child_namespaces.h"
 #include "child_security.h"
 #include "context.h"
+#include "devices.h"
+#include "overlay.h"
+#include "timing.h"
+
+/**
+ * FD_SCAN_MAX - Highest fd closed by hand when close_range() is unavailable
+ */
+#define FD_SCAN_MAX 1024
+
+/**
+ * close_fd_range - Close every fd in [first, last]
+ * @first: Lowest fd to close
+ * @last: Highest fd to close
+ *
+ * close_range() (Linux 5.9) does this in a single syscall. On older kernels we
+ * fall back to closing each fd up to FD_SCAN_MAX, ignoring EBADF.
+ */
+static void close_fd_range(unsigned int first, unsigned int last) {
+  if (first > last) {
+    return;
+  }
+
+  if (syscall(SYS_close_range, first, last, 0) == 0) {
+    return;
+  }
+
+  for (unsigned int fd = first; fd <= last && fd < FD_SCAN_MAX; fd++) {
+    close(fd);
+  }
+}
+
+/**
+ * close_inherited_fds - Close every fd the container doesn't need
+ * @ctx: Container configuration naming the fds to keep
+ *
+ * clone() without CLONE_FILES copies the parent's whole file descriptor
+ * table. Besides leaking host files into the container, this matters when the
+ * parent runs several containers: each one would hold the pipe ends of the
+ * others, so none of them ever sees EOF when the parent closes its end.
+ *
+ * We keep stdin/stdout/stderr, the read end of our synchronization pipe, the
+ * write ends of the profiling, supervisor, timing and output pipes and the
+ * network slot's namespace, and close everything else.
+ */
+static void close_inherited_fds(struct container_ctx *ctx) {
+  int keep[] = {ctx->pipe_fds[0],     ctx->profile_fds[1],
+                ctx->supervisor_fds[1], ctx->timing_fds[1],
+                ctx->stdout_fds[1],   ctx->stderr_fds[1],
+                ctx->netns_fd};
+  unsigned int num_keep = sizeof(keep) / sizeof(keep[0]);
+  unsigned int next = STDERR_FILENO + 1;
+
+  /* Sort the (at most seven) fds to keep so we can close the gaps in order */
+  for (unsigned int i = 1; i < num_keep; i++) {
+    for (unsigned int j = i; j > 0 && keep[j - 1] > keep[j]; j--) {
+      int tmp = keep[j];
+      keep[j] = keep[j - 1];
+      keep[j - 1] = tmp;
+    }
+  }
+
+  for (unsigned int i = 0; i < num_keep; i++) {
+    if (keep[i] < (int)next) {
+      continue;
+    }
+    close_fd_range(next, keep[i] - 1);
+    next = keep[i] + 1;
+  }
+
+  close_fd_range(next, ~0U);
+}
+
+/**
+ * redirect_output - Point stdout and stderr at the parent's output pipes
+ * @ctx: Container configuration with stdout_fds and stderr_fds
+ *
+ * dup2() clears close-on-exec on the copies, so the target program inherits
+ * them as fds 1 and 2 while the originals go away.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int redirect_output(struct container_ctx *ctx) {
+  if (dup2(ctx->stdout_fds[1], STDOUT_FILENO) == -1 ||
+      dup2(ctx->stderr_fds[1], STDERR_FILENO) == -1) {
+    fprintf(stderr, "Failed to redirect output: %s\n", strerror(errno));
+    return -1;
+  }
+
+  close(ctx->stdout_fds[1]);
+  close(ctx->stderr_fds[1]);
+  ctx->stdout_fds[1] = -1;
+  ctx->stderr_fds[1] = -1;
+
+  return 0;
+}
 
 /**
  * child_main - Entry point for the container child process
@@ -51,7 +154,8 @@
  *
  * SYNCHRONIZATION:
  * Uses a pipe to wait for the parent to finish cgroup setup so that the child
- * doesn't try to join a cgroup that doesn't exist yet.
+ * doesn't try to join a cgroup that doesn't exist yet. Children created with
+ * CLONE_INTO_CGROUP start out in their cgroup and skip this.
  *
  * SECURITY LAYERS:
  * 1. Namespace isolation: Separate hostname, PID tree, mounts, network, IPC
@@ -67,28 +171,71 @@ int child_main(void *arg) {
   struct container_ctx *ctx = arg;
   char *pong;
 
+  launch_stamp(&ctx->timing, LAUNCH_CLONE);
+
+  /*
+   * Only the parent writes to the pipe, so this also drops our copy of the
+   * write end. That way we see EOF if the parent goes away, instead of
+   * blocking forever.
+   */
+  close_inherited_fds(ctx);
+
   /*
-   * Wait for parent to configure cgroups. This blocks until the parent writes
-   * to the pipe.
+   * From here on, our own error messages end up in the job's log as well.
    */
-  if (read(ctx->pipe_fds[0], &pong, 1) == -1) {
-    fprintf(stderr, "Failed to read from pipe: %s\n", strerror(errno));
+  if (ctx->stdout_fds[1] != -1 && redirect_output(ctx) == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_CLOSE_FDS);
+
+  /*
+   * A child created with CLONE_INTO_CGROUP is already in its cgroup. One in a
+   * user namespace waits anyway: until the parent has written its id maps,
+   * it's nobody and can't set anything up.
+   */
+  int userns = ctx->namespaces & CLONE_NEWUSER;
+  if (!ctx->in_cgroup || userns) {
+    /*
+     * Wait for parent to configure cgroups. This blocks until the parent
+     * writes to the pipe.
+     */
+    ssize_t got = read(ctx->pipe_fds[0], &pong, 1);
+    if (got == -1) {
+      fprintf(stderr, "Failed to read from pipe: %s\n", strerror(errno));
+      return -1;
+    }
+
+    /* The parent gave up on us, as it does when the id maps failed */
+    if (got == 0) {
+      return -1;
+    }
+  }
 
   /*
    * Join the cgroup configured by the parent
    */
-  if (add_self_to_cgroup() == -1) {
+  if (!ctx->in_cgroup && add_self_to_cgroup(ctx->cgroup_path) == -1) {
+    return -1;
+  }
+  launch_stamp(&ctx->timing, LAUNCH_JOIN_CGROUP);
+
+  /*
+   * A container with a network was cloned without a network namespace of its
+   * own, and joins the one its network slot has ready.
+   */
+  if (ctx->netns_fd != -1 && join_network_namespace(ctx) == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_NETNS);
 
   /*
-   * Set the hostname visible inside the container
+   * Set the hostname visible inside the container. Without a UTS namespace
+   * it would be the host's.
    */
-  if (setup_uts_namespace(ctx) == -1) {
+  if ((ctx->namespaces & CLONE_NEWUTS) && setup_uts_namespace(ctx) == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_UTS);
 
   /*
    * Make mounts private to prevent propagation to/from host
@@ -96,35 +243,81 @@ int child_main(void *arg) {
   if (setup_mount_propagation() == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_PROPAGATION);
 
   /*
    * OverlayFS gives the user a temporary filesystem on top of the read-only
-   * rootfs, this is used extensively in Docker.
+   * rootfs, this is used extensively in Docker. Without it, the container
+   * runs in rootfs itself.
    */
-  if (setup_overlay(ctx) == -1) {
+  const char *root = ctx->rootfs;
+  char merged[PATH_MAX];
+  if (ctx->overlay) {
+    if (userns && mount_private_slot(ctx) == -1) {
+      return -1;
+    }
+    if (setup_overlay(ctx, merged) == -1) {
+      return -1;
+    }
+    root = merged;
+  }
+  launch_stamp(&ctx->timing, LAUNCH_OVERLAY);
+
+  /*
+   * devtmpfs can't be mounted in a user namespace, so the devices are bound
+   * in from the host while we can still reach them.
+   */
+  if (userns && ctx->mount_dev && bind_dev(root) == -1) {
     return -1;
   }
 
+  /*
+   * Same for /proc, which needs the host's in view (see mount_proc())
+   */
+  if (userns && ctx->mount_proc) {
+    char proc[PATH_MAX];
+    if (snprintf(proc, PATH_MAX, "%s/proc", root) >= PATH_MAX) {
+      fprintf(stderr, "Path too long: %s\n", root);
+      return -1;
+    }
+    if (mount_proc(ctx, proc) == -1) {
+      return -1;
+    }
+  }
+
   /*
    * Change root filesystem to isolate from host
    */
-  if (setup_rootfs(ctx) == -1) {
+  if (setup_rootfs(ctx, root) == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_ROOTFS);
 
   /*
-   * Mount /dev for device access
+   * Mount /dev for device access. The minimal /dev is part of the overlay
+   * and already there, and in a user namespace it's been bound in already.
    */
-  if (mount_dev() == -1) {
+  if (ctx->mount_dev && !ctx->minimal_dev && !userns &&
+      mount_dev(ctx) == -1) {
     return -1;
   }
 
   /*
-   * Mount /proc for process information
+   * Neither of those has ptys, so they get a devpts of their own
    */
-  if (mount_proc() == -1) {
+  if (ctx->mount_dev && (ctx->minimal_dev || userns) &&
+      mount_devpts(ctx) == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_DEV);
+
+  /*
+   * Mount /proc for process information, unless the job has no use for it
+   */
+  if (ctx->mount_proc && !userns && mount_proc(ctx, "/proc") == -1) {
+    return -1;
+  }
+  launch_stamp(&ctx->timing, LAUNCH_PROC);
 
   /*
    * Remove all capabilities to limit what the process can do
@@ -132,6 +325,7 @@ int child_main(void *arg) {
   if (drop_capabilities() == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_DROP_CAPS);
 
   /*
    * Prevent gaining new privileges (required before installing seccomp filter)
@@ -139,13 +333,53 @@ int child_main(void *arg) {
   if (lock_capabilities() == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_LOCK_CAPS);
+
+  /*
+   * When profiling, every syscall from here on is reported to the parent. This
+   * has to come before the regular filter, since that one doesn't permit the
+   * seccomp() syscall used to install the profiler.
+   */
+  if (ctx->profile_fds[1] != -1 &&
+      apply_seccomp_profiler(ctx->profile_fds[1]) == -1) {
+    return -1;
+  }
 
   /*
-   * Install syscall filter to allow only whitelisted operations
+   * Install syscall filter to allow only whitelisted operations, unless the
+   * configuration turned it off. A supervised filter reports its listener to
+   * the parent's supervisor thread.
    */
-  if (apply_seccomp() == -1) {
+  if (ctx->supervise) {
+    if (apply_seccomp_supervised(ctx->supervisor_fds[1]) == -1) {
+      return -1;
+    }
+  } else if (ctx->seccomp && apply_seccomp() == -1) {
     return -1;
   }
+  launch_stamp(&ctx->timing, LAUNCH_SECCOMP);
+
+  /*
+   * A warm container is fully set up at this point and parks here until the
+   * parent hands it a command. EOF means the pool is shutting down and the
+   * container was never needed.
+   */
+  if (ctx->pooled) {
+    static struct command cmd;
+
+    int received = receive_command(ctx->pipe_fds[0], &cmd);
+    if (received <= 0) {
+      return received;
+    }
+
+    ctx->cmd = cmd.argv;
+  }
+  launch_stamp(&ctx->timing, LAUNCH_COMMAND);
+
+  /*
+   * The parent stamps LAUNCH_EXEC when the exec closes the pipe.
+   */
+  send_launch_timing(ctx->timing_fds[1], &ctx->timing);
 
   /*
    * Execute the target program.
@@ -5,59 +5,107 @@
  * Handles the filesystem isolation layer of the container, including:
  * - OverlayFS: Provides writable layer on top of read-only rootfs
  * - /proc: Process information isolated to the container's PID namespace
- * - /dev: Device access via devtmpfs
- * - tmpfs: The overlay is created within a temporary filesystem located in RAM
+ * - /dev: Device access via devtmpfs, unless the overlay brings its own
+ *   (see devices.h)
+ * - tmpfs: The overlay's writable layer lives in a temporary filesystem
+ *   located in RAM, prepared by the parent in an overlay slot (see overlay.h)
  *
  * OVERLAYFS LAYERS:
  * - Lower: Read-only original rootfs
  * - Upper: Writable layer for modifications
  * - Work: Temporary workspace used for atomic file operations
  * - Merged: The combined view that is used as the container's new rootfs
+ *
+ * MOUNT API:
+ * With new_mount_api, filesystems are created with the file descriptor based
+ * mount API of Linux 5.2 instead of mount(2):
+ * - fsopen() starts a filesystem context for a filesystem type
+ * - fsconfig() sets its options one at a time, as separate strings instead
+ *   of a single comma-separated one that has to be escaped and fit a page
+ * - fsconfig(FSCONFIG_CMD_CREATE) creates the superblock, and errors come
+ *   with a message from the filesystem that can be read from the context
+ * - fsmount() turns it into a mount that isn't attached anywhere yet
+ * - move_mount() attaches it
+ * The overlay mount is the container's root as it is, so it doesn't need to
+ * be bind mounted onto itself before pivot_root() either. Without the
+ * overlay, open_tree() clones rootfs instead of a bind mount. Kernels
+ * without the API make the first fsopen() fail with ENOSYS, after which
+ * everything falls back to mount(2). Kernels before 6.8 have the API but not
+ * "lowerdir+", so stacks too long for fsconfig() are mounted with mount(2)
+ * there.
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
-#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
 #include "child_filesystem.h"
 #include "context.h"
+#include "layers.h"
+
+/**
+ * FSCONFIG_STRING_MAX - Longest string fsconfig() takes, with the null byte
+ */
+#define FSCONFIG_STRING_MAX 256
+
+/**
+ * mount_api_unsupported - Set once the kernel turned down fsopen()
+ */
+static int mount_api_unsupported = 0;
 
 /**
- * mount_tmpfs - Mount the temporary filesystem at overlay_base
- * @ctx: Container configuration containing paths for overlayFS
+ * lowerdir_append_unsupported - Set once overlayfs turned down "lowerdir+"
+ */
+static int lowerdir_append_unsupported = 0;
+
+/**
+ * use_mount_api - Check whether to mount through the fd-based mount API
+ * @ctx: Container configuration containing new_mount_api
  *
- * A tmpfs is mounted at overlay_base to store the upper and work directories in
- * RAM. This has a few effects:
- * - File operations are faster (since RAM is faster than disk)
- * - No persistent filesystem state
- * - The lower layer (original rootfs) remains unchanged
+ * Return: Non-zero if the configuration asks for it and the kernel has it
+ */
+static int use_mount_api(const struct container_ctx *ctx) {
+  return ctx->new_mount_api && !mount_api_unsupported;
+}
+
+/**
+ * print_fs_log - Print the messages a filesystem left in its context
+ * @fs_fd: Filesystem context
  *
- * Return: 0 on success, -1 on failure
+ * Messages start with "e " for errors, "w " for warnings and "i " for
+ * information. They say which option was wrong, far more than errno does.
  */
-static int mount_tmpfs(struct container_ctx *ctx) {
-  const int TMPFS_OPTS_LEN = 32;
+static void print_fs_log(int fs_fd) {
+  char message[512];
+  ssize_t len;
 
-  if (mkdir(ctx->overlay_base, 0755) == -1 && errno != EEXIST) {
-    fprintf(stderr, "Failed to create overlayfs base directory: %s\n",
-            strerror(errno));
-    return -1;
+  while ((len = read(fs_fd, message, sizeof(message) - 1)) > 0) {
+    message[len] = '\0';
+    fprintf(stderr, "  %s\n", message);
   }
+}
 
-  char tmpfs_opts[TMPFS_OPTS_LEN];
-  snprintf(tmpfs_opts, TMPFS_OPTS_LEN, "size=%dM", ctx->tmpfs_size);
-
-  /**
-   * Everything created inside of the tmpfs lives in RAM and only exists as long
-   * as the sandbox is running.
-   */
-  if (mount("tmpfs", ctx->overlay_base, "tmpfs", 0, tmpfs_opts) == -1) {
-    fprintf(stderr, "Failed to mount tmpfs: %s\n", strerror(errno));
+/**
+ * set_fs_option - Set a string option of a filesystem context
+ * @fs_fd: Filesystem context
+ * @key: Option name
+ * @value: Option value
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+static int set_fs_option(int fs_fd, const char *key, const char *value) {
+  if (fsconfig(fs_fd, FSCONFIG_SET_STRING, key, value, 0) == -1) {
+    int saved_errno = errno;
+    fprintf(stderr, "Failed to set %s=%s: %s\n", key, value,
+            strerror(saved_errno));
+    print_fs_log(fs_fd);
+    errno = saved_errno;
     return -1;
   }
 
@@ -65,162 +113,175 @@ static int mount_tmpfs(struct container_ctx *ctx) {
 }
 
 /**
- * cleanup_overlay_dirs - Free all dynamically allocated memory in overlay_dirs
- * struct
- * @dirs: Struct containing overlay directories
+ * open_fs - Start a filesystem context
+ * @fstype: Filesystem type
  *
- * Frees all heap-allocated memory in the overlay_dirs structure. This is safe
- * to call even if initialization fails partway through since we check for NULL.
+ * Return: Filesystem context on success, -1 on failure. On kernels without
+ *         the mount API, mount_api_unsupported is set and nothing is printed
  */
-static void cleanup_overlay_dirs(struct overlay_dirs *dirs) {
-  if (dirs->overlay_work) {
-    free(dirs->overlay_work);
-  }
-
-  if (dirs->overlay_upper) {
-    free(dirs->overlay_upper);
+static int open_fs(const char *fstype) {
+  int fs_fd = fsopen(fstype, FSOPEN_CLOEXEC);
+  if (fs_fd == -1) {
+    if (errno == ENOSYS) {
+      mount_api_unsupported = 1;
+    } else {
+      fprintf(stderr, "Failed to open %s context: %s\n", fstype,
+              strerror(errno));
+    }
+    return -1;
   }
 
-  if (dirs->overlay_merged) {
-    free(dirs->overlay_merged);
+  /* Shows up in /proc/self/mountinfo the same as with mount(2) */
+  if (set_fs_option(fs_fd, "source", fstype) == -1) {
+    close(fs_fd);
+    return -1;
   }
 
-  if (dirs) {
-    free(dirs);
-  }
+  return fs_fd;
 }
 
 /**
- * construct_overlay_paths - Builds paths to work, upper, and merged dirs in
- * overlayfs
- * @ctx: Container context containing overlay base directory
+ * attach_fs - Create the filesystem of a context and mount it
+ * @fs_fd: Filesystem context with its options set, closed by us
+ * @fstype: Filesystem type, for messages
+ * @target: Directory to mount it on
  *
- * Return: Struct containing overlay paths, NULL on failure
+ * Return: 0 on success, -1 on failure with errno set
  */
-static struct overlay_dirs *construct_overlay_paths(struct container_ctx *ctx) {
-  struct overlay_dirs *dirs = {0};
-  dirs = malloc(sizeof(struct overlay_dirs));
-  if (!dirs) {
-    fprintf(stderr,
-            "Failed to allocate memory for overlay_dirs struct: %s\n",
+static int attach_fs(int fs_fd, const char *fstype, const char *target) {
+  int mnt_fd = -1;
+  int ret = -1;
+
+  if (fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1) {
+    fprintf(stderr, "Failed to create %s: %s\n", fstype, strerror(errno));
+    print_fs_log(fs_fd);
+  } else if ((mnt_fd = fsmount(fs_fd, FSMOUNT_CLOEXEC, 0)) == -1) {
+    fprintf(stderr, "Failed to mount %s: %s\n", fstype, strerror(errno));
+  } else if (move_mount(mnt_fd, "", AT_FDCWD, target,
+                        MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+    fprintf(stderr, "Failed to attach %s to %s: %s\n", fstype, target,
             strerror(errno));
-    return NULL;
+  } else {
+    ret = 0;
   }
 
-  int work_len = strlen(ctx->overlay_base) + strlen("/work") + 1;
-  dirs->overlay_work = malloc(work_len);
-  if (!dirs->overlay_work) {
-    fprintf(stderr,
-            "Failed to allocate memory for overlayfs work directory: %s\n",
-            strerror(errno));
-    cleanup_overlay_dirs(dirs);
-    return NULL;
+  int saved_errno = errno;
+  if (mnt_fd != -1) {
+    close(mnt_fd);
   }
-  snprintf(dirs->overlay_work, work_len, "%s/work", ctx->overlay_base);
+  close(fs_fd);
+  errno = saved_errno;
 
-  int upper_len = strlen(ctx->overlay_base) + strlen("/upper") + 1;
-  dirs->overlay_upper = malloc(upper_len);
-  if (!dirs->overlay_upper) {
-    fprintf(stderr,
-            "Failed to allocate memory for overlayfs upper directory: %s\n",
-            strerror(errno));
-    cleanup_overlay_dirs(dirs);
-
-    return NULL;
-  }
-  snprintf(dirs->overlay_upper, upper_len, "%s/upper", ctx->overlay_base);
+  return ret;
+}
 
-  int merged_len = strlen(ctx->overlay_base) + strlen("/merged") + 1;
-  dirs->overlay_merged = malloc(merged_len);
-  if (!dirs->overlay_merged) {
-    fprintf(stderr,
-            "Failed to allocate memory for overlayfs merged directory: %s\n",
-            strerror(errno));
-    cleanup_overlay_dirs(dirs);
-    return NULL;
+/**
+ * mount_new_fs - Mount a filesystem without options through the mount API
+ * @fstype: Filesystem type
+ * @target: Directory to mount it on
+ *
+ * Return: 0 on success, -1 on failure (check mount_api_unsupported)
+ */
+static int mount_new_fs(const char *fstype, const char *target) {
+  int fs_fd = open_fs(fstype);
+  if (fs_fd == -1) {
+    return -1;
   }
-  snprintf(dirs->overlay_merged, merged_len, "%s/merged", ctx->overlay_base);
 
-  return dirs;
+  return attach_fs(fs_fd, fstype, target);
 }
 
 /**
- * make_overlay_dirs - Create directories required by overlayfs
- * @dirs: Struct containing overlay directories
+ * set_lowerdir - Give an overlay context its lower layers
+ * @fs_fd: Overlay filesystem context
+ * @lowerdir: Lower layers, top first, separated by ':'
  *
- * Makes all of the directories required by overlayfs using the paths built by
- * construct_overlay_paths.
+ * fsconfig() takes strings of up to 255 characters, less than the mount(2)
+ * options allow for. Longer stacks are added a layer at a time with
+ * "lowerdir+", which needs Linux 6.8. Older overlayfs rejects the key with
+ * EINVAL, which sets lowerdir_append_unsupported and prints nothing.
  *
- * Return: 0 on success, -1 on failure
+ * Return: 0 on success, -1 on failure with errno set
  */
-static int make_overlay_dirs(struct overlay_dirs *dirs) {
-  if (mkdir(dirs->overlay_work, 0755) == -1) {
-    fprintf(stderr, "Failed to create overlayfs working directory: %s\n",
-            strerror(errno));
-    return -1;
+static int set_lowerdir(int fs_fd, const char *lowerdir) {
+  if (strlen(lowerdir) < FSCONFIG_STRING_MAX) {
+    return set_fs_option(fs_fd, "lowerdir", lowerdir);
   }
 
-  if (mkdir(dirs->overlay_upper, 0755) == -1) {
-    fprintf(stderr, "Failed to create overlay upper directory: %s\n",
-            strerror(errno));
+  char layers[LOWERDIR_MAX];
+  if (snprintf(layers, LOWERDIR_MAX, "%s", lowerdir) >= LOWERDIR_MAX) {
+    errno = E2BIG;
     return -1;
   }
 
-  if (mkdir(dirs->overlay_merged, 0755) == -1) {
-    fprintf(stderr, "Failed to create overlay work directory: %s\n",
-            strerror(errno));
+  char *save;
+  char *layer = strtok_r(layers, ":", &save);
+
+  /* Only the first layer can tell an unknown key from a bad layer */
+  if (layer &&
+      fsconfig(fs_fd, FSCONFIG_SET_STRING, "lowerdir+", layer, 0) == -1) {
+    int saved_errno = errno;
+    if (saved_errno == EINVAL) {
+      lowerdir_append_unsupported = 1;
+    } else {
+      fprintf(stderr, "Failed to set lowerdir+=%s: %s\n", layer,
+              strerror(saved_errno));
+      print_fs_log(fs_fd);
+    }
+    errno = saved_errno;
     return -1;
   }
 
+  while ((layer = strtok_r(NULL, ":", &save))) {
+    if (set_fs_option(fs_fd, "lowerdir+", layer) == -1) {
+      return -1;
+    }
+  }
+
   return 0;
 }
 
 /**
- * mount_overlay - Mount overlayfs with the paths previously created for it
- * @ctx: Container configuration containing rootfs path
- * @dirs: Struct containing overlay paths
- *
- * Mounts the overlay directories themselves. After mounting, the rootfs path is
- * updated to be the overlay merged directory for the sake of simplicity.
+ * mount_overlay_fd - Mount the overlay through the mount API
+ * @ctx: Container configuration containing the overlay slot
+ * @lowerdir: Lower layers
+ * @merged: Mount point
  *
- * Return: 0 on success, -1 on failure
+ * Return: 0 on success, -1 on failure (check mount_api_unsupported and
+ *         lowerdir_append_unsupported)
  */
-static int mount_overlay(struct container_ctx *ctx, struct overlay_dirs *dirs) {
-  const int mount_opts_length =
-      strlen("lowerdir=,upperdir=,workdir=") + strlen(ctx->rootfs) +
-      strlen(dirs->overlay_upper) + strlen(dirs->overlay_work) + 1;
-
-  char *mount_opts = malloc(mount_opts_length);
-  if (!mount_opts) {
-    fprintf(stderr, "Failed to allocate memory for overlay mount options: %s\n",
-            strerror(errno));
+static int mount_overlay_fd(const struct container_ctx *ctx,
+                            const char *lowerdir, const char *merged) {
+  char upper[PATH_MAX];
+  char work[PATH_MAX];
+  if (snprintf(upper, PATH_MAX, "%s/upper", ctx->overlay_dir) >= PATH_MAX ||
+      snprintf(work, PATH_MAX, "%s/work", ctx->overlay_dir) >= PATH_MAX) {
+    fprintf(stderr, "Overlay slot path is too long\n");
     return -1;
   }
 
-  snprintf(mount_opts, mount_opts_length, "lowerdir=%s,upperdir=%s,workdir=%s",
-           ctx->rootfs, dirs->overlay_upper, dirs->overlay_work);
-
-  if (mount("overlay", dirs->overlay_merged, "overlay", 0, mount_opts) == -1) {
-    fprintf(stderr, "Failed to mount overlay: %s\n", strerror(errno));
+  int fs_fd = open_fs("overlay");
+  if (fs_fd == -1) {
     return -1;
   }
 
-  free(ctx->rootfs);
-  ctx->rootfs = strdup(dirs->overlay_merged);
-  if (!ctx->rootfs) {
-    fprintf(stderr, "Failed to update rootfs pointer: %s\n", strerror(errno));
+  if (set_lowerdir(fs_fd, lowerdir) == -1 ||
+      set_fs_option(fs_fd, "upperdir", upper) == -1 ||
+      set_fs_option(fs_fd, "workdir", work) == -1) {
+    close(fs_fd);
     return -1;
   }
 
-  return 0;
+  return attach_fs(fs_fd, "overlay", merged);
 }
 
 /**
  * setup_overlay - Configure overlayfs for writable rootfs
- * @ctx: Container configuration containing paths for overlayFS
+ * @ctx: Container configuration containing rootfs and the overlay slot
+ * @merged: Set to the overlay's mount point, PATH_MAX bytes
  *
  * Creates an overlay filesystem:
- * - Lower layer: Read-only rootfs
+ * - Lower layer: Read-only rootfs, or the stack of layers in ctx->lowerdir
  * - Upper layer: Writable layer
  * - Work layer: Temporary workspace used by overlayfs for atomic operations
  * - Merged: Combined view of lower and upper that becomes the new root
@@ -231,44 +292,106 @@ static int mount_overlay(struct container_ctx *ctx, struct overlay_dirs *dirs) {
  * lower if needed) The merged directory presents a unified view where the
  * modified files in upper mask the originals in lower.
  *
- * TMPFS:
- * A tmpfs is mounted at overlay_base to store the upper and work directories in
- * RAM. This has a few effects:
+ * SLOTS:
+ * Upper, work and merged live in the overlay slot the parent claimed for us
+ * (ctx->overlay_dir), on a tmpfs it has already mounted. The tmpfs keeps the
+ * writable layer in RAM, so:
  * - File operations are faster (since RAM is faster than disk)
- * - No persistent filesystem state
+ * - No persistent filesystem state, the parent resets the slot after we exit
  * - The lower layer (original rootfs) remains unchanged
+ * That leaves a single mount for us to do, and nothing to allocate.
  *
  * Return: 0 on success, -1 on failure
  */
-int setup_overlay(struct container_ctx *ctx) {
-  if (mount_tmpfs(ctx) == -1) {
+int setup_overlay(const struct container_ctx *ctx, char *merged) {
+  if (snprintf(merged, PATH_MAX, "%s/merged", ctx->overlay_dir) >= PATH_MAX) {
+    fprintf(stderr, "Overlay slot path is too long\n");
     return -1;
   }
 
-  struct overlay_dirs *dirs = {0};
-  dirs = construct_overlay_paths(ctx);
-  if (!dirs) {
+  /*
+   * Layers from the store are named relative to it, which keeps the options
+   * short enough for a deep stack of layers.
+   */
+  if (ctx->layers[0] != '\0' && chdir(ctx->layer_store) == -1) {
+    fprintf(stderr, "Failed to navigate to %s: %s\n", ctx->layer_store,
+            strerror(errno));
     return -1;
   }
+  const char *lowerdir = ctx->lowerdir ? ctx->lowerdir : ctx->rootfs;
+
+  if (use_mount_api(ctx)) {
+    if (mount_overlay_fd(ctx, lowerdir, merged) == 0) {
+      return 0;
+    }
+    if (!mount_api_unsupported && !lowerdir_append_unsupported) {
+      return -1;
+    }
+  }
 
-  if (make_overlay_dirs(dirs) == -1) {
-    cleanup_overlay_dirs(dirs);
+  char mount_opts[LOWERDIR_MAX + 2 * PATH_MAX];
+  int len = snprintf(mount_opts, sizeof(mount_opts),
+                     "lowerdir=%s,upperdir=%s/upper,workdir=%s/work",
+                     lowerdir, ctx->overlay_dir, ctx->overlay_dir);
+  if (len >= (int)sizeof(mount_opts)) {
+    fprintf(stderr, "Overlay mount options are too long\n");
     return -1;
   }
 
-  if (mount_overlay(ctx, dirs) == -1) {
-    cleanup_overlay_dirs(dirs);
+  if (mount("overlay", merged, "overlay", 0, mount_opts) == -1) {
+    fprintf(stderr, "Failed to mount overlay: %s\n", strerror(errno));
     return -1;
   }
 
-  cleanup_overlay_dirs(dirs);
+  return 0;
+}
+
+/**
+ * make_root_mount - Make sure the new root is a mount point of its own
+ * @ctx: Container configuration containing overlay and new_mount_api
+ * @root: Directory to make the new root
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int make_root_mount(const struct container_ctx *ctx, const char *root) {
+  if (use_mount_api(ctx)) {
+    /* The overlay was just mounted at root, so it's a mount point already */
+    if (ctx->overlay) {
+      return 0;
+    }
+
+    int tree_fd = open_tree(AT_FDCWD, root,
+                            OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree_fd != -1) {
+      int ret = move_mount(tree_fd, "", AT_FDCWD, root, MOVE_MOUNT_F_EMPTY_PATH);
+      if (ret == -1) {
+        fprintf(stderr, "Failed to attach a clone of %s onto itself: %s\n",
+                root, strerror(errno));
+      }
+      close(tree_fd);
+      return ret;
+    }
+
+    if (errno != ENOSYS) {
+      fprintf(stderr, "Failed to clone %s: %s\n", root, strerror(errno));
+      return -1;
+    }
+  }
+
+  if (mount(root, root, "bind", MS_BIND | MS_REC, NULL) == -1) {
+    fprintf(stderr, "Failed to setup bind-mount rootfs onto itself: %s\n",
+            strerror(errno));
+    return -1;
+  }
 
   return 0;
 }
 
 /**
  * setup_rootfs - Change root filesystem using pivot_root
- * @ctx: Container configuration containing rootfs path
+ * @ctx: Container configuration containing overlay and new_mount_api
+ * @root: Directory to make the new root, the overlay's merged directory or
+ *        rootfs itself
  *
  * Replaces the current root filesystem with a new one, completely isolating the
  * container's filesystem view from the host. Uses pivot_root instead of chroot
@@ -278,38 +401,29 @@ int setup_overlay(struct container_ctx *ctx) {
  * "/" is resolved without actually change the root mount.
  *
  * WORKFLOW:
- * - Bind mount rootfs onto itself (required by pivot_root)
- * - Create temporary directory for old root
- * - Call pivot_root
- * - chdir("/") to move to new root
+ * - Bind mount rootfs onto itself (required by pivot_root), unless it's the
+ *   overlay mounted through the mount API
+ * - chdir() into it
+ * - Call pivot_root(".", "."), which stacks the old root on the new one
  * - Unmount old root (removes access to host filesystem)
- * - Remove temporary directory
+ * - chdir("/") to move to new root
  *
  * pivot_root requires new_root to be a mount point. Bind mounting it onto
  * itself makes it a mount point if it wasn't already.
  *
  * Return: 0 on success, -1 on failure
  */
-int setup_rootfs(struct container_ctx *ctx) {
-  if (mount(ctx->rootfs, ctx->rootfs, "bind", MS_BIND | MS_REC, NULL) == -1) {
-    fprintf(stderr, "Failed to setup bind-mount rootfs onto itself: %s\n",
-            strerror(errno));
+int setup_rootfs(const struct container_ctx *ctx, const char *root) {
+  if (make_root_mount(ctx, root) == -1) {
     return -1;
   }
 
   /*
-   * put_old is the location we'll store the old rootfs at before we unmount it
+   * pivot_root(".", ".") below works on the current directory, which has to
+   * be the new root.
    */
-  char put_old[PATH_MAX];
-  snprintf(put_old, PATH_MAX, "%s/.pivot_old", ctx->rootfs);
-
-  /*
-   * Create the directory to store the old root.
-   * EEXIST is okay here, directory might exist from a previous run.
-   */
-  if (mkdir(put_old, 0700) == -1 && errno != EEXIST) {
-    fprintf(stderr, "Failed to make directory %s: %s\n", put_old,
-            strerror(errno));
+  if (chdir(root) == -1) {
+    fprintf(stderr, "Failed to navigate to %s: %s\n", root, strerror(errno));
     return -1;
   }
 
@@ -322,36 +436,37 @@ int setup_rootfs(struct container_ctx *ctx) {
    * mount. This is more secure than chroot because it actually changes the root
    * mount and allows us to unmount the old root, removing access to it
    * entirely.
+   *
+   * Passing "." for both stacks the old root on top of the new one, instead
+   * of moving it to a directory inside the new root. That way we don't have
+   * to create a put_old directory in the rootfs, which containers sharing a
+   * rootfs without an overlay would race on.
    */
-  if (syscall(SYS_pivot_root, ctx->rootfs, put_old) == -1) {
+  if (syscall(SYS_pivot_root, ".", ".") == -1) {
     fprintf(stderr, "Failed to change root mount: %s\n", strerror(errno));
     return -1;
   }
 
-  /* Navigate to our new root directory */
-  if (chdir("/") == -1) {
-    fprintf(stderr, "Failed to navigate to new root directory: %s\n",
-            strerror(errno));
-    return -1;
-  }
-
   /*
    * Unmounting the old root means that the container can't see the host
    * filesystem. umount2 differs from umount in that it supports flags. The
    * MNT_DETACH flag means "detach the mount immediately, even if busy, and
    * clean up once no references remain".
    *
+   * The old root is the top mount at "." now, so that's what gets unmounted,
+   * revealing the new root underneath.
+   *
    * This is important for security, because it fully isolates the container
    * from the host filesystem.
    */
-  if (umount2("/.pivot_old", MNT_DETACH) == -1) {
+  if (umount2(".", MNT_DETACH) == -1) {
     fprintf(stderr, "Failed to unmount old root: %s\n", strerror(errno));
     return -1;
   }
 
-  /* We don't need the temp directory anymore so we remove it */
-  if (rmdir("/.pivot_old") == -1) {
-    fprintf(stderr, "Failed to remove temporary directory: %s\n",
+  /* Navigate to our new root directory */
+  if (chdir("/") == -1) {
+    fprintf(stderr, "Failed to navigate to new root directory: %s\n",
             strerror(errno));
     return -1;
   }
@@ -361,6 +476,7 @@ int setup_rootfs(struct container_ctx *ctx) {
 
 /**
  * mount_dev - Mount /dev filesystem
+ * @ctx: Container configuration containing new_mount_api
  *
  * Mounts a devtmpfs filesystem at /dev to provide access to device files. The
  * container's /dev is isolated from the host's /dev because we're in a mount
@@ -373,7 +489,16 @@ int setup_rootfs(struct container_ctx *ctx) {
  *
  * Return: 0 on success, -1 on failure
  */
-int mount_dev(void) {
+int mount_dev(const struct container_ctx *ctx) {
+  if (use_mount_api(ctx)) {
+    if (mount_new_fs("devtmpfs", "/dev") == 0) {
+      return 0;
+    }
+    if (!mount_api_unsupported) {
+      return -1;
+    }
+  }
+
   if (mount("devtmpfs", "/dev", "devtmpfs", 0, "") == -1) {
     fprintf(stderr, "Failed to mount devtmpfs: %s\n", strerror(errno));
     return -1;
@@ -382,10 +507,54 @@ int mount_dev(void) {
   return 0;
 }
 
+/**
+ * mount_devpts - Mount a devpts instance of the container's own at /dev/pts
+ * @ctx: Container configuration containing new_mount_api
+ *
+ * The minimal /dev links ptmx to pts/ptmx, which only exists once devpts is
+ * mounted. A new instance has none of the host's ptys, and ptmxmode=0666
+ * lets the container's processes open its ptmx without capabilities.
+ * Unlike devtmpfs, devpts can be mounted inside a user namespace.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_devpts(const struct container_ctx *ctx) {
+  if (use_mount_api(ctx)) {
+    int fs_fd = open_fs("devpts");
+    if (fs_fd != -1) {
+      if (fsconfig(fs_fd, FSCONFIG_SET_FLAG, "newinstance", NULL, 0) == -1) {
+        fprintf(stderr, "Failed to set newinstance: %s\n", strerror(errno));
+        print_fs_log(fs_fd);
+        close(fs_fd);
+        return -1;
+      }
+      if (set_fs_option(fs_fd, "ptmxmode", "0666") == -1 ||
+          set_fs_option(fs_fd, "mode", "0620") == -1) {
+        close(fs_fd);
+        return -1;
+      }
+      return attach_fs(fs_fd, "devpts", "/dev/pts");
+    }
+    if (!mount_api_unsupported) {
+      return -1;
+    }
+  }
+
+  if (mount("devpts", "/dev/pts", "devpts", 0,
+            "newinstance,ptmxmode=0666,mode=0620") == -1) {
+    fprintf(stderr, "Failed to mount devpts: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * mount_proc - Mount /proc filesystem
+ * @ctx: Container configuration containing new_mount_api
+ * @target: Where to mount it, "/proc" once the new root is in place
  *
- * Mounts a proc filesystem at /proc. Because we're in a PID namespace, this
+ * Mounts a proc filesystem at target. Because we're in a PID namespace, this
  * /proc shows only processes in our namespace rather than host processes.
  *
  * PROC FILESYSTEM:
@@ -398,10 +567,25 @@ int mount_dev(void) {
  * Many programs read /proc to get process information. The PID namespace
  * ensures that they only see container processes.
  *
+ * USER NAMESPACES:
+ * Inside a user namespace, the kernel only allows a proc mount while our
+ * mount namespace still has a fully visible one, so that the new one reveals
+ * nothing that's hidden. After pivot_root() there is none left, so a
+ * container in a user namespace mounts it at {root}/proc beforehand.
+ *
  * Return: 0 on success, -1 on failure
  */
-int mount_proc(void) {
-  if (mount("proc", "/proc", "proc", 0, NULL) == -1) {
+int mount_proc(const struct container_ctx *ctx, const char *target) {
+  if (use_mount_api(ctx)) {
+    if (mount_new_fs("proc", target) == 0) {
+      return 0;
+    }
+    if (!mount_api_unsupported) {
+      return -1;
+    }
+  }
+
+  if (mount("proc", target, "proc", 0, NULL) == -1) {
     fprintf(stderr, "Failed to mount proc: %s\n", strerror(errno));
     return -1;
   }
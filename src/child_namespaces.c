@@ -12,7 +12,9 @@
  * isolation, we make the root mount private via the MS_PRIVATE option.
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mount.h>
@@ -71,3 +73,26 @@ int setup_mount_propagation(void) {
 
   return 0;
 }
+
+/**
+ * join_network_namespace - Move into the network slot's namespace
+ * @ctx: Container configuration with netns_fd, which gets closed
+ *
+ * The namespace was configured by the parent (see network.h), so joining it
+ * is all that's left. We still hold every capability at this point, which
+ * setns() needs for network namespaces.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int join_network_namespace(struct container_ctx *ctx) {
+  if (setns(ctx->netns_fd, CLONE_NEWNET) == -1) {
+    fprintf(stderr, "Failed to join network namespace: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  close(ctx->netns_fd);
+  ctx->netns_fd = -1;
+
+  return 0;
+}
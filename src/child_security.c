@@ -158,10 +158,91 @@ int lock_capabilities(void) {
  * Return: 0 on success, -1 on failure
  */
 int apply_seccomp(void) {
-  if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, get_fprog(), 0, 0) == -1) {
+  const struct sock_fprog *fprog = get_fprog();
+  if (!fprog) {
+    return -1;
+  }
+
+  if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, fprog, 0, 0) == -1) {
     fprintf(stderr, "Failed to install seccomp filter: %s\n", strerror(errno));
     return -1;
   }
 
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * apply_seccomp_profiler - Install the syscall profiling filter
+ * @report_fd: Write end of the pipe used to report the listener fd
+ *
+ * Installs the filter from get_profiler_fprog() with
+ * SECCOMP_FILTER_FLAG_NEW_LISTENER, which makes the kernel return a listener
+ * file descriptor. Every syscall the child makes from here on is reported on
+ * this listener and blocks until the parent answers it.
+ *
+ * The parent can't see our file descriptor table, so we write the listener's
+ * fd number to report_fd and let the parent pull it over with pidfd_getfd().
+ * The profiling filter lets exactly this write through without a notification,
+ * since nobody is listening yet.
+ *
+ * This has to happen through the seccomp() syscall rather than prctl(),
+ * because prctl() can't pass filter flags. It must be called before
+ * apply_seccomp(), since the regular filter doesn't allow seccomp().
+ *
+ * The listener is created with O_CLOEXEC, so the target program never sees
+ * it.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int apply_seccomp_profiler(int report_fd) {
+  int listener_fd =
+      syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+              SECCOMP_FILTER_FLAG_NEW_LISTENER, get_profiler_fprog(report_fd));
+  if (listener_fd == -1) {
+    fprintf(stderr, "Failed to install seccomp profiler: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  if (write(report_fd, &listener_fd, sizeof(listener_fd)) == -1) {
+    fprintf(stderr, "Failed to report seccomp listener: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * apply_seccomp_supervised - Install the syscall filter with a supervisor
+ * @report_fd: Write end of the pipe used to report the listener fd
+ *
+ * Like apply_seccomp_profiler(), the filter is installed with seccomp() and
+ * SECCOMP_FILTER_FLAG_NEW_LISTENER, and the listener's fd number is written
+ * to report_fd for the parent to pull over with pidfd_getfd(). The write is
+ * allowed by the filter itself. execve() is supervised, so our exec waits
+ * for the supervisor, which by then holds its own copy of the listener.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int apply_seccomp_supervised(int report_fd) {
+  const struct sock_fprog *fprog = get_fprog();
+  if (!fprog) {
+    return -1;
+  }
+
+  int listener_fd = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                            SECCOMP_FILTER_FLAG_NEW_LISTENER, fprog);
+  if (listener_fd == -1) {
+    fprintf(stderr, "Failed to install seccomp filter: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (write(report_fd, &listener_fd, sizeof(listener_fd)) == -1) {
+    fprintf(stderr, "Failed to report seccomp listener: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
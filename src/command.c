@@ -0,0 +1,177 @@
+/**
+ * command.c
+ *
+ * Command vectors that can be handed to a container after it was spawned.
+ *
+ * OVERVIEW:
+ * Builds execvp()-ready argument vectors from lines of text and moves them
+ * across the parent-child synchronization pipe.
+ *
+ * receive_command() runs in the child after the seccomp filter has been
+ * installed, so it sticks to read() and doesn't allocate.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command.h"
+
+/**
+ * build_argv - Point argv at each packed argument in buf
+ * @cmd: Command whose buf and len are already filled in
+ *
+ * Return: Number of arguments on success, -1 if buf is malformed
+ */
+static int build_argv(struct command *cmd) {
+  int argc = 0;
+  uint32_t pos = 0;
+
+  while (pos < cmd->len) {
+    if (argc == COMMAND_ARGS_MAX) {
+      return -1;
+    }
+
+    cmd->argv[argc++] = &cmd->buf[pos];
+
+    const char *end = memchr(&cmd->buf[pos], '\0', cmd->len - pos);
+    if (!end) {
+      return -1;
+    }
+    pos = end - cmd->buf + 1;
+  }
+
+  cmd->argv[argc] = NULL;
+
+  return argc;
+}
+
+/**
+ * command_from_line - Split a line of text into a command
+ * @cmd: Command to fill in
+ * @line: Arguments separated by spaces or tabs, may end in a newline
+ *
+ * Return: Number of arguments on success (0 for a blank line), -1 if the line
+ * has too many arguments or is too long
+ */
+int command_from_line(struct command *cmd, const char *line) {
+  cmd->len = 0;
+
+  while (*line) {
+    size_t skip = strspn(line, " \t\n");
+    line += skip;
+
+    size_t arg_len = strcspn(line, " \t\n");
+    if (arg_len == 0) {
+      break;
+    }
+
+    if (cmd->len + arg_len + 1 > COMMAND_MAX) {
+      fprintf(stderr, "Command is longer than %zu bytes\n", COMMAND_MAX);
+      return -1;
+    }
+
+    memcpy(&cmd->buf[cmd->len], line, arg_len);
+    cmd->len += arg_len;
+    cmd->buf[cmd->len++] = '\0';
+    line += arg_len;
+  }
+
+  int argc = build_argv(cmd);
+  if (argc == -1) {
+    fprintf(stderr, "Command has more than %d arguments\n", COMMAND_ARGS_MAX);
+  }
+
+  return argc;
+}
+
+/**
+ * send_command - Write a command to a pipe
+ * @fd: Write end of the pipe
+ * @cmd: Command to send
+ *
+ * The length and the arguments go out in a single write() of at most
+ * PIPE_BUF bytes, so the reader never sees half a message.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int send_command(int fd, const struct command *cmd) {
+  char msg[PIPE_BUF];
+
+  memcpy(msg, &cmd->len, sizeof(cmd->len));
+  memcpy(msg + sizeof(cmd->len), cmd->buf, cmd->len);
+
+  ssize_t msg_len = sizeof(cmd->len) + cmd->len;
+  if (write(fd, msg, msg_len) != msg_len) {
+    fprintf(stderr, "Failed to send command: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * read_full - Read exactly len bytes unless the pipe closes first
+ * @fd: File descriptor to read from
+ * @buf: Buffer to read into
+ * @len: Number of bytes to read
+ *
+ * Return: Number of bytes read (less than len only on EOF), -1 on failure
+ */
+static ssize_t read_full(int fd, void *buf, size_t len) {
+  size_t total = 0;
+
+  while (total < len) {
+    ssize_t bytes = read(fd, (char *)buf + total, len - total);
+    if (bytes == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (bytes == 0) {
+      break;
+    }
+
+    total += bytes;
+  }
+
+  return total;
+}
+
+/**
+ * receive_command - Read a command from a pipe
+ * @fd: Read end of the pipe
+ * @cmd: Command to fill in
+ *
+ * Return: 1 if a command was received, 0 if the pipe was closed first, -1 on
+ * failure
+ */
+int receive_command(int fd, struct command *cmd) {
+  ssize_t bytes = read_full(fd, &cmd->len, sizeof(cmd->len));
+  if (bytes == 0) {
+    return 0;
+  }
+
+  if (bytes != sizeof(cmd->len) || cmd->len == 0 || cmd->len > COMMAND_MAX) {
+    fprintf(stderr, "Failed to read command header: %s\n",
+            bytes == -1 ? strerror(errno) : "malformed message");
+    return -1;
+  }
+
+  bytes = read_full(fd, cmd->buf, cmd->len);
+  if (bytes != (ssize_t)cmd->len) {
+    fprintf(stderr, "Failed to read command: %s\n",
+            bytes == -1 ? strerror(errno) : "truncated message");
+    return -1;
+  }
+
+  if (build_argv(cmd) <= 0) {
+    fprintf(stderr, "Received malformed command\n");
+    return -1;
+  }
+
+  return 1;
+}
@@ -0,0 +1,488 @@
+/**
+ * config.c
+ *
+ * Runtime configuration of the container.
+ *
+ * OVERVIEW:
+ * Every key maps to a field of container_ctx and a value type in config_keys.
+ * Values are validated completely before the field is touched, so a rejected
+ * assignment leaves the previous value in place.
+ *
+ * Nothing here is compiled into locked-down builds (EUCLID_LOCKED).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "config.h"
+#include "context.h"
+
+#ifndef EUCLID_LOCKED
+
+/**
+ * LINE_MAX_LEN - Longest line accepted in a configuration file
+ */
+#define LINE_MAX_LEN 4096
+
+/**
+ * enum config_type - How the value of a key is parsed
+ * @CONFIG_STRING: Copied as is into a char * field
+ * @CONFIG_COMMAND: Split into arguments, replaces ctx->cmd
+ * @CONFIG_SIZE: Size in bytes with an optional suffix into a long long field
+ * @CONFIG_NUMBER: Positive number into an int field
+ * @CONFIG_BOOL: "yes" or "no" into an int field
+ * @CONFIG_NAMESPACES: Comma-separated namespace names into ctx->namespaces
+ */
+enum config_type {
+  CONFIG_STRING,
+  CONFIG_COMMAND,
+  CONFIG_SIZE,
+  CONFIG_NUMBER,
+  CONFIG_BOOL,
+  CONFIG_NAMESPACES,
+};
+
+/**
+ * struct config_key - A configurable field of container_ctx
+ * @name: Key used in configuration files and -s
+ * @type: How the value is parsed
+ * @offset: Offset of the field in struct container_ctx
+ * @unlimited: Whether "max" is accepted, stored as -1
+ */
+struct config_key {
+  const char *name;
+  enum config_type type;
+  size_t offset;
+  int unlimited;
+};
+
+/**
+ * config_keys - Every key that can be set at runtime
+ *
+ * mem_max isn't set through its offset, see apply_value().
+ */
+static const struct config_key config_keys[] = {
+    {"hostname", CONFIG_STRING, offsetof(struct container_ctx, hostname), 0},
+    {"rootfs", CONFIG_STRING, offsetof(struct container_ctx, rootfs), 0},
+    {"layers", CONFIG_STRING, offsetof(struct container_ctx, layers), 0},
+    {"layer_store", CONFIG_STRING,
+     offsetof(struct container_ctx, layer_store), 0},
+    {"cmd", CONFIG_COMMAND, offsetof(struct container_ctx, cmd), 0},
+    {"cgroup_parent", CONFIG_STRING,
+     offsetof(struct container_ctx, cgroup_parent), 0},
+    {"cpu_max", CONFIG_STRING, offsetof(struct container_ctx, cpu_max), 0},
+    {"mem_max", CONFIG_SIZE, offsetof(struct container_ctx, mem_max), 1},
+    {"mem_high", CONFIG_SIZE, offsetof(struct container_ctx, mem_high), 1},
+    {"mem_high_min", CONFIG_SIZE, offsetof(struct container_ctx, mem_high_min),
+     0},
+    {"mem_high_max", CONFIG_SIZE, offsetof(struct container_ctx, mem_high_max),
+     0},
+    {"mem_swap_max", CONFIG_SIZE, offsetof(struct container_ctx, mem_swap_max),
+     1},
+    {"pids_max", CONFIG_NUMBER, offsetof(struct container_ctx, pids_max), 1},
+    {"cpuset_cpus", CONFIG_STRING, offsetof(struct container_ctx, cpuset_cpus),
+     0},
+    {"cpuset_mems", CONFIG_STRING, offsetof(struct container_ctx, cpuset_mems),
+     0},
+    {"cpuset_partition", CONFIG_STRING,
+     offsetof(struct container_ctx, cpuset_partition), 0},
+    {"numa_spread", CONFIG_BOOL, offsetof(struct container_ctx, numa_spread),
+     0},
+    {"overlay_base", CONFIG_STRING,
+     offsetof(struct container_ctx, overlay_base), 0},
+    {"tmpfs_size", CONFIG_NUMBER, offsetof(struct container_ctx, tmpfs_size),
+     0},
+    {"tmpfs_huge", CONFIG_STRING, offsetof(struct container_ctx, tmpfs_huge),
+     0},
+    {"tmpfs_mpol", CONFIG_STRING, offsetof(struct container_ctx, tmpfs_mpol),
+     0},
+    {"tmpfs_nr_inodes", CONFIG_NUMBER,
+     offsetof(struct container_ctx, tmpfs_nr_inodes), 1},
+    {"namespaces", CONFIG_NAMESPACES,
+     offsetof(struct container_ctx, namespaces), 0},
+    {"overlay", CONFIG_BOOL, offsetof(struct container_ctx, overlay), 0},
+    {"seccomp", CONFIG_BOOL, offsetof(struct container_ctx, seccomp), 0},
+    {"policy", CONFIG_STRING, offsetof(struct container_ctx, policy), 0},
+    {"supervise", CONFIG_BOOL, offsetof(struct container_ctx, supervise), 0},
+    {"minimal_dev", CONFIG_BOOL, offsetof(struct container_ctx, minimal_dev),
+     0},
+    {"mount_dev", CONFIG_BOOL, offsetof(struct container_ctx, mount_dev), 0},
+    {"mount_proc", CONFIG_BOOL, offsetof(struct container_ctx, mount_proc), 0},
+    {"new_mount_api", CONFIG_BOOL,
+     offsetof(struct container_ctx, new_mount_api), 0},
+    {"vfork", CONFIG_BOOL, offsetof(struct container_ctx, vfork), 0},
+    {"network", CONFIG_BOOL, offsetof(struct container_ctx, network), 0},
+    {"bridge", CONFIG_STRING, offsetof(struct container_ctx, bridge), 0},
+    {"subnet", CONFIG_STRING, offsetof(struct container_ctx, subnet), 0},
+    {"criu", CONFIG_STRING, offsetof(struct container_ctx, criu), 0},
+    {"lazy_restore", CONFIG_BOOL, offsetof(struct container_ctx, lazy_restore),
+     0},
+    {"freeze_idle", CONFIG_NUMBER, offsetof(struct container_ctx, freeze_idle),
+     1},
+    {"idle_reclaim", CONFIG_BOOL, offsetof(struct container_ctx, idle_reclaim),
+     0},
+    {"output_buffer", CONFIG_SIZE,
+     offsetof(struct container_ctx, output_buffer), 0},
+};
+
+/**
+ * struct namespace_name - An optional namespace
+ * @name: Name used in the namespaces key
+ * @flag: CLONE_NEW* flag of the namespace
+ */
+struct namespace_name {
+  const char *name;
+  int flag;
+};
+
+/**
+ * namespace_names - Namespaces that can be turned off
+ *
+ * The mount namespace isn't one of them, see NAMESPACES in context.c.
+ */
+static const struct namespace_name namespace_names[] = {
+    {"uts", CLONE_NEWUTS},
+    {"pid", CLONE_NEWPID},
+    {"net", CLONE_NEWNET},
+    {"ipc", CLONE_NEWIPC},
+    {"user", CLONE_NEWUSER},
+};
+
+/**
+ * NUM_CONFIG_KEYS - Number of elements in config_keys
+ */
+static const unsigned int NUM_CONFIG_KEYS =
+    sizeof(config_keys) / sizeof(config_keys[0]);
+
+/**
+ * find_key - Look up a key by name
+ * @name: Name of the key
+ *
+ * Return: The key on success, NULL if there is no such key
+ */
+static const struct config_key *find_key(const char *name) {
+  for (unsigned int i = 0; i < NUM_CONFIG_KEYS; i++) {
+    if (strcmp(config_keys[i].name, name) == 0) {
+      return &config_keys[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * parse_size - Parse a size with an optional K, M, G or T suffix
+ * @value: Text to parse
+ * @size: Where to store the size in bytes
+ *
+ * Return: 0 on success, -1 if value isn't a valid size
+ */
+static int parse_size(const char *value, long long *size) {
+  char *end;
+
+  errno = 0;
+  long long number = strtoll(value, &end, 10);
+  if (errno || end == value || number < 0) {
+    return -1;
+  }
+
+  int shift = 0;
+  if (*end) {
+    const char *suffix = strchr("KMGT", *end);
+    if (!suffix || end[1]) {
+      return -1;
+    }
+    shift = 10 * (suffix - "KMGT" + 1);
+  }
+
+  if (number > LLONG_MAX >> shift) {
+    return -1;
+  }
+
+  *size = number << shift;
+
+  return 0;
+}
+
+/**
+ * parse_number - Parse a positive number that fits an int
+ * @value: Text to parse
+ * @number: Where to store the number
+ *
+ * Return: 0 on success, -1 if value isn't a valid number
+ */
+static int parse_number(const char *value, int *number) {
+  char *end;
+
+  errno = 0;
+  long parsed = strtol(value, &end, 10);
+  if (errno || end == value || *end || parsed <= 0 || parsed > INT_MAX) {
+    return -1;
+  }
+
+  *number = (int)parsed;
+
+  return 0;
+}
+
+/**
+ * parse_namespaces - Parse a comma-separated list of namespace names
+ * @value: Text to parse, empty for none
+ * @namespaces: Where to store the CLONE_NEW* flags
+ *
+ * Return: 0 on success, -1 if value names an unknown namespace
+ */
+static int parse_namespaces(const char *value, int *namespaces) {
+  int flags = 0;
+
+  while (*value) {
+    size_t len = strcspn(value, ",");
+    unsigned int i;
+
+    for (i = 0; i < sizeof(namespace_names) / sizeof(namespace_names[0]);
+         i++) {
+      if (strlen(namespace_names[i].name) == len &&
+          strncmp(namespace_names[i].name, value, len) == 0) {
+        flags |= namespace_names[i].flag;
+        break;
+      }
+    }
+
+    if (i == sizeof(namespace_names) / sizeof(namespace_names[0])) {
+      return -1;
+    }
+
+    value += len;
+    if (*value == ',') {
+      value++;
+    }
+  }
+
+  *namespaces = flags;
+
+  return 0;
+}
+
+/**
+ * apply_value - Parse a value and store it in its field
+ * @ctx: Container context to configure
+ * @key: Key being set
+ * @value: Value with surrounding whitespace already trimmed
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int apply_value(struct container_ctx *ctx, const struct config_key *key,
+                       const char *value) {
+  char *field = (char *)ctx + key->offset;
+
+  if (key->unlimited && strcmp(value, "max") == 0) {
+    if (key->type == CONFIG_NUMBER) {
+      *(int *)field = -1;
+    } else if (field == (char *)&ctx->mem_max) {
+      set_ctx_mem_max(ctx, -1);
+    } else {
+      *(long long *)field = -1;
+    }
+    return 0;
+  }
+
+  switch (key->type) {
+  case CONFIG_STRING: {
+    if (!*value) {
+      fprintf(stderr, "%s must not be empty\n", key->name);
+      return -1;
+    }
+
+    char *copy = strdup(value);
+    if (!copy) {
+      fprintf(stderr, "Failed to duplicate string for %s: %s\n", key->name,
+              strerror(errno));
+      return -1;
+    }
+
+    free(*(char **)field);
+    *(char **)field = copy;
+    return 0;
+  }
+
+  case CONFIG_COMMAND: {
+    struct command cmd;
+    if (command_from_line(&cmd, value) == -1) {
+      return -1;
+    }
+    return set_ctx_cmd(ctx, cmd.argv);
+  }
+
+  case CONFIG_SIZE: {
+    long long size;
+    if (parse_size(value, &size) == -1) {
+      fprintf(stderr, "Invalid size for %s: %s\n", key->name, value);
+      return -1;
+    }
+
+    /* The limits derived from mem_max follow it */
+    if (field == (char *)&ctx->mem_max) {
+      set_ctx_mem_max(ctx, size);
+    } else {
+      *(long long *)field = size;
+    }
+    return 0;
+  }
+
+  case CONFIG_NUMBER: {
+    int number;
+    if (parse_number(value, &number) == -1) {
+      fprintf(stderr, "Invalid number for %s: %s\n", key->name, value);
+      return -1;
+    }
+
+    *(int *)field = number;
+    return 0;
+  }
+
+  case CONFIG_BOOL:
+    if (strcmp(value, "yes") == 0) {
+      *(int *)field = 1;
+    } else if (strcmp(value, "no") == 0) {
+      *(int *)field = 0;
+    } else {
+      fprintf(stderr, "%s must be yes or no, got: %s\n", key->name, value);
+      return -1;
+    }
+    return 0;
+
+  case CONFIG_NAMESPACES:
+    if (parse_namespaces(value, (int *)field) == -1) {
+      fprintf(stderr, "Invalid namespaces, expected a list of uts, pid, "
+                      "net, ipc and user: %s\n",
+              value);
+      return -1;
+    }
+    return 0;
+  }
+
+  return -1;
+}
+
+/**
+ * trim - Strip leading and trailing whitespace in place
+ * @text: Text to trim
+ *
+ * Return: Pointer to the first non-whitespace character of text
+ */
+static char *trim(char *text) {
+  text += strspn(text, " \t\n");
+
+  size_t len = strlen(text);
+  while (len && strchr(" \t\n", text[len - 1])) {
+    text[--len] = '\0';
+  }
+
+  return text;
+}
+
+/**
+ * set_assignment - Apply a "key=value" assignment, modifying it in place
+ * @ctx: Container context to configure
+ * @assignment: Key and value separated by '='
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int set_assignment(struct container_ctx *ctx, char *assignment) {
+  char *separator = strchr(assignment, '=');
+  if (!separator) {
+    fprintf(stderr, "Expected key=value, got: %s\n", trim(assignment));
+    return -1;
+  }
+
+  *separator = '\0';
+  const char *name = trim(assignment);
+  const char *value = trim(separator + 1);
+
+  const struct config_key *key = find_key(name);
+  if (!key) {
+    fprintf(stderr, "Unknown configuration key: %s\n", name);
+    return -1;
+  }
+
+  return apply_value(ctx, key, value);
+}
+
+/**
+ * config_set - Apply one "key=value" assignment
+ * @ctx: Container context to configure
+ * @assignment: Key and value separated by '='
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int config_set(struct container_ctx *ctx, const char *assignment) {
+  char copy[LINE_MAX_LEN];
+
+  if (strlen(assignment) >= LINE_MAX_LEN) {
+    fprintf(stderr, "Assignment is longer than %d bytes\n", LINE_MAX_LEN - 1);
+    return -1;
+  }
+
+  strcpy(copy, assignment);
+
+  return set_assignment(ctx, copy);
+}
+
+/**
+ * config_load - Apply every assignment in a configuration file
+ * @ctx: Container context to configure
+ * @path: Path of the configuration file
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int config_load(struct container_ctx *ctx, const char *path) {
+  FILE *file = fopen(path, "re");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  char line[LINE_MAX_LEN];
+  int line_number = 0;
+  int ret = 0;
+
+  while (fgets(line, LINE_MAX_LEN, file)) {
+    line_number++;
+
+    if (!strchr(line, '\n') && !feof(file)) {
+      fprintf(stderr, "%s:%d: Line is longer than %d bytes\n", path,
+              line_number, LINE_MAX_LEN - 2);
+      ret = -1;
+      break;
+    }
+
+    char *text = trim(line);
+    if (!*text || *text == '#') {
+      continue;
+    }
+
+    if (set_assignment(ctx, text) == -1) {
+      fprintf(stderr, "%s:%d: Invalid configuration\n", path, line_number);
+      ret = -1;
+      break;
+    }
+  }
+
+  if (ret == 0 && ferror(file)) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    ret = -1;
+  }
+
+  fclose(file);
+
+  return ret;
+}
+
+#endif
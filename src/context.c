@@ -3,12 +3,12 @@
  *
  * OVERVIEW:
  * Provides initialization and cleanup for the container_ctx structure, which
- * holds all configuration parameters for the container. Configuration values
- * are defined as compile-time constants to reduce the attack surface.
+ * holds all configuration parameters for the container. The defaults are
+ * defined as compile-time constants, which config.c can override at runtime.
  *
  * DESIGN RATIONALE:
- * Using hardcoded constants instead of configuration files offers several
- * security benefits:
+ * Building with EUCLID_LOCKED leaves the hardcoded constants as the only
+ * configuration, which offers several security benefits:
  * - No file parsing attack surface
  * - No TOCTOU (time-of-check-time-of-use) races on config files
  * - No need to validate untrusted input
@@ -21,8 +21,10 @@
  * - Stack-allocated data would be invalid after clone() returns
  */
 
+#define _GNU_SOURCE
 #include "errno.h"
 #include <linux/limits.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,8 +37,9 @@
  * CONTAINER CONFIGURATION
  * ============================================================================
  *
- * These constants define the container's behavior and resource limits.
- * Modify these values and recompile to change the container's configuration.
+ * These constants define the container's default behavior and resource
+ * limits. Modify these values and recompile to change the defaults, or
+ * override them with -c and -s (see config.h).
  */
 
 /**
@@ -58,14 +61,14 @@ static const char *ROOTFS = "/home/noodle/alpine";
  * CMD - Command to execute inside the container
  *
  * The first element is the program to execute, remaining elements are
- * arguments.
+ * arguments, and the array ends with NULL.
  *
  * EXECUTION:
  * - Executed via execvp(), so PATH is searched
  * - This process becomes PID 1 in the container's PID namespace
  * - When this process exits, the container terminates
  */
-static const char *CMD[] = {"/bin/sh"};
+static char *const CMD[] = {"/bin/sh", NULL};
 
 /*
  * ============================================================================
@@ -76,6 +79,16 @@ static const char *CMD[] = {"/bin/sh"};
  * consuming excessive resources or performing fork bomb attacks.
  */
 
+/**
+ * CGROUP_PARENT - Cgroup that holds the leaf cgroup of every container
+ *
+ * Controllers are enabled in its parent, the root of the hierarchy here,
+ * which only root may do. Without root, this has to be below a subtree
+ * delegated to the user, such as the one systemd gives every user manager:
+ * /sys/fs/cgroup/user.slice/user-UID.slice/user@UID.service/euclid
+ */
+static const char *CGROUP_PARENT = "/sys/fs/cgroup/euclid";
+
 /**
  * CPU_MAX - CPU quota in cgroups v2 format
  *
@@ -90,7 +103,7 @@ static const char *CMD[] = {"/bin/sh"};
  * The container can use up to quota microseconds of CPU time per period
  * microseconds. If it exceeds this, its throttled until the next period.
  */
-static const char *CPU_MAX = "100000, 100000";
+static const char *CPU_MAX = "100000 100000";
 
 /**
  * MEM_MAX - Hard memory limit in bytes
@@ -100,10 +113,10 @@ static const char *CPU_MAX = "100000, 100000";
  *
  * This should definitely be adjusted based on the application being tested
  */
-static const int MEM_MAX = 512000000;
+static const long long MEM_MAX = 512000000;
 
 /**
- * MEM_HIGH - Soft memory limit in bytes
+ * MEM_HIGH_PERCENT - Soft memory limit in percent of MEM_MAX
  *
  * Threshold at which the kernel starts aggressively reclaiming memory from the
  * container. This is a soft limit, the container can exceed it temporarily but
@@ -111,9 +124,34 @@ static const int MEM_MAX = 512000000;
  *
  * CURRENT SETTING: 90% of MEM_MAX
  *
- * This provides a soft warning before hitting the hard limit.
+ * This provides a soft warning before hitting the hard limit. It's a share
+ * rather than a size so it follows a memory limit set at runtime.
+ */
+static const int MEM_HIGH_PERCENT = 90;
+
+/**
+ * MEM_HIGH_MIN_PERCENT - Lowest soft memory limit in percent of MEM_MAX when
+ * adapting memory.high
+ *
+ * With -a, the parent moves memory.high between MEM_HIGH_MIN_PERCENT and
+ * MEM_HIGH_MAX_PERCENT of the memory limit depending on how much the container
+ * stalls on memory (see governor.h). The container's memory above the minimum
+ * is only left alone while it needs it.
+ *
+ * CURRENT SETTING: 50% of MEM_MAX
+ */
+static const int MEM_HIGH_MIN_PERCENT = 50;
+
+/**
+ * MEM_HIGH_MAX_PERCENT - Highest soft memory limit in percent of MEM_MAX when
+ * adapting memory.high
+ *
+ * Kept below MEM_MAX, so that reclaim at memory.high still gets a chance to
+ * run before the OOM killer does.
+ *
+ * CURRENT SETTING: 95% of MEM_MAX
  */
-static const int MEM_HIGH = (int)(MEM_MAX - (MEM_MAX * 0.10));
+static const int MEM_HIGH_MAX_PERCENT = 95;
 
 /**
  * MEM_SWAP_MAX - Maximum swap usage in bytes
@@ -123,7 +161,7 @@ static const int MEM_HIGH = (int)(MEM_MAX - (MEM_MAX * 0.10));
  *
  * CURRENT SETTING: 0 (disabled)
  */
-static const int MEM_SWAP_MAX = 0;
+static const long long MEM_SWAP_MAX = 0;
 
 /**
  * PIDS_MAX - Maximum number of processes/threads
@@ -140,23 +178,340 @@ static const int MEM_SWAP_MAX = 0;
 static const int PIDS_MAX = 256;
 
 /**
- * NUM_COMMAND_ARGS - Number of elements in CMD array
+ * CPUSET_CPUS - CPUs the container may run on, in cpuset.cpus syntax such as
+ * "0-7,16-23"
  *
- * Calculated at compile time using sizeof. Used for allocating space and
- * iterating over command arguments.
+ * Empty, so the container can use every CPU of the euclid cgroup.
  */
-static const unsigned int NUM_COMMAND_ARGS = sizeof(CMD) / sizeof(CMD[0]);
+static const char *CPUSET_CPUS = "";
 
 /**
- * OVERLAY_BASE - Base directory for overlayfs
+ * CPUSET_MEMS - NUMA nodes the container may allocate memory on, in
+ * cpuset.mems syntax such as "0" or "0-1"
+ *
+ * Empty, so the container can use the memory of every node.
+ */
+static const char *CPUSET_MEMS = "";
+
+/**
+ * CPUSET_PARTITION - cpuset.cpus.partition of the container's leaf, "root"
+ * or "isolated" to give it CPUSET_CPUS exclusively
+ *
+ * Empty leaves the leaf a plain member, sharing its CPUs with its siblings.
+ */
+static const char *CPUSET_PARTITION = "";
+
+/**
+ * NUMA_SPREAD - Whether to put each container on a NUMA node of its own
+ * choosing, see numa.h
+ */
+static const int NUMA_SPREAD = 0;
+
+/**
+ * LAYERS - Layers from the layer store to use instead of ROOTFS
+ *
+ * Empty, so the overlay sits on ROOTFS unless layers are configured.
+ */
+static const char *LAYERS = "";
+
+/**
+ * LAYER_STORE - Directory of the content-addressed layer store
+ */
+static const char *LAYER_STORE = "/var/lib/euclid/layers";
+
+/**
+ * OVERLAY_BASE - Directory holding the overlay slots
+ *
+ * The slots stay mounted here after euclid exits, so they can be reused by
+ * the next run.
  */
 static const char *OVERLAY_BASE = "/tmp/euclid_overlay";
 
 /**
- * TMPFS_SIZE - Size of the tmpfs in Megabytes
+ * TMPFS_SIZE - Size of each overlay slot's tmpfs in Megabytes
  */
 static const int TMPFS_SIZE = 512;
 
+/**
+ * TMPFS_HUGE - Huge page policy of the overlay slots' tmpfs, "never",
+ * "always", "within_size" or "advise" (see tmpfs(5))
+ *
+ * Empty leaves it to the kernel, which uses normal pages unless
+ * transparent_hugepage_shmem is set on the kernel command line.
+ */
+static const char *TMPFS_HUGE = "";
+
+/**
+ * TMPFS_MPOL - NUMA memory policy of the overlay slots' tmpfs, such as
+ * "bind:0" or "prefer:1" (see tmpfs(5)), empty for the kernel's default
+ */
+static const char *TMPFS_MPOL = "";
+
+/**
+ * TMPFS_NR_INODES - Most inodes in each overlay slot's tmpfs, -1 for no
+ * limit and 0 for the kernel's default of half the number of RAM pages
+ */
+static const int TMPFS_NR_INODES = 0;
+
+/**
+ * OUTPUT_BUFFER - Size of each container output pipe in bytes when output is
+ * captured with -l
+ *
+ * This is all the output a job can get ahead of the relay before its writes
+ * block. The kernel rounds it up to a power of two pages, and only lets root
+ * go beyond /proc/sys/fs/pipe-max-size.
+ */
+static const long long OUTPUT_BUFFER = 1048576;
+
+/**
+ * free_cmd - Free a NULL-terminated command array and its strings
+ * @cmd: Command array to free, may be NULL
+ */
+static void free_cmd(char **cmd) {
+  if (!cmd) {
+    return;
+  }
+
+  for (unsigned int i = 0; cmd[i]; i++) {
+    free(cmd[i]);
+  }
+
+  free(cmd);
+}
+
+/**
+ * set_ctx_cmd - Replace the command the container runs
+ * @ctx: Container context
+ * @argv: NULL-terminated array of command and arguments, copied
+ *
+ * The new array is built completely before the old one is freed, so a failed
+ * allocation leaves the previous command in place.
+ *
+ * Return: 0 on success, -1 on failure (ctx->cmd is left unchanged)
+ */
+int set_ctx_cmd(struct container_ctx *ctx, char *const argv[]) {
+  unsigned int argc = 0;
+  while (argv[argc]) {
+    argc++;
+  }
+
+  if (argc == 0) {
+    fprintf(stderr, "Command must not be empty\n");
+    return -1;
+  }
+
+  char **cmd = calloc(argc + 1, sizeof(char *));
+  if (!cmd) {
+    fprintf(stderr, "Memory allocation failed for container_ctx->cmd: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < argc; i++) {
+    cmd[i] = strdup(argv[i]);
+    if (!cmd[i]) {
+      fprintf(stderr,
+              "Failed to duplicate string for command argument %d: %s\n", i,
+              strerror(errno));
+      free_cmd(cmd);
+      return -1;
+    }
+  }
+
+  free_cmd(ctx->cmd);
+  ctx->cmd = cmd;
+
+  return 0;
+}
+
+/**
+ * set_ctx_mem_max - Set the hard memory limit and the limits derived from it
+ * @ctx: Container context
+ * @mem_max: Hard memory limit in bytes, -1 for none
+ *
+ * Moves mem_high, mem_high_min and mem_high_max to their shares of the new
+ * limit. Without a hard limit, there is no soft limit either, and the bounds
+ * for adapting it are left as they were.
+ */
+void set_ctx_mem_max(struct container_ctx *ctx, long long mem_max) {
+  ctx->mem_max = mem_max;
+
+  if (mem_max == -1) {
+    ctx->mem_high = -1;
+    return;
+  }
+
+  ctx->mem_high = mem_max / 100 * MEM_HIGH_PERCENT;
+  ctx->mem_high_min = mem_max / 100 * MEM_HIGH_MIN_PERCENT;
+  ctx->mem_high_max = mem_max / 100 * MEM_HIGH_MAX_PERCENT;
+}
+
+/*
+ * ============================================================================
+ * ISOLATION
+ * ============================================================================
+ *
+ * These exist to measure what each layer costs (see make bench). Turning any
+ * of them off weakens the sandbox.
+ */
+
+/**
+ * NAMESPACES - Optional namespaces to create for the container
+ *
+ * The mount namespace is always created, since the rootfs setup would
+ * otherwise change the host's mounts. Without a UTS namespace the hostname
+ * is left alone, for the same reason.
+ *
+ * CURRENT SETTING: All of them
+ */
+static const int NAMESPACES =
+    CLONE_NEWUTS | CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWIPC;
+
+/**
+ * OVERLAY - Whether to put a tmpfs overlay on top of ROOTFS
+ *
+ * Without the overlay, ROOTFS is bind-mounted as it is and the container
+ * writes straight into it.
+ */
+static const int OVERLAY = 1;
+
+/**
+ * SECCOMP - Whether to install the seccomp filter
+ */
+static const int SECCOMP = 1;
+
+/**
+ * POLICY - Seccomp policy the filter is built from, one of the files in
+ * policy/ without .policy
+ *
+ * "default" suits a shell and the usual command line tools. Jobs that don't
+ * need them can run under a tighter policy, such as "compute".
+ */
+static const char *POLICY = "default";
+
+/**
+ * SUPERVISE - Whether a supervisor thread in euclid decides the few syscalls
+ * that are only safe with some arguments, such as socket()
+ *
+ * Off, so those syscalls are decided by the filter alone, like all others.
+ */
+static const int SUPERVISE = 0;
+
+/**
+ * MINIMAL_DEV - Whether /dev holds just the basic devices (see devices.h)
+ * rather than mounting devtmpfs with every device of the host
+ */
+static const int MINIMAL_DEV = 0;
+
+/**
+ * MOUNT_DEV - Whether the container gets a /dev at all
+ *
+ * Turning it off saves a mount per launch for jobs that open no devices.
+ * They then see whatever the rootfs has in /dev, usually nothing, so not even
+ * /dev/null.
+ */
+static const int MOUNT_DEV = 1;
+
+/**
+ * MOUNT_PROC - Whether /proc is mounted in the container
+ *
+ * Turning it off saves a mount per launch for jobs that don't look at
+ * processes. Programs that read /proc/self, as many runtimes do for their own
+ * limits and maps, then fail or fall back.
+ */
+static const int MOUNT_PROC = 1;
+
+/**
+ * NEW_MOUNT_API - Whether to mount through fsopen()/fsmount()/move_mount()
+ * where the kernel has them, rather than mount(2)
+ */
+static const int NEW_MOUNT_API = 1;
+
+/*
+ * ============================================================================
+ * PROCESS CREATION
+ * ============================================================================
+ */
+
+/**
+ * VFORK - Whether to spawn containers with CLONE_VM | CLONE_VFORK, sharing
+ * euclid's memory until their exec instead of copying it
+ *
+ * Off, since the parent can't go on to the next launch while a child sets
+ * itself up, and this only pays off once euclid's address space is large.
+ */
+static const int VFORK = 0;
+
+/*
+ * ============================================================================
+ * NETWORKING
+ * ============================================================================
+ */
+
+/**
+ * NETWORK - Whether the container gets a network beyond its own loopback
+ * device
+ *
+ * Off, so the network namespace keeps the container offline.
+ */
+static const int NETWORK = 0;
+
+/**
+ * BRIDGE - Host bridge the containers are connected to, created if it doesn't
+ * exist
+ */
+static const char *BRIDGE = "euclid0";
+
+/**
+ * SUBNET - IPv4 subnet of the bridge and the containers on it
+ *
+ * The bridge is the containers' gateway at the first address, 10.88.0.1.
+ * Routing or masquerading traffic beyond the bridge is up to the host.
+ */
+static const char *SUBNET = "10.88.0.0/16";
+
+/*
+ * ============================================================================
+ * CHECKPOINT/RESTORE
+ * ============================================================================
+ */
+
+/**
+ * CRIU - criu binary that -k and -r run, looked up in PATH
+ */
+static const char *CRIU = "criu";
+
+/**
+ * LAZY_RESTORE - Whether restored containers start before their memory has
+ * been read back from the image
+ *
+ * On, so a restore takes about as long no matter how large the service's heap
+ * is. Needs userfaultfd, which is in every kernel CRIU supports for this.
+ */
+static const int LAZY_RESTORE = 1;
+
+/*
+ * ============================================================================
+ * IDLE FREEZING
+ * ============================================================================
+ */
+
+/**
+ * FREEZE_IDLE - Milliseconds of idleness before a container is frozen
+ *
+ * Off (-1), since a frozen service answers nothing until something thaws it.
+ */
+static const int FREEZE_IDLE = -1;
+
+/**
+ * IDLE_RECLAIM - Whether frozen containers give their memory back
+ *
+ * On, as the point of freezing is making room for containers that do run.
+ * A frozen container's page cache is dropped, and its anonymous memory goes
+ * to swap (or zswap) as far as MEM_SWAP_MAX allows.
+ */
+static const int IDLE_RECLAIM = 1;
+
 /**
  * cleanup_ctx - Free all dynamically allocated memory in container context
  * @ctx: Container context to clean up
@@ -165,15 +520,7 @@ static const int TMPFS_SIZE = 512;
  * call even if initialization fails partway through since we check for NULL.
  */
 void cleanup_ctx(struct container_ctx *ctx) {
-  for (unsigned int i = 0; i < NUM_COMMAND_ARGS; i++) {
-    if (ctx->cmd[i]) {
-      free(ctx->cmd[i]);
-    }
-  }
-
-  if (ctx->cmd) {
-    free(ctx->cmd);
-  }
+  free_cmd(ctx->cmd);
 
   if (ctx->hostname) {
     free(ctx->hostname);
@@ -183,20 +530,71 @@ void cleanup_ctx(struct container_ctx *ctx) {
     free(ctx->rootfs);
   }
 
+  if (ctx->layers) {
+    free(ctx->layers);
+  }
+
+  if (ctx->layer_store) {
+    free(ctx->layer_store);
+  }
+
+  if (ctx->lowerdir) {
+    free(ctx->lowerdir);
+  }
+
+  if (ctx->cgroup_parent) {
+    free(ctx->cgroup_parent);
+  }
+
   if (ctx->cpu_max) {
     free(ctx->cpu_max);
   }
 
+  if (ctx->cpuset_cpus) {
+    free(ctx->cpuset_cpus);
+  }
+
+  if (ctx->cpuset_mems) {
+    free(ctx->cpuset_mems);
+  }
+
+  if (ctx->cpuset_partition) {
+    free(ctx->cpuset_partition);
+  }
+
   if (ctx->overlay_base) {
     free(ctx->overlay_base);
   }
 
+  if (ctx->tmpfs_huge) {
+    free(ctx->tmpfs_huge);
+  }
+
+  if (ctx->tmpfs_mpol) {
+    free(ctx->tmpfs_mpol);
+  }
+
+  if (ctx->policy) {
+    free(ctx->policy);
+  }
+
+  if (ctx->bridge) {
+    free(ctx->bridge);
+  }
+
+  if (ctx->subnet) {
+    free(ctx->subnet);
+  }
+
+  if (ctx->criu) {
+    free(ctx->criu);
+  }
+
   free(ctx);
 }
 
 /**
  * init_ctx - Allocate and initialize container context
- * @pipe_fds: Pipe file descriptors for parent-child synchronization
  *
  * Creates a new container_ctx structure and initializes it with values from the
  * compile-time constants. All string fields are duplicated using strdup() to
@@ -210,7 +608,7 @@ void cleanup_ctx(struct container_ctx *ctx) {
  * - Duplicate each command argument
  * - Duplicate CPU limit string
  * - Copy numeric limits
- * - Store pipe file descriptors
+ * - Mark pipe file descriptors as not yet created
  *
  * STRDUP:
  * strdup() allocates memory and copies a string. We use it instead of direct
@@ -220,14 +618,14 @@ void cleanup_ctx(struct container_ctx *ctx) {
  * - Memory management is cleaner since everything is heap-allocated
  *
  * COMMAND ARRAY:
- * The command array is NULL-terminated (execvp requirement), so we allocate
- * NUM_COMMAND_ARGS + 1 elements and set the last to NULL.
+ * The command array is NULL-terminated (execvp requirement), and so is CMD,
+ * so set_ctx_cmd() can copy it like any command given at runtime.
  *
  * Return: Pointer to initialized context on success, NULL on failure
  */
-struct container_ctx *init_ctx(int pipe_fds[2]) {
-  struct container_ctx *ctx = {0};
-  ctx = malloc(sizeof(struct container_ctx));
+struct container_ctx *init_ctx(void) {
+  /* Zeroed, so cleanup_ctx() can tell which fields were allocated */
+  struct container_ctx *ctx = calloc(1, sizeof(struct container_ctx));
   if (!ctx) {
     fprintf(stderr, "Memory allocation failed for container_ctx: %s\n",
             strerror(errno));
@@ -250,26 +648,29 @@ struct container_ctx *init_ctx(int pipe_fds[2]) {
     return NULL;
   }
 
-  ctx->cmd = malloc((NUM_COMMAND_ARGS + 1) * sizeof(char *));
-  if (!ctx->cmd) {
-    fprintf(stderr, "Memory allocation failed for container_ctx->cmd: %s\n",
+  ctx->layers = strdup(LAYERS);
+  ctx->layer_store = strdup(LAYER_STORE);
+  if (!ctx->layers || !ctx->layer_store) {
+    fprintf(stderr, "Failed to duplicate string for layers: %s\n",
             strerror(errno));
-    free(ctx);
+    cleanup_ctx(ctx);
     return NULL;
   }
 
-  for (unsigned int i = 0; i < NUM_COMMAND_ARGS; i++) {
-    ctx->cmd[i] = strdup(CMD[i]);
-    if (!ctx->cmd[i]) {
-      fprintf(stderr,
-              "Failed to duplicate string for command argument %d: %s\n", i,
-              strerror(errno));
-      cleanup_ctx(ctx);
-      return NULL;
-    }
+  ctx->lowerdir = NULL;
+
+  if (set_ctx_cmd(ctx, CMD) == -1) {
+    cleanup_ctx(ctx);
+    return NULL;
   }
 
-  ctx->cmd[NUM_COMMAND_ARGS] = NULL;
+  ctx->cgroup_parent = strdup(CGROUP_PARENT);
+  if (!ctx->cgroup_parent) {
+    fprintf(stderr, "Failed to duplicate string for cgroup_parent: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
 
   ctx->cpu_max = strdup(CPU_MAX);
   if (!ctx->cpu_max) {
@@ -279,14 +680,27 @@ struct container_ctx *init_ctx(int pipe_fds[2]) {
     return NULL;
   }
 
-  ctx->mem_high = MEM_HIGH;
-  ctx->mem_max = MEM_MAX;
+  set_ctx_mem_max(ctx, MEM_MAX);
+  ctx->adapt_mem_high = 0;
   ctx->mem_swap_max = MEM_SWAP_MAX;
 
   ctx->pids_max = PIDS_MAX;
 
-  ctx->pipe_fds[0] = pipe_fds[0];
-  ctx->pipe_fds[1] = pipe_fds[1];
+  ctx->cpuset_cpus = strdup(CPUSET_CPUS);
+  ctx->cpuset_mems = strdup(CPUSET_MEMS);
+  ctx->cpuset_partition = strdup(CPUSET_PARTITION);
+  if (!ctx->cpuset_cpus || !ctx->cpuset_mems || !ctx->cpuset_partition) {
+    fprintf(stderr, "Failed to duplicate string for cpuset: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
+
+  ctx->numa_spread = NUMA_SPREAD;
+  ctx->numa_node = -1;
+
+  ctx->pipe_fds[0] = -1;
+  ctx->pipe_fds[1] = -1;
 
   ctx->overlay_base = strdup(OVERLAY_BASE);
   if (!ctx->overlay_base) {
@@ -299,5 +713,80 @@ struct container_ctx *init_ctx(int pipe_fds[2]) {
 
   ctx->tmpfs_size = TMPFS_SIZE;
 
+  ctx->tmpfs_huge = strdup(TMPFS_HUGE);
+  ctx->tmpfs_mpol = strdup(TMPFS_MPOL);
+  if (!ctx->tmpfs_huge || !ctx->tmpfs_mpol) {
+    fprintf(stderr, "Failed to duplicate string for tmpfs options: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
+
+  ctx->tmpfs_nr_inodes = TMPFS_NR_INODES;
+
+  ctx->namespaces = NAMESPACES;
+  ctx->overlay = OVERLAY;
+  ctx->seccomp = SECCOMP;
+  ctx->policy = strdup(POLICY);
+  if (!ctx->policy) {
+    fprintf(stderr, "Failed to duplicate string for policy: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
+  ctx->supervise = SUPERVISE;
+  ctx->minimal_dev = MINIMAL_DEV;
+  ctx->mount_dev = MOUNT_DEV;
+  ctx->mount_proc = MOUNT_PROC;
+  ctx->new_mount_api = NEW_MOUNT_API;
+  ctx->vfork = VFORK;
+
+  ctx->network = NETWORK;
+  ctx->bridge = strdup(BRIDGE);
+  ctx->subnet = strdup(SUBNET);
+  if (!ctx->bridge || !ctx->subnet) {
+    fprintf(stderr, "Failed to duplicate string for network: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
+  ctx->netns_fd = -1;
+
+  ctx->criu = strdup(CRIU);
+  if (!ctx->criu) {
+    fprintf(stderr, "Failed to duplicate string for criu: %s\n",
+            strerror(errno));
+    cleanup_ctx(ctx);
+    return NULL;
+  }
+  ctx->lazy_restore = LAZY_RESTORE;
+
+  ctx->freeze_idle = FREEZE_IDLE;
+  ctx->idle_reclaim = IDLE_RECLAIM;
+
+  /*
+   * Syscall profiling is off unless main() sets up the report pipe.
+   */
+  ctx->profile_fds[0] = -1;
+  ctx->profile_fds[1] = -1;
+  ctx->supervisor_fds[0] = -1;
+  ctx->supervisor_fds[1] = -1;
+
+  ctx->cgroup_path[0] = '\0';
+
+  ctx->pooled = 0;
+  ctx->in_cgroup = 0;
+
+  ctx->time_launch = 0;
+  ctx->timing_fds[0] = -1;
+  ctx->timing_fds[1] = -1;
+
+  ctx->output_buffer = OUTPUT_BUFFER;
+  ctx->capture_output = 0;
+  ctx->stdout_fds[0] = -1;
+  ctx->stdout_fds[1] = -1;
+  ctx->stderr_fds[0] = -1;
+  ctx->stderr_fds[1] = -1;
+
   return ctx;
 }
\ No newline at end of file
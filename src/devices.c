@@ -0,0 +1,333 @@
+/**
+ * devices.c
+ *
+ * Minimal /dev for containers, as an extra lower layer of the overlay.
+ *
+ * OVERVIEW:
+ * The template is a directory layer at {overlay_base}/dev_layer holding just
+ * a dev directory. It's marked opaque for overlayfs, so whatever the root
+ * filesystem has in /dev stays hidden and the container sees exactly the
+ * nodes listed in DEV_NODES and DEV_LINKS. pts is left empty, and the child
+ * mounts a devpts instance of its own on it after pivot_root() (see
+ * mount_devpts()), which is where the ptmx link points.
+ *
+ * BUILDING:
+ * The template is built under a lock, in dev.tmp first, and renamed to dev
+ * when it's complete. Every step tolerates what an interrupted build left
+ * behind, so a crash halfway through is fixed by the next run. Once dev
+ * exists it's used as it is.
+ *
+ * USER NAMESPACES:
+ * Neither mknod() nor devtmpfs is allowed inside a user namespace, so an
+ * unprivileged container gets the same nodes from bind_dev() instead: a
+ * tmpfs at /dev with the host's nodes bind-mounted onto empty files.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "devices.h"
+#include "layers.h"
+
+/**
+ * struct dev_node - A device node of the template
+ * @name: File name in /dev
+ * @mode: Permissions
+ * @major: Major device number
+ * @minor: Minor device number
+ */
+struct dev_node {
+  const char *name;
+  mode_t mode;
+  unsigned int major;
+  unsigned int minor;
+};
+
+/**
+ * DEV_NODES - Character devices every program may expect, see
+ * Documentation/admin-guide/devices.txt for the numbers
+ */
+static const struct dev_node DEV_NODES[] = {
+    {"null", 0666, 1, 3},    {"zero", 0666, 1, 5}, {"full", 0666, 1, 7},
+    {"random", 0666, 1, 8},  {"urandom", 0666, 1, 9},
+    {"tty", 0666, 5, 0},
+};
+
+#define NUM_DEV_NODES (sizeof(DEV_NODES) / sizeof(DEV_NODES[0]))
+
+/**
+ * DEV_LINKS - Symlinks of the template, name and target
+ */
+static const char *DEV_LINKS[][2] = {
+    {"fd", "/proc/self/fd"},       {"stdin", "/proc/self/fd/0"},
+    {"stdout", "/proc/self/fd/1"}, {"stderr", "/proc/self/fd/2"},
+    {"ptmx", "pts/ptmx"},
+};
+
+#define NUM_DEV_LINKS (sizeof(DEV_LINKS) / sizeof(DEV_LINKS[0]))
+
+/**
+ * ensure_dir - Create a directory with exact permissions if it's missing
+ * @dir_fd: Directory to create it in
+ * @name: Name of the directory
+ * @mode: Permissions, applied regardless of the umask
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int ensure_dir(int dir_fd, const char *name, mode_t mode) {
+  if (mkdirat(dir_fd, name, mode) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+
+  if (fchmodat(dir_fd, name, mode, 0) == -1) {
+    fprintf(stderr, "Failed to set mode of %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * populate_dev - Create the template's nodes and links
+ * @dev_fd: Directory to create them in
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int populate_dev(int dev_fd) {
+  for (size_t i = 0; i < NUM_DEV_NODES; i++) {
+    const struct dev_node *node = &DEV_NODES[i];
+
+    if (mknodat(dev_fd, node->name, S_IFCHR | node->mode,
+                makedev(node->major, node->minor)) == -1 &&
+        errno != EEXIST) {
+      fprintf(stderr, "Failed to create /dev/%s: %s\n", node->name,
+              strerror(errno));
+      return -1;
+    }
+
+    if (fchmodat(dev_fd, node->name, node->mode, 0) == -1) {
+      fprintf(stderr, "Failed to set mode of /dev/%s: %s\n", node->name,
+              strerror(errno));
+      return -1;
+    }
+  }
+
+  for (size_t i = 0; i < NUM_DEV_LINKS; i++) {
+    if (symlinkat(DEV_LINKS[i][1], dev_fd, DEV_LINKS[i][0]) == -1 &&
+        errno != EEXIST) {
+      fprintf(stderr, "Failed to create /dev/%s: %s\n", DEV_LINKS[i][0],
+              strerror(errno));
+      return -1;
+    }
+  }
+
+  if (ensure_dir(dev_fd, "pts", 0755) == -1 ||
+      ensure_dir(dev_fd, "shm", 01777) == -1) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * build_template - Build {layer}/dev unless it already exists
+ * @layer_fd: The template layer's directory, locked by us
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int build_template(int layer_fd) {
+  struct stat st;
+  if (fstatat(layer_fd, "dev", &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    return 0;
+  }
+
+  if (ensure_dir(layer_fd, "dev.tmp", 0755) == -1) {
+    return -1;
+  }
+
+  int dev_fd = openat(layer_fd, "dev.tmp", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dev_fd == -1) {
+    fprintf(stderr, "Failed to open dev.tmp: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int ret = populate_dev(dev_fd);
+
+  /* Hides the root filesystem's own /dev underneath the template */
+  if (ret == 0 && fsetxattr(dev_fd, "trusted.overlay.opaque", "y", 1, 0) == -1) {
+    fprintf(stderr, "Failed to make the /dev template opaque: %s\n",
+            strerror(errno));
+    ret = -1;
+  }
+
+  close(dev_fd);
+
+  if (ret == 0 && renameat(layer_fd, "dev.tmp", layer_fd, "dev") == -1) {
+    fprintf(stderr, "Failed to move the /dev template into place: %s\n",
+            strerror(errno));
+    ret = -1;
+  }
+
+  return ret;
+}
+
+/**
+ * setup_dev_layer - Build the /dev template and put it on top of lowerdir
+ * @ctx: Container configuration with minimal_dev, lowerdir is replaced
+ *
+ * Without mount_dev there's no /dev to give the container, minimal or not.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int setup_dev_layer(struct container_ctx *ctx) {
+  if (!ctx->minimal_dev || !ctx->mount_dev) {
+    return 0;
+  }
+
+  if (!ctx->overlay) {
+    fprintf(stderr, "minimal_dev needs the overlay\n");
+    return -1;
+  }
+
+  if (mkdir(ctx->overlay_base, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create overlayfs base directory: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  char layer[PATH_MAX];
+  if (snprintf(layer, PATH_MAX, "%s/dev_layer", ctx->overlay_base) >=
+      PATH_MAX) {
+    fprintf(stderr, "Path too long: %s\n", ctx->overlay_base);
+    return -1;
+  }
+
+  if (mkdir(layer, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", layer, strerror(errno));
+    return -1;
+  }
+
+  int layer_fd = open(layer, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (layer_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", layer, strerror(errno));
+    return -1;
+  }
+
+  int ret = flock(layer_fd, LOCK_EX);
+  if (ret == -1) {
+    fprintf(stderr, "Failed to lock %s: %s\n", layer, strerror(errno));
+  } else {
+    ret = build_template(layer_fd);
+  }
+
+  close(layer_fd);
+
+  if (ret == -1) {
+    return -1;
+  }
+
+  const char *below = ctx->lowerdir ? ctx->lowerdir : ctx->rootfs;
+  char lowerdir[LOWERDIR_MAX];
+  if (snprintf(lowerdir, LOWERDIR_MAX, "%s:%s", layer, below) >=
+      LOWERDIR_MAX) {
+    fprintf(stderr, "Too many layers for one overlay mount\n");
+    return -1;
+  }
+
+  char *stacked = strdup(lowerdir);
+  if (!stacked) {
+    fprintf(stderr, "Failed to duplicate lowerdir: %s\n", strerror(errno));
+    return -1;
+  }
+
+  free(ctx->lowerdir);
+  ctx->lowerdir = stacked;
+
+  return 0;
+}
+
+/**
+ * bind_dev - Give a container in a user namespace its /dev
+ * @root: Directory that is about to become the container's root
+ *
+ * Runs in the child before pivot_root(), while the host's /dev is still in
+ * reach. Mounting the nodes onto the new root's /dev rather than building the
+ * template keeps this to the nodes and links in DEV_NODES and DEV_LINKS, like
+ * minimal_dev.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int bind_dev(const char *root) {
+  char dev[PATH_MAX];
+  if (snprintf(dev, PATH_MAX, "%s/dev", root) >= PATH_MAX) {
+    fprintf(stderr, "Path too long: %s\n", root);
+    return -1;
+  }
+
+  if (mount("tmpfs", dev, "tmpfs", MS_NOSUID | MS_NOEXEC, "mode=0755") == -1) {
+    fprintf(stderr, "Failed to mount tmpfs at %s: %s\n", dev,
+            strerror(errno));
+    return -1;
+  }
+
+  for (size_t i = 0; i < NUM_DEV_NODES; i++) {
+    char host[PATH_MAX];
+    char target[PATH_MAX];
+    snprintf(host, PATH_MAX, "/dev/%s", DEV_NODES[i].name);
+    if (snprintf(target, PATH_MAX, "%s/%s", dev, DEV_NODES[i].name) >=
+        PATH_MAX) {
+      fprintf(stderr, "Path too long: %s\n", dev);
+      return -1;
+    }
+
+    /* A bind mount needs something to cover, an empty file will do */
+    int fd = open(target, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd == -1) {
+      fprintf(stderr, "Failed to create %s: %s\n", target, strerror(errno));
+      return -1;
+    }
+    close(fd);
+
+    if (mount(host, target, NULL, MS_BIND, NULL) == -1) {
+      fprintf(stderr, "Failed to bind-mount %s: %s\n", host,
+              strerror(errno));
+      return -1;
+    }
+  }
+
+  int dev_fd = open(dev, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dev_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < NUM_DEV_LINKS && ret == 0; i++) {
+    if (symlinkat(DEV_LINKS[i][1], dev_fd, DEV_LINKS[i][0]) == -1) {
+      fprintf(stderr, "Failed to create /dev/%s: %s\n", DEV_LINKS[i][0],
+              strerror(errno));
+      ret = -1;
+    }
+  }
+
+  if (ret == 0 && (ensure_dir(dev_fd, "pts", 0755) == -1 ||
+                   ensure_dir(dev_fd, "shm", 01777) == -1)) {
+    ret = -1;
+  }
+
+  close(dev_fd);
+  return ret;
+}
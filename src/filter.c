@@ -24,226 +24,934 @@
  * - BPF program returns an action
  * - Kernel acts on this action
  *
- * BLOCKED SYSCALLS:
- * Some syscalls that were intentionally omitted include getxattr, lgetxattr,
- * and fgetxattr. These syscalls can be useful for reconnaissance as the probe
- * extended attributes. For this reason, running the sandbox through debugging
- * tools like valgrind will result in the child being killed under signal 31
- * (bad syscall).
+ * POLICIES:
+ * What the container may do is a policy compiled in from policy/NAME.policy
+ * (see policy.h), chosen with set_filter_policy(). A policy gives every
+ * syscall it names an action, possibly depending on the syscall's arguments,
+ * and everything else is killed. The socket syscalls are added on top for
+ * containers with a network, unless the policy decides them itself.
+ *
+ * DECISION TREE:
+ * Checking the syscall number against every allowed syscall in turn means a
+ * call near the end of the list pays for every comparison before it, and this
+ * cost is paid on every single syscall the container makes. Instead, the
+ * syscall numbers are split into ranges of consecutive numbers that share a
+ * verdict (allow, kill, fail with an errno, check the arguments or, with
+ * supervision, notify). The program then does a binary search over the range
+ * boundaries with BPF_JGE, so any syscall reaches its verdict after roughly
+ * log2(number of ranges) comparisons.
+ *
+ * ARGUMENT CHECKS:
+ * A syscall whose verdict depends on its arguments ends its search in a jump
+ * to a check block behind the tree. Every block is emitted once for each
+ * check and pair of actions and shared by all the syscalls using it. Inside a
+ * block, a run of clauses that compare the same argument for equality, like a
+ * list of allowed ioctls, loads the argument once and tests one value per
+ * instruction.
+ *
+ * PROFILE WEIGHTING:
+ * A balanced tree treats every syscall as equally likely, but real workloads
+ * spend most of their syscalls on a handful of numbers (read, write, futex).
+ * When a recorded profile is loaded with set_filter_weights(), each split is
+ * placed so that both halves carry about the same share of recorded calls
+ * instead of the same number of ranges. Hot syscalls end up close to the root
+ * and the average number of comparisons per syscall goes down.
+ *
+ * ARCHITECTURE:
+ * Syscall numbers only mean something together with the calling convention
+ * they were made with. An x86_64 process can still make i386 syscalls
+ * through int 0x80, and those numbers collide with unrelated x86_64 ones:
+ * i386 execve is x86_64 munmap, and i386 socketcall is getuid. The program
+ * first kills any syscall whose seccomp_data.arch isn't AUDIT_ARCH_X86_64, so
+ * the search only ever sees x86_64 numbers. x32 syscalls share the arch but
+ * have __X32_SYSCALL_BIT set, which puts them in the last range, past every
+ * syscall a policy names.
+ *
+ * SUPERVISED SYSCALLS:
+ * With set_filter_supervise(), a few rare syscalls whose arguments decide
+ * whether they're safe return SECCOMP_RET_USER_NOTIF instead, and the
+ * supervisor in the parent answers them (see supervisor.h). They are ranges
+ * of the same tree, so the hot syscalls keep being allowed in the kernel at
+ * the same cost as before.
+ *
+ * Running the sandbox through debugging tools like valgrind will result in the
+ * child being killed under signal 31 (bad syscall), since they make syscalls
+ * no policy allows.
  */
+#include <linux/audit.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/syscall.h>
 
+#include "filter.h"
+#include "policy.h"
+
 /**
- * ALLOW - Macro to generate BPF instructions for whitelisting a syscall
- * @syscall: Syscall number to allow (e.g., __NR_READ)
+ * network_syscalls - Syscalls permitted on top of the policy when the
+ * container has a network (see set_filter_network())
  *
- * BREAKDOWN:
- * First instruction (conditional jump):
- * - BPF_JMPG: This is a jump instruction
- * - BPF_JEQ: Jump if equal
- * - BPF_K: Compare to a constant (K = constant)
- * - syscall: The constant to compare against
- * - 0: If true (equal), skip 0 instructions (fall through to allow)
- * - 1: If false (not equal), skip 1 instructions (jump over allow)
+ * Without a network, the container's network namespace only has a loopback
+ * device that is down, so there is nothing to use sockets for.
+ */
+static const unsigned int network_syscalls[] = {
+    __NR_socket,
+    __NR_connect,
+    __NR_accept,
+    __NR_accept4,
+    __NR_bind,
+    __NR_listen,
+    __NR_shutdown,
+    __NR_getsockname,
+    __NR_getpeername,
+    __NR_getsockopt,
+    __NR_setsockopt,
+    __NR_sendto,
+    __NR_recvfrom,
+    __NR_sendmsg,
+    __NR_recvmsg,
+    __NR_sendmmsg,
+    __NR_recvmmsg,
+    __NR_ppoll,
+    __NR_select,
+    __NR_pselect6,
+};
+
+/**
+ * NUM_NETWORK - Number of elements in network_syscalls
+ */
+#define NUM_NETWORK (sizeof(network_syscalls) / sizeof(network_syscalls[0]))
+
+/**
+ * supervised_syscalls - Syscalls handed to the supervisor when supervision is
+ * on (see set_filter_supervise()), even if they're allowed otherwise
  *
- * Second instruction (return):
- * - BPF_RET: Return from the BPF program
- * - BPF_K: Return a constant value
- * - SECCOMP_RET_ALLOW: The constant to return (allow syscall)
+ * socket() is allowed or refused depending on its family, type and protocol,
+ * and may be answered with a socket the container couldn't create itself.
+ * execve() and execveat() are always continued. They only go through the
+ * supervisor so that the exec can't close the listener before the supervisor
+ * has taken it over.
+ */
+static const unsigned int supervised_syscalls[] = {
+    __NR_socket,
+    __NR_execve,
+    __NR_execveat,
+};
+
+/**
+ * NUM_SUPERVISED - Number of elements in supervised_syscalls
+ */
+#define NUM_SUPERVISED                                                         \
+  (sizeof(supervised_syscalls) / sizeof(supervised_syscalls[0]))
+
+/**
+ * MAX_RANGES - Upper bound on the number of ranges in the decision tree
+ *
+ * In the worst case every syscall number below SYSCALL_TABLE_SIZE is a range
+ * of its own, followed by the kill range for everything above.
+ */
+#define MAX_RANGES (SYSCALL_TABLE_SIZE + 1)
+
+/**
+ * DEFAULT_POLICY - Policy the filter is built from unless set_filter_policy()
+ * picked another one
+ */
+#define DEFAULT_POLICY "default"
+
+/**
+ * policy - Policy the filter is built from, NULL for DEFAULT_POLICY
+ */
+static const struct policy *policy = NULL;
+
+/**
+ * allow_network - Non-zero if network_syscalls are part of the filter
  */
-#define ALLOW(syscall)                                                         \
-  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, syscall, 0, 1),                          \
-      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)
+static int allow_network = 0;
+
+/**
+ * supervise - Non-zero if supervised_syscalls return SECCOMP_RET_USER_NOTIF
+ */
+static int supervise = 0;
+
+/**
+ * MAX_JUMP - Largest offset that fits in the jt/jf fields of a BPF jump
+ *
+ * Conditional jumps only have 8 bits for each of their offsets. Farther
+ * targets have to go through an unconditional BPF_JA, which has 32 bits.
+ */
+#define MAX_JUMP 255
+
+/**
+ * MAX_GROUP - Most equality clauses tested after a single load
+ *
+ * The load of the upper half jumps over the whole group.
+ */
+#define MAX_GROUP (MAX_JUMP - 2)
+
+/**
+ * ARG_LO - Offset of the lower half of a syscall argument in seccomp_data
+ * @arg: Index of the argument
+ *
+ * The upper half follows at ARG_LO(arg) + 4 on little-endian x86_64.
+ */
+#define ARG_LO(arg)                                                            \
+  (offsetof(struct seccomp_data, args) + (arg) * sizeof(__u64))
+
+/**
+ * struct verdict - What the filter does with a syscall
+ * @action: Seccomp return value, once check holds if there is one
+ * @fail_action: Seccomp return value if check doesn't hold, 0 without a check
+ * @check: Index of the argument check in policy_checks, -1 if the arguments
+ *         don't matter
+ */
+struct verdict {
+  unsigned int action;
+  unsigned int fail_action;
+  int check;
+};
+
+/**
+ * struct syscall_range - Consecutive syscall numbers that share a verdict
+ * @first: Lowest syscall number in the range
+ * @verdict: What happens to every syscall in the range
+ * @weight: How often syscalls in this range are expected to be made
+ *
+ * A range extends up to (but not including) the first syscall number of the
+ * next range, the last range extends to the largest possible syscall number.
+ */
+struct syscall_range {
+  unsigned int first;
+  struct verdict verdict;
+  unsigned long weight;
+};
+
+/**
+ * struct fixup - A jump from a leaf of the tree to an argument check block
+ * @pos: Index of the leaf's BPF_JA in filter[]
+ * @range: Index of the range the leaf belongs to
+ * @target: Index of the block in filter[], once it's been emitted
+ */
+struct fixup {
+  int pos;
+  int range;
+  int target;
+};
+
+/**
+ * fixups - Leaves of the tree that jump to a check block
+ *
+ * The blocks are emitted after the tree, so the jumps are filled in last.
+ */
+static struct fixup fixups[MAX_RANGES];
+static int num_fixups;
+
+/**
+ * syscall_weights - Recorded call counts indexed by syscall number
+ *
+ * All zero unless set_filter_weights() has been called, in which case every
+ * range weighs the same and the tree is balanced by range count.
+ */
+static unsigned long syscall_weights[SYSCALL_TABLE_SIZE];
 
 /**
  * filter - BPF program instructions for syscall filtering
  *
- * This array contains all the BPF instructions that make up our filter. The
- * kernel executes these instructions in order on every syscall.
+ * Filled in by build_filter() the first time get_fprog() is called. It never
+ * needs more than the kernel's own limit of BPF_MAXINSNS instructions.
  *
  * PROGRAM:
+ * - Kill the syscall unless it was made with the x86_64 calling convention
  * - Load syscall number from seccomp_data into accumulator
- * - Check if it matches any allowed syscall using ALLOW macros
- * - If no match found, kill the process
+ * - Binary search for the range containing that number
+ * - Return the action of that range, or jump to its argument check block
+ * - The check blocks, each ending in a return
  */
-static const struct sock_filter filter[] = {
-    /*
-     * The seccomp_data struct contains information about the syscall
-     * being requested, with the nr field giving the number of the call. The
-     * BPF_STMT macro tells BPF what operation to perform and gives it an
-     * argument for the operation. BPF has two registers, the accumulator (A)
-     * and the index register (X). BPF_LD means "Load into A". BPF_W means "Load
-     * a 32-bit word". BPF can load from an absolute offset or an indirect
-     * offset, seccomp uses absolute offsets so we use the BPF_ABS option.
-     */
+static struct sock_filter filter[BPF_MAXINSNS];
+
+/**
+ * FILTER_PROLOGUE_LEN - Instructions of filter[] before the tree: the arch
+ * check and the load of the syscall number
+ */
+#define FILTER_PROLOGUE_LEN 4
+
+/**
+ * prog - Seccomp filter program structure
+ *
+ * Wraps the filter instructions in a sock_fprog structure that the kernel
+ * expects. This structure contains:
+ * - len: Number of instructions in the program
+ * - filter: Pointer to the instruction array
+ *
+ * len stays 0 until the filter has been built.
+ */
+static struct sock_fprog prog = {
+    .len = 0,
+    .filter = filter,
+};
+
+/**
+ * profiler_filter - BPF program used while recording a syscall profile
+ *
+ * Every syscall is handed to the supervisor in the parent as a user
+ * notification, with one exception: write() to the report pipe must go
+ * through directly, since that's how the child tells the parent which fd the
+ * notifications arrive on. Instruction 3 gets the pipe's fd number patched in
+ * by get_profiler_fprog().
+ *
+ * Only the lower 32 bits of the first argument are compared, which is enough
+ * for a file descriptor on little-endian x86_64.
+ */
+static struct sock_filter profiler_filter[] = {
     BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_write, 0, 3),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, args[0])),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+};
 
-    /*
-     * ========================================================================
-     * FILE AND DIRECTORY OPERATIONS
-     * ========================================================================
-     */
-    ALLOW(__NR_access),
-    ALLOW(__NR_faccessat),
-    ALLOW(__NR_chdir),
-    ALLOW(__NR_close),
-    ALLOW(__NR_dup),
-    ALLOW(__NR_dup2),
-    ALLOW(__NR_dup3),
-    ALLOW(__NR_fchmod),
-    ALLOW(__NR_fchmodat),
-    ALLOW(__NR_fchown),
-    ALLOW(__NR_fchownat),
-    ALLOW(__NR_fcntl),
-    ALLOW(__NR_fdatasync),
-    ALLOW(__NR_fstat),
-    ALLOW(__NR_fsync),
-    ALLOW(__NR_getcwd),
-    ALLOW(__NR_getdents64),
-    ALLOW(__NR_lseek),
-    ALLOW(__NR_lstat),
-    ALLOW(__NR_mkdir),
-    ALLOW(__NR_mkdirat),
-    ALLOW(__NR_newfstatat),
-    ALLOW(__NR_open),
-    ALLOW(__NR_openat),
-    ALLOW(__NR_openat2),
-    ALLOW(__NR_pipe),
-    ALLOW(__NR_poll),
-    ALLOW(__NR_pread64),
-    ALLOW(__NR_pwrite64),
-    ALLOW(__NR_read),
-    ALLOW(__NR_readlink),
-    ALLOW(__NR_readlinkat),
-    ALLOW(__NR_readv),
-    ALLOW(__NR_rename),
-    ALLOW(__NR_renameat),
-    ALLOW(__NR_renameat2),
-    ALLOW(__NR_rmdir),
-    ALLOW(__NR_stat),
-    ALLOW(__NR_statx),
-    ALLOW(__NR_symlink),
-    ALLOW(__NR_symlinkat),
-    ALLOW(__NR_unlink),
-    ALLOW(__NR_unlinkat),
-    ALLOW(__NR_utimensat),
-    ALLOW(__NR_write),
-    ALLOW(__NR_writev),
+/**
+ * profiler_prog - Seccomp filter program structure for profiler_filter
+ */
+static struct sock_fprog profiler_prog = {
+    .len = sizeof(profiler_filter) / sizeof(profiler_filter[0]),
+    .filter = profiler_filter,
+};
 
-    /*
-     * ========================================================================
-     * PROCESS MANAGEMENT
-     * ========================================================================
-     */
-    ALLOW(__NR_arch_prctl),
-    ALLOW(__NR_clone),
-    ALLOW(__NR_execve),
-    ALLOW(__NR_execveat),
-    ALLOW(__NR_exit),
-    ALLOW(__NR_exit_group),
-    ALLOW(__NR_fork),
-    ALLOW(__NR_getpid),
-    ALLOW(__NR_getpgid),
-    ALLOW(__NR_getppid),
-    ALLOW(__NR_gettid),
-    ALLOW(__NR_getuid),
-    ALLOW(__NR_geteuid),
-    ALLOW(__NR_prctl),
-    ALLOW(__NR_setpgid),
-    ALLOW(__NR_wait4),
-    ALLOW(__NR_waitid),
+/**
+ * range_weight - Sum the recorded calls that fall inside a range
+ * @ranges: Sorted array of ranges
+ * @num_ranges: Number of elements in ranges
+ * @index: Index of the range to weigh
+ *
+ * Every range gets a base weight of 1, so syscalls that never showed up in
+ * the profile still keep the tree balanced among themselves.
+ *
+ * Return: Weight of the range
+ */
+static unsigned long range_weight(const struct syscall_range *ranges,
+                                  int num_ranges, int index) {
+  unsigned long weight = 1;
+  unsigned int end = SYSCALL_TABLE_SIZE;
 
-    /*
-     * ========================================================================
-     * MEMORY MANAGEMENT
-     * ========================================================================
-     */
-    ALLOW(__NR_brk),
-    ALLOW(__NR_madvise),
-    ALLOW(__NR_mmap),
-    ALLOW(__NR_mprotect),
-    ALLOW(__NR_mremap),
-    ALLOW(__NR_munmap),
+  if (index + 1 < num_ranges && ranges[index + 1].first < end) {
+    end = ranges[index + 1].first;
+  }
 
-    /*
-     * ========================================================================
-     * TIME AND SCHEDULING
-     * ========================================================================
-     */
-    ALLOW(__NR_clock_gettime),
-    ALLOW(__NR_clock_nanosleep),
-    ALLOW(__NR_gettimeofday),
-    ALLOW(__NR_nanosleep),
-    ALLOW(__NR_time),
-    ALLOW(__NR_sched_yield),
+  for (unsigned int nr = ranges[index].first; nr < end; nr++) {
+    weight += syscall_weights[nr];
+  }
 
-    /*
-     * ========================================================================
-     * SIGNALS
-     * ========================================================================
-     */
-    ALLOW(__NR_rt_sigaction),
-    ALLOW(__NR_rt_sigprocmask),
-    ALLOW(__NR_rt_sigreturn),
-    ALLOW(__NR_sigaltstack),
-    ALLOW(__NR_tgkill),
-    ALLOW(__NR_tkill),
+  return weight;
+}
 
-    /*
-     * ========================================================================
-     * RESOURCE LIMITS
-     * ========================================================================
-     */
-    ALLOW(__NR_getrlimit),
-    ALLOW(__NR_prlimit64),
-    ALLOW(__NR_setrlimit),
+/**
+ * split_ranges - Pick where to split a slice of ranges
+ * @ranges: Sorted array of ranges
+ * @lo: Index of the first range in the slice
+ * @hi: Index of the last range in the slice
+ *
+ * Finds the split that divides the weight of the slice most evenly between
+ * the lower and upper half. With the default weight of 1 per range, this is
+ * simply the middle of the slice.
+ *
+ * Return: Index of the first range in the upper half
+ */
+static int split_ranges(const struct syscall_range *ranges, int lo, int hi) {
+  unsigned long total = 0;
+  for (int i = lo; i <= hi; i++) {
+    total += ranges[i].weight;
+  }
+
+  int best = lo + 1;
+  unsigned long best_diff = (unsigned long)-1;
+  unsigned long lower = 0;
+
+  for (int mid = lo + 1; mid <= hi; mid++) {
+    lower += ranges[mid - 1].weight;
+
+    unsigned long upper = total - lower;
+    unsigned long diff = lower > upper ? lower - upper : upper - lower;
+    if (diff < best_diff) {
+      best = mid;
+      best_diff = diff;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * set_actions - Give a list of syscalls the same unconditional action
+ * @verdicts: Verdict of every syscall number below SYSCALL_TABLE_SIZE
+ * @syscalls: Syscall numbers
+ * @num_syscalls: Number of elements in syscalls
+ * @action: Seccomp return value to give them
+ * @override: Zero to leave alone the syscalls that aren't killed already
+ */
+static void set_actions(struct verdict *verdicts, const unsigned int *syscalls,
+                        unsigned int num_syscalls, unsigned int action,
+                        int override) {
+  for (unsigned int i = 0; i < num_syscalls; i++) {
+    if (syscalls[i] >= SYSCALL_TABLE_SIZE) {
+      continue;
+    }
+
+    struct verdict *verdict = &verdicts[syscalls[i]];
+    if (override || (verdict->check == -1 &&
+                     verdict->action == SECCOMP_RET_KILL_PROCESS)) {
+      *verdict = (struct verdict){action, 0, -1};
+    }
+  }
+}
+
+/**
+ * same_verdict - Check whether two syscalls can share a range or check block
+ * @a: First verdict
+ * @b: Second verdict
+ *
+ * Return: Non-zero if both verdicts are the same
+ */
+static int same_verdict(const struct verdict *a, const struct verdict *b) {
+  return a->action == b->action && a->fail_action == b->fail_action &&
+         a->check == b->check;
+}
+
+/**
+ * build_ranges - Convert the policy and syscall lists into sorted ranges
+ * @ranges: Output array with room for MAX_RANGES elements
+ *
+ * Looks up the verdict of every syscall number below SYSCALL_TABLE_SIZE in
+ * the policy, adds the network syscalls the policy doesn't decide if
+ * allow_network is on and the supervised ones, whatever the policy says, if
+ * supervise is on. Runs of consecutive numbers that share a verdict are
+ * merged into a single range. Everything from SYSCALL_TABLE_SIZE on is
+ * killed, so the ranges cover every possible syscall number.
+ *
+ * Return: Number of ranges written
+ */
+static int build_ranges(struct syscall_range *ranges) {
+  struct verdict verdicts[SYSCALL_TABLE_SIZE];
+  int num_ranges = 0;
+
+  for (unsigned int nr = 0; nr < SYSCALL_TABLE_SIZE; nr++) {
+    verdicts[nr] = (struct verdict){SECCOMP_RET_KILL_PROCESS, 0, -1};
+  }
+
+  for (unsigned int i = 0; i < policy->num_rules; i++) {
+    const struct policy_rule *rule = &policy->rules[i];
+    if (rule->nr < SYSCALL_TABLE_SIZE) {
+      verdicts[rule->nr] = (struct verdict){
+          rule->action, rule->check == -1 ? 0 : rule->fail_action,
+          rule->check};
+    }
+  }
+
+  if (allow_network) {
+    set_actions(verdicts, network_syscalls, NUM_NETWORK, SECCOMP_RET_ALLOW, 0);
+  }
+  if (supervise) {
+    set_actions(verdicts, supervised_syscalls, NUM_SUPERVISED,
+                SECCOMP_RET_USER_NOTIF, 1);
+  }
+
+  for (unsigned int nr = 0; nr < SYSCALL_TABLE_SIZE; nr++) {
+    if (num_ranges == 0 ||
+        !same_verdict(&ranges[num_ranges - 1].verdict, &verdicts[nr])) {
+      ranges[num_ranges].first = nr;
+      ranges[num_ranges].verdict = verdicts[nr];
+      num_ranges++;
+    }
+  }
+
+  const struct verdict *last = &ranges[num_ranges - 1].verdict;
+  if (last->check != -1 || last->action != SECCOMP_RET_KILL_PROCESS) {
+    ranges[num_ranges].first = SYSCALL_TABLE_SIZE;
+    ranges[num_ranges].verdict =
+        (struct verdict){SECCOMP_RET_KILL_PROCESS, 0, -1};
+    num_ranges++;
+  }
+
+  for (int i = 0; i < num_ranges; i++) {
+    ranges[i].weight = range_weight(ranges, num_ranges, i);
+  }
+
+  return num_ranges;
+}
+
+/**
+ * emit_tree - Emit the binary search over a slice of ranges
+ * @ranges: Sorted array of ranges
+ * @lo: Index of the first range in the slice
+ * @hi: Index of the last range in the slice
+ * @pos: Index in filter[] to start writing instructions at
+ *
+ * A slice with a single range is a leaf: the syscall number is known to fall
+ * inside it, so we just return its action, or jump to its argument check
+ * block if it has one (see fixups). Otherwise we split the slice in two (see
+ * split_ranges()) and emit:
+ *
+ *   JGE first-of-upper-half, jt=len(lower), jf=0
+ *   <lower half>
+ *   <upper half>
+ *
+ * If the lower half is too long for the 8-bit jt field, the node jumps to an
+ * inserted BPF_JA instead, which then jumps over the lower half.
+ *
+ * Return: Number of instructions written, -1 if filter[] is full
+ */
+static int emit_tree(const struct syscall_range *ranges, int lo, int hi,
+                     int pos) {
+  if (pos >= BPF_MAXINSNS) {
+    return -1;
+  }
+
+  if (lo == hi) {
+    if (ranges[lo].verdict.check == -1) {
+      filter[pos] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+                                                 ranges[lo].verdict.action);
+    } else {
+      filter[pos] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0);
+      fixups[num_fixups++] = (struct fixup){pos, lo, -1};
+    }
+    return 1;
+  }
+
+  int mid = split_ranges(ranges, lo, hi);
+  int first_fixup = num_fixups;
+
+  int lower_len = emit_tree(ranges, lo, mid - 1, pos + 1);
+  if (lower_len == -1) {
+    return -1;
+  }
+
+  int len = 1 + lower_len;
+
+  if (lower_len > MAX_JUMP) {
+    if (pos + len >= BPF_MAXINSNS) {
+      return -1;
+    }
 
     /*
-     * ========================================================================
-     * MISCELLANEOUS
-     * ========================================================================
+     * Shift the lower half down by one to make room for the trampoline. Jumps
+     * are relative, so the moved instructions stay valid, but the leaves
+     * waiting for their check block have moved.
      */
-    ALLOW(__NR_futex),
-    ALLOW(__NR_getrandom),
-    ALLOW(__NR_ioctl),
-    ALLOW(__NR_set_robust_list),
-    ALLOW(__NR_set_tid_address),
-    ALLOW(__NR_uname),
-    ALLOW(__NR_umask),
+    memmove(&filter[pos + 2], &filter[pos + 1],
+            lower_len * sizeof(struct sock_filter));
+    for (int i = first_fixup; i < num_fixups; i++) {
+      fixups[i].pos++;
+    }
+    filter[pos + 1] =
+        (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, lower_len, 0, 0);
+    filter[pos] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+                                               ranges[mid].first, 0, 1);
+    len++;
+  } else {
+    filter[pos] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+                                               ranges[mid].first, lower_len, 0);
+  }
+
+  int upper_len = emit_tree(ranges, mid, hi, pos + len);
+  if (upper_len == -1) {
+    return -1;
+  }
+
+  return len + upper_len;
+}
+
+/**
+ * cond_len - Number of instructions emit_cond() writes for a comparison
+ * @cond: Comparison
+ *
+ * Return: 2 if one half of the argument decides it, 4 otherwise
+ */
+static int cond_len(const struct policy_cond *cond) {
+  unsigned int hi = cond->value >> 32;
+
+  if ((cond->op == POLICY_SET && hi == 0) ||
+      (cond->op == POLICY_IN && hi == 0xffffffff)) {
+    return 2;
+  }
 
+  return 4;
+}
+
+/**
+ * emit_cond - Emit one comparison of a clause
+ * @cond: Comparison
+ * @pos: Index in filter[] to start writing instructions at
+ * @fail: Index in filter[] to jump to if the comparison doesn't hold
+ *
+ * Falls through to the instruction after it if the comparison holds. The
+ * lower half of the argument is compared first, since that's where the two
+ * sides of a comparison usually differ. The caller makes sure there's room
+ * for cond_len() instructions and that fail is within reach.
+ */
+static void emit_cond(const struct policy_cond *cond, int pos, int fail) {
+  unsigned int lo = cond->value & 0xffffffff;
+  unsigned int hi = cond->value >> 32;
+  int len = cond_len(cond);
+  int lo_fail = fail - (pos + 1) - 1;
+  int hi_fail = fail - (pos + 3) - 1;
+
+  filter[pos] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             ARG_LO(cond->arg));
+  if (len == 4) {
+    filter[pos + 2] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                                   ARG_LO(cond->arg) + 4);
+  }
+
+  switch (cond->op) {
+  case POLICY_EQ:
+    filter[pos + 1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                   lo, 0, lo_fail);
+    filter[pos + 3] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                   hi, 0, hi_fail);
+    break;
+  case POLICY_NE:
     /*
-     * If execution reaches this point, none of the ALLOW macros matched.
-     * This indicates that the syscall is not whitelisted, so we kill the
-     * process.
+     * A different lower half is enough, skip the upper one.
      */
-    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
-};
+    filter[pos + 1] =
+        (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 2);
+    filter[pos + 3] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                   hi, hi_fail, 0);
+    break;
+  case POLICY_SET:
+    if (len == 2) {
+      filter[pos + 1] = (struct sock_filter)BPF_JUMP(
+          BPF_JMP | BPF_JSET | BPF_K, lo, 0, lo_fail);
+    } else {
+      filter[pos + 1] =
+          (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, lo, 2, 0);
+      filter[pos + 3] = (struct sock_filter)BPF_JUMP(
+          BPF_JMP | BPF_JSET | BPF_K, hi, 0, hi_fail);
+    }
+    break;
+  case POLICY_IN:
+    filter[pos + 1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,
+                                                   ~lo, lo_fail, 0);
+    if (len == 4) {
+      filter[pos + 3] = (struct sock_filter)BPF_JUMP(
+          BPF_JMP | BPF_JSET | BPF_K, ~hi, hi_fail, 0);
+    }
+    break;
+  }
+}
 
 /**
- * prog - Seccomp filter program structure
+ * emit_clause - Emit a clause that returns an action if all of it holds
+ * @clause: Clause
+ * @action: Seccomp return value if the clause holds
+ * @pos: Index in filter[] to start writing instructions at
  *
- * Wraps the filter instructions in a sock_fprog structure that the kernel
- * expects. This structure contains:
- * - len: Number of instructions in the program
- * - filter: Pointer to the instruction array
+ * Every comparison that doesn't hold jumps to the instruction after the
+ * clause, which starts the next clause.
  *
- * The filter is baked into the binary at compile time for security.
+ * Return: Number of instructions written, -1 if filter[] is full
  */
-static const struct sock_fprog prog = {
-    /* The number of BPF instructions */
-    .len = sizeof(filter) / sizeof(filter[0]),
-    /* Pointer to the filter array defined above */
-    .filter = (struct sock_filter *)filter,
-};
+static int emit_clause(const struct policy_clause *clause, unsigned int action,
+                       int pos) {
+  int len = 1;
+  for (unsigned int i = 0; i < clause->num; i++) {
+    len += cond_len(&policy_conds[clause->first + i]);
+  }
+
+  if (pos + len > BPF_MAXINSNS) {
+    return -1;
+  }
+
+  int cond_pos = pos;
+  for (unsigned int i = 0; i < clause->num; i++) {
+    const struct policy_cond *cond = &policy_conds[clause->first + i];
+    emit_cond(cond, cond_pos, pos + len);
+    cond_pos += cond_len(cond);
+  }
+
+  filter[cond_pos] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, action);
+
+  return len;
+}
+
+/**
+ * group_len - Count the clauses that can be tested after a single load
+ * @first: Index of the first clause in policy_clauses
+ * @end: Index of the clause after the check's last one
+ *
+ * A group is a run of clauses that each compare the same argument, with the
+ * same upper half, for equality and nothing else.
+ *
+ * Return: Number of clauses in the group starting at first, 0 if that clause
+ * isn't a single equality
+ */
+static unsigned int group_len(unsigned int first, unsigned int end) {
+  const struct policy_cond *head = &policy_conds[policy_clauses[first].first];
+  unsigned int len = 0;
+
+  while (first + len < end && len < MAX_GROUP) {
+    const struct policy_clause *clause = &policy_clauses[first + len];
+    const struct policy_cond *cond = &policy_conds[clause->first];
+
+    if (clause->num != 1 || cond->op != POLICY_EQ || cond->arg != head->arg ||
+        cond->value >> 32 != head->value >> 32) {
+      break;
+    }
+    len++;
+  }
+
+  return len;
+}
+
+/**
+ * emit_group - Emit a group of equality clauses (see group_len())
+ * @first: Index of the first clause in policy_clauses
+ * @num: Number of clauses in the group
+ * @action: Seccomp return value if any of them holds
+ * @pos: Index in filter[] to start writing instructions at
+ *
+ *   LD upper half;  JEQ upper, jt=0, jf=<next clause>
+ *   LD lower half;  JEQ value1, jt=<RET>, ... JEQ valueN, jt=0, jf=1
+ *   RET action
+ *
+ * Return: Number of instructions written, -1 if filter[] is full
+ */
+static int emit_group(unsigned int first, unsigned int num,
+                      unsigned int action, int pos) {
+  const struct policy_cond *head = &policy_conds[policy_clauses[first].first];
+  int len = num + 4;
+
+  if (pos + len > BPF_MAXINSNS) {
+    return -1;
+  }
+
+  filter[pos] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             ARG_LO(head->arg) + 4);
+  filter[pos + 1] = (struct sock_filter)BPF_JUMP(
+      BPF_JMP | BPF_JEQ | BPF_K, head->value >> 32, 0, num + 2);
+  filter[pos + 2] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                                 ARG_LO(head->arg));
+
+  for (unsigned int i = 0; i < num; i++) {
+    const struct policy_cond *cond =
+        &policy_conds[policy_clauses[first + i].first];
+    filter[pos + 3 + i] = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K, cond->value & 0xffffffff, num - 1 - i,
+        i == num - 1 ? 1 : 0);
+  }
+
+  filter[pos + 3 + num] =
+      (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, action);
+
+  return len;
+}
+
+/**
+ * emit_check - Emit the argument check block of a verdict
+ * @verdict: Verdict with a check
+ * @pos: Index in filter[] to start writing instructions at
+ *
+ * The clauses are tried in the order the policy lists them, the first one
+ * that holds returns verdict->action. If none does, the block ends in
+ * verdict->fail_action.
+ *
+ * Return: Number of instructions written, -1 if filter[] is full
+ */
+static int emit_check(const struct verdict *verdict, int pos) {
+  const struct policy_check *check = &policy_checks[verdict->check];
+  unsigned int end = check->first + check->num;
+  int len = 0;
+
+  for (unsigned int clause = check->first; clause < end;) {
+    unsigned int group = group_len(clause, end);
+    int clause_len;
+
+    if (group > 0) {
+      clause_len = emit_group(clause, group, verdict->action, pos + len);
+      clause += group;
+    } else {
+      clause_len =
+          emit_clause(&policy_clauses[clause], verdict->action, pos + len);
+      clause++;
+    }
+
+    if (clause_len == -1) {
+      return -1;
+    }
+    len += clause_len;
+  }
+
+  if (pos + len >= BPF_MAXINSNS) {
+    return -1;
+  }
+  filter[pos + len] =
+      (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, verdict->fail_action);
+
+  return len + 1;
+}
+
+/**
+ * build_filter - Generate the complete BPF program
+ *
+ * The seccomp_data struct contains information about the syscall being
+ * requested, with the nr field giving the number of the call. The BPF_STMT
+ * macro tells BPF what operation to perform and gives it an argument for the
+ * operation. BPF has two registers, the accumulator (A) and the index register
+ * (X). BPF_LD means "Load into A". BPF_W means "Load a 32-bit word". BPF can
+ * load from an absolute offset or an indirect offset, seccomp uses absolute
+ * offsets so we use the BPF_ABS option.
+ *
+ * After the load, the decision tree never modifies the accumulator, so every
+ * comparison in it tests the syscall number. The check blocks follow the
+ * tree, and load the arguments they compare themselves.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int build_filter(void) {
+  struct syscall_range ranges[MAX_RANGES];
+
+  if (!policy && set_filter_policy(DEFAULT_POLICY) == -1) {
+    return -1;
+  }
+
+  int num_ranges = build_ranges(ranges);
+  num_fixups = 0;
+
+  filter[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                           offsetof(struct seccomp_data, arch));
+  filter[1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                           AUDIT_ARCH_X86_64, 1, 0);
+  filter[2] =
+      (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS);
+  filter[3] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                           offsetof(struct seccomp_data, nr));
+
+  int tree_len = emit_tree(ranges, 0, num_ranges - 1, FILTER_PROLOGUE_LEN);
+  if (tree_len == -1) {
+    fprintf(stderr, "Seccomp filter exceeds %d instructions\n", BPF_MAXINSNS);
+    return -1;
+  }
+
+  int len = FILTER_PROLOGUE_LEN + tree_len;
+
+  for (int i = 0; i < num_fixups; i++) {
+    const struct verdict *verdict = &ranges[fixups[i].range].verdict;
+
+    for (int j = 0; j < i && fixups[i].target == -1; j++) {
+      if (same_verdict(verdict, &ranges[fixups[j].range].verdict)) {
+        fixups[i].target = fixups[j].target;
+      }
+    }
+
+    if (fixups[i].target == -1) {
+      int block_len = emit_check(verdict, len);
+      if (block_len == -1) {
+        fprintf(stderr, "Seccomp filter exceeds %d instructions\n",
+                BPF_MAXINSNS);
+        return -1;
+      }
+
+      fixups[i].target = len;
+      len += block_len;
+    }
+
+    filter[fixups[i].pos].k = fixups[i].target - fixups[i].pos - 1;
+  }
+
+  prog.len = len;
+
+  return 0;
+}
 
 /**
  * get_fprog - Get pointer to seccomp filter program
  *
- * This gets passed to prctl(PR_SET_SECCOMP, ...) to install the filter.
+ * This gets passed to prctl(PR_SET_SECCOMP, ...) to install the filter. The
+ * program is generated on the first call and reused afterwards.
+ *
+ * Return: Pointer to sock_fprog structure, NULL if the filter can't be built
+ */
+const struct sock_fprog *get_fprog(void) {
+  if (prog.len == 0 && build_filter() == -1) {
+    return NULL;
+  }
+
+  return &prog;
+}
+
+/**
+ * set_filter_weights - Weight the decision tree with a syscall profile
+ * @counts: Number of recorded calls indexed by syscall number
+ *
+ * Copies the counts and discards any previously built program, so it gets
+ * regenerated with the new weights on the next call to get_fprog().
+ */
+void set_filter_weights(const unsigned long counts[SYSCALL_TABLE_SIZE]) {
+  memcpy(syscall_weights, counts, sizeof(syscall_weights));
+  prog.len = 0;
+}
+
+/**
+ * set_filter_network - Choose whether the filter permits socket syscalls
+ * @allow: Non-zero to add network_syscalls to the policy
+ *
+ * Discards any previously built program if the choice changed, like
+ * set_filter_weights().
+ */
+void set_filter_network(int allow) {
+  if (allow_network != !!allow) {
+    allow_network = !!allow;
+    prog.len = 0;
+  }
+}
+
+/**
+ * set_filter_supervise - Choose whether the supervisor decides rare syscalls
+ * @enable: Non-zero to make supervised_syscalls return SECCOMP_RET_USER_NOTIF
+ *
+ * Discards any previously built program if the choice changed, like
+ * set_filter_weights().
+ */
+void set_filter_supervise(int enable) {
+  if (supervise != !!enable) {
+    supervise = !!enable;
+    prog.len = 0;
+  }
+}
+
+/**
+ * set_filter_policy - Choose the policy the filter is built from
+ * @name: Name of a policy compiled in from policy/
+ *
+ * Discards any previously built program if the choice changed, like
+ * set_filter_weights().
+ *
+ * Return: 0 on success, -1 if there is no such policy
+ */
+int set_filter_policy(const char *name) {
+  for (unsigned int i = 0; i < num_policies; i++) {
+    if (strcmp(policies[i].name, name) == 0) {
+      if (policy != &policies[i]) {
+        policy = &policies[i];
+        prog.len = 0;
+      }
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "Unknown seccomp policy %s\n", name);
+  return -1;
+}
+
+/**
+ * get_profiler_fprog - Get pointer to the profiling filter program
+ * @report_fd: File descriptor the child uses to report its listener fd
  *
  * Return: Pointer to sock_fprog structure
  */
-const struct sock_fprog *get_fprog(void) { return &prog; }
+const struct sock_fprog *get_profiler_fprog(int report_fd) {
+  profiler_filter[3].k = report_fd;
+  return &profiler_prog;
+}
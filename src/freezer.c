@@ -0,0 +1,273 @@
+/**
+ * freezer.c
+ *
+ * Freezing idle containers and thawing them on demand.
+ *
+ * OVERVIEW:
+ * The cgroup v2 freezer is asynchronous: writing "1" to cgroup.freeze returns
+ * right away and the kernel stops each task the next time it returns to user
+ * space. We don't wait for cgroup.events to report "frozen 1", since the
+ * reclaim that follows doesn't need the tasks stopped, it only needs them not
+ * to touch their memory afterwards. Fatal signals still get through to frozen
+ * tasks, so freezing never keeps a container from being killed.
+ *
+ * IDLE CHECK:
+ * The timer doesn't look at how long the container was idle, only at whether
+ * its CPU time grew by less than 1% of the last interval. A container is
+ * therefore frozen at most two intervals after it went idle, and a short
+ * burst of work resets the clock.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "cgroups.h"
+#include "context.h"
+#include "freezer.h"
+
+/**
+ * IDLE_SHARE - Fraction of a CPU below which a container counts as idle
+ *
+ * 1/100 of the interval, enough for a service's timers and housekeeping.
+ */
+static const int IDLE_SHARE = 100;
+
+/**
+ * STAT_MAX - Size of the buffer cpu.stat is read into
+ */
+#define STAT_MAX 1024
+
+/**
+ * read_usage - Read the CPU time a container has used
+ * @freezer: Freezer of the container
+ *
+ * Return: usage_usec from cpu.stat, -1 on failure
+ */
+static long long read_usage(const struct freezer *freezer) {
+  char buf[STAT_MAX];
+
+  ssize_t len = pread(freezer->stat_fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[len] = '\0';
+
+  /* usage_usec is the first line, cpu.stat exists with or without cpu */
+  if (strncmp(buf, "usage_usec ", 11) != 0) {
+    return -1;
+  }
+
+  return strtoll(buf + 11, NULL, 10);
+}
+
+/**
+ * restart_timer - Start a whole idle interval from now
+ * @freezer: Freezer of the container
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int restart_timer(struct freezer *freezer) {
+  struct timespec interval = {
+      .tv_sec = freezer->interval_ms / 1000,
+      .tv_nsec = (freezer->interval_ms % 1000) * 1000000L};
+  struct itimerspec spec = {.it_interval = interval, .it_value = interval};
+
+  if (timerfd_settime(freezer->timer_fd, 0, &spec, NULL) == -1) {
+    fprintf(stderr, "Failed to start idle timer: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * freeze_cgroup - Freeze a container and reclaim its memory
+ * @cgroup: Handle of the container's leaf cgroup
+ * @reclaim: Non-zero to reclaim the container's memory once it's frozen
+ *
+ * Return: 0 on success, -1 if the container couldn't be frozen
+ */
+int freeze_cgroup(struct cgroup *cgroup, int reclaim) {
+  if (cgroup_set(cgroup, CGROUP_FREEZE, "1\n") == -1) {
+    return -1;
+  }
+
+  if (reclaim && cgroup_reclaim(cgroup) == -1) {
+    fprintf(stderr, "Failed to reclaim memory of %s\n", cgroup->path);
+  }
+
+  return 0;
+}
+
+/**
+ * thaw_cgroup - Let a frozen container run again
+ * @cgroup: Handle of the container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int thaw_cgroup(struct cgroup *cgroup) {
+  return cgroup_set(cgroup, CGROUP_FREEZE, "0\n");
+}
+
+/**
+ * freezer_start - Start freezing a single container while it's idle
+ * @freezer: Freezer to initialize
+ * @ctx: Container configuration with freeze_idle and idle_reclaim
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int freezer_start(struct freezer *freezer, struct container_ctx *ctx,
+                  const char *cgroup_path) {
+  freezer->stat_fd = -1;
+  freezer->timer_fd = -1;
+  freezer->signal_fd = -1;
+  freezer->interval_ms = ctx->freeze_idle;
+  freezer->reclaim = ctx->idle_reclaim;
+  freezer->frozen = 0;
+
+  if (cgroup_open(&freezer->cgroup, cgroup_path) == -1) {
+    cgroup_close(&freezer->cgroup);
+    return -1;
+  }
+
+  freezer->stat_fd =
+      openat(freezer->cgroup.dir_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+  if (freezer->stat_fd == -1) {
+    fprintf(stderr, "Failed to open %s/cpu.stat: %s\n", cgroup_path,
+            strerror(errno));
+    goto fail;
+  }
+
+  freezer->usage_usec = read_usage(freezer);
+  if (freezer->usage_usec == -1) {
+    fprintf(stderr, "Failed to read CPU usage of %s\n", cgroup_path);
+    goto fail;
+  }
+
+  freezer->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (freezer->timer_fd == -1) {
+    fprintf(stderr, "Failed to create idle timer: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  if (restart_timer(freezer) == -1) {
+    goto fail;
+  }
+
+  /*
+   * SIGUSR2 has to be blocked for the signalfd to get it instead of the
+   * default action, which would kill us.
+   */
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+    fprintf(stderr, "Failed to block SIGUSR2: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  freezer->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (freezer->signal_fd == -1) {
+    fprintf(stderr, "Failed to create signalfd: %s\n", strerror(errno));
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  if (freezer->timer_fd != -1) {
+    close(freezer->timer_fd);
+  }
+  if (freezer->stat_fd != -1) {
+    close(freezer->stat_fd);
+  }
+  cgroup_close(&freezer->cgroup);
+  return -1;
+}
+
+/**
+ * freezer_tick - React to the idle timer firing
+ * @freezer: Freezer whose timer_fd became readable
+ *
+ * Freezes the container if it used less than its idle share of a CPU since
+ * the last tick. A frozen container stays frozen until the next demand.
+ */
+void freezer_tick(struct freezer *freezer) {
+  uint64_t expirations;
+  if (read(freezer->timer_fd, &expirations, sizeof(expirations)) == -1 ||
+      freezer->frozen) {
+    return;
+  }
+
+  long long usage_usec = read_usage(freezer);
+  if (usage_usec == -1) {
+    return;
+  }
+
+  long long used_usec = usage_usec - freezer->usage_usec;
+  freezer->usage_usec = usage_usec;
+
+  long long interval_usec = (long long)freezer->interval_ms * 1000;
+  if (used_usec * IDLE_SHARE < interval_usec * (long long)expirations &&
+      freeze_cgroup(&freezer->cgroup, freezer->reclaim) == 0) {
+    freezer->frozen = 1;
+  }
+}
+
+/**
+ * freezer_demand - React to SIGUSR2
+ * @freezer: Freezer whose signal_fd became readable
+ */
+void freezer_demand(struct freezer *freezer) {
+  struct signalfd_siginfo info;
+  if (read(freezer->signal_fd, &info, sizeof(info)) == -1) {
+    return;
+  }
+
+  if (freezer->frozen && thaw_cgroup(&freezer->cgroup) == 0) {
+    freezer->frozen = 0;
+  }
+
+  /* The time it spent frozen doesn't count towards the next interval */
+  long long usage_usec = read_usage(freezer);
+  if (usage_usec != -1) {
+    freezer->usage_usec = usage_usec;
+  }
+  restart_timer(freezer);
+}
+
+/**
+ * freezer_stop - Stop freezing, thawing the container if it's frozen
+ * @freezer: Freezer to stop
+ */
+void freezer_stop(struct freezer *freezer) {
+  if (freezer->frozen) {
+    thaw_cgroup(&freezer->cgroup);
+  }
+
+  /* A SIGUSR2 still pending would kill us once it's unblocked */
+  struct signalfd_siginfo info;
+  while (read(freezer->signal_fd, &info, sizeof(info)) > 0) {
+  }
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+  close(freezer->signal_fd);
+  close(freezer->timer_fd);
+  close(freezer->stat_fd);
+  cgroup_close(&freezer->cgroup);
+}
@@ -0,0 +1,234 @@
+/**
+ * governor.c
+ *
+ * Adapting memory.high to a container's memory pressure.
+ *
+ * OVERVIEW:
+ * Raising memory.high is urgent, since a stalling job is losing time and may
+ * be about to hit memory.max, so it happens on every trigger and in big
+ * steps. Lowering it is not, so it happens at most once per relax interval
+ * and in small steps. This is what keeps the governor from oscillating: a job
+ * that is throttled right after memory.high was lowered gets the memory
+ * straight back, and it takes several quiet intervals to undo one raise.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "cgroups.h"
+#include "context.h"
+#include "governor.h"
+
+/**
+ * PSI_TRIGGER - Stall time and window of the memory pressure trigger
+ *
+ * Fires when some task in the cgroup stalled on memory for 200ms within a
+ * 2s window, 10% of the job's time. The kernel accepts windows between 500ms
+ * and 10s, but without CAP_SYS_RESOURCE only multiples of 2s.
+ */
+static const char *PSI_TRIGGER = "some 200000 2000000";
+
+/**
+ * RELAX_INTERVAL_MS - How long memory pressure has to stay low before
+ * memory.high is lowered
+ */
+static const int RELAX_INTERVAL_MS = 2000;
+
+/**
+ * RAISE_STEPS - Number of raises from the lowest to the highest memory.high
+ */
+static const int RAISE_STEPS = 8;
+
+/**
+ * RELAX_STEPS - Number of quiet intervals it takes to undo one raise
+ */
+static const int RELAX_STEPS = 4;
+
+/**
+ * set_high - Write a new memory.high
+ * @governor: Governor of the container
+ * @high: New memory.high in bytes, -1 for "max"
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int set_high(struct governor *governor, long long high) {
+  char value[CGROUP_VALUE_MAX];
+
+  if (high == -1) {
+    snprintf(value, CGROUP_VALUE_MAX, "max\n");
+  } else {
+    snprintf(value, CGROUP_VALUE_MAX, "%lld\n", high);
+  }
+
+  return cgroup_set(&governor->cgroup, CGROUP_MEMORY_HIGH, value);
+}
+
+/**
+ * raise_step - How much memory.high moves up on a trigger
+ * @governor: Governor of the container
+ *
+ * Return: Step size in bytes, at least one page
+ */
+static long long raise_step(const struct governor *governor) {
+  long long step = (governor->max - governor->min) / RAISE_STEPS;
+
+  return step > 4096 ? step : 4096;
+}
+
+/**
+ * governor_start - Start adapting a container's memory.high
+ * @governor: Governor to initialize
+ * @ctx: Container configuration with the memory.high bounds
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int governor_start(struct governor *governor, struct container_ctx *ctx,
+                   const char *cgroup_path) {
+  governor->trigger_fd = -1;
+  governor->timer_fd = -1;
+  governor->min = ctx->mem_high_min;
+  governor->max = ctx->mem_high_max;
+  governor->initial = ctx->mem_high;
+  governor->stalled = 0;
+
+  /*
+   * An unlimited memory.high starts out at the top of the range, anything
+   * else is moved into it.
+   */
+  governor->high = ctx->mem_high == -1 ? governor->max : ctx->mem_high;
+  if (governor->high < governor->min) {
+    governor->high = governor->min;
+  }
+  if (governor->high > governor->max) {
+    governor->high = governor->max;
+  }
+
+  if (cgroup_open(&governor->cgroup, cgroup_path) == -1) {
+    cgroup_close(&governor->cgroup);
+    return -1;
+  }
+
+  governor->trigger_fd = openat(governor->cgroup.dir_fd, "memory.pressure",
+                                O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (governor->trigger_fd == -1) {
+    fprintf(stderr, "Failed to open %s/memory.pressure: %s\n", cgroup_path,
+            strerror(errno));
+    goto fail;
+  }
+
+  /*
+   * The kernel parses the trigger from a NUL-terminated buffer, so the
+   * terminator is part of the write.
+   */
+  if (write(governor->trigger_fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) ==
+      -1) {
+    fprintf(stderr, "Failed to set memory pressure trigger: %s\n",
+            strerror(errno));
+    goto fail;
+  }
+
+  governor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (governor->timer_fd == -1) {
+    fprintf(stderr, "Failed to create relax timer: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  struct timespec interval = {.tv_sec = RELAX_INTERVAL_MS / 1000,
+                              .tv_nsec = (RELAX_INTERVAL_MS % 1000) * 1000000L};
+  struct itimerspec spec = {.it_interval = interval, .it_value = interval};
+  if (timerfd_settime(governor->timer_fd, 0, &spec, NULL) == -1) {
+    fprintf(stderr, "Failed to start relax timer: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  if (governor->high != governor->initial &&
+      set_high(governor, governor->high) == -1) {
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  if (governor->timer_fd != -1) {
+    close(governor->timer_fd);
+  }
+  if (governor->trigger_fd != -1) {
+    close(governor->trigger_fd);
+  }
+  cgroup_close(&governor->cgroup);
+  return -1;
+}
+
+/**
+ * governor_pressure - React to the PSI trigger firing
+ * @governor: Governor whose trigger_fd reported POLLPRI
+ *
+ * Raises memory.high by a step, up to the configured maximum.
+ */
+void governor_pressure(struct governor *governor) {
+  governor->stalled = 1;
+
+  long long high = governor->high + raise_step(governor);
+  if (high > governor->max) {
+    high = governor->max;
+  }
+
+  if (high != governor->high && set_high(governor, high) == 0) {
+    governor->high = high;
+  }
+}
+
+/**
+ * governor_relax - React to the relax timer firing
+ * @governor: Governor whose timer_fd became readable
+ *
+ * Lowers memory.high by a fraction of a step, down to the configured minimum,
+ * unless the trigger fired during the interval.
+ */
+void governor_relax(struct governor *governor) {
+  uint64_t expirations;
+  if (read(governor->timer_fd, &expirations, sizeof(expirations)) == -1) {
+    return;
+  }
+
+  if (governor->stalled) {
+    governor->stalled = 0;
+    return;
+  }
+
+  long long high = governor->high - raise_step(governor) / RELAX_STEPS;
+  if (high < governor->min) {
+    high = governor->min;
+  }
+
+  if (high != governor->high && set_high(governor, high) == 0) {
+    governor->high = high;
+  }
+}
+
+/**
+ * governor_stop - Stop adapting and restore the initial memory.high
+ * @governor: Governor to stop
+ *
+ * The governor writes through a handle of its own, so a pooled leaf's handle
+ * still believes the initial memory.high is in place. If restoring it fails,
+ * the pool is told to rewrite it, or the next job on the leaf would run with
+ * whatever we last set.
+ */
+void governor_stop(struct governor *governor) {
+  if (governor->high != governor->initial &&
+      set_high(governor, governor->initial) == -1) {
+    forget_cgroup_limit(governor->cgroup.path, CGROUP_MEMORY_HIGH);
+  }
+
+  close(governor->timer_fd);
+  close(governor->trigger_fd);
+  cgroup_close(&governor->cgroup);
+}
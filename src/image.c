@@ -0,0 +1,267 @@
+/**
+ * image.c
+ *
+ * Layers imported from filesystem images and tarballs.
+ *
+ * OVERVIEW:
+ * An image layer is mounted the way mount(8) does it with -o loop: claim a
+ * free loop device from /dev/loop-control, back it with the image and mount
+ * the device. Squashfs and erofs read and decompress blocks only when they
+ * are first accessed, so mounting is instant whatever the image's size, and
+ * files that are never read are never read from disk.
+ *
+ * LOOP DEVICES:
+ * LOOP_CONFIGURE (Linux 5.8) sets up a loop device in one call. Older kernels
+ * get the same from LOOP_SET_FD and LOOP_SET_STATUS64. The device is
+ * read-only and set to autoclear, so it detaches itself when its last user
+ * goes away: the mount once the image has been mounted, or us closing it if
+ * mounting fails.
+ *
+ * TARBALLS:
+ * Tarballs come in too many compressions and dialects to be worth parsing
+ * here, so they're handed to tar(1), which streams them to disk without ever
+ * holding the whole archive.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <linux/loop.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "image.h"
+
+/**
+ * SQUASHFS_MAGIC - "hsqs", the first four bytes of a squashfs image
+ */
+#define SQUASHFS_MAGIC 0x73717368
+
+/**
+ * EROFS_MAGIC - Magic number of the erofs superblock, 1024 bytes in
+ */
+#define EROFS_MAGIC 0xe0f5e1e2
+
+#define EROFS_SUPER_OFFSET 1024
+
+/**
+ * MAX_LOOP_ATTEMPTS - Times to retry when another process takes the loop
+ * device we were given first
+ */
+#define MAX_LOOP_ATTEMPTS 16
+
+/**
+ * read_le32 - Read a little-endian 32-bit number from a file
+ * @fd: File to read
+ * @offset: Position of the number
+ * @value: Output for the number
+ *
+ * Return: 0 on success, -1 if the file is too short or can't be read
+ */
+static int read_le32(int fd, off_t offset, uint32_t *value) {
+  unsigned char bytes[4];
+
+  if (pread(fd, bytes, sizeof(bytes), offset) != sizeof(bytes)) {
+    return -1;
+  }
+
+  *value = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+
+  return 0;
+}
+
+/**
+ * image_fstype - Recognize a filesystem image by its superblock
+ * @fd: Open file to check
+ *
+ * Return: "squashfs" or "erofs", or NULL if fd is neither
+ */
+const char *image_fstype(int fd) {
+  uint32_t magic;
+
+  if (read_le32(fd, 0, &magic) == 0 && magic == SQUASHFS_MAGIC) {
+    return "squashfs";
+  }
+
+  if (read_le32(fd, EROFS_SUPER_OFFSET, &magic) == 0 && magic == EROFS_MAGIC) {
+    return "erofs";
+  }
+
+  return NULL;
+}
+
+/**
+ * configure_loop - Back a loop device with an image
+ * @loop_fd: Open loop device
+ * @image_fd: Open image
+ * @image: Path of the image, shown in the loop device's backing_file
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+static int configure_loop(int loop_fd, int image_fd, const char *image) {
+  struct loop_config config;
+  memset(&config, 0, sizeof(config));
+  config.fd = image_fd;
+  config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+  snprintf((char *)config.info.lo_file_name, LO_NAME_SIZE, "%s", image);
+
+  if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) {
+    return 0;
+  }
+
+  if (errno != EINVAL && errno != ENOTTY) {
+    return -1;
+  }
+
+  /* Kernels before 5.8 */
+  if (ioctl(loop_fd, LOOP_SET_FD, image_fd) == -1) {
+    return -1;
+  }
+
+  if (ioctl(loop_fd, LOOP_SET_STATUS64, &config.info) == -1) {
+    int saved_errno = errno;
+    ioctl(loop_fd, LOOP_CLR_FD, 0);
+    errno = saved_errno;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * attach_loop - Set up a free loop device for an image
+ * @image: Image file
+ * @device: Output buffer of PATH_MAX bytes for the device's path
+ *
+ * Return: Open loop device on success, -1 on failure
+ */
+static int attach_loop(const char *image, char *device) {
+  int image_fd = open(image, O_RDONLY | O_CLOEXEC);
+  if (image_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", image, strerror(errno));
+    return -1;
+  }
+
+  int control_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+  if (control_fd == -1) {
+    fprintf(stderr, "Failed to open /dev/loop-control: %s\n", strerror(errno));
+    close(image_fd);
+    return -1;
+  }
+
+  int loop_fd = -1;
+
+  for (int attempt = 0; attempt < MAX_LOOP_ATTEMPTS; attempt++) {
+    int number = ioctl(control_fd, LOOP_CTL_GET_FREE);
+    if (number == -1) {
+      fprintf(stderr, "Failed to find a free loop device: %s\n",
+              strerror(errno));
+      break;
+    }
+
+    snprintf(device, PATH_MAX, "/dev/loop%d", number);
+
+    loop_fd = open(device, O_RDONLY | O_CLOEXEC);
+    if (loop_fd == -1) {
+      fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+      break;
+    }
+
+    if (configure_loop(loop_fd, image_fd, image) == 0) {
+      break;
+    }
+
+    int saved_errno = errno;
+    close(loop_fd);
+    loop_fd = -1;
+
+    /* Someone else claimed the device between the two calls */
+    if (saved_errno != EBUSY) {
+      fprintf(stderr, "Failed to set up %s: %s\n", device,
+              strerror(saved_errno));
+      break;
+    }
+  }
+
+  close(control_fd);
+  close(image_fd);
+
+  return loop_fd;
+}
+
+/**
+ * mount_image - Mount a filesystem image read-only through a loop device
+ * @image: Image file
+ * @fstype: Filesystem of the image, as returned by image_fstype()
+ * @target: Directory to mount it on
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_image(const char *image, const char *fstype, const char *target) {
+  char device[PATH_MAX];
+
+  int loop_fd = attach_loop(image, device);
+  if (loop_fd == -1) {
+    return -1;
+  }
+
+  int ret = 0;
+  if (mount(device, target, fstype, MS_RDONLY, NULL) == -1) {
+    fprintf(stderr, "Failed to mount %s on %s: %s\n", image, target,
+            strerror(errno));
+    ret = -1;
+  }
+
+  /* The mount holds the device now, or autoclear detaches it */
+  close(loop_fd);
+
+  return ret;
+}
+
+/**
+ * extract_tarball - Unpack a tarball into a directory
+ * @tarball: Archive to unpack, compressed or not
+ * @dir: Existing directory to unpack it into
+ *
+ * Ownership is restored by number, since the names in the archive mean
+ * nothing on the host.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int extract_tarball(const char *tarball, const char *dir) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Failed to fork tar: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    execlp("tar", "tar", "-x", "-p", "--numeric-owner", "-f", tarball, "-C",
+           dir, (char *)NULL);
+    fprintf(stderr, "Failed to run tar: %s\n", strerror(errno));
+    _exit(127);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Failed to wait for tar: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Failed to extract %s\n", tarball);
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,898 @@
+/**
+ * launch.c
+ *
+ * Container process creation and reaping.
+ *
+ * OVERVIEW:
+ * Creates the container's init process with clone() in new namespaces, and
+ * reaps it once it exits. The child side of the container lives in child.c.
+ *
+ * CLONE_INTO_CGROUP:
+ * On Linux 5.7 and later, clone3() can create the child directly inside its
+ * leaf cgroup. The child then doesn't have to wait for the parent and join the
+ * cgroup itself, which saves a round trip through the synchronization pipe and
+ * a write to cgroup.procs on every launch. On older kernels we fall back to
+ * clone() and the pipe handshake.
+ *
+ * ALLOCATIONS:
+ * Launching a container doesn't touch the heap. Paths live in PATH_MAX
+ * buffers inside ctx and struct container, commands in struct command, and
+ * every clone() child starts on the same static stack. The pools that are
+ * allocated (cgroup leaves, overlay and network slots) only grow until they
+ * cover the most containers alive at once.
+ *
+ * USER NAMESPACES:
+ * With "user" in ctx->namespaces, the child gets a user namespace of its own,
+ * in which it is root and holds the capabilities its setup needs, no matter
+ * who we are. Its uid and gid maps can only be written from outside, so the
+ * child always waits for the "ready" byte, which we only send once
+ * map_user() has mapped root to our own uid and gid. The namespace has no
+ * other ids in it, so files of anyone else show up as nobody.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/sched.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cgroups.h"
+#include "checkpoint.h"
+#include "child.h"
+#include "context.h"
+#include "filter.h"
+#include "launch.h"
+#include "network.h"
+#include "numa.h"
+#include "overlay.h"
+#include "supervisor.h"
+
+/**
+ * STACK_SIZE - Size of stack for the child process
+ *
+ * The clone() syscall requires a separate stack for the child process.
+ *
+ * On x86_64, stacks grown downward (from high addresses to low).
+ * We allocate the stack at the low address and pass a pointer to the top to
+ * clone().
+ */
+#define STACK_SIZE (1024 * 1024)
+
+/**
+ * child_stack - Stack every child created with clone() starts out on
+ *
+ * Without CLONE_VM, the child gets a copy-on-write copy of our memory at the
+ * moment of the clone(), stack included, so the same buffer can be handed to
+ * the next clone() right away. Being in .bss, its pages are only backed by
+ * memory once a child has touched them, and only in that child.
+ */
+static char child_stack[STACK_SIZE] __attribute__((aligned(16)));
+
+/**
+ * child_namespaces - Namespaces to create for the child
+ * @ctx: Container configuration
+ *
+ * A child with a network slot joins the slot's network namespace itself, so
+ * a new one would only be thrown away.
+ *
+ * Return: CLONE_NEW* flags for clone()
+ */
+static int child_namespaces(const struct container_ctx *ctx) {
+  int flags = ctx->namespaces | CLONE_NEWNS;
+
+  if (ctx->netns_fd != -1) {
+    flags &= ~CLONE_NEWNET;
+  }
+
+  return flags;
+}
+
+/**
+ * use_vfork - Check whether a container is spawned with CLONE_VFORK
+ * @ctx: Container configuration
+ *
+ * We're suspended until a CLONE_VFORK child execs, so the child must never
+ * wait for us on the way there. Warm containers wait for their command,
+ * profiled and supervised ones for their syscalls to be answered, and those
+ * in a user namespace for their id maps, so they always get their own memory.
+ *
+ * Return: Non-zero to spawn with CLONE_VM | CLONE_VFORK
+ */
+static int use_vfork(const struct container_ctx *ctx) {
+  return ctx->vfork && !ctx->pooled && ctx->profile_fds[1] == -1 &&
+         !ctx->supervise && !(ctx->namespaces & CLONE_NEWUSER);
+}
+
+/**
+ * vfork_child - Entry point of a child created with CLONE_VM
+ * @arg: Our container configuration
+ *
+ * Until the exec, the child runs in our memory, so anything it writes outside
+ * child_stack is written for us too. child_main() must not touch:
+ * - Our ctx: it updates its ctx as it goes (closed fds are set to -1, stages
+ *   are stamped), while start_container() still has to close our fds. So the
+ *   child works on a copy on its own stack. The strings it points to are only
+ *   read.
+ * - The seccomp filter: get_fprog() builds the static program on first use,
+ *   so start_container() builds it before the spawn and the child only reads
+ *   it.
+ * - Anything else static or on the heap, since we'd find it changed once the
+ *   child has exec'd.
+ * Two writes can't be avoided and are harmless because we are suspended
+ * meanwhile: errno is our thread's errno, and we don't read it until clone()
+ * has set it again, and the error paths only print to stderr, which is
+ * unbuffered. stdout must stay untouched, or we'd flush the child's output
+ * as our own.
+ *
+ * Return: Only returns on error, like child_main()
+ */
+static int vfork_child(void *arg) {
+  struct container_ctx ctx = *(struct container_ctx *)arg;
+
+  return child_main(&ctx);
+}
+
+/**
+ * spawn_container - Create child process in new namespaces
+ * @ctx: Container configuration
+ *
+ * Creates a new process using clone() with namespace isolation flags.
+ * The child process will execute child_main() in the new namespaces.
+ *
+ * CLONE VS FORK:
+ * - fork(): Creates a complete copy of the process
+ * - clone(): Can selectively share/isolate resources via flags
+ *
+ * NAMESPACE FLAGS:
+ * - CLONE_NEWUTS: New UTS namespace (hostname)
+ * - CLONE_NEWPID: New PID namespace (child becomes PID 1)
+ * - CLONE_NEWNS: New mount namespace (isolated mounts)
+ * - CLONE_NEWNET: New network namespace (no network access)
+ * - CLONE_NEWIPC: New IPC namespace (isolated IPC)
+ * - SIGCHLD: Send SIGCHLD to parent when child exits
+ * All but CLONE_NEWNS can be turned off with ctx->namespaces, and
+ * CLONE_NEWNET is left out when the child joins a network slot instead.
+ *
+ * STACK ALLOCATION:
+ * clone() requires a separate stack for the child. All children share
+ * child_stack, so launching a container doesn't touch the heap.
+ *
+ * CLONE_VFORK:
+ * With ctx->vfork, the child shares our memory (CLONE_VM) instead of getting
+ * a copy of it, so no page tables are copied and nothing is faulted in copy
+ * on write afterwards, however large we are. CLONE_VFORK suspends us until
+ * the child has exec'd or died, which is what makes this safe: nothing else
+ * touches child_stack or our memory meanwhile, and the exec gives the child
+ * an address space of its own. The price is that the child's setup no longer
+ * overlaps with our next launch.
+ *
+ * Return: Child PID on success, -1 on failure
+ */
+int spawn_container(struct container_ctx *ctx) {
+  /*
+   * Calculate the top of the stack since stacks grow downward on x86_64
+   */
+  char *stack_top = child_stack + STACK_SIZE;
+
+  /*
+   * Set up namespace flags for clone().
+   *
+   * SIGCHLD ensures we get notified when the child exits so we can call wait()
+   * to reap it.
+   */
+  int flags = child_namespaces(ctx) | SIGCHLD;
+  int (*fn)(void *) = child_main;
+
+  if (use_vfork(ctx)) {
+    flags |= CLONE_VM | CLONE_VFORK;
+    fn = vfork_child;
+  }
+
+  /*
+   * Create the child process.
+   * The child begins execution in child_main() with the new namespaces already
+   * active
+   */
+  int pid = clone(fn, stack_top, flags, ctx);
+  if (pid == -1) {
+    fprintf(stderr, "Failed to create child process: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return pid;
+}
+
+/**
+ * clone3_unsupported - Set once the kernel turned down CLONE_INTO_CGROUP
+ *
+ * Every later container goes straight to the fallback instead of asking the
+ * kernel again.
+ */
+static int clone3_unsupported = 0;
+
+/**
+ * spawn_into_cgroup - Create child process directly inside its leaf cgroup
+ * @ctx: Container configuration, cgroup_path must already be configured
+ * @pidfd: Set to a pidfd for the child
+ *
+ * Uses the same namespace flags as spawn_container(). clone3() has no glibc
+ * wrapper and no fn argument, so the child returns from the syscall like after
+ * fork(), on a copy-on-write copy of our stack, and calls child_main() there.
+ *
+ * UNSUPPORTED KERNELS:
+ * - ENOSYS: No clone3() at all (before Linux 5.3)
+ * - E2BIG: clone3() doesn't know the cgroup field (before Linux 5.7)
+ * - EINVAL: CLONE_INTO_CGROUP isn't a known flag
+ * These are returned without printing anything, so the caller can fall back
+ * quietly.
+ *
+ * Return: Child PID on success, -1 on failure with errno set
+ */
+static int spawn_into_cgroup(struct container_ctx *ctx, int *pidfd) {
+  int cgroup_fd = open(ctx->cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cgroup_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", ctx->cgroup_path,
+            strerror(errno));
+    return -1;
+  }
+
+  struct clone_args args = {
+      .flags = (unsigned int)child_namespaces(ctx) | CLONE_PIDFD |
+               CLONE_INTO_CGROUP,
+      .pidfd = (uint64_t)(uintptr_t)pidfd,
+      .exit_signal = SIGCHLD,
+      .cgroup = cgroup_fd,
+  };
+
+  /*
+   * The child sees this in its copy of ctx and skips the handshake.
+   */
+  ctx->in_cgroup = 1;
+
+  long pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == 0) {
+    _exit(child_main(ctx));
+  }
+
+  int saved_errno = errno;
+  ctx->in_cgroup = 0;
+  close(cgroup_fd);
+  errno = saved_errno;
+
+  if (pid == -1 && errno != ENOSYS && errno != E2BIG && errno != EINVAL) {
+    fprintf(stderr, "Failed to create child process: %s\n", strerror(errno));
+  }
+
+  return pid;
+}
+
+/**
+ * write_proc_file - Write a short string to one of a process's /proc files
+ * @pid: Process whose file to write
+ * @name: Name of the file in /proc/{pid}
+ * @value: What to write, in a single write() as the id map files require
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int write_proc_file(int pid, const char *name, const char *value) {
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "/proc/%d/%s", pid, name);
+
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  size_t len = strlen(value);
+  if (write(fd, value, len) != (ssize_t)len) {
+    fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+  return 0;
+}
+
+/**
+ * map_user - Map the child's root to us and let it carry on
+ * @ctx: Container configuration, pipe_fds[1] is written to
+ * @pid: The child, waiting in a user namespace of its own
+ *
+ * An unprivileged process may only map its own uid and gid, one each, and
+ * only once setgroups() is denied in the namespace for good. Denying it also
+ * keeps the container from dropping groups it was given to get around a
+ * file's group permissions.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int map_user(struct container_ctx *ctx, int pid) {
+  char map[64];
+
+  if (write_proc_file(pid, "setgroups", "deny") == -1) {
+    return -1;
+  }
+
+  snprintf(map, sizeof(map), "0 %u 1\n", (unsigned int)geteuid());
+  if (write_proc_file(pid, "uid_map", map) == -1) {
+    return -1;
+  }
+
+  snprintf(map, sizeof(map), "0 %u 1\n", (unsigned int)getegid());
+  if (write_proc_file(pid, "gid_map", map) == -1) {
+    return -1;
+  }
+
+  char ping = 'c';
+  if (write(ctx->pipe_fds[1], &ping, 1) == -1) {
+    fprintf(stderr, "Failed to write to pipe: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * CGROUP_NAME_MAX - Maximum length of a container's leaf cgroup name
+ */
+#define CGROUP_NAME_MAX 64
+
+/**
+ * next_container_id - Sequence number for the next container
+ */
+static int next_container_id = 0;
+
+/**
+ * close_timing_pipe - Close both ends of ctx's timing pipe, if there is one
+ * @ctx: Container configuration
+ */
+static void close_timing_pipe(struct container_ctx *ctx) {
+  for (int i = 0; i < 2; i++) {
+    if (ctx->timing_fds[i] != -1) {
+      close(ctx->timing_fds[i]);
+      ctx->timing_fds[i] = -1;
+    }
+  }
+}
+
+/**
+ * close_supervisor_pipe - Close both ends of ctx's supervisor pipe, if there
+ * is one
+ * @ctx: Container configuration
+ */
+static void close_supervisor_pipe(struct container_ctx *ctx) {
+  for (int i = 0; i < 2; i++) {
+    if (ctx->supervisor_fds[i] != -1) {
+      close(ctx->supervisor_fds[i]);
+      ctx->supervisor_fds[i] = -1;
+    }
+  }
+}
+
+/**
+ * close_output_pipes - Close every end of ctx's output pipes that is open
+ * @ctx: Container configuration
+ */
+static void close_output_pipes(struct container_ctx *ctx) {
+  for (int i = 0; i < 2; i++) {
+    if (ctx->stdout_fds[i] != -1) {
+      close(ctx->stdout_fds[i]);
+      ctx->stdout_fds[i] = -1;
+    }
+
+    if (ctx->stderr_fds[i] != -1) {
+      close(ctx->stderr_fds[i]);
+      ctx->stderr_fds[i] = -1;
+    }
+  }
+}
+
+/**
+ * open_output_pipe - Create the pipe one of the child's output streams goes
+ * into
+ * @ctx: Container configuration with output_buffer
+ * @fds: Set to the pipe's read and write ends
+ *
+ * Only our read end is non-blocking. The job gets an ordinary blocking pipe,
+ * which is what makes it wait for the relay once the pipe is full.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int open_output_pipe(const struct container_ctx *ctx, int fds[2]) {
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create output pipe: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+    fprintf(stderr, "Failed to make output pipe non-blocking: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  int size = ctx->output_buffer > INT_MAX ? INT_MAX : ctx->output_buffer;
+  if (fcntl(fds[0], F_SETPIPE_SZ, size) == -1) {
+    fprintf(stderr, "Failed to resize output pipe to %lld bytes: %s\n",
+            ctx->output_buffer, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * abandon_start - Give back what start_container() acquired before failing
+ * @container: Container that couldn't be started
+ */
+static void abandon_start(struct container *container) {
+  if (container->stdout_fd != -1) {
+    close(container->stdout_fd);
+    container->stdout_fd = -1;
+  }
+
+  if (container->stderr_fd != -1) {
+    close(container->stderr_fd);
+    container->stderr_fd = -1;
+  }
+
+  release_net_slot(container->net_slot);
+  container->net_slot = -1;
+  release_overlay_slot(container->overlay_slot);
+  container->overlay_slot = -1;
+  release_cgroup(container->cgroup_path);
+  numa_release_node(container->numa_node);
+  container->numa_node = -1;
+}
+
+/**
+ * claim_cgroup - Give a new container its NUMA node and leaf cgroup
+ * @ctx: Container configuration, numa_node and cgroup_path are overwritten
+ * @container: Container being started, numa_node and cgroup_path are set
+ *
+ * On failure, everything claimed so far has been given back.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int claim_cgroup(struct container_ctx *ctx,
+                        struct container *container) {
+  container->id = next_container_id++;
+  container->pid = -1;
+  container->pidfd = -1;
+  container->sync_fd = -1;
+  container->overlay_slot = -1;
+  container->net_slot = -1;
+  container->numa_node = -1;
+  container->timing_fd = -1;
+  container->timing.received = 0;
+  container->stdout_fd = -1;
+  container->stderr_fd = -1;
+
+  char name[CGROUP_NAME_MAX];
+  snprintf(name, CGROUP_NAME_MAX, "%d-%d", getpid(), container->id);
+
+  /*
+   * acquire_cgroup() only sets the path once it's about to create the leaf,
+   * so on failure we never remove a cgroup that isn't ours.
+   */
+  ctx->numa_node = -1;
+  if (ctx->numa_spread) {
+    ctx->numa_node = numa_acquire_node();
+    if (ctx->numa_node == -1) {
+      return -1;
+    }
+  }
+  container->numa_node = ctx->numa_node;
+
+  ctx->cgroup_path[0] = '\0';
+  int acquired = acquire_cgroup(ctx, name);
+  memcpy(container->cgroup_path, ctx->cgroup_path, PATH_MAX);
+  if (acquired == -1) {
+    fprintf(stderr, "Failed to configure cgroups\n");
+    abandon_start(container);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * start_container - Create a container in its own leaf cgroup
+ * @ctx: Container configuration, pipe_fds, numa_node, cgroup_path,
+ *       overlay_dir and netns_fd are overwritten
+ * @container: Filled in with the new container
+ *
+ * The leaf comes from the cgroup pool if one was set up with
+ * cgroup_pool_init(). Fresh leaf names combine our PID with a sequence number,
+ * which keeps them unique across containers of this process and across euclid
+ * processes running at the same time. The overlay slot is claimed after the
+ * cgroup, so the slot stage of the launch timing only covers the slot, and the
+ * network slot after that for the same reason.
+ *
+ * The child is created inside its leaf cgroup with CLONE_INTO_CGROUP where
+ * the kernel supports it. Otherwise the "cgroups ready" byte is written
+ * before clone(), so it is already waiting in the pipe when the child gets to
+ * its first read. A child in a user namespace gets the byte after its id
+ * maps, in either case. The pipe is O_CLOEXEC so that the target program never
+ * inherits it.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int start_container(struct container_ctx *ctx, struct container *container) {
+  launch_stamp(&ctx->timing, LAUNCH_START);
+
+  /* A child sharing our memory must find the filter built (see vfork_child) */
+  if (use_vfork(ctx) && ctx->seccomp && !get_fprog()) {
+    return -1;
+  }
+
+  if (claim_cgroup(ctx, container) == -1) {
+    return -1;
+  }
+  launch_stamp(&ctx->timing, LAUNCH_CGROUP);
+
+  /* A container in a user namespace mounts a private slot itself */
+  int userns = ctx->namespaces & CLONE_NEWUSER;
+  if (ctx->overlay && !userns) {
+    container->overlay_slot = acquire_overlay_slot(ctx);
+    if (container->overlay_slot == -1) {
+      abandon_start(container);
+      return -1;
+    }
+  }
+  launch_stamp(&ctx->timing, LAUNCH_OVERLAY_SLOT);
+
+  ctx->netns_fd = -1;
+  if (ctx->network) {
+    container->net_slot = acquire_net_slot(ctx);
+    if (container->net_slot == -1) {
+      abandon_start(container);
+      return -1;
+    }
+  }
+  launch_stamp(&ctx->timing, LAUNCH_NET_SLOT);
+
+  /*
+   * The child's write end is close-on-exec, which is how we learn that the
+   * exec happened. Our end is non-blocking so event loops can poll it.
+   */
+  if (ctx->time_launch &&
+      pipe2(ctx->timing_fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+    fprintf(stderr, "Failed to create timing pipe: %s\n", strerror(errno));
+    abandon_start(container);
+    return -1;
+  }
+
+  if (ctx->capture_output &&
+      (open_output_pipe(ctx, ctx->stdout_fds) == -1 ||
+       open_output_pipe(ctx, ctx->stderr_fds) == -1)) {
+    close_output_pipes(ctx);
+    close_timing_pipe(ctx);
+    abandon_start(container);
+    return -1;
+  }
+
+  if (ctx->supervise && pipe2(ctx->supervisor_fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create supervisor pipe: %s\n",
+            strerror(errno));
+    close_output_pipes(ctx);
+    close_timing_pipe(ctx);
+    abandon_start(container);
+    return -1;
+  }
+
+  if (pipe2(ctx->pipe_fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+    close_supervisor_pipe(ctx);
+    close_output_pipes(ctx);
+    close_timing_pipe(ctx);
+    abandon_start(container);
+    return -1;
+  }
+
+  /*
+   * clone3() has no fn argument, so a child sharing our memory would have to
+   * start out with hand-written assembly. CLONE_VFORK children join their
+   * cgroup themselves instead.
+   */
+  int vfork = use_vfork(ctx);
+
+  if (!vfork && !clone3_unsupported) {
+    container->pid = spawn_into_cgroup(ctx, &container->pidfd);
+    if (container->pid == -1 &&
+        (errno == ENOSYS || errno == E2BIG || errno == EINVAL)) {
+      clone3_unsupported = 1;
+    }
+  }
+
+  if (vfork || clone3_unsupported) {
+    char ping = 'c';
+    if (!userns && write(ctx->pipe_fds[1], &ping, 1) == -1) {
+      fprintf(stderr, "Failed to write to pipe: %s\n", strerror(errno));
+      close(ctx->pipe_fds[0]);
+      close(ctx->pipe_fds[1]);
+      close_supervisor_pipe(ctx);
+      close_output_pipes(ctx);
+      close_timing_pipe(ctx);
+      abandon_start(container);
+      return -1;
+    }
+
+    container->pid = spawn_container(ctx);
+
+    /*
+     * pidfd_open() needs Linux 5.3, so a missing pidfd is only an error for
+     * callers that need one.
+     */
+    if (container->pid != -1) {
+      container->pidfd = syscall(SYS_pidfd_open, container->pid, 0);
+    }
+  }
+
+  if (container->pid != -1 && userns && map_user(ctx, container->pid) == -1) {
+    kill(container->pid, SIGKILL);
+    waitpid(container->pid, NULL, 0);
+    if (container->pidfd != -1) {
+      close(container->pidfd);
+      container->pidfd = -1;
+    }
+    container->pid = -1;
+  }
+
+  /*
+   * The read end belongs to the child now. The child closes its copy of the
+   * write end, so it sees EOF once we close ours.
+   */
+  if (close(ctx->pipe_fds[0]) == -1) {
+    fprintf(stderr, "Failed to close pipe: %s\n", strerror(errno));
+  }
+
+  /*
+   * Only the child writes to the profiling pipe. Closing our copy of the write
+   * end means a read sees EOF if the child dies before reporting.
+   */
+  if (ctx->profile_fds[1] != -1) {
+    if (close(ctx->profile_fds[1]) == -1) {
+      fprintf(stderr, "Failed to close profiling pipe: %s\n",
+              strerror(errno));
+    }
+    ctx->profile_fds[1] = -1;
+  }
+
+  /*
+   * Same for the timing pipe, so we see EOF on exec or if the child dies.
+   */
+  if (ctx->timing_fds[1] != -1) {
+    close(ctx->timing_fds[1]);
+    ctx->timing_fds[1] = -1;
+  }
+  container->timing_fd = ctx->timing_fds[0];
+  ctx->timing_fds[0] = -1;
+
+  /*
+   * The output pipes' write ends are the child's stdout and stderr now.
+   */
+  if (ctx->capture_output) {
+    close(ctx->stdout_fds[1]);
+    close(ctx->stderr_fds[1]);
+    ctx->stdout_fds[1] = -1;
+    ctx->stderr_fds[1] = -1;
+  }
+  container->stdout_fd = ctx->stdout_fds[0];
+  container->stderr_fd = ctx->stderr_fds[0];
+  ctx->stdout_fds[0] = -1;
+  ctx->stderr_fds[0] = -1;
+
+  /*
+   * Only the child writes to the supervisor pipe as well.
+   */
+  if (ctx->supervisor_fds[1] != -1) {
+    close(ctx->supervisor_fds[1]);
+    ctx->supervisor_fds[1] = -1;
+  }
+
+  if (container->pid == -1) {
+    close(ctx->pipe_fds[1]);
+    if (container->timing_fd != -1) {
+      close(container->timing_fd);
+      container->timing_fd = -1;
+    }
+    close_supervisor_pipe(ctx);
+    abandon_start(container);
+    return -1;
+  }
+
+  container->sync_fd = ctx->pipe_fds[1];
+
+  /*
+   * The supervisor gets its own pidfd, since it may outlive our container
+   * struct by a little.
+   */
+  if (ctx->supervise) {
+    int report_fd = ctx->supervisor_fds[0];
+    ctx->supervisor_fds[0] = -1;
+
+    int supervisor_pidfd = container->pidfd == -1
+                               ? -1
+                               : fcntl(container->pidfd, F_DUPFD_CLOEXEC, 0);
+    if (supervisor_pidfd == -1) {
+      fprintf(stderr, "Failed to get a pidfd for the supervisor: %s\n",
+              strerror(errno));
+      close(report_fd);
+    }
+
+    if (supervisor_pidfd == -1 ||
+        supervise_container(supervisor_pidfd, report_fd) == -1) {
+      /* Its exec would wait for an answer that never comes */
+      kill(container->pid, SIGKILL);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * restore_container - Restore a checkpointed container in its own leaf cgroup
+ * @ctx: Container configuration, numa_node and cgroup_path are overwritten
+ * @container: Filled in with the restored container
+ * @dir: Directory holding the image written by checkpoint_container()
+ *
+ * The leaf is the same as start_container() would claim, but criu creates
+ * the processes in it (see checkpoint.c). Nothing is sent to a restored
+ * container, so it has no synchronization pipe.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int restore_container(struct container_ctx *ctx, struct container *container,
+                      const char *dir) {
+  if (claim_cgroup(ctx, container) == -1) {
+    return -1;
+  }
+
+  container->pid = restore_checkpoint(ctx, dir, container->cgroup_path);
+  if (container->pid == -1) {
+    abandon_start(container);
+    return -1;
+  }
+
+  container->pidfd = syscall(SYS_pidfd_open, container->pid, 0);
+
+  return 0;
+}
+
+/**
+ * collect_launch_timing - Read a container's launch timing if it's ready
+ * @container: Container with an open timing_fd
+ * @job: Job number to report
+ * @out: Stream to write the launch timing line to
+ *
+ * Return: 1 if timing_fd was closed, 0 if the exec hasn't happened yet
+ */
+int collect_launch_timing(struct container *container, int job, FILE *out) {
+  int complete = read_launch_timing(container->timing_fd, &container->timing);
+  if (complete == 0) {
+    return 0;
+  }
+
+  if (complete == 1) {
+    report_launch_timing(&container->timing, job, container->pid, out);
+  }
+
+  close(container->timing_fd);
+  container->timing_fd = -1;
+
+  return 1;
+}
+
+/**
+ * release_container - Free the parent's resources for a container
+ * @container: Container that has already been reaped
+ */
+void release_container(struct container *container) {
+  if (container->pidfd != -1) {
+    if (close(container->pidfd) == -1) {
+      fprintf(stderr, "Failed to close pidfd: %s\n", strerror(errno));
+    }
+    container->pidfd = -1;
+  }
+
+  if (container->sync_fd != -1) {
+    if (close(container->sync_fd) == -1) {
+      fprintf(stderr, "Failed to close pipe: %s\n", strerror(errno));
+    }
+    container->sync_fd = -1;
+  }
+
+  if (container->timing_fd != -1) {
+    if (close(container->timing_fd) == -1) {
+      fprintf(stderr, "Failed to close timing pipe: %s\n", strerror(errno));
+    }
+    container->timing_fd = -1;
+  }
+
+  if (container->stdout_fd != -1) {
+    close(container->stdout_fd);
+    container->stdout_fd = -1;
+  }
+
+  if (container->stderr_fd != -1) {
+    close(container->stderr_fd);
+    container->stderr_fd = -1;
+  }
+
+  release_cgroup(container->cgroup_path);
+  numa_release_node(container->numa_node);
+  container->numa_node = -1;
+
+  release_overlay_slot(container->overlay_slot);
+  container->overlay_slot = -1;
+
+  release_net_slot(container->net_slot);
+  container->net_slot = -1;
+}
+
+/**
+ * wait_for_container - Wait for container to exit and report status
+ * @pid: PID of container process
+ * @status: Set to the wait status
+ * @usage: Set to the resources the container's init process and the
+ *         processes it reaped used
+ *
+ * Blocks until the container process exits, then reports how it terminated.
+ * This is essential for proper process cleanup.
+ *
+ * Return: 0 on success, -1 if the container couldn't be reaped
+ */
+int wait_for_container(int pid, int *status, struct rusage *usage) {
+  /*
+   * Wait for the specific child process to change state. This blocks until the
+   * child exits. wait4() is waitpid() that also hands over the child's
+   * rusage, which is otherwise gone once it's reaped.
+   */
+  while (wait4(pid, status, 0, usage) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Failed to wait for container: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  /*
+   * Check if process exited normally by calling exit() or returning from main
+   */
+  if (WIFEXITED(*status)) {
+    printf("Child exited normally\n");
+  }
+
+  /*
+   * Check if process was killed by a signal
+   */
+  if (WIFSIGNALED(*status)) {
+    int sig = WTERMSIG(*status);
+    printf("Child killed by signal %d: %s\n", sig, strsignal(sig));
+
+    /*
+     * SIGSYS (31) is sent by seccomp when a non-whitelisted syscall is
+     * attempted.
+     */
+    if (sig == SIGSYS) {
+      printf("Likely seccomp violation.\n");
+    }
+  }
+
+  /*
+   * Other containers may write to the same terminal or file, so make sure the
+   * report shows up right after the container it belongs to.
+   */
+  fflush(stdout);
+
+  return 0;
+}
@@ -0,0 +1,725 @@
+/**
+ * layers.c
+ *
+ * Content-addressed store of root filesystem layers.
+ *
+ * OVERVIEW:
+ * The store is a plain directory with one subdirectory per layer, named after
+ * the layer's digest. Overlayfs stacks the layers itself, so there is nothing
+ * to unpack or copy at launch: resolve_layers() only has to turn digests into
+ * a lowerdir option once, before the first container starts.
+ *
+ * IMAGES:
+ * A squashfs or erofs image is kept as {digest}.img, where the digest is
+ * simply that of the image file (what sha256sum(1) prints), next to an empty
+ * {digest} directory. resolve_layers() mounts the image on that directory
+ * the first time a container needs it, and the mount is left in place for
+ * later runs, so from then on the layer is used like any other. Tarballs are
+ * unpacked into a temporary directory inside the store and imported from
+ * there, which makes them directory layers with the same digest as the tree
+ * they contain.
+ *
+ * HASHING:
+ * A layer is hashed by walking it depth-first with the entries of every
+ * directory sorted by name (strcmp(), not the locale's collation), feeding
+ * one record per entry into SHA-256:
+ *   <relative path> NUL <st_mode in octal> <uid> <gid> NUL <payload>
+ * The payload is the size and contents of a regular file, the target of a
+ * symlink or "major:minor" of a device node, and empty for everything else.
+ *
+ * LOWERDIR LENGTH:
+ * Overlayfs gets all of its options in a single page, so the lower layers
+ * have to fit in LOWERDIR_MAX bytes. Store layers are written relative to the
+ * store, 64 characters each, which is why the child mounts the overlay from
+ * inside layer_store.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ftw.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "image.h"
+#include "layers.h"
+#include "sha256.h"
+
+/**
+ * READ_CHUNK - Bytes read from a file at a time while hashing it
+ */
+#define READ_CHUNK 65536
+
+/**
+ * IMPORT_FDS - Directories nftw() keeps open while removing a tree
+ */
+#define IMPORT_FDS 64
+
+static int hash_entry(struct sha256 *sha, int parent_fd, const char *name,
+                      const char *rel);
+
+/**
+ * skip_dots - scandirat() filter that leaves out "." and ".."
+ * @entry: Directory entry
+ *
+ * Return: Non-zero to keep the entry
+ */
+static int skip_dots(const struct dirent *entry) {
+  return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+/**
+ * compare_names - scandirat() comparator sorting entries bytewise by name
+ * @a: First entry
+ * @b: Second entry
+ *
+ * alphasort() would use the locale's collation, which would make the digest
+ * depend on the environment.
+ *
+ * Return: Negative, zero, or positive like strcmp()
+ */
+static int compare_names(const struct dirent **a, const struct dirent **b) {
+  return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/**
+ * hash_file - Feed the contents of a regular file into a digest
+ * @sha: Digest state
+ * @fd: File to read, at its start
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int hash_file(struct sha256 *sha, int fd) {
+  static char buf[READ_CHUNK];
+
+  for (;;) {
+    ssize_t bytes = read(fd, buf, sizeof(buf));
+    if (bytes == 0) {
+      return 0;
+    }
+
+    if (bytes == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    sha256_update(sha, buf, bytes);
+  }
+}
+
+/**
+ * hash_dir - Feed every entry of a directory into a digest, sorted by name
+ * @sha: Digest state
+ * @dir_fd: Directory to hash
+ * @rel: Path of the directory relative to the layer, "" for the layer itself
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int hash_dir(struct sha256 *sha, int dir_fd, const char *rel) {
+  struct dirent **entries;
+  int count = scandirat(dir_fd, ".", &entries, skip_dots, compare_names);
+  if (count == -1) {
+    fprintf(stderr, "Failed to read directory /%s: %s\n", rel,
+            strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+
+  for (int i = 0; i < count; i++) {
+    char child_rel[PATH_MAX];
+    const char *name = entries[i]->d_name;
+
+    if (ret == 0) {
+      if (snprintf(child_rel, PATH_MAX, "%s%s%s", rel, rel[0] ? "/" : "",
+                   name) >= PATH_MAX) {
+        fprintf(stderr, "Path too long in layer: /%s/%s\n", rel, name);
+        ret = -1;
+      } else {
+        ret = hash_entry(sha, dir_fd, name, child_rel);
+      }
+    }
+
+    free(entries[i]);
+  }
+
+  free(entries);
+
+  return ret;
+}
+
+/**
+ * hash_entry - Feed the record of one entry into a digest
+ * @sha: Digest state
+ * @parent_fd: Directory containing the entry, or AT_FDCWD
+ * @name: Name of the entry in parent_fd
+ * @rel: Path of the entry relative to the layer, "" for the layer itself
+ *
+ * Directories are followed by the records of everything inside them.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int hash_entry(struct sha256 *sha, int parent_fd, const char *name,
+                      const char *rel) {
+  struct stat st;
+  if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+    fprintf(stderr, "Failed to stat /%s: %s\n", rel, strerror(errno));
+    return -1;
+  }
+
+  char header[64];
+  int header_len = snprintf(header, sizeof(header), "%o %u %u",
+                            (unsigned int)st.st_mode, (unsigned int)st.st_uid,
+                            (unsigned int)st.st_gid);
+
+  /* The terminating null bytes keep neighbouring fields apart */
+  sha256_update(sha, rel, strlen(rel) + 1);
+  sha256_update(sha, header, header_len + 1);
+
+  if (S_ISREG(st.st_mode)) {
+    int fd = openat(parent_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "Failed to open /%s: %s\n", rel, strerror(errno));
+      return -1;
+    }
+
+    char size[32];
+    int size_len = snprintf(size, sizeof(size), "%lld", (long long)st.st_size);
+    sha256_update(sha, size, size_len + 1);
+
+    int ret = hash_file(sha, fd);
+    if (ret == -1) {
+      fprintf(stderr, "Failed to read /%s: %s\n", rel, strerror(errno));
+    }
+    close(fd);
+
+    return ret;
+  }
+
+  if (S_ISLNK(st.st_mode)) {
+    char target[PATH_MAX];
+    ssize_t len = readlinkat(parent_fd, name, target, sizeof(target));
+    if (len == -1) {
+      fprintf(stderr, "Failed to read link /%s: %s\n", rel, strerror(errno));
+      return -1;
+    }
+
+    sha256_update(sha, target, len);
+    return 0;
+  }
+
+  if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+    char numbers[32];
+    int len = snprintf(numbers, sizeof(numbers), "%u:%u", major(st.st_rdev),
+                       minor(st.st_rdev));
+    sha256_update(sha, numbers, len);
+    return 0;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    int fd = openat(parent_fd, name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "Failed to open /%s: %s\n", rel, strerror(errno));
+      return -1;
+    }
+
+    int ret = hash_dir(sha, fd, rel);
+    close(fd);
+
+    return ret;
+  }
+
+  return 0;
+}
+
+/**
+ * layer_digest - Compute the digest of a layer
+ * @dir: Directory holding the layer
+ * @digest: Output buffer of SHA256_HEX_LEN + 1 bytes
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int layer_digest(const char *dir, char *digest) {
+  struct stat st;
+  if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "%s is not a directory\n", dir);
+    return -1;
+  }
+
+  struct sha256 sha;
+  sha256_init(&sha);
+
+  if (hash_entry(&sha, AT_FDCWD, dir, "") == -1) {
+    return -1;
+  }
+
+  sha256_hex(&sha, digest);
+
+  return 0;
+}
+
+/**
+ * make_dirs - Create a directory and any missing parents
+ * @path: Directory to create
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int make_dirs(const char *path) {
+  char partial[PATH_MAX];
+  if (snprintf(partial, PATH_MAX, "%s", path) >= PATH_MAX) {
+    fprintf(stderr, "Path too long: %s\n", path);
+    return -1;
+  }
+
+  for (char *slash = strchr(partial + 1, '/');; slash = strchr(slash + 1, '/')) {
+    if (slash) {
+      *slash = '\0';
+    }
+
+    if (mkdir(partial, 0755) == -1 && errno != EEXIST) {
+      fprintf(stderr, "Failed to create %s: %s\n", partial, strerror(errno));
+      return -1;
+    }
+
+    if (!slash) {
+      return 0;
+    }
+    *slash = '/';
+  }
+}
+
+/**
+ * store_path - Build the path of a layer in the store
+ * @path: Output buffer of PATH_MAX bytes
+ * @store: Layer store directory
+ * @digest: Digest of the layer
+ * @suffix: Appended to the digest, "" for the layer or ".img" for its image
+ *
+ * Return: 0 on success, -1 if the path doesn't fit
+ */
+static int store_path(char *path, const char *store, const char *digest,
+                      const char *suffix) {
+  if (snprintf(path, PATH_MAX, "%s/%s%s", store, digest, suffix) >= PATH_MAX) {
+    fprintf(stderr, "Path too long: %s\n", store);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * move_into_store - Rename a file or directory to its place in the store
+ * @from: Layer or image to move
+ * @target: Its path in the store
+ *
+ * Importing a layer that another import moved in at the same time fails with
+ * EEXIST or ENOTEMPTY, which is as good as success.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int move_into_store(const char *from, const char *target) {
+  struct stat st;
+  if (lstat(target, &st) == 0) {
+    return 0;
+  }
+
+  if (rename(from, target) == -1 && errno != EEXIST && errno != ENOTEMPTY) {
+    fprintf(stderr, "Failed to move %s into the layer store: %s\n", from,
+            strerror(errno));
+    if (errno == EXDEV) {
+      fprintf(stderr, "The layer has to be on the same filesystem as the "
+                      "layer store\n");
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * import_dir - Move a directory layer into the store
+ * @ctx: Container configuration containing layer_store
+ * @dir: Directory holding the layer
+ * @digest: Output buffer of SHA256_HEX_LEN + 1 bytes
+ *
+ * The layer is moved with rename() rather than copied, which is instant and
+ * keeps ownership, permissions and hard links exactly as they were.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int import_dir(const struct container_ctx *ctx, const char *dir,
+                      char *digest) {
+  char target[PATH_MAX];
+
+  if (layer_digest(dir, digest) == -1 ||
+      store_path(target, ctx->layer_store, digest, "") == -1) {
+    return -1;
+  }
+
+  return move_into_store(dir, target);
+}
+
+/**
+ * import_image - Move a squashfs or erofs image into the store
+ * @ctx: Container configuration containing layer_store
+ * @image: Image file
+ * @fd: Open image, at its start
+ * @digest: Output buffer of SHA256_HEX_LEN + 1 bytes
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int import_image(const struct container_ctx *ctx, const char *image,
+                        int fd, char *digest) {
+  struct sha256 sha;
+  sha256_init(&sha);
+
+  if (hash_file(&sha, fd) == -1) {
+    fprintf(stderr, "Failed to read %s: %s\n", image, strerror(errno));
+    return -1;
+  }
+  sha256_hex(&sha, digest);
+
+  char target[PATH_MAX];
+  char mount_point[PATH_MAX];
+  if (store_path(target, ctx->layer_store, digest, ".img") == -1 ||
+      store_path(mount_point, ctx->layer_store, digest, "") == -1) {
+    return -1;
+  }
+
+  /*
+   * The image goes in first, an empty directory without it would be taken
+   * for an empty layer.
+   */
+  if (move_into_store(image, target) == -1) {
+    return -1;
+  }
+
+  if (mkdir(mount_point, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", mount_point, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * remove_entry - nftw() callback deleting everything it visits
+ * @path: Entry to delete
+ * @st: Unused
+ * @type: Unused
+ * @ftw: Unused
+ *
+ * Return: 0 to keep walking, -1 to stop
+ */
+static int remove_entry(const char *path, const struct stat *st, int type,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)type;
+  (void)ftw;
+
+  if (remove(path) == -1) {
+    fprintf(stderr, "Failed to remove %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * import_tarball - Unpack a tarball and import it as a directory layer
+ * @ctx: Container configuration containing layer_store
+ * @tarball: Archive to unpack
+ * @digest: Output buffer of SHA256_HEX_LEN + 1 bytes
+ *
+ * The tarball is unpacked inside the store, so that moving the result into
+ * place never has to cross filesystems. Whatever is left of the temporary
+ * directory afterwards is removed, which is all of it if the store already
+ * had the layer.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int import_tarball(const struct container_ctx *ctx, const char *tarball,
+                          char *digest) {
+  char tmp_dir[PATH_MAX];
+  if (store_path(tmp_dir, ctx->layer_store, ".import-", "XXXXXX") == -1) {
+    return -1;
+  }
+
+  if (!mkdtemp(tmp_dir)) {
+    fprintf(stderr, "Failed to create a directory in %s: %s\n",
+            ctx->layer_store, strerror(errno));
+    return -1;
+  }
+
+  /* mkdtemp() makes it 0700, for archives without a "./" entry */
+  int ret = chmod(tmp_dir, 0755);
+  if (ret == -1) {
+    fprintf(stderr, "Failed to set mode of %s: %s\n", tmp_dir,
+            strerror(errno));
+  }
+
+  if (ret == 0) {
+    ret = extract_tarball(tarball, tmp_dir);
+  }
+
+  if (ret == 0) {
+    ret = import_dir(ctx, tmp_dir, digest);
+  }
+
+  struct stat st;
+  if (lstat(tmp_dir, &st) == 0 &&
+      nftw(tmp_dir, remove_entry, IMPORT_FDS, FTW_DEPTH | FTW_PHYS) != 0) {
+    ret = -1;
+  }
+
+  return ret;
+}
+
+/**
+ * import_layer - Move a directory, image or tarball into the layer store
+ * @ctx: Container configuration containing layer_store
+ * @path: Directory, squashfs or erofs image, or tarball holding the layer
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int import_layer(const struct container_ctx *ctx, const char *path) {
+  struct stat st;
+  if (lstat(path, &st) == -1) {
+    fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "%s is not a directory, image or tarball\n", path);
+    return -1;
+  }
+
+  if (make_dirs(ctx->layer_store) == -1) {
+    return -1;
+  }
+
+  char digest[SHA256_HEX_LEN + 1];
+  int ret;
+
+  if (S_ISDIR(st.st_mode)) {
+    ret = import_dir(ctx, path, digest);
+  } else {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+
+    if (image_fstype(fd)) {
+      ret = import_image(ctx, path, fd, digest);
+    } else {
+      ret = import_tarball(ctx, path, digest);
+    }
+    close(fd);
+  }
+
+  if (ret == 0) {
+    printf("%s\n", digest);
+  }
+
+  return ret;
+}
+
+/**
+ * is_digest_prefix - Check that a layer reference only has hex digits
+ * @ref: Layer reference from ctx->layers
+ *
+ * Return: 1 if ref can be (the start of) a digest, 0 otherwise
+ */
+static int is_digest_prefix(const char *ref) {
+  size_t len = strspn(ref, "0123456789abcdef");
+
+  return len > 0 && len <= SHA256_HEX_LEN && ref[len] == '\0';
+}
+
+/**
+ * find_layer - Look up the layer a digest or digest prefix refers to
+ * @store: Layer store directory
+ * @ref: Digest or prefix of one
+ * @digest: Output buffer of SHA256_HEX_LEN + 1 bytes
+ *
+ * Return: 0 on success, -1 if no layer or more than one layer matches
+ */
+static int find_layer(const char *store, const char *ref, char *digest) {
+  if (!is_digest_prefix(ref)) {
+    fprintf(stderr, "Invalid layer %s, expected a digest or an absolute "
+                    "path\n",
+            ref);
+    return -1;
+  }
+
+  DIR *dir = opendir(store);
+  if (!dir) {
+    fprintf(stderr, "Failed to open layer store %s: %s\n", store,
+            strerror(errno));
+    return -1;
+  }
+
+  int matches = 0;
+  size_t ref_len = strlen(ref);
+  struct dirent *entry;
+
+  while ((entry = readdir(dir))) {
+    if (strlen(entry->d_name) == SHA256_HEX_LEN &&
+        strncmp(entry->d_name, ref, ref_len) == 0) {
+      memcpy(digest, entry->d_name, SHA256_HEX_LEN + 1);
+      matches++;
+    }
+  }
+
+  closedir(dir);
+
+  if (matches != 1) {
+    fprintf(stderr, matches ? "Layer %s is ambiguous\n"
+                            : "No layer %s in the layer store\n",
+            ref);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * mount_store_image - Make sure an image layer is mounted
+ * @store: Layer store directory
+ * @digest: Digest of the layer
+ *
+ * The image is locked while we check whether it's mounted and mount it, so
+ * that euclid processes starting at the same time don't both mount it.
+ *
+ * Return: 0 on success or if the layer isn't an image, -1 on failure
+ */
+static int mount_store_image(const char *store, const char *digest) {
+  char image[PATH_MAX];
+  char mount_point[PATH_MAX];
+  if (store_path(image, store, digest, ".img") == -1 ||
+      store_path(mount_point, store, digest, "") == -1) {
+    return -1;
+  }
+
+  int fd = open(image, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    fprintf(stderr, "Failed to open %s: %s\n", image, strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+  struct stat store_st;
+  struct stat mount_st;
+
+  if (flock(fd, LOCK_EX) == -1) {
+    fprintf(stderr, "Failed to lock %s: %s\n", image, strerror(errno));
+    ret = -1;
+  } else if (stat(store, &store_st) == -1 || stat(mount_point, &mount_st) == -1) {
+    fprintf(stderr, "Failed to stat %s: %s\n", mount_point, strerror(errno));
+    ret = -1;
+  } else if (mount_st.st_dev == store_st.st_dev) {
+    /* Not mounted yet, the mount point is still on the store's filesystem */
+    const char *fstype = image_fstype(fd);
+    if (!fstype) {
+      fprintf(stderr, "%s is not a squashfs or erofs image\n", image);
+      ret = -1;
+    } else {
+      ret = mount_image(image, fstype, mount_point);
+    }
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+/**
+ * resolve_layers - Build the overlay's lowerdir from ctx->layers
+ * @ctx: Container configuration, lowerdir is replaced
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int resolve_layers(struct container_ctx *ctx) {
+  if (!ctx->layers || ctx->layers[0] == '\0') {
+    return 0;
+  }
+
+  if (!ctx->overlay) {
+    fprintf(stderr, "Layers can only be stacked with the overlay enabled\n");
+    return -1;
+  }
+
+  char *refs = strdup(ctx->layers);
+  if (!refs) {
+    fprintf(stderr, "Failed to duplicate layer list: %s\n", strerror(errno));
+    return -1;
+  }
+
+  char lowerdir[LOWERDIR_MAX];
+  size_t len = 0;
+  int ret = 0;
+  char *save;
+
+  for (char *ref = strtok_r(refs, ":", &save); ref && ret == 0;
+       ref = strtok_r(NULL, ":", &save)) {
+    char digest[SHA256_HEX_LEN + 1];
+    const char *layer = ref;
+    struct stat st;
+
+    if (ref[0] == '/') {
+      if (stat(ref, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Layer %s is not a directory\n", ref);
+        ret = -1;
+        break;
+      }
+    } else if (find_layer(ctx->layer_store, ref, digest) == -1 ||
+               mount_store_image(ctx->layer_store, digest) == -1) {
+      ret = -1;
+      break;
+    } else {
+      layer = digest;
+    }
+
+    int written = snprintf(lowerdir + len, LOWERDIR_MAX - len, "%s%s",
+                           len ? ":" : "", layer);
+    if (written >= (int)(LOWERDIR_MAX - len)) {
+      fprintf(stderr, "Too many layers for one overlay mount\n");
+      ret = -1;
+      break;
+    }
+    len += written;
+  }
+
+  free(refs);
+
+  if (ret == 0 && len == 0) {
+    fprintf(stderr, "No layers in %s\n", ctx->layers);
+    ret = -1;
+  }
+
+  if (ret == 0) {
+    free(ctx->lowerdir);
+    ctx->lowerdir = strdup(lowerdir);
+    if (!ctx->lowerdir) {
+      fprintf(stderr, "Failed to duplicate lowerdir: %s\n", strerror(errno));
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
@@ -8,234 +8,809 @@
  * namespaces, cgroups, and seccomp-bpf filtering.
  *
  * EXECUTION FLOW:
- * - Create pipe for parent-child synchronization
  * - Initialize container configuration
+ * - Parse command-line options and apply runtime configuration
+ * - Configure the container's cgroup (parent)
  * - Spawn container child process (clone with namespaces flags)
- * - Configure cgroups (parent)
- * - Signal child to proceed (via pipe)
+ * - Record a syscall profile (profiling runs only)
  * - Wait for child to exit
  * - Clean up resources
  *
- * NAMESPACES USED:
- * - CLONE_NEWUTS: Isolated hostname
- * - CLONE_NEWPID: Isolated process tree (child is PID 1)
- * - CLONE_NEWNS: Isolated mount table
- * - CLONE_NEWNET: Isolated network stack
- * - CLONE_NEWIPC: Isolated IPC resources
+ * BATCH MODE:
+ * With -b, euclid reads commands from a file or stdin (one per line) and runs
+ * each of them in its own container, up to -j of them at the same time. See
+ * batch.h.
  *
- * CLONE_NEWUSER is planned for later versions.
+ * POOL MODE:
+ * With -n, batch containers come from a pool of warm containers that are set
+ * up ahead of time. See pool.h.
+ *
+ * IDLE FREEZING:
+ * With the freeze_idle key set, a container that sits idle that long is
+ * frozen and its memory reclaimed, warm containers in a pool as well. A
+ * single container is thawed by sending SIGUSR2 to euclid. See freezer.h.
+ *
+ * OPTIONS:
+ * -a: Adapt each container's memory.high to its memory pressure
+ * -b FILE: Run the commands in FILE ("-" for stdin), one container each
+ * -i PATH: Import a directory, image or tarball into the layer store and print
+ *          its digest (see layers.h)
+ * -c FILE: Apply the configuration in FILE (see config.h)
+ * -s KEY=VALUE: Apply a single configuration setting
+ * -e: Write an exit record for every container (see telemetry.h)
+ * -t: Report how long each stage of every container launch took
+ * -j JOBS: Run up to JOBS batch containers at the same time (default 1)
+ * -l DIR: Relay each batch job's stdout and stderr to files in DIR
+ * -n SIZE: Keep SIZE warm containers for batch mode, implies -b - without -b
+ * -m MS: Sample each container's cgroup every MS milliseconds (0: summary only)
+ * -o FILE: Write telemetry, launch timing and exit records to FILE instead
+ *          of stderr
+ * -p FILE: Record how often the container makes each syscall to FILE
+ * -w FILE: Weight the seccomp filter with a profile recorded by -p
+ * -k DIR: Checkpoint the container into DIR on SIGUSR1 (see checkpoint.h)
+ * -r DIR: Restore the container checkpointed into DIR instead of starting one
+ *
+ * Anything after the options is the command to run instead of the configured
+ * one. Builds with EUCLID_LOCKED have no -c, -s, -k and -r, and take no
+ * command, since a checkpoint could bring in any process tree.
+ *
+ * The namespaces themselves are created in launch.c.
  */
 
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sched.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mount.h>
 #include <sys/stat.h>
-#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "batch.h"
 #include "cgroups.h"
-#include "child.h"
+#include "checkpoint.h"
+#include "config.h"
 #include "context.h"
+#include "devices.h"
+#include "filter.h"
+#include "freezer.h"
+#include "governor.h"
+#include "launch.h"
+#include "layers.h"
+#include "network.h"
+#include "pool.h"
+#include "profile.h"
+#include "supervisor.h"
+#include "telemetry.h"
 
 /**
- * STACK_SIZE - Size of stack for the child process
+ * OPTSTRING - getopt() options
  *
- * The clone() syscall requires a separate stack for the child process.
- *
- * On x86_64, stacks grown downward (from high addresses to low).
- * We allocate the stack at the low address and pass a pointer to the top to
- * clone().
+ * The leading '+' stops option parsing at the first non-option, so options
+ * of the container's command aren't taken for ours.
  */
-#define STACK_SIZE (1024 * 1024)
+#ifdef EUCLID_LOCKED
+#define OPTSTRING "+ab:ei:j:l:m:n:o:p:tw:"
+#else
+#define OPTSTRING "+ab:c:ei:j:k:l:m:n:o:p:r:s:tw:"
+#endif
 
 /**
- * spawn_container - Create child process in new namespaces
- * @ctx: Container configuration
- *
- * Creates a new process using clone() with namespace isolation flags.
- * The child process will execute child_main() in the new namespaces.
+ * print_usage - Print command-line usage
+ * @prog: Name the program was invoked as
+ */
+static void print_usage(const char *prog) {
+#ifdef EUCLID_LOCKED
+  fprintf(stderr,
+          "Usage: %s [-a] [-b batch_file] [-e] [-i layer] [-j jobs] "
+          "[-l log_dir] [-n pool_size] [-m interval_ms] [-o telemetry_out] "
+          "[-p profile_out] [-t] [-w profile_in]\n",
+          prog);
+#else
+  fprintf(stderr,
+          "Usage: %s [-a] [-b batch_file] [-c config_file] [-e] "
+          "[-i layer] [-j jobs] [-k checkpoint_dir] [-l log_dir] "
+          "[-n pool_size] [-m interval_ms] [-o telemetry_out] "
+          "[-p profile_out] [-r checkpoint_dir] [-s key=value] [-t] "
+          "[-w profile_in] [command [args...]]\n",
+          prog);
+#endif
+  fprintf(stderr,
+          "  -a       Adapt memory.high to the container's memory pressure\n"
+          "  -b FILE  Run each command in FILE (- for stdin) in a container\n"
+#ifndef EUCLID_LOCKED
+          "  -c FILE  Apply the configuration in FILE\n"
+#endif
+          "  -e       Write an exit record with rusage, throttling and OOM "
+          "kills for each container\n"
+          "  -i PATH  Import a directory, image or tarball into the layer "
+          "store\n"
+          "  -j JOBS  Run up to JOBS batch containers at the same time\n"
+#ifndef EUCLID_LOCKED
+          "  -k DIR   Checkpoint the container into DIR on SIGUSR1\n"
+#endif
+          "  -l DIR   Write each batch job's stdout and stderr to files in "
+          "DIR\n"
+          "  -n SIZE  Keep SIZE warm containers for batch mode\n"
+          "  -m MS    Write cgroup telemetry every MS milliseconds "
+          "(0: summary only)\n"
+          "  -o FILE  Write telemetry, launch timing and exit records to FILE "
+          "instead of stderr\n"
+          "  -p FILE  Record a syscall profile of the container to FILE\n"
+#ifndef EUCLID_LOCKED
+          "  -r DIR   Restore the container checkpointed into DIR\n"
+#endif
+#ifndef EUCLID_LOCKED
+          "  -s K=V   Set configuration key K to V\n"
+#endif
+          "  -t       Write how long each stage of a launch took\n"
+          "  -w FILE  Weight the seccomp filter with the profile in FILE\n");
+}
+
+/**
+ * detach_command_stream - Move stdin out of the containers' reach
  *
- * CLONE VS FORK:
- * - fork(): Creates a complete copy of the process
- * - clone(): Can selectively share/isolate resources via flags
+ * In batch mode stdin can carry the commands. The containers would otherwise
+ * inherit it and could read commands meant for later containers, so we move
+ * it to a close-on-exec descriptor for ourselves and give fd 0 /dev/null.
  *
- * NAMESPACE FLAGS:
- * - CLONE_NEWUTS: New UTS namespace (hostname)
- * - CLONE_NEWPID: New PID namespace (child becomes PID 1)
- * - CLONE_NEWNS: New mount namespace (isolated mounts)
- * - CLONE_NEWNET: New network namespace (no network access)
- * - CLONE_NEWIPC: New IPC namespace (isolated IPC)
- * - SIGCHLD: Send SIGCHLD to parent when child exits
+ * Return: Stream to read commands from on success, NULL on failure
+ */
+static FILE *detach_command_stream(void) {
+  int cmd_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+  if (cmd_fd == -1) {
+    fprintf(stderr, "Failed to duplicate stdin: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd == -1 || dup2(null_fd, STDIN_FILENO) == -1) {
+    fprintf(stderr, "Failed to redirect stdin: %s\n", strerror(errno));
+    close(cmd_fd);
+    return NULL;
+  }
+
+  if (null_fd != STDIN_FILENO) {
+    close(null_fd);
+  }
+
+  FILE *stream = fdopen(cmd_fd, "r");
+  if (!stream) {
+    fprintf(stderr, "Failed to open command stream: %s\n", strerror(errno));
+    close(cmd_fd);
+  }
+
+  return stream;
+}
+
+/**
+ * open_batch_input - Open the stream batch commands are read from
+ * @path: File to read commands from, "-" for stdin
  *
- * STACK ALLOCATION:
- * clone() requires a separate stack for the child. We allocate this on the heap
- * and free it after clone() returns.
+ * Return: Stream to read commands from on success, NULL on failure
+ */
+static FILE *open_batch_input(const char *path) {
+  if (strcmp(path, "-") == 0) {
+    return detach_command_stream();
+  }
+
+  FILE *stream = fopen(path, "re");
+  if (!stream) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+  }
+
+  return stream;
+}
+
+/**
+ * run_batch_mode - Run commands from a file or stdin, one container each
+ * @ctx: Container configuration
+ * @batch_path: File to read commands from, "-" for stdin
+ * @concurrency: Maximum number of containers running at the same time
+ * @pool_size: Number of warm containers to keep around, 0 for none
+ * @telemetry: Telemetry configuration, NULL to disable telemetry
+ * @launch_out: Stream to write launch timing to, NULL unless ctx->time_launch
+ * @exit_out: Stream to write exit records to, NULL for none
+ * @log_dir: Directory to relay the jobs' output to, NULL to not capture it
  *
- * Return: Child PID on success, -1 on failure
+ * Return: Number of failed jobs on success, -1 on failure
  */
-static int spawn_container(struct container_ctx *ctx) {
+static int run_batch_mode(struct container_ctx *ctx, const char *batch_path,
+                          int concurrency, int pool_size,
+                          const struct telemetry_config *telemetry,
+                          FILE *launch_out, FILE *exit_out,
+                          const char *log_dir) {
   /*
-   * Allocate stack for the child process.
-   * Must be heap-allocated to ensure its valid across clone().
+   * A warm container that died leaves a pipe without a reader. We want
+   * write() to fail with EPIPE so the pool can move on to the next container.
    */
-  char *stack = malloc(STACK_SIZE);
-  if (!stack) {
-    fprintf(stderr, "Memory allocation failed for child's stack: %s\n",
-            strerror(errno));
+  signal(SIGPIPE, SIG_IGN);
+
+  if (log_dir && mkdir(log_dir, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", log_dir, strerror(errno));
     return -1;
   }
 
-  /*
-   * Calculate the top of the stack since stacks grow downward on x86_64
-   */
-  char *stack_top = stack + STACK_SIZE;
+  FILE *stream = open_batch_input(batch_path);
+  if (!stream) {
+    return -1;
+  }
 
   /*
-   * Set up namespace flags for clone().
-   *
-   * SIGCHLD ensures we get notified when the child exits so we can call wait()
-   * to reap it.
+   * At most concurrency containers run while pool_size more wait for a
+   * command, so that many leaves are enough for one to always be ready.
    */
-  int flags = CLONE_NEWUTS | CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWNET |
-              CLONE_NEWIPC | SIGCHLD;
+  if (cgroup_pool_init(ctx, concurrency + pool_size) == -1) {
+    fprintf(stderr, "Failed to create cgroup pool\n");
+    fclose(stream);
+    return -1;
+  }
 
   /*
-   * Create the child process.
-   * The child begins execution in child_main() with the new namespaces already
-   * active
+   * The same goes for network slots, which are the slowest part of a
+   * networked launch to create.
    */
-  int pid = clone(child_main, stack_top, flags, ctx);
-  if (pid == -1) {
-    fprintf(stderr, "Failed to create child process: %s\n", strerror(errno));
-    free(stack);
+  if (net_pool_init(ctx, concurrency + pool_size) == -1) {
+    fprintf(stderr, "Failed to create network slots\n");
+    net_pool_destroy();
+    cgroup_pool_destroy();
+    fclose(stream);
     return -1;
   }
 
-  /*
-   * The child has its own copy of the stack, so we can free it here
-   */
-  free(stack);
+  struct pool pool;
+  if (pool_size && pool_init(&pool, ctx, pool_size) == -1) {
+    fprintf(stderr, "Failed to fill container pool\n");
+    net_pool_destroy();
+    cgroup_pool_destroy();
+    fclose(stream);
+    return -1;
+  }
 
-  return pid;
+  int ret = run_batch(ctx, stream, concurrency, pool_size ? &pool : NULL,
+                      telemetry, launch_out, exit_out, log_dir);
+
+  fclose(stream);
+  if (pool_size) {
+    pool_destroy(&pool);
+  }
+  net_pool_destroy();
+  cgroup_pool_destroy();
+
+  return ret;
 }
 
 /**
- * wait_for_container - Wait for container to exit and report status
- * @pid: PID of container process
+ * watch_container - Sample, govern and freeze a container until it exits
+ * @container: The running container
+ * @telemetry: Telemetry state of the container, NULL if not monitored
+ * @config: Telemetry configuration, its out stream also gets the launch
+ *          timing
+ * @governor: memory.high governor of the container, NULL if not governed
+ * @freezer: Idle freezer of the container, NULL if it's never frozen
  *
- * Blocks until the container process exits, then reports how it terminated.
- * This is essential for proper process cleanup.
+ * Returns once the container's pidfd reports that it has exited, without
+ * reaping it. Returns right away if there is nothing to do while the
+ * container runs (only a telemetry summary was requested), so the caller can
+ * go on to wait for the container either way.
  */
-static void wait_for_container(const int pid) {
-  int status;
+static void watch_container(struct container *container,
+                            struct telemetry *telemetry,
+                            const struct telemetry_config *config,
+                            struct governor *governor,
+                            struct freezer *freezer) {
+  int pidfd = container->pidfd;
+  int timer_fd = -1;
 
-  /*
-   * Wait for the specific child process to change state. This blocks until the
-   * child exits.
-   */
-  waitpid(pid, &status, 0);
+  if (telemetry && config->interval_ms > 0) {
+    timer_fd = telemetry_timer(config->interval_ms);
+  }
 
-  /*
-   * Check if process exited normally by calling exit() or returning from main
-   */
-  if (WIFEXITED(status)) {
-    printf("Child exited normally\n");
+  if (timer_fd == -1 && !governor && !freezer &&
+      container->timing_fd == -1) {
+    return;
   }
 
-  /*
-   * Check if process was killed by a signal
-   */
-  if (WIFSIGNALED(status)) {
-    int sig = WTERMSIG(status);
-    printf("Child killed by signal %d: %s\n", sig, strsignal(sig));
+  if (pidfd == -1) {
+    fprintf(stderr, "No pidfd for the container, can't watch it\n");
+    if (timer_fd != -1) {
+      close(timer_fd);
+    }
+    return;
+  }
 
-    /*
-     * SIGSYS (31) is sent by seccomp when a non-whitelisted syscall is
-     * attempted.
-     */
-    if (sig == SIGSYS) {
-      printf("Likely seccomp violation.\n");
+  /* poll() skips negative descriptors, so unused entries can stay in */
+  struct pollfd fds[7] = {
+      {.fd = pidfd, .events = POLLIN},
+      {.fd = timer_fd, .events = POLLIN},
+      {.fd = governor ? governor->trigger_fd : -1, .events = POLLPRI},
+      {.fd = governor ? governor->timer_fd : -1, .events = POLLIN},
+      {.fd = container->timing_fd, .events = POLLIN},
+      {.fd = freezer ? freezer->timer_fd : -1, .events = POLLIN},
+      {.fd = freezer ? freezer->signal_fd : -1, .events = POLLIN}};
+
+  for (;;) {
+    if (poll(fds, 7, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to wait for container: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents) {
+      break;
+    }
+
+    uint64_t expirations;
+    if (fds[1].revents &&
+        read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+      telemetry_sample(telemetry, config->out);
+    }
+
+    if (fds[2].revents & POLLPRI) {
+      governor_pressure(governor);
+    }
+
+    if (fds[3].revents) {
+      governor_relax(governor);
+    }
+
+    if (fds[4].revents && collect_launch_timing(container, 1, config->out)) {
+      fds[4].fd = -1;
+    }
+
+    if (fds[5].revents) {
+      freezer_tick(freezer);
+    }
+
+    if (fds[6].revents) {
+      freezer_demand(freezer);
     }
   }
+
+  /* A container that exited right after its exec left the EOF unread */
+  if (container->timing_fd != -1) {
+    collect_launch_timing(container, 1, config->out);
+  }
+
+  if (timer_fd != -1) {
+    close(timer_fd);
+  }
 }
 
 /**
  * main - Entry pointer for the program
+ * @argc: Number of command-line arguments
+ * @argv: Command-line arguments
  *
  * Orchestrates the creation and management of a containerized environment.
  *
  * PROCESS:
- * - Create pipe for parent-child synchronization
- * - Initialize container configuration
- * - Spawn child process in new namespaces
- * - Configure cgroups (parent)
- * - Signal child to proceed (via pipe write)
+ * - Initialize container configuration with the compiled-in defaults
+ * - Parse command-line options, which may override the configuration
+ * - Configure the container's cgroup and spawn it in new namespaces
+ * - Record a syscall profile (profiling runs only)
  * - Wait for child to complete
  * - Clean up resources
  *
- * Return: EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * Return: EXIT_SUCCESS on success, EXIT_FAILURE on failure (in batch mode,
+ * also when any job failed)
  */
-int main(void) {
-  /*
-   * Create a pipe for synchronization between parent and child.
-   * pipe_fds[0] is the read end, pipe_fds[1] is the write end.
-   *
-   * The child will block until the parent writes to pipe_fds[1], ensuring
-   * cgroups are configured before the child tries to join them.
-   */
-  int pipe_fds[2];
-  if (pipe(pipe_fds) == -1) {
-    fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
+int main(int argc, char *argv[]) {
+  const char *profile_out = NULL;
+  const char *profile_in = NULL;
+  const char *batch_path = NULL;
+  const char *import_dir = NULL;
+  const char *log_dir = NULL;
+  const char *checkpoint_dir = NULL;
+  const char *restore_dir = NULL;
+  int concurrency = 1;
+  int pool_size = 0;
+  int adapt_mem_high = 0;
+  int time_launch = 0;
+  int account_exits = 0;
+  const char *telemetry_path = NULL;
+  struct telemetry_config telemetry = {.out = stderr, .interval_ms = -1};
 
   /*
    * Initialize container configuration.
    * This allocates memory and copies configuration from the compile-time
-   * constants in context.c.
+   * constants in context.c, which -c, -s and the command then override in
+   * the order they are given.
    */
-  struct container_ctx *ctx = init_ctx(pipe_fds);
+  struct container_ctx *ctx = init_ctx();
   if (!ctx) {
     fprintf(stderr, "Failed to configure container, exiting...\n");
     exit(EXIT_FAILURE);
   }
 
+  int opt;
+  while ((opt = getopt(argc, argv, OPTSTRING)) != -1) {
+    switch (opt) {
+    case 'a':
+      adapt_mem_high = 1;
+      break;
+    case 't':
+      time_launch = 1;
+      break;
+    case 'e':
+      account_exits = 1;
+      break;
+    case 'b':
+      batch_path = optarg;
+      break;
+    case 'i':
+      import_dir = optarg;
+      break;
+    case 'l':
+      log_dir = optarg;
+      break;
+    case 'j':
+      concurrency = atoi(optarg);
+      if (concurrency <= 0) {
+        fprintf(stderr, "Number of jobs must be a positive number\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'm':
+      telemetry.interval_ms = atoi(optarg);
+      if (telemetry.interval_ms < 0) {
+        fprintf(stderr, "Sampling interval can't be negative\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'o':
+      telemetry_path = optarg;
+      break;
+    case 'n':
+      pool_size = atoi(optarg);
+      if (pool_size <= 0) {
+        fprintf(stderr, "Pool size must be a positive number\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      profile_out = optarg;
+      break;
+    case 'w':
+      profile_in = optarg;
+      break;
+#ifndef EUCLID_LOCKED
+    case 'k':
+      checkpoint_dir = optarg;
+      break;
+    case 'r':
+      restore_dir = optarg;
+      break;
+    case 'c':
+      if (config_load(ctx, optarg) == -1) {
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 's':
+      if (config_set(ctx, optarg) == -1) {
+        exit(EXIT_FAILURE);
+      }
+      break;
+#endif
+    default:
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+#ifdef EUCLID_LOCKED
+  if (optind != argc) {
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+#else
+  if (optind != argc) {
+    if (batch_path || pool_size) {
+      fprintf(stderr, "Batch commands can't be combined with a command\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if (restore_dir) {
+      fprintf(stderr, "-r can't be combined with a command\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if (set_ctx_cmd(ctx, &argv[optind]) == -1) {
+      exit(EXIT_FAILURE);
+    }
+  }
+#endif
+
   /*
-   * Create the child process in new namespaces.
-   * The child will execute child_main() but will block on the pipe read before
-   * proceeding with setup.
+   * Importing a layer only touches the store, no container is started.
    */
-  int pid = spawn_container(ctx);
-  if (pid == -1) {
-    fprintf(stderr, "Failed to create container, exiting...\n");
+  if (import_dir) {
+    if (optind != argc || batch_path || pool_size || profile_out) {
+      fprintf(stderr, "-i can't be combined with a command, -b, -n or -p\n");
+      exit(EXIT_FAILURE);
+    }
+
+    int ret = import_layer(ctx, import_dir);
+    cleanup_ctx(ctx);
+    exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  /*
+   * Without root, we can't mknod() the /dev template, move the container into
+   * a network slot's namespace or run CRIU.
+   */
+  if ((ctx->namespaces & CLONE_NEWUSER) &&
+      ((ctx->minimal_dev && ctx->mount_dev) || ctx->network ||
+       checkpoint_dir || restore_dir)) {
+    fprintf(stderr, "user can't be used with minimal_dev, network, -k or -r\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (resolve_layers(ctx) == -1 || setup_dev_layer(ctx) == -1) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (ctx->network && !(ctx->namespaces & CLONE_NEWNET)) {
+    fprintf(stderr, "network needs the net namespace\n");
     exit(EXIT_FAILURE);
   }
 
   /*
-   * Configure cgroups for resource limits
-   * This must be done by the parent because it involves writing to privileged
-   * directories.
+   * Checkpoints are taken and restored one container at a time, and refer to
+   * the container's root and namespaces as they are, which an overlay or
+   * network slot wouldn't keep.
    */
-  if (configure_cgroups(ctx)) {
-    fprintf(stderr, "Failed to configure cgroups, exiting...\n");
+  if (checkpoint_dir || restore_dir) {
+    if (checkpoint_dir && restore_dir) {
+      fprintf(stderr, "-k can't be used with -r\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if (batch_path || pool_size || profile_out || time_launch) {
+      fprintf(stderr, "-k and -r can't be used with -b, -n, -p or -t\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if (ctx->overlay || ctx->network || ctx->supervise) {
+      fprintf(stderr, "-k and -r need overlay, network and supervise off\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /*
+   * A checkpointed container ends with its dump, so there's nothing to
+   * sample, govern or account for.
+   */
+  if (checkpoint_dir &&
+      (adapt_mem_high || account_exits || telemetry.interval_ms != -1)) {
+    fprintf(stderr, "-k can't be used with -a, -e or -m\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ctx->supervise && !ctx->seccomp) {
+    fprintf(stderr, "supervise needs seccomp\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * The profiler's filter would take the supervised syscalls' notifications
+   * for itself.
+   */
+  if (ctx->supervise && profile_out) {
+    fprintf(stderr, "-p can't be used with supervise\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (adapt_mem_high && ctx->mem_high_min > ctx->mem_high_max) {
+    fprintf(stderr, "mem_high_min must not be above mem_high_max\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * Warm containers only make sense when there are commands to hand them.
+   */
+  if (pool_size && !batch_path) {
+    batch_path = "-";
+  }
+
+  /*
+   * Profiling runs a single container under our supervision, which a batch
+   * can't do.
+   */
+  if (batch_path && profile_out) {
+    fprintf(stderr, "-b and -n can't be used with -p\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * The memory.high governor and the profiler would both need the parent's
+   * attention while the container runs.
+   */
+  if (adapt_mem_high && profile_out) {
+    fprintf(stderr, "-a can't be used with -p\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * Every syscall is much slower while profiling, so launch timings would be
+   * meaningless.
+   */
+  if (time_launch && profile_out) {
+    fprintf(stderr, "-t can't be used with -p\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * A single container keeps our terminal, so it can be used interactively.
+   */
+  if (log_dir && !batch_path) {
+    fprintf(stderr, "-l needs -b or -n\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (telemetry_path && telemetry.interval_ms == -1 && !time_launch &&
+      !account_exits) {
+    fprintf(stderr, "-o needs -e, -m or -t\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * Telemetry must not mix with the job reports on stdout, and stays out of
+   * any file the containers write to.
+   */
+  if (telemetry_path) {
+    telemetry.out = fopen(telemetry_path, "we");
+    if (!telemetry.out) {
+      fprintf(stderr, "Failed to open %s: %s\n", telemetry_path,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  const struct telemetry_config *telemetry_config =
+      telemetry.interval_ms == -1 ? NULL : &telemetry;
+
+  /*
+   * The profile has to be loaded before the child is cloned, so that the
+   * child's copy of the filter weights includes it.
+   */
+  if (profile_in && load_profile(profile_in) == -1) {
+    fprintf(stderr, "Failed to load syscall profile, exiting...\n");
+    exit(EXIT_FAILURE);
+  }
+
+  ctx->adapt_mem_high = adapt_mem_high;
+  ctx->time_launch = time_launch;
+  ctx->capture_output = log_dir != NULL;
+  set_filter_network(ctx->network);
+  set_filter_supervise(ctx->supervise);
+  if (ctx->seccomp && set_filter_policy(ctx->policy) == -1) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (ctx->supervise && supervisor_start(ctx->network) == -1) {
     exit(EXIT_FAILURE);
   }
 
+  if (batch_path) {
+    int failed = run_batch_mode(ctx, batch_path, concurrency, pool_size,
+                                telemetry_config,
+                                time_launch ? telemetry.out : NULL,
+                                account_exits ? telemetry.out : NULL, log_dir);
+    supervisor_stop();
+    cleanup_ctx(ctx);
+    exit(failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
   /*
-   * Signal the child to proceed
+   * The child reports its seccomp listener over a separate pipe, since the
+   * synchronization pipe is only ever written by the parent. O_CLOEXEC keeps
+   * it from leaking into the target program.
    */
-  char ping = 'c';
-  if (write(ctx->pipe_fds[1], &ping, 1) == -1) {
-    fprintf(stderr, "Failed to write to pipe: %s\n", strerror(errno));
+  if (profile_out && pipe2(ctx->profile_fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create profiling pipe: %s\n", strerror(errno));
     exit(EXIT_FAILURE);
   }
 
+  /*
+   * Configure the container's cgroup and create the child process in new
+   * namespaces. Cgroups must be configured by the parent because it involves
+   * writing to privileged directories, and before the child tries to join
+   * them, so start_container() does both in that order.
+   */
+  if (checkpoint_dir && catch_checkpoint_signal() == -1) {
+    exit(EXIT_FAILURE);
+  }
+
+  struct container container;
+  if (restore_dir) {
+    if (restore_container(ctx, &container, restore_dir) == -1) {
+      fprintf(stderr, "Failed to restore container, exiting...\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (start_container(ctx, &container) == -1) {
+    fprintf(stderr, "Failed to create container, exiting...\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * criu kills the container once it's dumped. If the dump fails, the
+   * container is killed all the same, so a service never runs on unnoticed.
+   */
+  if (checkpoint_dir) {
+    int ret = wait_for_checkpoint_signal(&container);
+    if (ret == 0) {
+      ret = checkpoint_container(ctx, &container, checkpoint_dir);
+    }
+
+    if (ret == -1) {
+      kill(container.pid, SIGKILL);
+    }
+    waitpid(container.pid, NULL, 0);
+
+    if (ret == 0) {
+      printf("Checkpointed container into %s\n", checkpoint_dir);
+    }
+
+    release_container(&container);
+    cleanup_ctx(ctx);
+    exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  /* A container we can't account for still runs, without an exit record */
+  struct exit_accounting accounting;
+  int accounted =
+      account_exits &&
+      exit_accounting_start(&accounting, container.cgroup_path) == 0;
+
+  struct telemetry container_telemetry;
+  int monitored = telemetry_config &&
+                  telemetry_start(&container_telemetry, 1, container.pid,
+                                  container.cgroup_path) == 0;
+
+  /*
+   * When profiling, we have to answer every syscall the container makes until
+   * it exits, so this returns only once the container is gone. Telemetry is
+   * then limited to the summary.
+   */
+  if (profile_out &&
+      record_profile(container.pid, ctx->profile_fds[0], profile_out) == -1) {
+    /*
+     * Without a supervisor, the child would stay blocked in its next syscall
+     * forever.
+     */
+    fprintf(stderr, "Failed to record syscall profile, killing container\n");
+    kill(container.pid, SIGKILL);
+  }
+
+  /* A container we can't govern keeps its fixed memory.high */
+  struct governor governor;
+  int governed =
+      ctx->adapt_mem_high &&
+      governor_start(&governor, ctx, container.cgroup_path) == 0;
+
+  /* A container we can't freeze simply keeps running while it's idle */
+  struct freezer freezer;
+  int freezing = !profile_out && ctx->freeze_idle != -1 &&
+                 freezer_start(&freezer, ctx, container.cgroup_path) == 0;
+
+  /*
+   * Sample, govern and freeze the container until it exits, without reaping
+   * it.
+   */
+  if (!profile_out) {
+    watch_container(&container, monitored ? &container_telemetry : NULL,
+                    &telemetry, governed ? &governor : NULL,
+                    freezing ? &freezer : NULL);
+  }
+
   /*
    * Wait for the container to exit.
    * This blocks until the child process terminates, then prints information
@@ -244,13 +819,38 @@ int main(void) {
    * This is essential for proper process cleanup and determining why the
    * container exited.
    */
-  wait_for_container(pid);
+  int status = 0;
+  struct rusage usage;
+  int reaped = wait_for_container(container.pid, &status, &usage) == 0;
+
+  if (accounted && reaped) {
+    exit_accounting_finish(&accounting, 1, container.pid, status, &usage,
+                           telemetry.out);
+  } else if (accounted) {
+    exit_accounting_abort(&accounting);
+  }
+
+  if (monitored) {
+    telemetry_finish(&container_telemetry, telemetry_config->out);
+  }
+
+  if (governed) {
+    governor_stop(&governor);
+  }
+
+  if (freezing) {
+    freezer_stop(&freezer);
+  }
 
   /*
-   * Clean up container context.
+   * Remove the container's cgroup and clean up container context.
    * Frees all allocated memory to prevent leaks.
    */
+  release_container(&container);
+  supervisor_stop();
+  net_pool_destroy();
+  finish_restore();
   cleanup_ctx(ctx);
 
   exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
@@ -0,0 +1,357 @@
+/**
+ * netlink.c
+ *
+ * Minimal rtnetlink client for setting up container networking.
+ *
+ * MESSAGES:
+ * An rtnetlink request is a struct nlmsghdr, a fixed header for its kind
+ * (struct ifinfomsg for links, struct ifaddrmsg for addresses, struct rtmsg
+ * for routes) and a list of attributes. Attributes are type-length-value
+ * records aligned to four bytes, and can nest other attributes, as veth does
+ * to describe its peer:
+ *
+ *   RTM_NEWLINK  ifinfomsg
+ *   +-- IFLA_IFNAME "eth0"
+ *   +-- IFLA_LINKINFO
+ *       +-- IFLA_INFO_KIND "veth"
+ *       +-- IFLA_INFO_DATA
+ *           +-- VETH_INFO_PEER  ifinfomsg
+ *               +-- IFLA_IFNAME "veth-eu0"
+ *               +-- IFLA_NET_NS_FD 5
+ *
+ * Requests are built in a fixed buffer, since none of ours comes close to
+ * filling it.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "netlink.h"
+
+/**
+ * NL_BUFFER_SIZE - Room for one request
+ */
+#define NL_BUFFER_SIZE 512
+
+/**
+ * NL_REPLY_SIZE - Room for the kernel's replies to one request
+ */
+#define NL_REPLY_SIZE 8192
+
+/**
+ * struct nl_request - An rtnetlink request being built
+ * @msg: The message, its header at the start of the buffer
+ * @overflow: Non-zero if an attribute didn't fit
+ */
+struct nl_request {
+  union {
+    struct nlmsghdr hdr;
+    char buf[NL_BUFFER_SIZE];
+  } msg;
+  int overflow;
+};
+
+/**
+ * nl_seq - Sequence number of the last request, to match replies with
+ */
+static unsigned int nl_seq = 0;
+
+/**
+ * nl_open - Open an rtnetlink socket in the current network namespace
+ *
+ * Return: Socket on success, -1 on failure
+ */
+int nl_open(void) {
+  int nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (nl == -1) {
+    fprintf(stderr, "Failed to open netlink socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  /* Acks without a copy of the request, older kernels just send it along */
+  int one = 1;
+  setsockopt(nl, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  if (bind(nl, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Failed to bind netlink socket: %s\n", strerror(errno));
+    close(nl);
+    return -1;
+  }
+
+  return nl;
+}
+
+/**
+ * nl_begin - Start a request
+ * @req: Request to initialize
+ * @type: RTM_* message type
+ * @flags: NLM_F_* flags besides NLM_F_REQUEST and NLM_F_ACK
+ * @header: Fixed header of the message type
+ * @header_len: Size of header
+ */
+static void nl_begin(struct nl_request *req, int type, int flags,
+                     const void *header, size_t header_len) {
+  memset(req, 0, sizeof(*req));
+  req->msg.hdr.nlmsg_len = NLMSG_LENGTH(header_len);
+  req->msg.hdr.nlmsg_type = type;
+  req->msg.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+  memcpy(NLMSG_DATA(&req->msg.hdr), header, header_len);
+}
+
+/**
+ * nl_put - Append an attribute to a request
+ * @req: Request to append to
+ * @type: Attribute type
+ * @data: Value of the attribute, or NULL for an empty one
+ * @len: Size of data
+ *
+ * Return: The attribute, or NULL if it doesn't fit (the request then fails
+ * with EMSGSIZE when sent)
+ */
+static struct rtattr *nl_put(struct nl_request *req, int type,
+                             const void *data, size_t len) {
+  size_t offset = NLMSG_ALIGN(req->msg.hdr.nlmsg_len);
+  if (offset + RTA_SPACE(len) > NL_BUFFER_SIZE) {
+    req->overflow = 1;
+    return NULL;
+  }
+
+  struct rtattr *attr = (struct rtattr *)(req->msg.buf + offset);
+  attr->rta_type = type;
+  attr->rta_len = RTA_LENGTH(len);
+  if (data) {
+    memcpy(RTA_DATA(attr), data, len);
+  }
+
+  req->msg.hdr.nlmsg_len = offset + RTA_SPACE(len);
+
+  return attr;
+}
+
+/**
+ * nl_put_str - Append a string attribute to a request
+ * @req: Request to append to
+ * @type: Attribute type
+ * @value: String, written with its terminator
+ */
+static void nl_put_str(struct nl_request *req, int type, const char *value) {
+  nl_put(req, type, value, strlen(value) + 1);
+}
+
+/**
+ * nl_nest_end - Close a nested attribute opened with nl_put(req, type, NULL,
+ * 0)
+ * @req: Request holding the attribute
+ * @nest: The nesting attribute, NULL if it didn't fit
+ *
+ * The nesting attribute's length is extended over everything appended after
+ * it.
+ */
+static void nl_nest_end(struct nl_request *req, struct rtattr *nest) {
+  if (nest) {
+    nest->rta_len = req->msg.buf + req->msg.hdr.nlmsg_len - (char *)nest;
+  }
+}
+
+/**
+ * nl_transact - Send a request and wait for the kernel's acknowledgement
+ * @nl: rtnetlink socket
+ * @req: Request to send
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+static int nl_transact(int nl, struct nl_request *req) {
+  if (req->overflow) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  unsigned int seq = ++nl_seq;
+  req->msg.hdr.nlmsg_seq = seq;
+
+  if (send(nl, &req->msg, req->msg.hdr.nlmsg_len, 0) == -1) {
+    return -1;
+  }
+
+  union {
+    struct nlmsghdr hdr;
+    char buf[NL_REPLY_SIZE];
+  } reply;
+
+  for (;;) {
+    ssize_t len = recv(nl, &reply, sizeof(reply), 0);
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    /* NLMSG_NEXT() counts down the bytes left in an int-sized way */
+    int left = len;
+    for (struct nlmsghdr *hdr = &reply.hdr; NLMSG_OK(hdr, left);
+         hdr = NLMSG_NEXT(hdr, left)) {
+      if (hdr->nlmsg_seq != seq || hdr->nlmsg_type != NLMSG_ERROR) {
+        continue;
+      }
+
+      const struct nlmsgerr *err = NLMSG_DATA(hdr);
+      if (err->error == 0) {
+        return 0;
+      }
+
+      errno = -err->error;
+      return -1;
+    }
+  }
+}
+
+/**
+ * nl_create_bridge - Create a bridge
+ * @nl: rtnetlink socket
+ * @name: Name of the bridge
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_create_bridge(int nl, const char *name) {
+  struct nl_request req;
+  struct ifinfomsg info = {.ifi_family = AF_UNSPEC};
+
+  nl_begin(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info));
+  nl_put_str(&req, IFLA_IFNAME, name);
+  struct rtattr *linkinfo = nl_put(&req, IFLA_LINKINFO, NULL, 0);
+  nl_put_str(&req, IFLA_INFO_KIND, "bridge");
+  nl_nest_end(&req, linkinfo);
+
+  return nl_transact(nl, &req);
+}
+
+/**
+ * nl_create_veth - Create a veth pair
+ * @nl: rtnetlink socket, the first end is created in its namespace
+ * @name: Name of the first end
+ * @peer: Name of the other end
+ * @peer_ns_fd: Network namespace to create the other end in
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_create_veth(int nl, const char *name, const char *peer,
+                   int peer_ns_fd) {
+  struct nl_request req;
+  struct ifinfomsg info = {.ifi_family = AF_UNSPEC};
+  uint32_t ns_fd = peer_ns_fd;
+
+  nl_begin(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info));
+  nl_put_str(&req, IFLA_IFNAME, name);
+  struct rtattr *linkinfo = nl_put(&req, IFLA_LINKINFO, NULL, 0);
+  nl_put_str(&req, IFLA_INFO_KIND, "veth");
+  struct rtattr *data = nl_put(&req, IFLA_INFO_DATA, NULL, 0);
+  struct rtattr *peer_info = nl_put(&req, VETH_INFO_PEER, &info, sizeof(info));
+  nl_put_str(&req, IFLA_IFNAME, peer);
+  nl_put(&req, IFLA_NET_NS_FD, &ns_fd, sizeof(ns_fd));
+  nl_nest_end(&req, peer_info);
+  nl_nest_end(&req, data);
+  nl_nest_end(&req, linkinfo);
+
+  return nl_transact(nl, &req);
+}
+
+/**
+ * nl_delete_link - Delete an interface by name
+ * @nl: rtnetlink socket
+ * @name: Name of the interface
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_delete_link(int nl, const char *name) {
+  struct nl_request req;
+  struct ifinfomsg info = {.ifi_family = AF_UNSPEC};
+
+  nl_begin(&req, RTM_DELLINK, 0, &info, sizeof(info));
+  nl_put_str(&req, IFLA_IFNAME, name);
+
+  return nl_transact(nl, &req);
+}
+
+/**
+ * nl_set_link - Bring an interface up, optionally attaching it to a bridge
+ * @nl: rtnetlink socket
+ * @index: Interface index
+ * @master: Interface index of the bridge, 0 for none
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_set_link(int nl, int index, int master) {
+  struct nl_request req;
+  struct ifinfomsg info = {.ifi_family = AF_UNSPEC,
+                           .ifi_index = index,
+                           .ifi_flags = IFF_UP,
+                           .ifi_change = IFF_UP};
+  uint32_t master_index = master;
+
+  nl_begin(&req, RTM_NEWLINK, 0, &info, sizeof(info));
+  if (master) {
+    nl_put(&req, IFLA_MASTER, &master_index, sizeof(master_index));
+  }
+
+  return nl_transact(nl, &req);
+}
+
+/**
+ * nl_add_address - Give an interface an IPv4 address
+ * @nl: rtnetlink socket
+ * @index: Interface index
+ * @addr: Address
+ * @prefix: Prefix length of the address's subnet
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_add_address(int nl, int index, struct in_addr addr, int prefix) {
+  struct nl_request req;
+  struct ifaddrmsg info = {.ifa_family = AF_INET,
+                           .ifa_prefixlen = prefix,
+                           .ifa_scope = RT_SCOPE_UNIVERSE,
+                           .ifa_index = index};
+
+  nl_begin(&req, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &info,
+           sizeof(info));
+  nl_put(&req, IFA_LOCAL, &addr, sizeof(addr));
+  nl_put(&req, IFA_ADDRESS, &addr, sizeof(addr));
+
+  return nl_transact(nl, &req);
+}
+
+/**
+ * nl_add_default_route - Add an IPv4 default route
+ * @nl: rtnetlink socket
+ * @index: Interface index the gateway is reached through
+ * @gateway: Address of the gateway
+ *
+ * Return: 0 on success, -1 on failure with errno set
+ */
+int nl_add_default_route(int nl, int index, struct in_addr gateway) {
+  struct nl_request req;
+  struct rtmsg info = {.rtm_family = AF_INET,
+                       .rtm_table = RT_TABLE_MAIN,
+                       .rtm_protocol = RTPROT_BOOT,
+                       .rtm_scope = RT_SCOPE_UNIVERSE,
+                       .rtm_type = RTN_UNICAST};
+  uint32_t oif = index;
+
+  nl_begin(&req, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info));
+  nl_put(&req, RTA_GATEWAY, &gateway, sizeof(gateway));
+  nl_put(&req, RTA_OIF, &oif, sizeof(oif));
+
+  return nl_transact(nl, &req);
+}
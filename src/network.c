@@ -0,0 +1,566 @@
+/**
+ * network.c
+ *
+ * Pre-created network namespaces for containers with a network.
+ *
+ * OVERVIEW:
+ * Setting up a network namespace takes a namespace, a veth pair, addresses,
+ * a route and a bridge port, and tearing it down again takes an RCU grace
+ * period in the kernel. Neither belongs in the launch path, so a slot's
+ * namespace is created once and handed from container to container. Since
+ * containers run without capabilities, they can't change the namespace's
+ * configuration, and the sockets of a container are gone with its processes.
+ *
+ * CREATING A SLOT:
+ * The parent unshare()s a new network namespace for itself, creates the veth
+ * pair from inside it with the peer going straight to the host's namespace,
+ * configures eth0, lo and ping sockets, and setns()es back. The namespace
+ * stays alive through the fd we keep open, and the host end only needs
+ * attaching to the bridge. This saves moving an interface between namespaces,
+ * which is slower than creating it in the right place.
+ *
+ * LOCKING:
+ * The host ends of all euclid processes share one namespace, so slot N's
+ * veth-euN name must only be used by one of them. Slots are claimed with
+ * flock() on {NET_LOCK_DIR}/netN.lock like overlay slots, and the lock is
+ * kept for as long as the slot exists, since its name is taken for that long.
+ * A veth left behind by a process that died is deleted before its slot is set
+ * up again.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <net/if.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "netlink.h"
+#include "network.h"
+
+/**
+ * NET_LOCK_DIR - Directory holding the lock files of the network slots
+ */
+static const char *NET_LOCK_DIR = "/run/euclid";
+
+/**
+ * CONTAINER_IFNAME - Name of the container's end of its veth pair
+ */
+static const char *CONTAINER_IFNAME = "eth0";
+
+/**
+ * PING_GROUP_RANGE - Group IDs allowed to create ICMP datagram sockets in a
+ * slot's namespace, which is all of them
+ */
+static const char *PING_GROUP_RANGE = "0 2147483647";
+
+/**
+ * MAX_NET_SLOTS - Most slots acquire_net_slot() goes through
+ *
+ * Far more containers than a host can run at the same time, and the highest
+ * number that still fits a veth-euN name.
+ */
+#define MAX_NET_SLOTS 4096
+
+/**
+ * struct net_slot - A slot as known to this process
+ * @lock_fd: Open lock file of the slot, flock()ed while we hold the slot
+ * @ns_fd: The slot's network namespace, -1 until we created it
+ * @in_use: Whether the slot is handed out to one of our containers
+ */
+struct net_slot {
+  int lock_fd;
+  int ns_fd;
+  int in_use;
+};
+
+/**
+ * net_slots - Every slot this process has opened, indexed by slot number
+ */
+static struct net_slot *net_slots = NULL;
+
+/**
+ * num_net_slots - Number of elements in net_slots
+ */
+static int num_net_slots = 0;
+
+/**
+ * host_nl - rtnetlink socket in the host's network namespace, -1 until the
+ * bridge has been set up
+ */
+static int host_nl = -1;
+
+/**
+ * bridge_index - Interface index of the bridge
+ */
+static int bridge_index = 0;
+
+/**
+ * subnet_addr - Network address of the subnet, in host byte order
+ */
+static uint32_t subnet_addr = 0;
+
+/**
+ * subnet_prefix - Prefix length of the subnet
+ */
+static int subnet_prefix = 0;
+
+/**
+ * num_hosts - Slots the subnet has addresses for
+ */
+static int num_hosts = 0;
+
+/**
+ * host_address - Address of a host in the subnet
+ * @n: 1 for the gateway, slot number + 2 for a slot
+ *
+ * Return: The address
+ */
+static struct in_addr host_address(int n) {
+  struct in_addr addr = {.s_addr = htonl(subnet_addr + n)};
+  return addr;
+}
+
+/**
+ * peer_name - Name of a slot's veth end on the host
+ * @peer: Output buffer of IFNAMSIZ bytes
+ * @slot: Slot number, below MAX_NET_SLOTS
+ */
+static void peer_name(char *peer, int slot) {
+  snprintf(peer, IFNAMSIZ, "veth-eu%d", slot % MAX_NET_SLOTS);
+}
+
+/**
+ * parse_subnet - Read the subnet in CIDR notation, such as "10.88.0.0/16"
+ * @subnet: Subnet from the configuration
+ *
+ * Every subnet needs a network address, the gateway, at least one
+ * container and a broadcast address, so the prefix can be 30 at most.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int parse_subnet(const char *subnet) {
+  char addr[INET_ADDRSTRLEN];
+  const char *slash = strchr(subnet, '/');
+  char *end;
+
+  if (!slash || (size_t)(slash - subnet) >= sizeof(addr)) {
+    fprintf(stderr, "Invalid subnet: %s\n", subnet);
+    return -1;
+  }
+
+  memcpy(addr, subnet, slash - subnet);
+  addr[slash - subnet] = '\0';
+
+  struct in_addr network;
+  long prefix = strtol(slash + 1, &end, 10);
+  if (inet_pton(AF_INET, addr, &network) != 1 || *end != '\0' ||
+      end == slash + 1 || prefix < 1 || prefix > 30) {
+    fprintf(stderr, "Invalid subnet: %s\n", subnet);
+    return -1;
+  }
+
+  uint32_t mask = ~0U << (32 - prefix);
+  subnet_addr = ntohl(network.s_addr) & mask;
+  subnet_prefix = prefix;
+
+  long hosts = (1L << (32 - prefix)) - 3;
+  num_hosts = hosts > MAX_NET_SLOTS ? MAX_NET_SLOTS : hosts;
+
+  return 0;
+}
+
+/**
+ * prepare_network - Set up the bridge the first time a slot is needed
+ * @ctx: Container configuration with bridge and subnet
+ *
+ * An existing bridge is used as it is, apart from getting the gateway
+ * address if it doesn't have it yet, so several euclid processes (or the
+ * host's own configuration) can share it.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int prepare_network(const struct container_ctx *ctx) {
+  if (host_nl != -1) {
+    return 0;
+  }
+
+  if (strlen(ctx->bridge) >= IFNAMSIZ) {
+    fprintf(stderr, "Bridge name is too long: %s\n", ctx->bridge);
+    return -1;
+  }
+
+  if (parse_subnet(ctx->subnet) == -1) {
+    return -1;
+  }
+
+  if (mkdir(NET_LOCK_DIR, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", NET_LOCK_DIR,
+            strerror(errno));
+    return -1;
+  }
+
+  int nl = nl_open();
+  if (nl == -1) {
+    return -1;
+  }
+
+  if (nl_create_bridge(nl, ctx->bridge) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create bridge %s: %s\n", ctx->bridge,
+            strerror(errno));
+    goto fail;
+  }
+
+  bridge_index = if_nametoindex(ctx->bridge);
+  if (bridge_index == 0) {
+    fprintf(stderr, "Failed to find bridge %s: %s\n", ctx->bridge,
+            strerror(errno));
+    goto fail;
+  }
+
+  if (nl_add_address(nl, bridge_index, host_address(1), subnet_prefix) ==
+          -1 ||
+      nl_set_link(nl, bridge_index, 0) == -1) {
+    fprintf(stderr, "Failed to configure bridge %s: %s\n", ctx->bridge,
+            strerror(errno));
+    goto fail;
+  }
+
+  host_nl = nl;
+
+  return 0;
+
+fail:
+  close(nl);
+  return -1;
+}
+
+/**
+ * open_net_slot - Open the next slot's lock file
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int open_net_slot(void) {
+  struct net_slot *grown =
+      realloc(net_slots, (num_net_slots + 1) * sizeof(struct net_slot));
+  if (!grown) {
+    fprintf(stderr, "Memory allocation failed for network slots: %s\n",
+            strerror(errno));
+    return -1;
+  }
+  net_slots = grown;
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/net%d.lock", NET_LOCK_DIR, num_net_slots);
+
+  struct net_slot *slot = &net_slots[num_net_slots];
+  slot->ns_fd = -1;
+  slot->in_use = 0;
+  slot->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (slot->lock_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  num_net_slots++;
+
+  return 0;
+}
+
+/**
+ * allow_ping - Let every group in the current namespace create ping sockets
+ *
+ * Containers don't have CAP_NET_RAW for raw ICMP sockets, so ping needs the
+ * unprivileged ICMP datagram sockets, which are off by default in a new
+ * namespace. The range covers ICMPv6 too.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int allow_ping(void) {
+  int fd = open("/proc/sys/net/ipv4/ping_group_range", O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open ping_group_range: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+  if (write(fd, PING_GROUP_RANGE, strlen(PING_GROUP_RANGE)) == -1) {
+    fprintf(stderr, "Failed to write ping_group_range: %s\n",
+            strerror(errno));
+    ret = -1;
+  }
+
+  close(fd);
+  return ret;
+}
+
+/**
+ * configure_namespace - Set up the inside of a slot's namespace
+ * @host_ns: Host's network namespace, where the veth's peer goes
+ * @peer: Name of the veth's peer
+ * @addr: Address of the slot
+ *
+ * Must be called from inside the slot's namespace.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int configure_namespace(int host_ns, const char *peer,
+                               struct in_addr addr) {
+  int nl = nl_open();
+  if (nl == -1) {
+    return -1;
+  }
+
+  int ret = -1;
+
+  if (nl_create_veth(nl, CONTAINER_IFNAME, peer, host_ns) == -1) {
+    fprintf(stderr, "Failed to create veth pair %s: %s\n", peer,
+            strerror(errno));
+    goto out;
+  }
+
+  int lo = if_nametoindex("lo");
+  int eth = if_nametoindex(CONTAINER_IFNAME);
+  if (lo == 0 || eth == 0) {
+    fprintf(stderr, "Failed to find interfaces of network slot: %s\n",
+            strerror(errno));
+    goto out;
+  }
+
+  /*
+   * The default route is added while the host end is still down, which the
+   * kernel accepts since the gateway is on eth0's subnet.
+   */
+  if (nl_set_link(nl, lo, 0) == -1 ||
+      nl_add_address(nl, eth, addr, subnet_prefix) == -1 ||
+      nl_set_link(nl, eth, 0) == -1 ||
+      nl_add_default_route(nl, eth, host_address(1)) == -1) {
+    fprintf(stderr, "Failed to configure network slot: %s\n",
+            strerror(errno));
+    goto out;
+  }
+
+  if (allow_ping() == -1) {
+    goto out;
+  }
+
+  ret = 0;
+
+out:
+  close(nl);
+  return ret;
+}
+
+/**
+ * create_net_slot - Create a slot's namespace and veth pair
+ * @slot: Slot to create, must be claimed by us
+ * @index: Slot number
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int create_net_slot(struct net_slot *slot, int index) {
+  char peer[IFNAMSIZ];
+  peer_name(peer, index);
+
+  if (nl_delete_link(host_nl, peer) == -1 && errno != ENODEV) {
+    fprintf(stderr, "Failed to delete stale interface %s: %s\n", peer,
+            strerror(errno));
+    return -1;
+  }
+
+  int host_ns = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+  if (host_ns == -1) {
+    fprintf(stderr, "Failed to open network namespace: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  if (unshare(CLONE_NEWNET) == -1) {
+    fprintf(stderr, "Failed to create network namespace: %s\n",
+            strerror(errno));
+    close(host_ns);
+    return -1;
+  }
+
+  int ns_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+  int ret = ns_fd == -1 ? -1
+                        : configure_namespace(host_ns, peer,
+                                              host_address(index + 2));
+  if (ns_fd == -1) {
+    fprintf(stderr, "Failed to open network namespace: %s\n",
+            strerror(errno));
+  }
+
+  /*
+   * Our host_nl socket keeps talking to the host either way, but everything
+   * we create from here on, containers included, would be in the wrong
+   * namespace.
+   */
+  if (setns(host_ns, CLONE_NEWNET) == -1) {
+    fprintf(stderr, "Failed to return to the host network namespace: %s\n",
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  close(host_ns);
+
+  if (ret == 0) {
+    int peer_index = if_nametoindex(peer);
+    if (peer_index == 0 ||
+        nl_set_link(host_nl, peer_index, bridge_index) == -1) {
+      fprintf(stderr, "Failed to attach %s to the bridge: %s\n", peer,
+              strerror(errno));
+      ret = -1;
+    }
+  }
+
+  if (ret == -1) {
+    if (ns_fd != -1) {
+      close(ns_fd);
+    }
+    nl_delete_link(host_nl, peer);
+    return -1;
+  }
+
+  slot->ns_fd = ns_fd;
+
+  return 0;
+}
+
+/**
+ * net_pool_init - Create network slots ahead of the containers using them
+ * @ctx: Container configuration
+ * @size: Number of slots to create
+ *
+ * Called before any container is started, so every slot that is in use
+ * afterwards was claimed here and can simply be released again.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int net_pool_init(struct container_ctx *ctx, int size) {
+  if (!ctx->network) {
+    return 0;
+  }
+
+  for (int i = 0; i < size; i++) {
+    if (acquire_net_slot(ctx) == -1) {
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < num_net_slots; i++) {
+    net_slots[i].in_use = 0;
+  }
+  ctx->netns_fd = -1;
+
+  return 0;
+}
+
+/**
+ * acquire_net_slot - Claim a network slot for a new container
+ * @ctx: Container configuration, the slot's namespace is stored in netns_fd
+ *
+ * Slots this process already created are reused before new ones are set up.
+ *
+ * Return: Slot number on success, -1 on failure
+ */
+int acquire_net_slot(struct container_ctx *ctx) {
+  if (prepare_network(ctx) == -1) {
+    return -1;
+  }
+
+  /* A slot we created for an earlier container is ready to go */
+  for (int i = 0; i < num_net_slots; i++) {
+    if (!net_slots[i].in_use && net_slots[i].ns_fd != -1) {
+      net_slots[i].in_use = 1;
+      ctx->netns_fd = net_slots[i].ns_fd;
+      return i;
+    }
+  }
+
+  for (int i = 0; i < num_hosts; i++) {
+    if (i == num_net_slots && open_net_slot() == -1) {
+      return -1;
+    }
+
+    /* Ours, and in use */
+    struct net_slot *slot = &net_slots[i];
+    if (slot->ns_fd != -1) {
+      continue;
+    }
+
+    /* Held by another euclid process */
+    if (flock(slot->lock_fd, LOCK_EX | LOCK_NB) == -1) {
+      if (errno == EWOULDBLOCK) {
+        continue;
+      }
+      fprintf(stderr, "Failed to lock network slot %d: %s\n", i,
+              strerror(errno));
+      return -1;
+    }
+
+    if (create_net_slot(slot, i) == -1) {
+      flock(slot->lock_fd, LOCK_UN);
+      return -1;
+    }
+
+    slot->in_use = 1;
+    ctx->netns_fd = slot->ns_fd;
+
+    return i;
+  }
+
+  fprintf(stderr, "No free network slot in %s\n", ctx->subnet);
+  return -1;
+}
+
+/**
+ * release_net_slot - Give up a container's network slot
+ * @slot: Slot number returned by acquire_net_slot(), -1 for none
+ */
+void release_net_slot(int slot) {
+  if (slot != -1) {
+    net_slots[slot].in_use = 0;
+  }
+}
+
+/**
+ * net_pool_destroy - Delete every network slot of this process
+ *
+ * The host end of each veth is deleted right away, taking the other end with
+ * it, rather than leaving that to the kernel's cleanup of the namespace once
+ * its fd is closed. That cleanup is asynchronous, and the next process to
+ * claim the slot would find the name still taken.
+ */
+void net_pool_destroy(void) {
+  for (int i = 0; i < num_net_slots; i++) {
+    struct net_slot *slot = &net_slots[i];
+
+    if (slot->ns_fd != -1) {
+      char peer[IFNAMSIZ];
+      peer_name(peer, i);
+      if (nl_delete_link(host_nl, peer) == -1 && errno != ENODEV) {
+        fprintf(stderr, "Failed to delete %s: %s\n", peer, strerror(errno));
+      }
+      close(slot->ns_fd);
+    }
+
+    /* Closing the lock file releases the lock */
+    close(slot->lock_fd);
+  }
+
+  free(net_slots);
+  net_slots = NULL;
+  num_net_slots = 0;
+
+  if (host_nl != -1) {
+    close(host_nl);
+    host_nl = -1;
+  }
+}
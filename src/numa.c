@@ -0,0 +1,231 @@
+/**
+ * numa.c
+ *
+ * Spreading containers across NUMA nodes.
+ *
+ * OVERVIEW:
+ * The kernel describes the machine's NUMA topology in sysfs:
+ *
+ *   /sys/devices/system/node
+ *   +-- has_cpu          nodes with CPUs, such as "0-1"
+ *   +-- node0/cpulist    CPUs of node 0, such as "0-15,32-47"
+ *   +-- node1/cpulist
+ *
+ * It's read once, and every node keeps count of the containers placed on it.
+ * A new container goes to the node with the lowest count, the lowest numbered
+ * one on a tie, so a batch fills the nodes in turn.
+ *
+ * Machines without NUMA show up as a single node 0 holding every CPU, where
+ * spreading costs nothing and changes nothing.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgroups.h"
+#include "numa.h"
+
+/**
+ * NODE_ROOT - Where the kernel lists the NUMA nodes
+ */
+static const char *NODE_ROOT = "/sys/devices/system/node";
+
+/**
+ * MAX_NODES - Most NUMA nodes we keep track of, as many as the kernel's
+ * largest NODES_SHIFT allows
+ */
+#define MAX_NODES 1024
+
+/**
+ * struct numa_node - A NUMA node with CPUs
+ * @cpus: CPU list of the node, in cpuset.cpus syntax
+ * @mems: Number of the node, in cpuset.mems syntax
+ * @containers: Containers currently placed on the node
+ */
+struct numa_node {
+  char cpus[CGROUP_VALUE_MAX];
+  char mems[16];
+  int containers;
+};
+
+/**
+ * nodes - NUMA nodes with CPUs, NULL until the topology has been read
+ */
+static struct numa_node *nodes = NULL;
+
+/**
+ * num_nodes - Number of entries in nodes
+ */
+static int num_nodes = 0;
+
+/**
+ * read_list - Read a one-line list file from sysfs
+ * @path: File to read
+ * @list: Output buffer of CGROUP_VALUE_MAX bytes, without the newline
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int read_list(const char *path, char *list) {
+  FILE *file = fopen(path, "re");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+  if (!fgets(list, CGROUP_VALUE_MAX, file)) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    ret = -1;
+  } else if (!strchr(list, '\n')) {
+    /* A list that long would not fit in cpuset.cpus either */
+    fprintf(stderr, "List too long in %s\n", path);
+    ret = -1;
+  } else {
+    list[strcspn(list, "\n")] = '\0';
+  }
+
+  fclose(file);
+
+  return ret;
+}
+
+/**
+ * add_node - Read a node's CPUs into nodes
+ * @id: Number of the node
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int add_node(int id) {
+  if (num_nodes == MAX_NODES) {
+    fprintf(stderr, "Too many NUMA nodes\n");
+    return -1;
+  }
+
+  struct numa_node *node = &nodes[num_nodes];
+
+  char path[128];
+  snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_ROOT, id);
+  if (read_list(path, node->cpus) == -1) {
+    return -1;
+  }
+
+  snprintf(node->mems, sizeof(node->mems), "%d", id);
+  node->containers = 0;
+  num_nodes++;
+
+  return 0;
+}
+
+/**
+ * load_topology - Read the NUMA nodes with CPUs from sysfs
+ *
+ * has_cpu is a list in the kernel's usual syntax, ranges and single numbers
+ * separated by commas, such as "0-1,4".
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int load_topology(void) {
+  char path[128];
+  char list[CGROUP_VALUE_MAX];
+
+  snprintf(path, sizeof(path), "%s/has_cpu", NODE_ROOT);
+  if (read_list(path, list) == -1) {
+    fprintf(stderr, "NUMA topology unavailable, numa_spread needs "
+                    "/sys/devices/system/node\n");
+    return -1;
+  }
+
+  nodes = calloc(MAX_NODES, sizeof(struct numa_node));
+  if (!nodes) {
+    fprintf(stderr, "Memory allocation failed for NUMA nodes: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  char *saveptr;
+  for (char *range = strtok_r(list, ",", &saveptr); range;
+       range = strtok_r(NULL, ",", &saveptr)) {
+    int first, last;
+    int fields = sscanf(range, "%d-%d", &first, &last);
+    if (fields == 1) {
+      last = first;
+    } else if (fields != 2 || first < 0 || last < first) {
+      fprintf(stderr, "Failed to parse %s: %s\n", path, range);
+      goto fail;
+    }
+
+    for (int id = first; id <= last; id++) {
+      if (add_node(id) == -1) {
+        goto fail;
+      }
+    }
+  }
+
+  if (num_nodes == 0) {
+    fprintf(stderr, "No NUMA node with CPUs\n");
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  free(nodes);
+  nodes = NULL;
+  num_nodes = 0;
+  return -1;
+}
+
+/**
+ * numa_acquire_node - Pick the NUMA node for a new container
+ *
+ * Return: Node index on success, -1 on failure
+ */
+int numa_acquire_node(void) {
+  if (!nodes && load_topology() == -1) {
+    return -1;
+  }
+
+  int best = 0;
+  for (int i = 1; i < num_nodes; i++) {
+    if (nodes[i].containers < nodes[best].containers) {
+      best = i;
+    }
+  }
+
+  nodes[best].containers++;
+
+  return best;
+}
+
+/**
+ * numa_release_node - Give back a container's NUMA node
+ * @node: Node index returned by numa_acquire_node(), -1 for none
+ */
+void numa_release_node(int node) {
+  if (node >= 0 && node < num_nodes && nodes[node].containers > 0) {
+    nodes[node].containers--;
+  }
+}
+
+/**
+ * numa_node_cpus - CPUs of a NUMA node
+ * @node: Node index returned by numa_acquire_node()
+ *
+ * Return: CPU list in cpuset.cpus syntax
+ */
+const char *numa_node_cpus(int node) {
+  return nodes[node].cpus;
+}
+
+/**
+ * numa_node_mems - Memory of a NUMA node
+ * @node: Node index returned by numa_acquire_node()
+ *
+ * Return: The node's number in cpuset.mems syntax
+ */
+const char *numa_node_mems(int node) {
+  return nodes[node].mems;
+}
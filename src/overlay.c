@@ -0,0 +1,556 @@
+/**
+ * overlay.c
+ *
+ * Pre-staged overlay slots for the container's writable layer.
+ *
+ * OVERVIEW:
+ * Building the writable layer used to be part of every launch: the child
+ * mounted a tmpfs at overlay_base, created upper, work and merged inside it
+ * and only then mounted the overlay. Slots move all but the overlay mount out
+ * of the launch path. A slot's tmpfs is mounted on the host once, and stays
+ * mounted after the container exits, so the next container that claims the
+ * slot finds everything in place.
+ *
+ * RESET:
+ * A container that writes to its overlay leaves files in upper. When such a
+ * slot is released, its tmpfs is unmounted and replaced by an empty one,
+ * which frees the memory at once no matter how many files there were. Slots
+ * that were only read from go back to the free slots as they are.
+ *
+ * upper is also the container's /, so a container running as root can
+ * change it without leaving an entry, by chmod()ing it or setting an xattr.
+ * Both change upper's ctime, so the ctime and mode it had when the slot was
+ * set up are kept, and a slot where either differs counts as written to.
+ *
+ * RUNS:
+ * Slots outlive euclid. The first time a process claims a slot it checks
+ * that the slot's tmpfs is mounted, has the wanted options and is clean, and
+ * resets it otherwise, which also recovers slots that a crashed run left
+ * behind. Later claims by the same process trust the slot as it was released.
+ *
+ * TMPFS OPTIONS:
+ * Besides its size, the tmpfs can be given a huge page policy (tmpfs_huge),
+ * a NUMA memory policy (tmpfs_mpol) and an inode limit (tmpfs_nr_inodes), see
+ * tmpfs(5). Write-heavy jobs get fewer page faults and TLB misses from huge
+ * pages, and a memory policy keeps the writable layer on the NUMA node the
+ * job runs on. The options a slot was mounted with are written to its lock
+ * file, since they can't all be read back from the mount.
+ *
+ * LOCKING:
+ * The lock files sit next to the slots rather than inside them, because the
+ * slot directory's inode changes every time a tmpfs is mounted on it, and
+ * locks on different inodes don't exclude each other. The kernel drops the
+ * locks of a process that dies, so a crash never leaves a slot claimed.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "overlay.h"
+
+/**
+ * MAX_OVERLAY_SLOTS - Most slots acquire_overlay_slot() goes through
+ *
+ * Far more containers than a host can run at the same time, it only keeps a
+ * broken overlay_base from being filled with slots.
+ */
+#define MAX_OVERLAY_SLOTS 4096
+
+/**
+ * TMPFS_OPTS_MAX - Room for the mount options of a slot's tmpfs
+ */
+#define TMPFS_OPTS_MAX 256
+
+/**
+ * SLOT_DIRS - Directories overlayfs needs inside every slot
+ */
+static const char *SLOT_DIRS[] = {"/upper", "/work", "/merged"};
+
+#define NUM_SLOT_DIRS (sizeof(SLOT_DIRS) / sizeof(SLOT_DIRS[0]))
+
+/**
+ * struct overlay_slot - A slot as known to this process
+ * @path: Directory of the slot, {overlay_base}/slot{N}
+ * @lock_fd: Open lock file of the slot, flock()ed while it's in use
+ * @in_use: Whether the slot is handed out to one of our containers
+ * @tmpfs_opts: Mount options the slot's tmpfs was set up with by this
+ *              process, empty if it hasn't been checked yet
+ * @upper_ctime: ctime of upper when the slot was set up or checked
+ * @upper_mode: Mode of upper at the same time
+ */
+struct overlay_slot {
+  char path[PATH_MAX];
+  int lock_fd;
+  int in_use;
+  char tmpfs_opts[TMPFS_OPTS_MAX];
+  struct timespec upper_ctime;
+  mode_t upper_mode;
+};
+
+/**
+ * slots - Every slot this process has opened, indexed by slot number
+ */
+static struct overlay_slot *slots = NULL;
+
+/**
+ * num_slots - Number of elements in slots
+ */
+static int num_slots = 0;
+
+/**
+ * slot_file - Build the path of a file belonging to a slot
+ * @path: Output buffer of PATH_MAX bytes
+ * @slot: Slot the file belongs to
+ * @suffix: Appended to the slot's directory, such as "/upper" or ".lock"
+ *
+ * Return: 0 on success, -1 if the path doesn't fit
+ */
+static int slot_file(char *path, const struct overlay_slot *slot,
+                     const char *suffix) {
+  if (snprintf(path, PATH_MAX, "%s%s", slot->path, suffix) >= PATH_MAX) {
+    fprintf(stderr, "Overlay slot path is too long: %s\n", slot->path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * open_slot - Open the next slot and its lock file
+ * @ctx: Container configuration containing overlay_base
+ *
+ * Creates the slot's directory and lock file if this is the first time any
+ * euclid process uses the slot.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int open_slot(struct container_ctx *ctx) {
+  struct overlay_slot *grown =
+      realloc(slots, (num_slots + 1) * sizeof(struct overlay_slot));
+  if (!grown) {
+    fprintf(stderr, "Memory allocation failed for overlay slots: %s\n",
+            strerror(errno));
+    return -1;
+  }
+  slots = grown;
+
+  if (num_slots == 0 && mkdir(ctx->overlay_base, 0755) == -1 &&
+      errno != EEXIST) {
+    fprintf(stderr, "Failed to create overlayfs base directory: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  struct overlay_slot *slot = &slots[num_slots];
+  snprintf(slot->path, PATH_MAX, "%s/slot%d", ctx->overlay_base, num_slots);
+  slot->in_use = 0;
+  slot->tmpfs_opts[0] = '\0';
+
+  if (mkdir(slot->path, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create overlay slot %s: %s\n", slot->path,
+            strerror(errno));
+    return -1;
+  }
+
+  char lock_path[PATH_MAX];
+  if (slot_file(lock_path, slot, ".lock") == -1) {
+    return -1;
+  }
+
+  slot->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (slot->lock_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", lock_path, strerror(errno));
+    return -1;
+  }
+
+  num_slots++;
+
+  return 0;
+}
+
+/**
+ * tmpfs_options - Build the mount options for the slots' tmpfs
+ * @ctx: Container configuration containing the tmpfs_* settings
+ * @opts: Output buffer of TMPFS_OPTS_MAX bytes
+ *
+ * Return: 0 on success, -1 if the options don't fit
+ */
+static int tmpfs_options(const struct container_ctx *ctx, char *opts) {
+  int len = snprintf(opts, TMPFS_OPTS_MAX, "size=%dM", ctx->tmpfs_size);
+
+  if (ctx->tmpfs_huge[0] != '\0' && len < TMPFS_OPTS_MAX) {
+    len += snprintf(opts + len, TMPFS_OPTS_MAX - len, ",huge=%s",
+                    ctx->tmpfs_huge);
+  }
+
+  if (ctx->tmpfs_mpol[0] != '\0' && len < TMPFS_OPTS_MAX) {
+    len += snprintf(opts + len, TMPFS_OPTS_MAX - len, ",mpol=%s",
+                    ctx->tmpfs_mpol);
+  }
+
+  /* -1 is "max", which tmpfs spells 0 */
+  if (ctx->tmpfs_nr_inodes != 0 && len < TMPFS_OPTS_MAX) {
+    len += snprintf(opts + len, TMPFS_OPTS_MAX - len, ",nr_inodes=%d",
+                    ctx->tmpfs_nr_inodes == -1 ? 0 : ctx->tmpfs_nr_inodes);
+  }
+
+  if (len >= TMPFS_OPTS_MAX) {
+    fprintf(stderr, "tmpfs options are too long\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * record_tmpfs_opts - Store the options of a slot's tmpfs in its lock file
+ * @slot: Slot, must be claimed by us
+ * @opts: Options to store, "" to forget them
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int record_tmpfs_opts(const struct overlay_slot *slot,
+                             const char *opts) {
+  size_t len = strlen(opts);
+
+  if (ftruncate(slot->lock_fd, 0) == -1 ||
+      pwrite(slot->lock_fd, opts, len, 0) != (ssize_t)len) {
+    fprintf(stderr, "Failed to record tmpfs options of %s: %s\n", slot->path,
+            strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * stat_upper - stat() a slot's upper directory
+ * @slot: Slot to check
+ * @st: Filled in with upper's status
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int stat_upper(const struct overlay_slot *slot, struct stat *st) {
+  char upper[PATH_MAX];
+  if (slot_file(upper, slot, "/upper") == -1) {
+    return -1;
+  }
+
+  return stat(upper, st);
+}
+
+/**
+ * record_upper - Remember what a clean slot's upper looks like
+ * @slot: Slot whose upper is known to be unchanged
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int record_upper(struct overlay_slot *slot) {
+  struct stat st;
+  if (stat_upper(slot, &st) == -1) {
+    fprintf(stderr, "Failed to stat upper of overlay slot %s: %s\n",
+            slot->path, strerror(errno));
+    return -1;
+  }
+
+  slot->upper_ctime = st.st_ctim;
+  slot->upper_mode = st.st_mode;
+
+  return 0;
+}
+
+/**
+ * reset_slot - Replace a slot's tmpfs with an empty one
+ * @slot: Slot to reset, must be claimed by us
+ * @opts: Mount options of the new tmpfs, from tmpfs_options()
+ *
+ * Unmounts everything stacked on the slot directory, mounts a fresh tmpfs on
+ * it and creates the overlay directories inside. Until that has worked, the
+ * lock file records no options, so a failed reset is never mistaken for a
+ * ready slot.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int reset_slot(struct overlay_slot *slot, const char *opts) {
+  if (record_tmpfs_opts(slot, "") == -1) {
+    return -1;
+  }
+
+  while (umount2(slot->path, MNT_DETACH) == 0) {
+  }
+
+  /* EINVAL means there's nothing (left) mounted on the slot */
+  if (errno != EINVAL) {
+    fprintf(stderr, "Failed to unmount overlay slot %s: %s\n", slot->path,
+            strerror(errno));
+    return -1;
+  }
+
+  if (mount("tmpfs", slot->path, "tmpfs", 0, opts) == -1) {
+    fprintf(stderr, "Failed to mount tmpfs with %s: %s\n", opts,
+            strerror(errno));
+    return -1;
+  }
+
+  for (size_t i = 0; i < NUM_SLOT_DIRS; i++) {
+    char path[PATH_MAX];
+    if (slot_file(path, slot, SLOT_DIRS[i]) == -1) {
+      return -1;
+    }
+
+    if (mkdir(path, 0755) == -1) {
+      fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  if (record_upper(slot) == -1) {
+    return -1;
+  }
+
+  return record_tmpfs_opts(slot, opts);
+}
+
+/**
+ * slot_dirty - Check whether a container wrote to a slot
+ * @slot: Slot to check
+ *
+ * Every change a container makes to its root filesystem, including deleting
+ * files of the lower layer, leaves an entry in upper, except for changes to
+ * / itself, which show in upper's ctime or mode.
+ *
+ * Return: 1 if upper changed, isn't empty or can't be read, 0 otherwise
+ */
+static int slot_dirty(const struct overlay_slot *slot) {
+  struct stat st;
+  if (stat_upper(slot, &st) == -1 || st.st_mode != slot->upper_mode ||
+      st.st_ctim.tv_sec != slot->upper_ctime.tv_sec ||
+      st.st_ctim.tv_nsec != slot->upper_ctime.tv_nsec) {
+    return 1;
+  }
+
+  char upper[PATH_MAX];
+  if (slot_file(upper, slot, "/upper") == -1) {
+    return 1;
+  }
+
+  DIR *dir = opendir(upper);
+  if (!dir) {
+    return 1;
+  }
+
+  int dirty = 0;
+  struct dirent *entry;
+  while (!dirty && (entry = readdir(dir))) {
+    dirty = strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+  }
+
+  closedir(dir);
+
+  return dirty;
+}
+
+/**
+ * slot_ready - Check a slot that this process hasn't used yet
+ * @slot: Slot to check
+ * @ctx: Container configuration containing overlay_base
+ * @opts: Mount options the slot's tmpfs should have
+ *
+ * A slot left behind by an earlier run is ready if it still has a tmpfs
+ * mounted with the same options, the overlay directories and nothing in
+ * upper. We don't know what upper looked like back then, but mkdir() gives
+ * it an mtime equal to its ctime and mode 0755, and changing / in any other
+ * way than adding or removing entries only moves the ctime.
+ *
+ * Return: 1 if the slot can be used as it is, 0 if it needs a reset
+ */
+static int slot_ready(struct overlay_slot *slot,
+                      const struct container_ctx *ctx, const char *opts) {
+  struct stat base_st, slot_st;
+  char recorded[TMPFS_OPTS_MAX];
+
+  /*
+   * The slot is a mount point if it's on a different device than its parent
+   * directory. overlay_base itself is often on a tmpfs too (/tmp), so the
+   * filesystem type alone doesn't tell.
+   */
+  if (stat(ctx->overlay_base, &base_st) == -1 ||
+      stat(slot->path, &slot_st) == -1 || base_st.st_dev == slot_st.st_dev) {
+    return 0;
+  }
+
+  ssize_t len = pread(slot->lock_fd, recorded, sizeof(recorded) - 1, 0);
+  if (len <= 0) {
+    return 0;
+  }
+  recorded[len] = '\0';
+
+  if (strcmp(recorded, opts) != 0) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < NUM_SLOT_DIRS; i++) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (slot_file(path, slot, SLOT_DIRS[i]) == -1 || stat(path, &st) == -1 ||
+        !S_ISDIR(st.st_mode)) {
+      return 0;
+    }
+  }
+
+  struct stat upper_st;
+  if (stat_upper(slot, &upper_st) == -1 ||
+      upper_st.st_mode != (S_IFDIR | 0755) ||
+      upper_st.st_mtim.tv_sec != upper_st.st_ctim.tv_sec ||
+      upper_st.st_mtim.tv_nsec != upper_st.st_ctim.tv_nsec ||
+      record_upper(slot) == -1) {
+    return 0;
+  }
+
+  return !slot_dirty(slot);
+}
+
+/**
+ * acquire_overlay_slot - Claim a free overlay slot for a new container
+ * @ctx: Container configuration, the slot's directory is stored in
+ *       overlay_dir
+ *
+ * Slots are tried in order, so the lowest free slot numbers get reused and
+ * the number of slots only grows up to the most containers that ever ran at
+ * the same time. A slot only needs setting up the first time this process
+ * claims it, or if the tmpfs options have changed since.
+ *
+ * Return: Slot number on success, -1 on failure
+ */
+int acquire_overlay_slot(struct container_ctx *ctx) {
+  char opts[TMPFS_OPTS_MAX];
+  if (tmpfs_options(ctx, opts) == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < MAX_OVERLAY_SLOTS; i++) {
+    if (i == num_slots && open_slot(ctx) == -1) {
+      return -1;
+    }
+
+    struct overlay_slot *slot = &slots[i];
+    if (slot->in_use) {
+      continue;
+    }
+
+    /* Held by another euclid process */
+    if (flock(slot->lock_fd, LOCK_EX | LOCK_NB) == -1) {
+      if (errno == EWOULDBLOCK) {
+        continue;
+      }
+      fprintf(stderr, "Failed to lock overlay slot %s: %s\n", slot->path,
+              strerror(errno));
+      return -1;
+    }
+
+    if (strcmp(slot->tmpfs_opts, opts) != 0) {
+      if (!slot_ready(slot, ctx, opts) && reset_slot(slot, opts) == -1) {
+        slot->tmpfs_opts[0] = '\0';
+        flock(slot->lock_fd, LOCK_UN);
+        return -1;
+      }
+      snprintf(slot->tmpfs_opts, TMPFS_OPTS_MAX, "%s", opts);
+    }
+
+    slot->in_use = 1;
+    snprintf(ctx->overlay_dir, PATH_MAX, "%s", slot->path);
+
+    return i;
+  }
+
+  fprintf(stderr, "No free overlay slot in %s\n", ctx->overlay_base);
+  return -1;
+}
+
+/**
+ * mount_private_slot - Set up a slot only the calling child can see
+ * @ctx: Container configuration, the slot's directory is stored in
+ *       overlay_dir
+ *
+ * The tmpfs goes straight onto overlay_base, which in our mount namespace
+ * hides the shared slots underneath, not that we would need them. It needs no
+ * lock, and no reset either: it goes away with the mount namespace.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int mount_private_slot(struct container_ctx *ctx) {
+  char opts[TMPFS_OPTS_MAX];
+  if (tmpfs_options(ctx, opts) == -1) {
+    return -1;
+  }
+
+  if (mkdir(ctx->overlay_base, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create overlayfs base directory: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  if (mount("tmpfs", ctx->overlay_base, "tmpfs", 0, opts) == -1) {
+    fprintf(stderr, "Failed to mount tmpfs with %s: %s\n", opts,
+            strerror(errno));
+    return -1;
+  }
+
+  for (size_t i = 0; i < NUM_SLOT_DIRS; i++) {
+    char path[PATH_MAX];
+    if (snprintf(path, PATH_MAX, "%s%s", ctx->overlay_base, SLOT_DIRS[i]) >=
+        PATH_MAX) {
+      fprintf(stderr, "Overlay slot path is too long: %s\n",
+              ctx->overlay_base);
+      return -1;
+    }
+
+    if (mkdir(path, 0755) == -1) {
+      fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  snprintf(ctx->overlay_dir, PATH_MAX, "%s", ctx->overlay_base);
+
+  return 0;
+}
+
+/**
+ * release_overlay_slot - Give up a container's overlay slot
+ * @slot: Slot number returned by acquire_overlay_slot(), -1 for none
+ *
+ * The reset happens here rather than in acquire_overlay_slot(), so it's
+ * paid after a container exits instead of before the next one can start.
+ * A slot that fails to reset is set up from scratch on its next claim.
+ */
+void release_overlay_slot(int slot) {
+  if (slot == -1) {
+    return;
+  }
+
+  struct overlay_slot *released = &slots[slot];
+
+  if (slot_dirty(released) &&
+      reset_slot(released, released->tmpfs_opts) == -1) {
+    released->tmpfs_opts[0] = '\0';
+  }
+
+  released->in_use = 0;
+
+  if (flock(released->lock_fd, LOCK_UN) == -1) {
+    fprintf(stderr, "Failed to unlock overlay slot %s: %s\n", released->path,
+            strerror(errno));
+  }
+}
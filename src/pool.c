@@ -0,0 +1,337 @@
+/**
+ * pool.c
+ *
+ * Pool of pre-spawned (warm) containers.
+ *
+ * OVERVIEW:
+ * Keeps a fixed number of containers that have finished their whole setup and
+ * are blocked reading a command from their synchronization pipe. Handing out
+ * a command then costs a single write(), and the setup of the replacement
+ * container runs in the background while the command executes.
+ *
+ * DEAD CONTAINERS:
+ * A warm container can die before it is used (for example when its setup
+ * fails). Writing to its pipe then fails with EPIPE, so SIGPIPE must be
+ * ignored by the caller. The dead container is reaped and the next one is
+ * tried.
+ *
+ * FREEZING:
+ * Containers are frozen in the order they were spawned, so the frozen ones
+ * are always at the front of the pool and the timer only ever needs to wait
+ * for the first one that isn't. A frozen container is thawed as it leaves
+ * the pool, whether it's about to run a command or to be discarded, since it
+ * can't read either from its pipe while frozen.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cgroups.h"
+#include "command.h"
+#include "context.h"
+#include "freezer.h"
+#include "launch.h"
+#include "pool.h"
+
+/**
+ * first_unfrozen - Find the oldest warm container that isn't frozen
+ * @pool: Pool to search
+ *
+ * Return: Its index, pool->count if every container is frozen
+ */
+static int first_unfrozen(const struct pool *pool) {
+  int i = 0;
+
+  while (i < pool->count && pool->containers[i].frozen) {
+    i++;
+  }
+
+  return i;
+}
+
+/**
+ * pool_arm - Set the timer for the next container to freeze
+ * @pool: Pool whose timer to set
+ *
+ * The timer is absolute, so a container that is already overdue fires it
+ * right away. Without a container to freeze, the timer is disarmed.
+ */
+static void pool_arm(struct pool *pool) {
+  if (pool->timer_fd == -1) {
+    return;
+  }
+
+  struct itimerspec spec = {0};
+  int next = first_unfrozen(pool);
+  if (next < pool->count) {
+    long long idle_ms = pool->ctx->freeze_idle;
+    spec.it_value = pool->containers[next].spawned;
+    spec.it_value.tv_sec += idle_ms / 1000;
+    spec.it_value.tv_nsec += (idle_ms % 1000) * 1000000L;
+    if (spec.it_value.tv_nsec >= 1000000000L) {
+      spec.it_value.tv_sec++;
+      spec.it_value.tv_nsec -= 1000000000L;
+    }
+  }
+
+  if (timerfd_settime(pool->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+    fprintf(stderr, "Failed to set pool freeze timer: %s\n", strerror(errno));
+  }
+}
+
+/**
+ * pool_refill - Spawn warm containers until the pool is full
+ * @pool: Pool to refill
+ *
+ * Return: 0 on success, -1 if a container couldn't be spawned
+ */
+static int pool_refill(struct pool *pool) {
+  int ret = 0;
+
+  while (pool->count < pool->size) {
+    struct warm_container *warm = &pool->containers[pool->count];
+    if (start_container(pool->ctx, &warm->container) == -1) {
+      ret = -1;
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &warm->spawned);
+    warm->frozen = 0;
+    pool->count++;
+  }
+
+  pool_arm(pool);
+
+  return ret;
+}
+
+/**
+ * pool_take - Remove the oldest running warm container from the pool
+ * @pool: Pool to take from
+ * @container: Set to the removed container
+ *
+ * The oldest container has had the most time to finish its setup. Frozen
+ * containers are only taken once every container is frozen, since they have
+ * to fault their memory back in, and are thawed first. One that can't be
+ * thawed is killed.
+ *
+ * Return: 0 on success, -1 if the pool is empty
+ */
+static int pool_take(struct pool *pool, struct container *container) {
+  for (;;) {
+    if (pool->count == 0) {
+      return -1;
+    }
+
+    int taken = first_unfrozen(pool);
+    if (taken == pool->count) {
+      taken = 0;
+    }
+
+    struct warm_container *warm = &pool->containers[taken];
+    *container = warm->container;
+
+    int thawed = 1;
+    if (warm->frozen) {
+      thawed = thaw_cgroup(&warm->cgroup) == 0;
+      cgroup_close(&warm->cgroup);
+    }
+
+    pool->count--;
+    memmove(warm, warm + 1,
+            (pool->count - taken) * sizeof(struct warm_container));
+    pool_arm(pool);
+
+    if (thawed) {
+      return 0;
+    }
+
+    /* Fatal signals get through to frozen tasks */
+    fprintf(stderr, "Failed to thaw warm container %d, killing it\n",
+            container->pid);
+    kill(container->pid, SIGKILL);
+    waitpid(container->pid, NULL, 0);
+    release_container(container);
+  }
+}
+
+/**
+ * discard_container - Close and reap a container that won't be used
+ * @warm: Container to discard
+ *
+ * The container exits on its own once it sees EOF on its pipe.
+ */
+static void discard_container(struct container *warm) {
+  if (close(warm->sync_fd) == -1) {
+    fprintf(stderr, "Failed to close pipe: %s\n", strerror(errno));
+  }
+  warm->sync_fd = -1;
+
+  if (waitpid(warm->pid, NULL, 0) == -1) {
+    fprintf(stderr, "Failed to reap warm container %d: %s\n", warm->pid,
+            strerror(errno));
+  }
+
+  release_container(warm);
+}
+
+/**
+ * pool_init - Fill a pool with warm containers
+ * @pool: Pool to initialize
+ * @ctx: Configuration to spawn containers with, its cmd is ignored
+ * @size: Number of warm containers to keep around
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int pool_init(struct pool *pool, struct container_ctx *ctx, int size) {
+  pool->ctx = ctx;
+  pool->size = size;
+  pool->count = 0;
+  pool->timer_fd = -1;
+
+  pool->containers = calloc(size, sizeof(struct warm_container));
+  if (!pool->containers) {
+    fprintf(stderr, "Memory allocation failed for container pool: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  if (ctx->freeze_idle != -1) {
+    pool->timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pool->timer_fd == -1) {
+      fprintf(stderr, "Failed to create pool freeze timer: %s\n",
+              strerror(errno));
+      pool_destroy(pool);
+      return -1;
+    }
+  }
+
+  /*
+   * Pooled children wait for their command instead of running ctx->cmd.
+   */
+  ctx->pooled = 1;
+
+  if (pool_refill(pool) == -1) {
+    pool_destroy(pool);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * pool_dispatch - Run a command in a warm container
+ * @pool: Pool to take the container from
+ * @cmd: Command to run
+ * @container: Set to the container running the command
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int pool_dispatch(struct pool *pool, const struct command *cmd,
+                  struct container *container) {
+  for (;;) {
+    /*
+     * Every warm container died, so we fall back to a cold one. Its setup
+     * simply runs before the command instead of ahead of time.
+     */
+    int cold = pool_take(pool, container) == -1;
+    if (cold && start_container(pool->ctx, container) == -1) {
+      return -1;
+    }
+
+    if (send_command(container->sync_fd, cmd) == 0) {
+      break;
+    }
+
+    /* A cold container that dies right away would only die again */
+    discard_container(container);
+    if (cold) {
+      return -1;
+    }
+  }
+
+  /*
+   * The container has its command, which it reads right away. Closing our end
+   * now means a container that somehow asks for a second one sees EOF.
+   */
+  if (close(container->sync_fd) == -1) {
+    fprintf(stderr, "Failed to close pipe: %s\n", strerror(errno));
+  }
+  container->sync_fd = -1;
+
+  if (pool_refill(pool) == -1) {
+    fprintf(stderr, "Failed to refill container pool\n");
+  }
+
+  return 0;
+}
+
+/**
+ * pool_idle - Freeze the warm containers that have been idle for too long
+ * @pool: Pool whose timer_fd became readable
+ *
+ * A container that can't be frozen would keep firing the timer, so the pool
+ * stops freezing containers altogether.
+ */
+void pool_idle(struct pool *pool) {
+  uint64_t expirations;
+  if (read(pool->timer_fd, &expirations, sizeof(expirations)) == -1) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = first_unfrozen(pool); i < pool->count; i++) {
+    struct warm_container *warm = &pool->containers[i];
+    long long idle_ms = (now.tv_sec - warm->spawned.tv_sec) * 1000LL +
+                        (now.tv_nsec - warm->spawned.tv_nsec) / 1000000L;
+    if (idle_ms < pool->ctx->freeze_idle) {
+      break;
+    }
+
+    if (cgroup_open(&warm->cgroup, warm->container.cgroup_path) == -1 ||
+        freeze_cgroup(&warm->cgroup, pool->ctx->idle_reclaim) == -1) {
+      cgroup_close(&warm->cgroup);
+      fprintf(stderr, "Failed to freeze warm container %d, no longer "
+                      "freezing the pool\n",
+              warm->container.pid);
+      close(pool->timer_fd);
+      pool->timer_fd = -1;
+      return;
+    }
+
+    warm->frozen = 1;
+  }
+
+  pool_arm(pool);
+}
+
+/**
+ * pool_destroy - Shut down all warm containers in a pool
+ * @pool: Pool to destroy
+ */
+void pool_destroy(struct pool *pool) {
+  struct container warm;
+
+  while (pool_take(pool, &warm) == 0) {
+    discard_container(&warm);
+  }
+
+  if (pool->timer_fd != -1) {
+    close(pool->timer_fd);
+    pool->timer_fd = -1;
+  }
+
+  free(pool->containers);
+  pool->containers = NULL;
+}
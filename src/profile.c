@@ -0,0 +1,321 @@
+/**
+ * profile.c
+ *
+ * Syscall frequency profiling for tuning the seccomp filter.
+ *
+ * OVERVIEW:
+ * Records how often a container makes each syscall by acting as a seccomp user
+ * notification supervisor for it, and loads those recordings back to weight
+ * the decision tree in filter.c.
+ *
+ * USER NOTIFICATIONS:
+ * A filter returning SECCOMP_RET_USER_NOTIF suspends the calling thread and
+ * queues a notification on a listener file descriptor. The supervisor reads
+ * it with SECCOMP_IOCTL_NOTIF_RECV and answers with SECCOMP_IOCTL_NOTIF_SEND.
+ * Answering with SECCOMP_USER_NOTIF_FLAG_CONTINUE lets the kernel carry on and
+ * run the syscall as if nothing happened.
+ *
+ * Every syscall makes a round trip through the parent, so a profiled run is
+ * much slower than a normal one. Only the counts matter, not the timing.
+ *
+ * The counts include the few syscalls the child makes between installing the
+ * profiler and calling execvp(). These are negligible for any real workload.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "profile.h"
+
+/**
+ * LINE_MAX_LEN - Maximum length of a line in a profile file
+ */
+#define LINE_MAX_LEN 128
+
+/**
+ * receive_listener - Take over the child's seccomp listener fd
+ * @pid: PID of the container process
+ * @report_fd: Read end of the pipe the child reports its listener fd on
+ *
+ * The child writes the number of its listener fd to the report pipe. That
+ * number is only meaningful in the child's file descriptor table, so we use
+ * pidfd_getfd() to duplicate it into ours. Neither syscall has a glibc wrapper
+ * on all of the distributions we build on.
+ *
+ * Return: Listener fd on success, -1 on failure
+ */
+static int receive_listener(int pid, int report_fd) {
+  int child_fd;
+
+  ssize_t bytes = read(report_fd, &child_fd, sizeof(child_fd));
+  if (bytes != sizeof(child_fd)) {
+    fprintf(stderr, "Failed to read seccomp listener from child: %s\n",
+            bytes == -1 ? strerror(errno) : "child exited");
+    return -1;
+  }
+
+  int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (pidfd == -1) {
+    fprintf(stderr, "Failed to open pidfd for child: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int listener_fd = syscall(SYS_pidfd_getfd, pidfd, child_fd, 0);
+  if (listener_fd == -1) {
+    fprintf(stderr, "Failed to get seccomp listener from child: %s\n",
+            strerror(errno));
+  }
+
+  if (close(pidfd) == -1) {
+    fprintf(stderr, "Failed to close pidfd: %s\n", strerror(errno));
+  }
+
+  return listener_fd;
+}
+
+/**
+ * count_notifications - Count and continue syscalls until the container exits
+ * @listener_fd: Seccomp listener fd
+ * @counts: Array of SYSCALL_TABLE_SIZE counters to increment
+ *
+ * The kernel may use larger notification structures than our headers know
+ * about, so we ask it for the sizes instead of trusting sizeof().
+ *
+ * POLLHUP on the listener means every process using the filter has exited.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int count_notifications(int listener_fd, unsigned long *counts) {
+  struct seccomp_notif_sizes sizes;
+  if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == -1) {
+    fprintf(stderr, "Failed to get seccomp notification sizes: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  size_t req_size = sizes.seccomp_notif > sizeof(struct seccomp_notif)
+                        ? sizes.seccomp_notif
+                        : sizeof(struct seccomp_notif);
+  size_t resp_size = sizes.seccomp_notif_resp > sizeof(struct seccomp_notif_resp)
+                         ? sizes.seccomp_notif_resp
+                         : sizeof(struct seccomp_notif_resp);
+
+  struct seccomp_notif *req = malloc(req_size);
+  struct seccomp_notif_resp *resp = malloc(resp_size);
+  if (!req || !resp) {
+    fprintf(stderr, "Memory allocation failed for seccomp notification: %s\n",
+            strerror(errno));
+    free(req);
+    free(resp);
+    return -1;
+  }
+
+  int ret = 0;
+  struct pollfd pfd = {.fd = listener_fd, .events = POLLIN};
+
+  for (;;) {
+    if (poll(&pfd, 1, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to poll seccomp listener: %s\n", strerror(errno));
+      ret = -1;
+      break;
+    }
+
+    if (!(pfd.revents & POLLIN)) {
+      break;
+    }
+
+    /* The kernel requires the buffer to be zeroed before every receive */
+    memset(req, 0, req_size);
+    if (ioctl(listener_fd, SECCOMP_IOCTL_NOTIF_RECV, req) == -1) {
+      /*
+       * ENOENT means the thread was killed before we got to its notification,
+       * EINTR that we were interrupted. Either way there's nothing to answer.
+       */
+      if (errno == ENOENT || errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to receive seccomp notification: %s\n",
+              strerror(errno));
+      ret = -1;
+      break;
+    }
+
+    if (req->data.nr >= 0 && req->data.nr < SYSCALL_TABLE_SIZE) {
+      counts[req->data.nr]++;
+    }
+
+    memset(resp, 0, resp_size);
+    resp->id = req->id;
+    resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+
+    if (ioctl(listener_fd, SECCOMP_IOCTL_NOTIF_SEND, resp) == -1 &&
+        errno != ENOENT) {
+      fprintf(stderr, "Failed to answer seccomp notification: %s\n",
+              strerror(errno));
+      ret = -1;
+      break;
+    }
+  }
+
+  free(req);
+  free(resp);
+
+  return ret;
+}
+
+/**
+ * write_profile - Write syscall counts to a profile file, hottest first
+ * @path: File to write the profile to
+ * @counts: Array of SYSCALL_TABLE_SIZE counters
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int write_profile(const char *path, unsigned long *counts) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  fprintf(fp, "# euclid seccomp profile: syscall_nr count\n");
+
+  /*
+   * Selection sort is fine here, the table is small and this runs once after
+   * the container has exited.
+   */
+  unsigned long total = 0;
+  int distinct = 0;
+  for (;;) {
+    int hottest = -1;
+    for (int nr = 0; nr < SYSCALL_TABLE_SIZE; nr++) {
+      if (counts[nr] && (hottest == -1 || counts[nr] > counts[hottest])) {
+        hottest = nr;
+      }
+    }
+
+    if (hottest == -1) {
+      break;
+    }
+
+    fprintf(fp, "%d %lu\n", hottest, counts[hottest]);
+    total += counts[hottest];
+    distinct++;
+    counts[hottest] = 0;
+  }
+
+  if (fclose(fp) == EOF) {
+    fprintf(stderr, "Failed to close %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  printf("Recorded %lu syscalls (%d distinct) to %s\n", total, distinct, path);
+
+  return 0;
+}
+
+/**
+ * record_profile - Count syscalls made by a container until it exits
+ * @pid: PID of the container process
+ * @report_fd: Read end of the pipe the child reports its listener fd on
+ * @path: File to write the profile to
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int record_profile(int pid, int report_fd, const char *path) {
+  int listener_fd = receive_listener(pid, report_fd);
+  if (listener_fd == -1) {
+    return -1;
+  }
+
+  unsigned long *counts = calloc(SYSCALL_TABLE_SIZE, sizeof(unsigned long));
+  if (!counts) {
+    fprintf(stderr, "Memory allocation failed for syscall counts: %s\n",
+            strerror(errno));
+    close(listener_fd);
+    return -1;
+  }
+
+  int ret = count_notifications(listener_fd, counts);
+
+  if (close(listener_fd) == -1) {
+    fprintf(stderr, "Failed to close seccomp listener: %s\n", strerror(errno));
+  }
+
+  if (ret == 0) {
+    ret = write_profile(path, counts);
+  }
+
+  free(counts);
+
+  return ret;
+}
+
+/**
+ * load_profile - Weight the seccomp filter with a recorded profile
+ * @path: Profile file written by record_profile()
+ *
+ * Unknown syscall numbers are ignored rather than rejected, so a profile
+ * recorded on a newer kernel still loads.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int load_profile(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  unsigned long *counts = calloc(SYSCALL_TABLE_SIZE, sizeof(unsigned long));
+  if (!counts) {
+    fprintf(stderr, "Memory allocation failed for syscall counts: %s\n",
+            strerror(errno));
+    fclose(fp);
+    return -1;
+  }
+
+  char line[LINE_MAX_LEN];
+  int line_num = 0;
+  int ret = 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    line_num++;
+
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+
+    int nr;
+    unsigned long count;
+    if (sscanf(line, "%d %lu", &nr, &count) != 2 || nr < 0) {
+      fprintf(stderr, "Malformed line %d in %s\n", line_num, path);
+      ret = -1;
+      break;
+    }
+
+    if (nr < SYSCALL_TABLE_SIZE) {
+      counts[nr] = count;
+    }
+  }
+
+  if (ret == 0) {
+    set_filter_weights(counts);
+  }
+
+  free(counts);
+  fclose(fp);
+
+  return ret;
+}
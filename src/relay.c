@@ -0,0 +1,113 @@
+/**
+ * relay.c
+ *
+ * Relaying container output to log files without copying it through us.
+ *
+ * OVERVIEW:
+ * A relay is the read end of a container's output pipe and the file it goes
+ * to. Whenever the pipe shows up as readable in the event loop, relay_pump()
+ * splices one chunk from the pipe into the file.
+ *
+ * SPLICE:
+ * splice() moves data between a pipe and any other file descriptor inside
+ * the kernel. The pipe end is non-blocking, and SPLICE_F_NONBLOCK makes the
+ * call itself not wait for data either, so an empty pipe returns EAGAIN
+ * instead of stalling the event loop. A return of 0 means every writer has
+ * closed its end, and nothing more will come.
+ *
+ * The file is always a regular one, see relay.h.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "relay.h"
+
+/**
+ * close_fd - Close a relay's descriptor if it's open
+ * @fd: Descriptor to close, set to -1
+ */
+static void close_fd(int *fd) {
+  if (*fd != -1) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+/**
+ * relay_open - Start relaying a pipe to a new file
+ * @relay: Relay to set up
+ * @pipe_fd: Read end of the pipe, owned by the relay from now on
+ * @path: File to relay to, created or truncated
+ * @chunk: Most bytes moved per relay_pump()
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int relay_open(struct relay *relay, int pipe_fd, const char *path, int chunk) {
+  relay->pipe_fd = pipe_fd;
+  relay->chunk = chunk;
+
+  /*
+   * No O_APPEND: splice() refuses to write to files opened with it, and we
+   * are the file's only writer anyway.
+   */
+  relay->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (relay->out_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    close_fd(&relay->pipe_fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * relay_pump - Move what's waiting in a relay's pipe to its file
+ * @relay: Relay whose pipe became readable
+ *
+ * Return: 1 while the stream is open, 0 once the relay has been closed
+ */
+int relay_pump(struct relay *relay) {
+  ssize_t moved = splice(relay->pipe_fd, NULL, relay->out_fd, NULL,
+                         relay->chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+  if (moved > 0 || (moved == -1 && (errno == EAGAIN || errno == EINTR))) {
+    return 1;
+  }
+
+  /*
+   * The job's output is lost from here on. Closing the pipe makes the job's
+   * next write fail with EPIPE instead of blocking it forever.
+   */
+  if (moved == -1) {
+    fprintf(stderr, "Failed to relay output: %s\n", strerror(errno));
+  }
+
+  close_fd(&relay->pipe_fd);
+  close_fd(&relay->out_fd);
+
+  return 0;
+}
+
+/**
+ * relay_close - Relay whatever is left in the pipe, then close the relay
+ * @relay: Relay to close, may already be closed
+ */
+void relay_close(struct relay *relay) {
+  if (relay->pipe_fd != -1) {
+    for (;;) {
+      ssize_t moved = splice(relay->pipe_fd, NULL, relay->out_fd, NULL,
+                             relay->chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (moved <= 0 && !(moved == -1 && errno == EINTR)) {
+        break;
+      }
+    }
+  }
+
+  close_fd(&relay->pipe_fd);
+  close_fd(&relay->out_fd);
+}
@@ -0,0 +1,167 @@
+/**
+ * sha256.c
+ *
+ * SHA-256 message digest.
+ *
+ * OVERVIEW:
+ * Follows FIPS 180-4: the message is padded to a multiple of 64 bytes with a
+ * single 1 bit, zeros and its length in bits, and every 64-byte block is
+ * mixed into the eight 32-bit words of the hash state by 64 rounds of the
+ * compression function. Everything is big-endian.
+ *
+ * Only used for layer digests, which aren't on the launch path, so it's
+ * written for clarity rather than speed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sha256.h"
+
+/**
+ * round_constants - First 32 bits of the fractional parts of the cube roots
+ * of the first 64 primes
+ */
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/**
+ * rotr - Rotate a 32-bit word right
+ * @x: Word to rotate
+ * @n: Number of bits, 1 to 31
+ *
+ * Return: Rotated word
+ */
+static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+/**
+ * compress - Mix one 64-byte block into the hash state
+ * @sha: Digest state
+ * @block: Block to mix in
+ */
+static void compress(struct sha256 *sha, const unsigned char *block) {
+  uint32_t w[64];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+  }
+
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2],
+           d = sha->state[3], e = sha->state[4], f = sha->state[5],
+           g = sha->state[6], h = sha->state[7];
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + round_constants[i] + w[i];
+    uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  sha->state[0] += a;
+  sha->state[1] += b;
+  sha->state[2] += c;
+  sha->state[3] += d;
+  sha->state[4] += e;
+  sha->state[5] += f;
+  sha->state[6] += g;
+  sha->state[7] += h;
+}
+
+/**
+ * sha256_init - Start a new digest
+ * @sha: Digest state to initialize
+ *
+ * The initial hash value is the first 32 bits of the fractional parts of the
+ * square roots of the first 8 primes.
+ */
+void sha256_init(struct sha256 *sha) {
+  static const uint32_t initial_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                            0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                            0x1f83d9ab, 0x5be0cd19};
+
+  memcpy(sha->state, initial_state, sizeof(initial_state));
+  sha->length = 0;
+  sha->block_len = 0;
+}
+
+/**
+ * sha256_update - Feed data into a digest
+ * @sha: Digest state
+ * @data: Data to add
+ * @len: Number of bytes in data
+ */
+void sha256_update(struct sha256 *sha, const void *data, size_t len) {
+  const unsigned char *bytes = data;
+
+  sha->length += len;
+
+  while (len > 0) {
+    size_t chunk = sizeof(sha->block) - sha->block_len;
+    if (chunk > len) {
+      chunk = len;
+    }
+
+    memcpy(sha->block + sha->block_len, bytes, chunk);
+    sha->block_len += chunk;
+    bytes += chunk;
+    len -= chunk;
+
+    if (sha->block_len == sizeof(sha->block)) {
+      compress(sha, sha->block);
+      sha->block_len = 0;
+    }
+  }
+}
+
+/**
+ * sha256_hex - Finish a digest and format it in lowercase hex
+ * @sha: Digest state, can't be fed any more data afterwards
+ * @hex: Output buffer of SHA256_HEX_LEN + 1 bytes
+ */
+void sha256_hex(struct sha256 *sha, char *hex) {
+  uint64_t bits = sha->length * 8;
+  unsigned char padding[72] = {0x80};
+
+  /*
+   * Pad with 0x80 and zeros up to 56 bytes into a block, which leaves exactly
+   * the 8 bytes for the length.
+   */
+  size_t pad_len = (sha->block_len < 56 ? 56 : 120) - sha->block_len;
+  for (int i = 0; i < 8; i++) {
+    padding[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
+  }
+  sha256_update(sha, padding, pad_len + 8);
+
+  for (int i = 0; i < 8; i++) {
+    snprintf(hex + 8 * i, 9, "%08x", (unsigned int)sha->state[i]);
+  }
+}
@@ -0,0 +1,488 @@
+/**
+ * supervisor.c
+ *
+ * Seccomp user notification supervisor for the syscalls the filter leaves to
+ * euclid.
+ *
+ * OVERVIEW:
+ * The supervisor thread sleeps in epoll_wait() on every container's report
+ * pipe or listener, and handles each event to completion before the next:
+ * - A readable report pipe carries the child's listener fd number, which is
+ *   turned into a listener of our own with pidfd_getfd()
+ * - A readable listener has a notification, which is received, decided and
+ *   answered with SECCOMP_IOCTL_NOTIF_SEND
+ * - A listener hanging up means every process using the filter is gone
+ * Answers only take a few syscalls, so one thread keeps up with many
+ * containers.
+ *
+ * ENTRIES:
+ * Containers are tracked in a fixed table rather than on the heap. The main
+ * thread clone()s containers while we run, and raw clone() doesn't take the
+ * allocator's locks the way fork() does, so a child cloned while we were in
+ * malloc() or free() would inherit a lock that is never released. The table
+ * is shared under table_lock, which the children never touch.
+ *
+ * The same goes for stdio, whose stderr lock the children take for their
+ * own error messages, so the thread reports errors with thread_error()
+ * rather than fprintf().
+ *
+ * RAW SOCKETS:
+ * Raw sockets are never handed out, not even ICMP ones. We create sockets as
+ * root, and the container's setsockopt() isn't supervised, so IP_HDRINCL on
+ * a raw socket would let it send any packet it likes onto the bridge. ping
+ * uses an unprivileged ICMP datagram socket instead, which network slots
+ * allow for every group (see network.c).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/seccomp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "supervisor.h"
+
+/**
+ * MAX_SUPERVISED - Most containers supervised at the same time
+ */
+#define MAX_SUPERVISED 4096
+
+/**
+ * MAX_EVENTS - Most epoll events handled per epoll_wait()
+ */
+#define MAX_EVENTS 64
+
+/**
+ * struct supervised - A supervised container
+ * @in_use: Non-zero while the entry belongs to a container
+ * @pidfd: pidfd of the container's init
+ * @report_fd: Read end of the supervisor pipe, -1 once the report was read
+ * @listener_fd: Our copy of the container's listener, -1 until it's taken
+ *               over
+ */
+struct supervised {
+  int in_use;
+  int pidfd;
+  int report_fd;
+  int listener_fd;
+};
+
+/**
+ * entries - Every container being supervised
+ */
+static struct supervised entries[MAX_SUPERVISED];
+
+/**
+ * table_lock - Guards in_use in entries
+ */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * epoll_fd - epoll set of the report pipes, listeners and stop_fd, -1 while
+ * the supervisor isn't running
+ */
+static int epoll_fd = -1;
+
+/**
+ * stop_fd - eventfd written by supervisor_stop() to end the thread
+ */
+static int stop_fd = -1;
+
+/**
+ * containers_networked - Non-zero if the containers have a network
+ */
+static int containers_networked = 0;
+
+/**
+ * supervisor_thread - The supervisor thread
+ */
+static pthread_t supervisor_thread;
+
+/**
+ * req - Buffer for received notifications, as large as the kernel's
+ */
+static struct seccomp_notif *req = NULL;
+
+/**
+ * req_size - Size of req
+ */
+static size_t req_size;
+
+/**
+ * resp - Buffer for answers, as large as the kernel's
+ */
+static struct seccomp_notif_resp *resp = NULL;
+
+/**
+ * resp_size - Size of resp
+ */
+static size_t resp_size;
+
+/**
+ * release_entry - Close a container's fds and free its entry
+ * @entry: Entry of a container we're done with
+ */
+static void release_entry(struct supervised *entry) {
+  if (entry->report_fd != -1) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry->report_fd, NULL);
+    close(entry->report_fd);
+    entry->report_fd = -1;
+  }
+
+  if (entry->listener_fd != -1) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry->listener_fd, NULL);
+    close(entry->listener_fd);
+    entry->listener_fd = -1;
+  }
+
+  close(entry->pidfd);
+  entry->pidfd = -1;
+
+  pthread_mutex_lock(&table_lock);
+  entry->in_use = 0;
+  pthread_mutex_unlock(&table_lock);
+}
+
+/**
+ * thread_error - Report a failure from the supervisor thread
+ * @what: What failed, after "Failed to "
+ *
+ * Formats the message into a buffer of our own and write()s it, so that no
+ * stdio lock is held if the main thread clones a container meanwhile.
+ * strerrordesc_np() is used over strerror() since it doesn't go through
+ * gettext and its locks.
+ */
+static void thread_error(const char *what) {
+  const char *desc = strerrordesc_np(errno);
+  char message[256];
+
+  int len = snprintf(message, sizeof(message), "Failed to %s: %s\n", what,
+                     desc ? desc : "Unknown error");
+  if (len < 0) {
+    return;
+  }
+  if ((size_t)len >= sizeof(message)) {
+    len = sizeof(message) - 1;
+  }
+
+  write(STDERR_FILENO, message, (size_t)len);
+}
+
+/**
+ * take_listener - Turn a container's report into a listener of our own
+ * @entry: Entry whose report pipe is readable
+ *
+ * EOF means the container died before installing its filter, and there is
+ * nothing left to supervise. A container whose listener we can't get is
+ * killed, since its exec would wait for an answer forever.
+ */
+static void take_listener(struct supervised *entry) {
+  int child_fd;
+  ssize_t bytes = read(entry->report_fd, &child_fd, sizeof(child_fd));
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry->report_fd, NULL);
+  close(entry->report_fd);
+  entry->report_fd = -1;
+
+  if (bytes != sizeof(child_fd)) {
+    if (bytes == -1) {
+      thread_error("read seccomp listener from child");
+      syscall(SYS_pidfd_send_signal, entry->pidfd, SIGKILL, NULL, 0);
+    }
+    release_entry(entry);
+    return;
+  }
+
+  entry->listener_fd = syscall(SYS_pidfd_getfd, entry->pidfd, child_fd, 0);
+  if (entry->listener_fd == -1) {
+    thread_error("get seccomp listener from child");
+    syscall(SYS_pidfd_send_signal, entry->pidfd, SIGKILL, NULL, 0);
+    release_entry(entry);
+    return;
+  }
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = entry};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, entry->listener_fd, &event) == -1) {
+    thread_error("watch seccomp listener");
+    syscall(SYS_pidfd_send_signal, entry->pidfd, SIGKILL, NULL, 0);
+    release_entry(entry);
+  }
+}
+
+/**
+ * decide_socket - Decide a socket() call
+ * @data: The call's seccomp data
+ *
+ * Return: 0 to continue the call, or a negative errno to fail it with
+ */
+static int decide_socket(const struct seccomp_data *data) {
+  int family = (int)data->args[0];
+  int type = (int)data->args[1] & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+  int protocol = (int)data->args[2];
+
+  if (!containers_networked) {
+    return -EAFNOSUPPORT;
+  }
+
+  switch (family) {
+  case AF_UNIX:
+    return 0;
+  case AF_INET:
+  case AF_INET6:
+    /* SOCK_DGRAM with IPPROTO_ICMP or IPPROTO_ICMPV6 is a ping socket */
+    if (type == SOCK_STREAM || type == SOCK_DGRAM) {
+      return 0;
+    }
+    return -EPERM;
+  case AF_NETLINK:
+    return protocol == NETLINK_ROUTE ? 0 : -EPERM;
+  default:
+    return -EAFNOSUPPORT;
+  }
+}
+
+/**
+ * answer_notification - Receive, decide and answer a notification
+ * @entry: Entry whose listener is readable
+ */
+static void answer_notification(struct supervised *entry) {
+  /* The kernel requires the buffer to be zeroed before every receive */
+  memset(req, 0, req_size);
+  if (ioctl(entry->listener_fd, SECCOMP_IOCTL_NOTIF_RECV, req) == -1) {
+    /*
+     * ENOENT means the thread was killed before we got to its notification,
+     * EINTR that we were interrupted. Either way there's nothing to answer.
+     */
+    if (errno != ENOENT && errno != EINTR) {
+      thread_error("receive seccomp notification");
+    }
+    return;
+  }
+
+  int verdict = 0;
+  if (req->data.nr == __NR_socket) {
+    verdict = decide_socket(&req->data);
+  }
+
+  memset(resp, 0, resp_size);
+  resp->id = req->id;
+  if (verdict == 0) {
+    resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+  } else {
+    resp->error = verdict;
+  }
+
+  if (ioctl(entry->listener_fd, SECCOMP_IOCTL_NOTIF_SEND, resp) == -1 &&
+      errno != ENOENT) {
+    thread_error("answer seccomp notification");
+  }
+}
+
+/**
+ * supervise - Body of the supervisor thread
+ * @arg: Unused
+ *
+ * Return: NULL
+ */
+static void *supervise(void *arg) {
+  (void)arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  for (;;) {
+    int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      thread_error("wait for seccomp notifications");
+      return NULL;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      struct supervised *entry = events[i].data.ptr;
+
+      /* stop_fd is the only fd registered without an entry */
+      if (!entry) {
+        return NULL;
+      }
+
+      if (entry->listener_fd == -1) {
+        take_listener(entry);
+      } else if (events[i].events & EPOLLIN) {
+        answer_notification(entry);
+      } else {
+        release_entry(entry);
+      }
+    }
+  }
+}
+
+/**
+ * supervisor_start - Start the supervisor thread
+ * @network: Non-zero if the containers have a network
+ *
+ * The thread blocks every signal, so signals meant for euclid keep going to
+ * the main thread.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int supervisor_start(int network) {
+  struct seccomp_notif_sizes sizes;
+  if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == -1) {
+    fprintf(stderr, "Failed to get seccomp notification sizes: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  req_size = sizes.seccomp_notif > sizeof(struct seccomp_notif)
+                 ? sizes.seccomp_notif
+                 : sizeof(struct seccomp_notif);
+  resp_size = sizes.seccomp_notif_resp > sizeof(struct seccomp_notif_resp)
+                  ? sizes.seccomp_notif_resp
+                  : sizeof(struct seccomp_notif_resp);
+
+  req = malloc(req_size);
+  resp = malloc(resp_size);
+  if (!req || !resp) {
+    fprintf(stderr, "Memory allocation failed for seccomp notification: %s\n",
+            strerror(errno));
+    goto fail;
+  }
+
+  containers_networked = network;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (epoll_fd == -1 || stop_fd == -1) {
+    fprintf(stderr, "Failed to create supervisor fds: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) == -1) {
+    fprintf(stderr, "Failed to watch supervisor stop fd: %s\n",
+            strerror(errno));
+    goto fail;
+  }
+
+  sigset_t all, saved;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &saved);
+  int error = pthread_create(&supervisor_thread, NULL, supervise, NULL);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+  if (error != 0) {
+    fprintf(stderr, "Failed to start supervisor thread: %s\n",
+            strerror(error));
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+  if (stop_fd != -1) {
+    close(stop_fd);
+    stop_fd = -1;
+  }
+  free(req);
+  free(resp);
+  req = NULL;
+  resp = NULL;
+  return -1;
+}
+
+/**
+ * supervise_container - Supervise a container's supervised syscalls
+ * @pidfd: pidfd of the container's init, owned by the supervisor from now on
+ * @report_fd: Read end of the container's supervisor pipe, likewise
+ *
+ * The entry belongs to the thread as soon as the report pipe is in the epoll
+ * set, so we don't touch it after that.
+ *
+ * Return: 0 on success, -1 on failure with both fds closed
+ */
+int supervise_container(int pidfd, int report_fd) {
+  struct supervised *entry = NULL;
+
+  pthread_mutex_lock(&table_lock);
+  for (int i = 0; i < MAX_SUPERVISED; i++) {
+    if (!entries[i].in_use) {
+      entry = &entries[i];
+      entry->in_use = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&table_lock);
+
+  if (!entry) {
+    fprintf(stderr, "Too many supervised containers\n");
+    close(pidfd);
+    close(report_fd);
+    return -1;
+  }
+
+  entry->pidfd = pidfd;
+  entry->report_fd = report_fd;
+  entry->listener_fd = -1;
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = entry};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, report_fd, &event) == -1) {
+    fprintf(stderr, "Failed to watch supervisor pipe: %s\n", strerror(errno));
+    entry->report_fd = -1;
+    close(report_fd);
+    release_entry(entry);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * supervisor_stop - Stop the supervisor thread
+ *
+ * Entries left over belong to containers that have been reaped, but whose
+ * listener hangup the thread hadn't got to yet.
+ */
+void supervisor_stop(void) {
+  if (epoll_fd == -1) {
+    return;
+  }
+
+  uint64_t one = 1;
+  if (write(stop_fd, &one, sizeof(one)) == -1) {
+    fprintf(stderr, "Failed to stop supervisor thread: %s\n", strerror(errno));
+    return;
+  }
+  pthread_join(supervisor_thread, NULL);
+
+  for (int i = 0; i < MAX_SUPERVISED; i++) {
+    if (entries[i].in_use) {
+      release_entry(&entries[i]);
+    }
+  }
+
+  close(epoll_fd);
+  close(stop_fd);
+  epoll_fd = -1;
+  stop_fd = -1;
+
+  free(req);
+  free(resp);
+  req = NULL;
+  resp = NULL;
+}
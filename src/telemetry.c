@@ -0,0 +1,587 @@
+/**
+ * telemetry.c
+ *
+ * Resource usage telemetry of running containers.
+ *
+ * OVERVIEW:
+ * Every sampled control file is opened once when monitoring starts and read
+ * again with pread() at offset 0 for each sample. The kernel regenerates the
+ * contents of a cgroup file for every read from the start, so this gives a
+ * fresh reading without a path walk through cgroupfs per sample.
+ *
+ * FILE FORMATS:
+ * - Single value: "4096\n" (memory.current, memory.peak, pids.current)
+ * - Flat keyed: "key value\n" per line (cpu.stat, memory.events)
+ * - Pressure: "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", followed by
+ *   a "full ..." line of the same shape
+ *
+ * EXIT CAUSES:
+ * The "cause" of an exit record is the most specific one that applies:
+ * - "oom": SIGKILL while the cgroup's oom_kill counter went up
+ * - "seccomp": SIGSYS, which is how the filter kills
+ * - "signal": Any other signal
+ * - "exit": The container's init exited by itself, whatever its status
+ * A job whose own child was killed by the OOM killer and that then exited
+ * with an error is an "exit" with a non-zero memory_oom_kills.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+/**
+ * READ_MAX - Size of the buffer a control file is read into
+ *
+ * cpu.stat is the longest sampled file, at a few hundred bytes.
+ */
+#define READ_MAX 1024
+
+/**
+ * telemetry_files - Name of every enum telemetry_file
+ */
+static const char *telemetry_files[TELEMETRY_FILE_COUNT] = {
+    [TELEMETRY_CPU_STAT] = "cpu.stat",
+    [TELEMETRY_MEMORY_CURRENT] = "memory.current",
+    [TELEMETRY_MEMORY_PEAK] = "memory.peak",
+    [TELEMETRY_MEMORY_EVENTS] = "memory.events",
+    [TELEMETRY_PIDS_CURRENT] = "pids.current",
+    [TELEMETRY_MEMORY_PRESSURE] = "memory.pressure",
+    [TELEMETRY_CPU_PRESSURE] = "cpu.pressure",
+};
+
+/**
+ * EXIT_FILES - The sampled files an exit record is read from
+ */
+static const enum telemetry_file EXIT_FILES[] = {TELEMETRY_CPU_STAT,
+                                                 TELEMETRY_MEMORY_EVENTS};
+
+/**
+ * NUM_EXIT_FILES - Number of elements in EXIT_FILES
+ */
+#define NUM_EXIT_FILES (sizeof(EXIT_FILES) / sizeof(EXIT_FILES[0]))
+
+/**
+ * elapsed_since - Seconds since a CLOCK_MONOTONIC timestamp
+ * @start: Earlier timestamp
+ *
+ * Return: Seconds elapsed since start
+ */
+static double elapsed_since(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * read_file - Read the current contents of a sampled file
+ * @fds: Descriptor of each sampled file, -1 where unavailable
+ * @file: File to read
+ * @buf: Buffer of READ_MAX bytes, NUL-terminated on success
+ *
+ * Return: 0 on success, -1 if the file isn't available
+ */
+static int read_file(const int *fds, enum telemetry_file file, char *buf) {
+  if (fds[file] == -1) {
+    return -1;
+  }
+
+  ssize_t len = pread(fds[file], buf, READ_MAX - 1, 0);
+  if (len == -1) {
+    return -1;
+  }
+  buf[len] = '\0';
+
+  return 0;
+}
+
+/**
+ * parse_keyed - Find a key's value in a flat keyed file
+ * @buf: Contents of the file
+ * @key: Key to look for
+ *
+ * Return: The key's value, -1 if the key isn't there
+ */
+static long long parse_keyed(const char *buf, const char *key) {
+  size_t key_len = strlen(key);
+
+  for (const char *line = buf; *line; line++) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+      return strtoll(line + key_len + 1, NULL, 10);
+    }
+
+    line = strchr(line, '\n');
+    if (!line) {
+      break;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * parse_pressure - Read one line of a pressure file
+ * @buf: Contents of the file
+ * @kind: "some" or "full"
+ * @avg10: Set to the line's avg10 value, -1 if the line isn't there
+ * @total: Set to the line's total value, -1 if the line isn't there
+ */
+static void parse_pressure(const char *buf, const char *kind, double *avg10,
+                           long long *total) {
+  *avg10 = -1;
+  *total = -1;
+
+  const char *line = strstr(buf, kind);
+  if (!line) {
+    return;
+  }
+
+  double avg60, avg300;
+  if (sscanf(line + strlen(kind), " avg10=%lf avg60=%lf avg300=%lf total=%lld",
+             avg10, &avg60, &avg300, total) != 4) {
+    *avg10 = -1;
+    *total = -1;
+  }
+}
+
+/**
+ * read_sample - Read every sampled file of a container's cgroup
+ * @fds: Descriptor of each sampled file, -1 where unavailable
+ * @sample: Filled in with the reading, -1 for the files that are unavailable
+ */
+static void read_sample(const int *fds, struct telemetry_sample *sample) {
+  char buf[READ_MAX];
+  const long long unavailable = -1;
+
+  sample->cpu_usage_usec = sample->cpu_user_usec = sample->cpu_system_usec =
+      unavailable;
+  sample->cpu_nr_throttled = sample->cpu_throttled_usec = unavailable;
+  if (read_file(fds, TELEMETRY_CPU_STAT, buf) == 0) {
+    sample->cpu_usage_usec = parse_keyed(buf, "usage_usec");
+    sample->cpu_user_usec = parse_keyed(buf, "user_usec");
+    sample->cpu_system_usec = parse_keyed(buf, "system_usec");
+    sample->cpu_nr_throttled = parse_keyed(buf, "nr_throttled");
+    sample->cpu_throttled_usec = parse_keyed(buf, "throttled_usec");
+  }
+
+  sample->memory_current = unavailable;
+  if (read_file(fds, TELEMETRY_MEMORY_CURRENT, buf) == 0) {
+    sample->memory_current = strtoll(buf, NULL, 10);
+  }
+
+  sample->memory_peak = unavailable;
+  if (read_file(fds, TELEMETRY_MEMORY_PEAK, buf) == 0) {
+    sample->memory_peak = strtoll(buf, NULL, 10);
+  }
+
+  sample->memory_high = sample->memory_max = unavailable;
+  sample->memory_oom = sample->memory_oom_kill = unavailable;
+  if (read_file(fds, TELEMETRY_MEMORY_EVENTS, buf) == 0) {
+    sample->memory_high = parse_keyed(buf, "high");
+    sample->memory_max = parse_keyed(buf, "max");
+    sample->memory_oom = parse_keyed(buf, "oom");
+    sample->memory_oom_kill = parse_keyed(buf, "oom_kill");
+  }
+
+  sample->pids_current = unavailable;
+  if (read_file(fds, TELEMETRY_PIDS_CURRENT, buf) == 0) {
+    sample->pids_current = strtoll(buf, NULL, 10);
+  }
+
+  sample->memory_some_avg10 = sample->memory_full_avg10 = -1;
+  sample->memory_some_total = sample->memory_full_total = unavailable;
+  if (read_file(fds, TELEMETRY_MEMORY_PRESSURE, buf) == 0) {
+    parse_pressure(buf, "some", &sample->memory_some_avg10,
+                   &sample->memory_some_total);
+    parse_pressure(buf, "full", &sample->memory_full_avg10,
+                   &sample->memory_full_total);
+  }
+
+  sample->cpu_some_avg10 = -1;
+  sample->cpu_some_total = unavailable;
+  if (read_file(fds, TELEMETRY_CPU_PRESSURE, buf) == 0) {
+    parse_pressure(buf, "some", &sample->cpu_some_avg10,
+                   &sample->cpu_some_total);
+  }
+}
+
+/**
+ * close_files - Close every open sampled file
+ * @fds: Descriptor of each sampled file, set to -1
+ */
+static void close_files(int *fds) {
+  for (int i = 0; i < TELEMETRY_FILE_COUNT; i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
+
+/**
+ * delta - Difference between a counter and its baseline
+ * @value: Current value of the counter, -1 if unavailable
+ * @base: Value when monitoring started, -1 if unavailable
+ *
+ * Return: value - base, -1 if either is unavailable
+ */
+static long long delta(long long value, long long base) {
+  if (value < 0 || base < 0) {
+    return -1;
+  }
+
+  return value - base;
+}
+
+/**
+ * json_int - Write an integer member of a JSON object
+ * @out: Stream to write to
+ * @key: Name of the member
+ * @value: Value of the member, left out if negative (unavailable)
+ */
+static void json_int(FILE *out, const char *key, long long value) {
+  if (value >= 0) {
+    fprintf(out, ",\"%s\":%lld", key, value);
+  }
+}
+
+/**
+ * json_double - Write a floating-point member of a JSON object
+ * @out: Stream to write to
+ * @key: Name of the member
+ * @value: Value of the member, left out if negative (unavailable)
+ */
+static void json_double(FILE *out, const char *key, double value) {
+  if (value >= 0) {
+    fprintf(out, ",\"%s\":%.2f", key, value);
+  }
+}
+
+/**
+ * track_peaks - Update the highest memory and task counts seen
+ * @telemetry: State of the container
+ * @sample: Latest reading
+ *
+ * Without a per-fd memory.peak, short spikes between samples are missed, but
+ * this still never reports less than we saw ourselves.
+ */
+static void track_peaks(struct telemetry *telemetry,
+                        const struct telemetry_sample *sample) {
+  if (sample->memory_current > telemetry->memory_peak) {
+    telemetry->memory_peak = sample->memory_current;
+  }
+
+  if (sample->memory_peak > telemetry->memory_peak) {
+    telemetry->memory_peak = sample->memory_peak;
+  }
+
+  if (sample->pids_current > telemetry->pids_peak) {
+    telemetry->pids_peak = sample->pids_current;
+  }
+}
+
+/**
+ * telemetry_start - Start monitoring a container
+ * @telemetry: State to initialize
+ * @job: Job number to report
+ * @pid: PID of the container's init process
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Files that can't be opened are skipped, since which ones exist depends on
+ * the enabled controllers and the kernel configuration.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int telemetry_start(struct telemetry *telemetry, int job, int pid,
+                    const char *cgroup_path) {
+  telemetry->job = job;
+  telemetry->pid = pid;
+  telemetry->samples = 0;
+  telemetry->memory_peak = -1;
+  telemetry->pids_peak = -1;
+  clock_gettime(CLOCK_MONOTONIC, &telemetry->start);
+
+  for (int i = 0; i < TELEMETRY_FILE_COUNT; i++) {
+    telemetry->fds[i] = -1;
+  }
+
+  int dir_fd = open(cgroup_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", cgroup_path, strerror(errno));
+    return -1;
+  }
+
+  for (int i = 0; i < TELEMETRY_FILE_COUNT; i++) {
+    telemetry->fds[i] =
+        openat(dir_fd, telemetry_files[i], O_RDONLY | O_CLOEXEC);
+  }
+
+  /*
+   * Since Linux 6.12, writing to memory.peak resets the peak as seen through
+   * the written file descriptor. On older kernels memory.peak is read-only,
+   * and we keep reporting the leaf's overall peak.
+   */
+  int peak_fd = openat(dir_fd, "memory.peak", O_RDWR | O_CLOEXEC);
+  if (peak_fd != -1 && write(peak_fd, "reset\n", 6) == 6) {
+    if (telemetry->fds[TELEMETRY_MEMORY_PEAK] != -1) {
+      close(telemetry->fds[TELEMETRY_MEMORY_PEAK]);
+    }
+    telemetry->fds[TELEMETRY_MEMORY_PEAK] = peak_fd;
+  } else if (peak_fd != -1) {
+    close(peak_fd);
+  }
+
+  close(dir_fd);
+
+  read_sample(telemetry->fds, &telemetry->base);
+
+  return 0;
+}
+
+/**
+ * telemetry_sample - Read the container's cgroup and write a sample line
+ * @telemetry: State of the container
+ * @out: Stream to write to
+ */
+void telemetry_sample(struct telemetry *telemetry, FILE *out) {
+  struct telemetry_sample now;
+  const struct telemetry_sample *base = &telemetry->base;
+
+  read_sample(telemetry->fds, &now);
+  track_peaks(telemetry, &now);
+  telemetry->samples++;
+
+  fprintf(out, "{\"type\":\"sample\",\"job\":%d,\"pid\":%d,\"elapsed\":%.3f",
+          telemetry->job, telemetry->pid, elapsed_since(&telemetry->start));
+  json_int(out, "cpu_usage_usec",
+           delta(now.cpu_usage_usec, base->cpu_usage_usec));
+  json_int(out, "cpu_user_usec", delta(now.cpu_user_usec, base->cpu_user_usec));
+  json_int(out, "cpu_system_usec",
+           delta(now.cpu_system_usec, base->cpu_system_usec));
+  json_int(out, "cpu_nr_throttled",
+           delta(now.cpu_nr_throttled, base->cpu_nr_throttled));
+  json_int(out, "cpu_throttled_usec",
+           delta(now.cpu_throttled_usec, base->cpu_throttled_usec));
+  json_int(out, "memory_current", now.memory_current);
+  json_int(out, "memory_peak", telemetry->memory_peak);
+  json_int(out, "memory_high_events",
+           delta(now.memory_high, base->memory_high));
+  json_int(out, "memory_max_events", delta(now.memory_max, base->memory_max));
+  json_int(out, "memory_oom_events", delta(now.memory_oom, base->memory_oom));
+  json_int(out, "memory_oom_kills",
+           delta(now.memory_oom_kill, base->memory_oom_kill));
+  json_int(out, "pids_current", now.pids_current);
+  json_double(out, "memory_some_avg10", now.memory_some_avg10);
+  json_double(out, "memory_full_avg10", now.memory_full_avg10);
+  json_double(out, "cpu_some_avg10", now.cpu_some_avg10);
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+/**
+ * telemetry_finish - Write the summary line and stop monitoring
+ * @telemetry: State of a container that has exited
+ * @out: Stream to write to
+ *
+ * The summary is what right-sizing the limits in context.c is based on: total
+ * CPU time and throttling, peak memory and tasks, how often the memory limits
+ * were hit, and how long the job stalled on memory and CPU.
+ */
+void telemetry_finish(struct telemetry *telemetry, FILE *out) {
+  struct telemetry_sample now;
+  const struct telemetry_sample *base = &telemetry->base;
+
+  read_sample(telemetry->fds, &now);
+  track_peaks(telemetry, &now);
+
+  fprintf(out,
+          "{\"type\":\"summary\",\"job\":%d,\"pid\":%d,\"elapsed\":%.3f,"
+          "\"samples\":%d",
+          telemetry->job, telemetry->pid, elapsed_since(&telemetry->start),
+          telemetry->samples);
+  json_int(out, "cpu_usage_usec",
+           delta(now.cpu_usage_usec, base->cpu_usage_usec));
+  json_int(out, "cpu_user_usec", delta(now.cpu_user_usec, base->cpu_user_usec));
+  json_int(out, "cpu_system_usec",
+           delta(now.cpu_system_usec, base->cpu_system_usec));
+  json_int(out, "cpu_nr_throttled",
+           delta(now.cpu_nr_throttled, base->cpu_nr_throttled));
+  json_int(out, "cpu_throttled_usec",
+           delta(now.cpu_throttled_usec, base->cpu_throttled_usec));
+  json_int(out, "memory_peak", telemetry->memory_peak);
+  json_int(out, "memory_high_events",
+           delta(now.memory_high, base->memory_high));
+  json_int(out, "memory_max_events", delta(now.memory_max, base->memory_max));
+  json_int(out, "memory_oom_events", delta(now.memory_oom, base->memory_oom));
+  json_int(out, "memory_oom_kills",
+           delta(now.memory_oom_kill, base->memory_oom_kill));
+  json_int(out, "pids_peak", telemetry->pids_peak);
+  json_int(out, "memory_some_usec",
+           delta(now.memory_some_total, base->memory_some_total));
+  json_int(out, "memory_full_usec",
+           delta(now.memory_full_total, base->memory_full_total));
+  json_int(out, "cpu_some_usec",
+           delta(now.cpu_some_total, base->cpu_some_total));
+  fprintf(out, "}\n");
+  fflush(out);
+
+  close_files(telemetry->fds);
+}
+
+/**
+ * telemetry_timer - Create a timer that fires every sampling interval
+ * @interval_ms: Milliseconds between samples
+ *
+ * The timer is a file descriptor, so it can wait in the same poll() or
+ * epoll_wait() as the containers' pidfds. It becomes readable once an
+ * interval has passed, and reading it returns how many have.
+ *
+ * Return: timerfd on success, -1 on failure
+ */
+int telemetry_timer(int interval_ms) {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    fprintf(stderr, "Failed to create sampling timer: %s\n", strerror(errno));
+    return -1;
+  }
+
+  struct timespec interval = {.tv_sec = interval_ms / 1000,
+                              .tv_nsec = (interval_ms % 1000) * 1000000L};
+  struct itimerspec spec = {.it_interval = interval, .it_value = interval};
+
+  if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1) {
+    fprintf(stderr, "Failed to start sampling timer: %s\n", strerror(errno));
+    close(timer_fd);
+    return -1;
+  }
+
+  return timer_fd;
+}
+
+/**
+ * timeval_usec - Convert a struct timeval to microseconds
+ * @tv: Time to convert
+ *
+ * Return: tv in microseconds
+ */
+static long long timeval_usec(const struct timeval *tv) {
+  return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/**
+ * exit_accounting_start - Take the baseline of a container's exit record
+ * @acct: State to initialize
+ * @cgroup_path: The container's leaf cgroup
+ *
+ * Return: 0 on success, -1 if the cgroup couldn't be opened
+ */
+int exit_accounting_start(struct exit_accounting *acct,
+                          const char *cgroup_path) {
+  for (int i = 0; i < TELEMETRY_FILE_COUNT; i++) {
+    acct->fds[i] = -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &acct->start);
+
+  int dir_fd = open(cgroup_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", cgroup_path, strerror(errno));
+    return -1;
+  }
+
+  for (size_t i = 0; i < NUM_EXIT_FILES; i++) {
+    acct->fds[EXIT_FILES[i]] =
+        openat(dir_fd, telemetry_files[EXIT_FILES[i]], O_RDONLY | O_CLOEXEC);
+  }
+  close(dir_fd);
+
+  read_sample(acct->fds, &acct->base);
+
+  return 0;
+}
+
+/**
+ * exit_accounting_finish - Write a container's exit record
+ * @acct: State of a container that has been reaped
+ * @job: Job number to report
+ * @pid: PID the container's init process had
+ * @status: Wait status of the container's init process
+ * @usage: rusage of the container's init process and the processes it reaped
+ * @out: Stream to write to
+ *
+ * cpu_throttled_percent is the share of the container's wall-clock time it
+ * spent throttled, which is what tells a job held back by cpu.max from a
+ * slow one.
+ * It's left out along with the throttling counters when cpu.stat doesn't
+ * have them.
+ */
+void exit_accounting_finish(struct exit_accounting *acct, int job, int pid,
+                            int status, const struct rusage *usage,
+                            FILE *out) {
+  struct telemetry_sample now;
+  const struct telemetry_sample *base = &acct->base;
+
+  read_sample(acct->fds, &now);
+  double elapsed = elapsed_since(&acct->start);
+
+  long long oom_kills = delta(now.memory_oom_kill, base->memory_oom_kill);
+  long long throttled_usec =
+      delta(now.cpu_throttled_usec, base->cpu_throttled_usec);
+
+  const char *cause = "exit";
+  if (WIFSIGNALED(status)) {
+    int sig = WTERMSIG(status);
+    cause = sig == SIGKILL && oom_kills > 0 ? "oom"
+            : sig == SIGSYS                 ? "seccomp"
+                                            : "signal";
+  }
+
+  fprintf(out, "{\"type\":\"exit\",\"job\":%d,\"pid\":%d", job, pid);
+  if (WIFSIGNALED(status)) {
+    fprintf(out, ",\"signal\":%d", WTERMSIG(status));
+  } else {
+    fprintf(out, ",\"exit\":%d", WEXITSTATUS(status));
+  }
+  fprintf(out, ",\"cause\":\"%s\",\"elapsed\":%.6f", cause, elapsed);
+
+  json_int(out, "user_usec", timeval_usec(&usage->ru_utime));
+  json_int(out, "system_usec", timeval_usec(&usage->ru_stime));
+  json_int(out, "max_rss_kb", usage->ru_maxrss);
+  json_int(out, "minor_faults", usage->ru_minflt);
+  json_int(out, "major_faults", usage->ru_majflt);
+  json_int(out, "voluntary_switches", usage->ru_nvcsw);
+  json_int(out, "involuntary_switches", usage->ru_nivcsw);
+  json_int(out, "cpu_nr_throttled",
+           delta(now.cpu_nr_throttled, base->cpu_nr_throttled));
+  json_int(out, "cpu_throttled_usec", throttled_usec);
+  if (throttled_usec >= 0 && elapsed > 0) {
+    json_double(out, "cpu_throttled_percent",
+                throttled_usec / (elapsed * 1e4));
+  }
+  json_int(out, "memory_high_events",
+           delta(now.memory_high, base->memory_high));
+  json_int(out, "memory_max_events", delta(now.memory_max, base->memory_max));
+  json_int(out, "memory_oom_kills", oom_kills);
+  fprintf(out, "}\n");
+  fflush(out);
+
+  exit_accounting_abort(acct);
+}
+
+/**
+ * exit_accounting_abort - Stop accounting without writing an exit record
+ * @acct: State of a container whose exit can't be reported
+ */
+void exit_accounting_abort(struct exit_accounting *acct) {
+  close_files(acct->fds);
+}
@@ -0,0 +1,149 @@
+/**
+ * timing.c
+ *
+ * Per-stage timing of container launches.
+ *
+ * OVERVIEW:
+ * send_launch_timing() runs in the child after the seccomp filter has been
+ * installed, so it sticks to a single write(). clock_gettime() is served by
+ * the vDSO and doesn't enter the kernel.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timing.h"
+
+/**
+ * stage_names - JSON key of the stage ending with each stamp
+ *
+ * LAUNCH_START has no stage before it.
+ */
+static const char *stage_names[LAUNCH_STAGE_COUNT] = {
+    [LAUNCH_CGROUP] = "cgroup",
+    [LAUNCH_OVERLAY_SLOT] = "overlay_slot",
+    [LAUNCH_NET_SLOT] = "net_slot",
+    [LAUNCH_CLONE] = "clone",
+    [LAUNCH_CLOSE_FDS] = "close_fds",
+    [LAUNCH_JOIN_CGROUP] = "join_cgroup",
+    [LAUNCH_NETNS] = "netns",
+    [LAUNCH_UTS] = "uts",
+    [LAUNCH_PROPAGATION] = "propagation",
+    [LAUNCH_OVERLAY] = "overlay",
+    [LAUNCH_ROOTFS] = "rootfs",
+    [LAUNCH_DEV] = "dev",
+    [LAUNCH_PROC] = "proc",
+    [LAUNCH_DROP_CAPS] = "drop_caps",
+    [LAUNCH_LOCK_CAPS] = "lock_caps",
+    [LAUNCH_SECCOMP] = "seccomp",
+    [LAUNCH_COMMAND] = "command",
+    [LAUNCH_EXEC] = "exec",
+};
+
+/**
+ * seconds_between - Time between two timestamps
+ * @start: Earlier timestamp
+ * @end: Later timestamp
+ *
+ * Return: Seconds from start to end
+ */
+static double seconds_between(const struct timespec *start,
+                              const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) +
+         (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * launch_stamp - Record that a stage just ended
+ * @timing: Timestamps of the launch
+ * @stage: Stage that ended
+ */
+void launch_stamp(struct launch_timing *timing, enum launch_stage stage) {
+  clock_gettime(CLOCK_MONOTONIC, &timing->stamps[stage]);
+}
+
+/**
+ * send_launch_timing - Write the child's record to the timing pipe
+ * @fd: Write end of the timing pipe, -1 if launches aren't timed
+ * @timing: Timestamps of the launch
+ *
+ * A failed write only costs the report, so the launch goes on either way.
+ */
+void send_launch_timing(int fd, const struct launch_timing *timing) {
+  if (fd == -1) {
+    return;
+  }
+
+  if (write(fd, timing, sizeof(*timing)) != (ssize_t)sizeof(*timing)) {
+    fprintf(stderr, "Failed to send launch timing: %s\n", strerror(errno));
+  }
+}
+
+/**
+ * read_launch_timing - Read the child's record from a non-blocking pipe
+ * @fd: Read end of the timing pipe
+ * @timing: Filled in with the child's record
+ *
+ * The record arrives in one piece, so a read either gets all of it or finds
+ * the pipe empty.
+ *
+ * Return: 1 once the record is complete, 0 if the exec hasn't happened yet,
+ * -1 if the pipe closed without a record (the child died first) or on failure
+ */
+int read_launch_timing(int fd, struct launch_timing *timing) {
+  for (;;) {
+    struct launch_timing record;
+    ssize_t bytes = read(fd, &record, sizeof(record));
+
+    if (bytes == (ssize_t)sizeof(record)) {
+      *timing = record;
+      timing->received = 1;
+      continue;
+    }
+
+    if (bytes == 0) {
+      if (!timing->received) {
+        return -1;
+      }
+      launch_stamp(timing, LAUNCH_EXEC);
+      return 1;
+    }
+
+    if (bytes == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (bytes == -1 && errno == EAGAIN) {
+      return 0;
+    }
+
+    fprintf(stderr, "Failed to read launch timing: %s\n",
+            bytes == -1 ? strerror(errno) : "short read");
+    return -1;
+  }
+}
+
+/**
+ * report_launch_timing - Write the stages of a launch as a JSON line
+ * @timing: A complete record
+ * @job: Job number to report
+ * @pid: PID of the container's init process
+ * @out: Stream to write to
+ */
+void report_launch_timing(const struct launch_timing *timing, int job, int pid,
+                          FILE *out) {
+  fprintf(out, "{\"type\":\"launch\",\"job\":%d,\"pid\":%d", job, pid);
+
+  for (int stage = LAUNCH_START + 1; stage < LAUNCH_STAGE_COUNT; stage++) {
+    fprintf(out, ",\"%s\":%.6f", stage_names[stage],
+            seconds_between(&timing->stamps[stage - 1],
+                            &timing->stamps[stage]));
+  }
+
+  fprintf(out, ",\"total\":%.6f}\n",
+          seconds_between(&timing->stamps[LAUNCH_START],
+                          &timing->stamps[LAUNCH_EXEC]));
+  fflush(out);
+}
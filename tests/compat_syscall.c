@@ -0,0 +1,107 @@
+/**
+ * compat_syscall.c
+ *
+ * Checks that the seccomp filter kills syscalls made through the i386 entry.
+ *
+ * OVERVIEW:
+ * An x86_64 process can make i386 syscalls with int 0x80, whose numbers the
+ * filter would otherwise look up as x86_64 ones. i386 getpid (20) is x86_64
+ * writev, which every policy allows, so without the arch check it would go
+ * through. The test installs the filter in a child, makes the i386 getpid
+ * and expects the child to die of SIGSYS. An x86_64 getpid under the same
+ * filter has to keep working, or the test proves nothing.
+ *
+ * Kernels without IA32 emulation have no int 0x80 to test, which is checked
+ * before the filter is installed and reported as skipped.
+ *
+ * USAGE:
+ *   make test
+ *
+ * Exit status 0 on success, 77 if skipped, 1 on failure.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "child_security.h"
+
+/**
+ * I386_NR_GETPID - getpid in the i386 syscall table
+ */
+#define I386_NR_GETPID 20
+
+/**
+ * EXIT_SKIP - Exit status for a test that can't run here
+ */
+#define EXIT_SKIP 77
+
+/**
+ * i386_syscall0 - Make an i386 syscall without arguments
+ * @nr: i386 syscall number
+ *
+ * Return: The syscall's return value
+ */
+static long i386_syscall0(long nr) {
+  long ret;
+  __asm__ volatile("int $0x80"
+                   : "=a"(ret)
+                   : "a"(nr)
+                   : "memory", "r8", "r9", "r10", "r11");
+  return ret;
+}
+
+/**
+ * run_child - Make the i386 getpid under the filter
+ *
+ * Return: Never if the filter works, EXIT_FAILURE otherwise
+ */
+static int run_child(void) {
+  if (lock_capabilities() == -1 || apply_seccomp() == -1) {
+    return EXIT_FAILURE;
+  }
+
+  if (syscall(SYS_getpid) != getpid()) {
+    fprintf(stderr, "x86_64 getpid failed under the filter\n");
+    return EXIT_FAILURE;
+  }
+
+  i386_syscall0(I386_NR_GETPID);
+  fprintf(stderr, "i386 getpid went through the filter\n");
+  return EXIT_FAILURE;
+}
+
+int main(void) {
+  if (i386_syscall0(I386_NR_GETPID) != getpid()) {
+    printf("SKIP: no i386 syscalls on this kernel\n");
+    return EXIT_SKIP;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return EXIT_FAILURE;
+  }
+  if (pid == 0) {
+    _exit(run_child());
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    perror("waitpid");
+    return EXIT_FAILURE;
+  }
+
+  if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGSYS) {
+    printf("FAIL: i386 getpid wasn't killed\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS: i386 getpid killed with SIGSYS\n");
+  return EXIT_SUCCESS;
+}